@@ -0,0 +1,27 @@
+#ifndef WEB_ROUTES_H
+#define WEB_ROUTES_H
+
+// Every route the firmware serves, in registration order: ROUTE for those
+// without a body, BODY_ROUTE with the fields of an HttpRoute for those that
+// read one. main.cpp turns each entry into a server.on() call, and
+// test_http_front registers the same list to check it fits HTTP_MAX_ROUTES.
+//
+//   /               the page
+//   /submit         one receipt, also via URL (/submit?message=...), fields are copied while they arrive
+//   /submit-batch   many receipts: newline-delimited text or a JSON array of strings as the body
+//   /print-image    PGM/PBM upload streamed band by band, or stored as a logo with logo=<id>;
+//                   the body is only read while the printer transmit ring has room for another band
+//   /template       receipt template stored under a name, compiled to printer bytes once
+//   /calibrate      start a printer link calibration
+//   /metrics        counters and latency histograms, Prometheus text or compact JSON
+#define WEB_ROUTES(ROUTE, BODY_ROUTE) \
+  ROUTE("/", HTTP_METHOD_GET, handleRoot) \
+  BODY_ROUTE("/submit", HTTP_METHOD_GET | HTTP_METHOD_POST, SUBMIT_MAX_BODY, beginSubmit, submitField, endSubmit, abortSubmit, nullptr) \
+  BODY_ROUTE("/submit-batch", HTTP_METHOD_POST, BATCH_MAX_BODY, beginBatch, batchField, endBatch, abortBatch, nullptr) \
+  BODY_ROUTE("/print-image", HTTP_METHOD_POST, IMAGE_MAX_BODY, beginImage, imageField, endImage, abortImage, imageReady) \
+  BODY_ROUTE("/template", HTTP_METHOD_POST, TEMPLATE_MAX_BODY, beginTemplate, templateField, endTemplate, abortTemplate, nullptr) \
+  ROUTE("/calibrate", HTTP_METHOD_POST, handleCalibrate) \
+  ROUTE("/metrics", HTTP_METHOD_GET, handleMetrics) \
+  ROUTE("/metrics.json", HTTP_METHOD_GET, handleMetricsJson)
+
+#endif
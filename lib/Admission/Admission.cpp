@@ -0,0 +1,118 @@
+#include "Admission.h"
+
+#define BUCKET_CAPACITY ((int32_t)CLIENT_BURST * CLIENT_REFILL_MS)
+
+
+uint32_t admissionHash(uint32_t hash, const void *data, size_t length) {
+  const uint8_t *bytes = (const uint8_t*)data;
+  while (length--) hash = (hash ^ *bytes++) * 16777619UL;
+  return hash;
+}
+
+uint32_t admissionKey(const char *key, uint32_t client, const char *route, uint32_t content, uint32_t &lifetimeMs) {
+  if (key[0] != '\0') {
+    lifetimeMs = IDEMPOTENCY_KEY_MS;
+    uint32_t hash = admissionHash(ADMISSION_HASH_SEED, key, strlen(key));
+    hash = admissionHash(hash, &client, sizeof(client));
+    return admissionHash(hash, route, strlen(route));
+  }
+  lifetimeMs = IDEMPOTENCY_CONTENT_MS;
+  return admissionHash(content, &client, sizeof(client));
+}
+
+// === Idempotency ===
+
+IdempotencyCache::IdempotencyCache() : clock(0), duplicateCount(0) {
+  memset(entries, 0, sizeof(entries));
+}
+
+bool IdempotencyCache::find(uint32_t key, uint32_t &firstId, uint16_t &count) {
+  uint32_t now = millis();
+  for (uint8_t i = 0; i < IDEMPOTENCY_SLOTS; i++) {
+    IdempotencyEntry &entry = entries[i];
+    if (entry.count == 0 || entry.key != key) continue;
+    if ((int32_t)(entry.expires - now) <= 0) {
+      entry.count = 0;                                                      // expired, the same content may print again
+      return false;
+    }
+    entry.used = ++clock;
+    firstId = entry.firstId;
+    count = entry.count;
+    duplicateCount++;
+    return true;
+  }
+  return false;
+}
+
+void IdempotencyCache::remember(uint32_t key, uint32_t firstId, uint16_t count, uint32_t lifetimeMs) {
+  // Free slot if there is one, otherwise the least recently seen
+  IdempotencyEntry *slot = &entries[0];
+  for (uint8_t i = 0; i < IDEMPOTENCY_SLOTS; i++) {
+    if (entries[i].count == 0) {
+      slot = &entries[i];
+      break;
+    }
+    if (entries[i].used < slot->used) slot = &entries[i];
+  }
+
+  slot->key = key;
+  slot->firstId = firstId;
+  slot->count = count;
+  slot->expires = millis() + lifetimeMs;
+  slot->used = ++clock;
+}
+
+// === Token Buckets ===
+
+ClientBuckets::ClientBuckets() : clock(0) {
+  memset(buckets, 0, sizeof(buckets));
+}
+
+uint32_t ClientBuckets::retryAfter(uint32_t client, uint16_t receipts) {
+  ClientBucket *bucket = find(client);
+  if (bucket == nullptr) return 0;                                          // full bucket
+  refill(*bucket);
+
+  int32_t need = (receipts < CLIENT_BURST ? receipts : CLIENT_BURST) * (int32_t)CLIENT_REFILL_MS;
+  return bucket->credit >= need ? 0 : need - bucket->credit;
+}
+
+void ClientBuckets::charge(uint32_t client, uint16_t receipts) {
+  ClientBucket *bucket = find(client);
+  if (bucket == nullptr) {
+    // New client, replaces the least recently seen one
+    bucket = &buckets[0];
+    for (uint8_t i = 1; i < CLIENT_SLOTS; i++) {
+      if (buckets[i].used < bucket->used) bucket = &buckets[i];
+    }
+    bucket->client = client;
+    bucket->credit = BUCKET_CAPACITY;
+    bucket->updated = millis();
+  }
+  refill(*bucket);
+  bucket->credit -= (int32_t)receipts * CLIENT_REFILL_MS;
+  bucket->used = ++clock;
+}
+
+uint8_t ClientBuckets::tracked() const {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < CLIENT_SLOTS; i++) {
+    if (buckets[i].used != 0) count++;
+  }
+  return count;
+}
+
+ClientBucket *ClientBuckets::find(uint32_t client) {
+  for (uint8_t i = 0; i < CLIENT_SLOTS; i++) {
+    if (buckets[i].used != 0 && buckets[i].client == client) return &buckets[i];
+  }
+  return nullptr;
+}
+
+void ClientBuckets::refill(ClientBucket &bucket) {
+  uint32_t now = millis();
+  uint32_t elapsed = now - bucket.updated;
+  bucket.updated = now;
+  if (elapsed >= (uint32_t)(BUCKET_CAPACITY - bucket.credit)) bucket.credit = BUCKET_CAPACITY; // also guards the add below
+  else bucket.credit += elapsed;
+}
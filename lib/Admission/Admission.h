@@ -0,0 +1,79 @@
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <Arduino.h>
+
+#define IDEMPOTENCY_SLOTS 32          // Recent submissions remembered, the least recently seen is replaced
+#define IDEMPOTENCY_KEY_MS 600000     // A repeated client key within 10 minutes is a duplicate
+#define IDEMPOTENCY_CONTENT_MS 60000  // Same message from the same address within a minute (retries, link previews)
+#define CLIENT_SLOTS 8                // Clients with their own token bucket, the least recently seen is replaced
+#define CLIENT_BURST 5                // Receipts a client may send back to back
+#define CLIENT_REFILL_MS 6000         // One more receipt every 6 s after the burst (10 per minute)
+#define ADMISSION_HASH_SEED 2166136261UL
+
+// FNV-1a, continued over pieces as they arrive: hash = admissionHash(hash, data, length)
+uint32_t admissionHash(uint32_t hash, const void *data, size_t length);
+
+// IdempotencyCache key of a submission. A client key (empty for none) only
+// repeats its own request: the same key from another address or on another
+// route is new. Without one, the same content hash from the same address is a
+// repeat for a short while. lifetimeMs gets how long the key counts.
+uint32_t admissionKey(const char *key, uint32_t client, const char *route, uint32_t content, uint32_t &lifetimeMs);
+
+struct IdempotencyEntry {
+  uint32_t key;
+  uint32_t firstId;                                 // receipt ids of the original submission
+  uint16_t count;                                   // 0 = free slot
+  uint32_t expires;                                 // millis()
+  uint32_t used;                                    // LRU stamp
+};
+
+// Fixed-size LRU table of recent submissions, keyed by the hash of a client
+// supplied key or of the content and client address. A hit returns the ids
+// the first submission got, so a retry can be answered like the original
+// without printing again.
+class IdempotencyCache {
+  public:
+    IdempotencyCache();
+
+    bool find(uint32_t key, uint32_t &firstId, uint16_t &count); // true for a duplicate (counted)
+    void remember(uint32_t key, uint32_t firstId, uint16_t count, uint32_t lifetimeMs);
+
+    uint32_t duplicates() const { return duplicateCount; }
+
+  private:
+    IdempotencyEntry entries[IDEMPOTENCY_SLOTS];
+    uint32_t clock;
+    uint32_t duplicateCount;
+};
+
+struct ClientBucket {
+  uint32_t client;                                  // IPv4 address
+  int32_t credit;                                   // milliseconds of refill time banked, negative after a large batch
+  uint32_t updated;                                 // millis() of the last refill
+  uint32_t used;                                    // LRU stamp, 0 = free slot
+};
+
+// Token bucket per client address. Credit is kept in milliseconds of refill
+// time, so a receipt costs CLIENT_REFILL_MS and no division is needed. A
+// request larger than the burst is let in on a full bucket and leaves the
+// client in debt, a batch is never refused for its size alone. Unknown clients
+// start with a full bucket.
+class ClientBuckets {
+  public:
+    ClientBuckets();
+
+    uint32_t retryAfter(uint32_t client, uint16_t receipts); // 0 = admit, else ms until it would be
+    void charge(uint32_t client, uint16_t receipts);         // after the receipts were queued
+
+    uint8_t tracked() const;                            // clients with a bucket
+
+  private:
+    ClientBucket buckets[CLIENT_SLOTS];
+    uint32_t clock;
+
+    ClientBucket *find(uint32_t client);
+    void refill(ClientBucket &bucket);
+};
+
+#endif
@@ -0,0 +1,216 @@
+#include "BatchParser.h"
+#include <stdarg.h>
+
+static int hexValue(uint8_t c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+BatchParser::BatchParser() {
+  begin(BATCH_LINES);
+}
+
+void BatchParser::begin(BatchFormat format) {
+  this->format = format;
+  state = format == BATCH_JSON ? JSON_START : LINE;
+  itemCount = 0;
+  used = 0;
+  inItem = false;
+  position = 0;
+  hexDigits = 0;
+  unicode = 0;
+  highSurrogate = 0;
+  failed = false;
+  tooLarge = false;
+  text[0] = '\0';
+  errorText[0] = '\0';
+}
+
+void BatchParser::write(const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len && !failed; i++) {
+    position++;
+    if (format == BATCH_JSON) jsonByte(data[i]);
+    else lineByte(data[i]);
+  }
+}
+
+bool BatchParser::end() {
+  if (failed) return false;
+  if (format == BATCH_LINES) {
+    if (inItem) finishItem();                                               // last line without '\n'
+  } else if (state != JSON_DONE) {
+    fail(false, "JSON array is not closed");
+  }
+  return !failed;
+}
+
+void BatchParser::fail(bool limit, const char *format, ...) {
+  if (failed) return;
+  va_list args;
+  va_start(args, format);
+  vsnprintf(errorText, sizeof(errorText), format, args);
+  va_end(args);
+  failed = true;
+  tooLarge = limit;
+}
+
+void BatchParser::lineByte(uint8_t c) {
+  if (c == '\n') {
+    if (inItem) finishItem();
+  } else if (c != '\r') {
+    if (!inItem) startItem();
+    add(c);
+  }
+}
+
+void BatchParser::jsonByte(uint8_t c) {
+  bool space = c == ' ' || c == '\t' || c == '\r' || c == '\n';
+
+  switch (state) {
+    case JSON_START:
+      if (space) return;
+      if (c == '[') state = JSON_BEFORE_VALUE;
+      else fail(false, "Expected a JSON array of strings");
+      return;
+
+    case JSON_BEFORE_VALUE:
+      if (space) return;
+      if (c == '"') {
+        startItem();
+        state = JSON_STRING;
+      } else if (c == ']' && itemCount == 0) {
+        state = JSON_DONE;                                                  // empty array, rejected by the caller
+      } else {
+        fail(false, "Expected a string at byte %u", (unsigned)position);
+      }
+      return;
+
+    case JSON_STRING:
+      if (c == '\\') {
+        state = JSON_ESCAPE;
+        return;
+      }
+      if (highSurrogate != 0) addCodepoint('?');                           // \uD8xx without its second half
+      if (c == '"') {
+        finishItem();
+        state = JSON_AFTER_VALUE;
+      } else if (c < 0x20) {
+        fail(false, "Control character in string at byte %u", (unsigned)position);
+      } else {
+        add(c);                                                             // UTF-8 passes through as is
+      }
+      return;
+
+    case JSON_ESCAPE:
+      state = JSON_STRING;
+      if (c == 'u') {
+        state = JSON_UNICODE;
+        hexDigits = 4;
+        unicode = 0;
+        return;
+      }
+      if (highSurrogate != 0) addCodepoint('?');
+      if (c == '"' || c == '\\' || c == '/') add(c);
+      else if (c == 'n') add('\n');
+      else if (c == 't') add('\t');
+      else if (c == 'r') add('\r');
+      else if (c != 'b' && c != 'f') fail(false, "Invalid escape at byte %u", (unsigned)position);
+      return;
+
+    case JSON_UNICODE: {
+      int digit = hexValue(c);
+      if (digit < 0) {
+        fail(false, "Invalid \\u escape at byte %u", (unsigned)position);
+        return;
+      }
+      unicode = (unicode << 4) | digit;
+      if (--hexDigits > 0) return;
+      state = JSON_STRING;
+
+      if (unicode >= 0xD800 && unicode < 0xDC00) {
+        if (highSurrogate != 0) addCodepoint('?');
+        highSurrogate = unicode;                                            // wait for the low half
+      } else if (unicode >= 0xDC00 && unicode < 0xE000) {
+        if (highSurrogate != 0) addCodepoint(0x10000 + ((uint32_t)(highSurrogate - 0xD800) << 10) + (unicode - 0xDC00));
+        else addCodepoint('?');
+        highSurrogate = 0;
+      } else {
+        if (highSurrogate != 0) addCodepoint('?');
+        addCodepoint(unicode);
+      }
+      return;
+    }
+
+    case JSON_AFTER_VALUE:
+      if (space) return;
+      if (c == ',') state = JSON_BEFORE_VALUE;
+      else if (c == ']') state = JSON_DONE;
+      else fail(false, "Expected ',' or ']' at byte %u", (unsigned)position);
+      return;
+
+    case JSON_DONE:
+      if (!space) fail(false, "Data after the JSON array");
+      return;
+
+    case LINE:
+      return;
+  }
+}
+
+void BatchParser::startItem() {
+  if (itemCount >= BATCH_MAX_ITEMS) {
+    fail(true, "More than %u messages", BATCH_MAX_ITEMS);
+    return;
+  }
+  if (used >= sizeof(text) - 1) {
+    fail(true, "Batch is larger than %u bytes", BATCH_MAX_BYTES);
+    return;
+  }
+  starts[itemCount] = used;
+  inItem = true;
+}
+
+void BatchParser::add(uint8_t c) {
+  if (failed) return;
+  if (used - starts[itemCount] >= MAX_MESSAGE_LENGTH) {
+    fail(true, "Message %u is longer than %u bytes", itemCount + 1, MAX_MESSAGE_LENGTH);
+  } else if (used >= sizeof(text) - 1) {
+    fail(true, "Batch is larger than %u bytes", BATCH_MAX_BYTES);          // keep room for the closing NUL
+  } else {
+    text[used++] = c;
+  }
+}
+
+void BatchParser::addCodepoint(uint32_t cp) {
+  highSurrogate = 0;
+  if (cp < 0x80) {
+    add(cp);
+  } else if (cp < 0x800) {
+    add(0xC0 | (cp >> 6));
+    add(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    add(0xE0 | (cp >> 12));
+    add(0x80 | ((cp >> 6) & 0x3F));
+    add(0x80 | (cp & 0x3F));
+  } else {
+    add(0xF0 | (cp >> 18));
+    add(0x80 | ((cp >> 12) & 0x3F));
+    add(0x80 | ((cp >> 6) & 0x3F));
+    add(0x80 | (cp & 0x3F));
+  }
+}
+
+void BatchParser::finishItem() {
+  if (failed) return;
+  if (used == starts[itemCount]) {
+    fail(false, "Message %u is empty", itemCount + 1);
+    return;
+  }
+  lengths[itemCount] = used - starts[itemCount];
+  text[used++] = '\0';
+  itemCount++;
+  inItem = false;
+}
@@ -0,0 +1,69 @@
+#ifndef BATCH_PARSER_H
+#define BATCH_PARSER_H
+
+#include <Arduino.h>
+#include <ReceiptQueue.h>
+
+#define BATCH_MAX_ITEMS 32            // Messages per batch
+#define BATCH_MAX_BYTES 4096          // Message bytes per batch (UTF-8, before transcoding)
+#define BATCH_ERROR_SIZE 48
+
+enum BatchFormat {
+  BATCH_LINES,                                      // one message per line, empty lines skipped
+  BATCH_JSON                                        // ["first", "second\nwith two lines"]
+};
+
+// Collects the messages of a batch request as the body streams in, so the
+// whole batch can be checked before any of it is queued. Items are kept
+// NUL-terminated, back to back, in a fixed buffer.
+class BatchParser {
+  public:
+    BatchParser();
+
+    void begin(BatchFormat format);
+    void write(const uint8_t *data, size_t len);        // feed the next chunk of the body
+    bool end();                                         // false if the batch is invalid or cut short
+
+    const char *error() const { return failed ? errorText : nullptr; }
+    bool overLimit() const { return tooLarge; }         // the error is a size limit, not a syntax error
+
+    uint8_t count() const { return itemCount; }
+    const char *item(uint8_t i) const { return text + starts[i]; }
+    size_t itemLength(uint8_t i) const { return lengths[i]; }
+    const char *all() const { return text; }            // every item, NUL separated
+    size_t allLength() const { return used; }
+
+  private:
+    enum State : uint8_t {
+      JSON_START, JSON_BEFORE_VALUE, JSON_STRING, JSON_ESCAPE, JSON_UNICODE, JSON_AFTER_VALUE, JSON_DONE,
+      LINE
+    };
+
+    char text[BATCH_MAX_BYTES];
+    uint16_t starts[BATCH_MAX_ITEMS];
+    uint16_t lengths[BATCH_MAX_ITEMS];
+    uint8_t itemCount;
+    size_t used;
+    bool inItem;
+
+    State state;
+    BatchFormat format;
+    uint32_t position;                                  // body bytes seen, for error messages
+    uint8_t hexDigits;
+    uint16_t unicode;
+    uint16_t highSurrogate;
+
+    bool failed;
+    bool tooLarge;
+    char errorText[BATCH_ERROR_SIZE];
+
+    void fail(bool limit, const char *format, ...);
+    void lineByte(uint8_t c);
+    void jsonByte(uint8_t c);
+    void startItem();
+    void add(uint8_t c);
+    void addCodepoint(uint32_t cp);
+    void finishItem();
+};
+
+#endif
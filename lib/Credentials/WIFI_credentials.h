@@ -1,4 +1,10 @@
 #define SSID "YOUR SSID"
 #define PASSWORD "YOUR PASSWORD"
 
-// TIP: Don't use blankspaces in your WiFi password. Seems like the D1 Mini has issues with that.
\ No newline at end of file
+// TIP: Don't use blankspaces in your WiFi password. Seems like the D1 Mini has issues with that.
+
+// Optional fixed address, skips DHCP on every boot (comma separated octets):
+// #define STATIC_IP 192, 168, 1, 50
+// #define STATIC_GATEWAY 192, 168, 1, 1
+// #define STATIC_SUBNET 255, 255, 255, 0
+// #define STATIC_DNS 192, 168, 1, 1
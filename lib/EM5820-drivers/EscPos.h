@@ -0,0 +1,55 @@
+#ifndef ESC_POS_H
+#define ESC_POS_H
+
+#include <Arduino.h>
+
+// ESC/POS byte sequences used by the EM5820 driver. Fixed sequences are complete
+// commands, prefixes still need their parameter byte(s) appended.
+namespace EscPos {
+
+  static constexpr uint8_t DLE = 0x10;
+  static constexpr uint8_t EOT = 0x04;
+  static constexpr uint8_t ESC = 0x1B;
+  static constexpr uint8_t GS = 0x1D;
+  static constexpr uint8_t FULL_BLOCK = 0xDB;                               // Full block character in PC437
+
+  // Fixed sequences
+  static constexpr uint8_t INIT[] = {ESC, '@'};                             // ESC @ reset printer
+  static constexpr uint8_t CRLF[] = {'\r', '\n'};
+  static constexpr uint8_t INVERSE_ON[] = {GS, 'B', 1};                     // GS B 1
+  static constexpr uint8_t INVERSE_OFF[] = {GS, 'B', 0};                    // GS B 0
+  static constexpr uint8_t INVERTED_SPACE[] = {GS, 'B', 0, FULL_BLOCK, GS, 'B', 1}; // black cell in place of a space inside inverted text
+  static constexpr uint8_t STATUS_PRINTER[] = {DLE, EOT, 1};              // DLE EOT 1 real-time printer status, answered with one byte
+  static constexpr uint8_t QR_PRINT[] = {GS, '(', 'k', 3, 0, 49, 81, 48};  // GS ( k print stored QR symbol
+  static constexpr uint8_t NV_CAPACITY[] = {GS, '(', 'L', 2, 0, 48, 0};     // GS ( L fn 0 NV graphics memory size, answered with 37h 30h <decimal digits> NUL
+
+  // ESC ## SBDR parameter: the index into this table. Calibration confirms
+  // every switch with a status request before it trusts the new rate.
+  static constexpr uint32_t BAUD_RATES[] = {9600, 19200, 38400, 57600, 115200};
+  static constexpr uint8_t BAUD_RATE_COUNT = sizeof(BAUD_RATES) / sizeof(BAUD_RATES[0]);
+
+  // Prefixes, followed by one parameter byte
+  static constexpr uint8_t SET_HEAT[] = {ESC, '#', '#', 'S', 'T', 'D', 'P'}; // ESC ## STDP n
+  static constexpr uint8_t SET_SPEED[] = {ESC, '#', '#', 'S', 'T', 'S', 'P'}; // ESC ## STSP n
+  static constexpr uint8_t SET_BAUD[] = {ESC, '#', '#', 'S', 'B', 'D', 'R'}; // ESC ## SBDR n, n indexes BAUD_RATES
+  static constexpr uint8_t SET_CODEPAGE[] = {ESC, '#', '#', 'S', 'L', 'A', 'N'}; // ESC ## SLAN n
+  static constexpr uint8_t SELECT_CODEPAGE[] = {ESC, 't'};                  // ESC t n
+  static constexpr uint8_t UPSIDE_DOWN[] = {ESC, '{'};                      // ESC { n
+  static constexpr uint8_t ALIGN[] = {ESC, 'a'};                            // ESC a n
+  static constexpr uint8_t BOLD[] = {ESC, 'E'};                             // ESC E n
+  static constexpr uint8_t UNDERLINE[] = {ESC, '-'};                        // ESC - n
+  static constexpr uint8_t INVERSE[] = {GS, 'B'};                           // GS B n
+  static constexpr uint8_t CHAR_SIZE[] = {GS, '!'};                         // GS ! n
+  static constexpr uint8_t FONT[] = {ESC, 'M'};                             // ESC M n
+  static constexpr uint8_t FEED_LINES[] = {ESC, 'd'};                       // ESC d n
+  static constexpr uint8_t FEED_DOTS[] = {ESC, 'J'};                        // ESC J n (n dot rows)
+
+  // Prefixes with a longer parameter block
+  static constexpr uint8_t RASTER[] = {GS, 'v', '0', 0};                    // GS v 0 m xL xH yL yH d1...dk (m=0 normal)
+  static constexpr uint8_t LEFT_MARGIN[] = {GS, 'L'};                       // GS L nL nH (dots)
+  static constexpr uint8_t QR_STORE[] = {GS, '(', 'k'};                     // GS ( k pL pH 49 80 48 d1...dk
+  static constexpr uint8_t NV_GRAPHICS[] = {GS, '(', 'L'};                  // GS ( L pL pH 48 fn ... (67 define raster, 69 print by key code)
+
+}
+
+#endif
@@ -0,0 +1,286 @@
+#include "PrintJob.h"
+#include <stdarg.h>
+#include "EscPos.h"
+#include "WordWrap.h"
+
+using namespace EscPos;
+
+
+PrintJob::PrintJob(ThermalPrinter &printer, uint8_t defaultCodePage) : printer(printer) {
+  memset(defaults, 0, sizeof(defaults));
+  defaults[STYLE_CODEPAGE] = defaultCodePage;
+  memcpy(committed, defaults, sizeof(committed));
+  opCount = 0;
+  savedTotal = 0;
+  bytesTotal = 0;
+  dotsTotal = 0;
+  arenaUsed = 0;
+  begin();
+}
+
+void PrintJob::begin() {
+  lower(opCount);                                                           // leftovers of a job that was never ended
+  arenaUsed = 0;
+  memcpy(committed, defaults, sizeof(committed));
+  lineEmpty = true;
+  sentLineEmpty = true;
+  jobCost = {0, 0, 0, 0};
+}
+
+void PrintJob::end() {
+  uint32_t naive = jobCost.naiveBytes;                                      // the reset is not part of the naive job
+  for (uint8_t i = 0; i < STYLE_COUNT; i++) style((PrintStyle)i, defaults[i]);  // dropped where nothing changed
+  jobCost.naiveBytes = naive;
+  commitStyles();
+  lower(opCount);
+  arenaUsed = 0;                                                            // nothing refers to the arena any more
+  estimate();
+}
+
+void PrintJob::flush() {
+  commitStyles();
+  lower(opCount);
+}
+
+// === Arena ===
+
+char *PrintJob::allocate(size_t size) {
+  if (size > sizeof(arena) - arenaUsed) return nullptr;
+  char *block = arena + arenaUsed;
+  arenaUsed += size;
+  return block;
+}
+
+const char *PrintJob::format(const char *format, ...) {
+  size_t room = sizeof(arena) - arenaUsed;
+  if (room == 0) return "";
+  char *text = arena + arenaUsed;
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf(text, room, format, args);
+  va_end(args);
+  if (length < 0) length = 0;
+  arenaUsed += ((size_t)length < room ? (size_t)length : room - 1) + 1;
+  return text;
+}
+
+// === Building ===
+
+void PrintJob::text(const char *text, size_t length) {
+  while (length > 0) {
+    uint16_t n = length > 0xFFFF ? 0xFFFF : length;
+    add({OP_TEXT, 0, n, 0, (const uint8_t*)text});
+    text += n;
+    length -= n;
+  }
+}
+
+void PrintJob::fill(uint8_t c, uint16_t count) {
+  add({OP_FILL, c, count, 0, nullptr});
+}
+
+void PrintJob::newline() {
+  add({OP_LINE, 0, 0, 0, nullptr});
+}
+
+void PrintJob::feed(uint8_t lines) {
+  add({OP_FEED, 0, lines, 0, nullptr});
+}
+
+void PrintJob::style(PrintStyle attribute, uint8_t value) {
+  add({OP_STYLE, attribute, value, 0, nullptr});
+}
+
+void PrintJob::raster(uint16_t width, uint16_t height, const uint8_t *data) {
+  add({OP_RASTER, 0, height, width, data});
+}
+
+void PrintJob::wrappedUpsideDown(const char *text, size_t length, uint8_t width) {
+  // Lines are sent last to first, the 180° rotation puts them back in reading order
+  WordWrap wrap(text, length, width);
+  wrap.forEachReversed([this](const char *line, size_t len) {
+    this->text(line, len);
+    newline();
+  });
+}
+
+void PrintJob::inverted(const char *text) {
+  // Spaces stay white in inverse mode, so each one is a black block printed with
+  // inverse off. The optimizer turns a run of spaces into a single toggle pair.
+  fill(FULL_BLOCK, 1);
+  style(STYLE_INVERSE, 1);
+  for (const char *c = text; *c; c++) {
+    if (*c == ' ') {
+      style(STYLE_INVERSE, 0);
+      fill(FULL_BLOCK, 1);
+      style(STYLE_INVERSE, 1);
+    } else {
+      this->text(c, 1);                                                     // neighbours are merged into one run
+    }
+  }
+  style(STYLE_INVERSE, 0);
+  fill(FULL_BLOCK, 1);
+}
+
+// === Optimizer ===
+
+void PrintJob::add(const PrintOp &in) {
+  jobCost.naiveBytes += opBytes(in, lineEmpty);
+  PrintOp op = in;
+  PrintOp *last = opCount > 0 ? &ops[opCount - 1] : nullptr;
+
+  switch (op.code) {
+    case OP_STYLE:
+      // Styles after the last printing op have not touched the paper yet: a later
+      // change of the same attribute replaces the earlier one, or cancels it
+      for (int i = opCount - 1; i >= 0 && ops[i].code == OP_STYLE; i--) {
+        if (ops[i].arg != op.arg) continue;
+        if (op.count == committed[op.arg]) {
+          memmove(&ops[i], &ops[i + 1], (opCount - i - 1) * sizeof(PrintOp));
+          opCount--;
+        } else {
+          ops[i].count = op.count;
+        }
+        return;
+      }
+      if (op.count == committed[op.arg]) return;                           // already in effect
+      break;
+
+    case OP_TEXT:
+      if (op.count == 0) return;
+      lineEmpty = false;
+      if (last != nullptr && last->code == OP_TEXT && last->data + last->count == op.data &&
+          (uint32_t)last->count + op.count <= 0xFFFF) {
+        last->count += op.count;                                           // contiguous in memory
+        return;
+      }
+      break;
+
+    case OP_FILL:
+      if (op.count == 0) return;
+      lineEmpty = false;
+      if (last != nullptr && last->code == OP_FILL && last->arg == op.arg && (uint32_t)last->count + op.count <= 0xFFFF) {
+        last->count += op.count;
+        return;
+      }
+      break;
+
+    case OP_LINE:
+      if (!lineEmpty) {
+        lineEmpty = true;
+        break;
+      }
+      op.code = OP_FEED;                                                   // empty line: a feed, which merges with its neighbours
+      op.count = 1;
+      // fall through
+
+    case OP_FEED:
+      if (op.count == 0) return;
+      if (last != nullptr && last->code == OP_FEED && last->count + op.count <= 255) {
+        last->count += op.count;
+        return;
+      }
+      lineEmpty = true;
+      break;
+
+    case OP_RASTER:
+      lineEmpty = true;
+      break;
+  }
+
+  uint8_t send = opCount;
+  if (op.code == OP_STYLE) {
+    while (send > 0 && ops[send - 1].code == OP_STYLE) send--;              // keep pending styles, they may still cancel
+  } else {
+    commitStyles();
+  }
+  if (opCount == PRINTJOB_MAX_OPS) lower(send);
+  ops[opCount++] = op;
+}
+
+void PrintJob::commitStyles() {
+  for (int i = opCount - 1; i >= 0 && ops[i].code == OP_STYLE; i--) committed[ops[i].arg] = ops[i].count;
+}
+
+// === Lowering ===
+
+void PrintJob::lower(uint8_t count) {
+  for (uint8_t i = 0; i < count; i++) {
+    const PrintOp &op = ops[i];
+    jobCost.bytes += opBytes(op, sentLineEmpty);
+
+    switch (op.code) {
+      case OP_TEXT:
+        printer.write(op.data, op.count);
+        sentLineEmpty = false;
+        break;
+
+      case OP_FILL: {
+        uint8_t run[16];
+        memset(run, op.arg, sizeof(run));
+        for (uint16_t left = op.count; left > 0;) {
+          uint16_t n = left > sizeof(run) ? sizeof(run) : left;
+          printer.write(run, n);
+          left -= n;
+        }
+        sentLineEmpty = false;
+        break;
+      }
+
+      case OP_LINE:
+        printer.write(CRLF, sizeof(CRLF));
+        jobCost.paperDots += PRINTJOB_LINE_DOTS;
+        sentLineEmpty = true;
+        break;
+
+      case OP_FEED:
+        if (sentLineEmpty && op.count == 1) printer.write(CRLF, sizeof(CRLF));  // one byte shorter than ESC d 1
+        else printer.feed(op.count);
+        jobCost.paperDots += (uint32_t)op.count * PRINTJOB_LINE_DOTS;
+        sentLineEmpty = true;
+        break;
+
+      case OP_STYLE:
+        switch (op.arg) {
+          case STYLE_INVERSE: printer.setInverse(op.count); break;
+          case STYLE_BOLD: printer.setBold(op.count); break;
+          case STYLE_UNDERLINE: printer.setUnderline(op.count); break;
+          case STYLE_SIZE: printer.setCharSize(op.count >> 4, op.count & 0x07); break;
+          case STYLE_ALIGN: printer.setAlign(op.count); break;
+          case STYLE_CODEPAGE: printer.setCodePage(op.count); break;
+        }
+        break;
+
+      case OP_RASTER:
+        printer.printBitmap(op.width, op.count, op.data);
+        jobCost.paperDots += op.count;
+        sentLineEmpty = true;
+        break;
+    }
+  }
+
+  opCount -= count;
+  memmove(ops, ops + count, opCount * sizeof(PrintOp));
+}
+
+uint32_t PrintJob::opBytes(const PrintOp &op, bool emptyLine) const {
+  switch (op.code) {
+    case OP_TEXT:
+    case OP_FILL: return op.count;
+    case OP_LINE: return sizeof(CRLF);
+    case OP_FEED: return emptyLine && op.count == 1 ? sizeof(CRLF) : sizeof(FEED_LINES) + 1;
+    case OP_STYLE: return op.arg == STYLE_CODEPAGE ? sizeof(SET_CODEPAGE) + 1 : 3;
+    case OP_RASTER: return 8 + (uint32_t)(op.width + 7) / 8 * op.count;  // before raster compression
+  }
+  return 0;
+}
+
+void PrintJob::estimate() {
+  // The printer prints while bytes arrive, so the slower of the two sets the pace
+  uint32_t serialMs = (uint64_t)jobCost.bytes * 10000 / printer.baud();    // 10 bits per byte on the wire
+  uint32_t paperMs = (uint64_t)jobCost.paperDots * 1000 / paperDotsPerSecond(printer.speed());
+  jobCost.ms = serialMs > paperMs ? serialMs : paperMs;
+  if (jobCost.naiveBytes > jobCost.bytes) savedTotal += jobCost.naiveBytes - jobCost.bytes;
+  bytesTotal += jobCost.bytes;
+  dotsTotal += jobCost.paperDots;
+}
@@ -0,0 +1,110 @@
+#ifndef PRINT_JOB_H
+#define PRINT_JOB_H
+
+#include <Arduino.h>
+#include "ThermalPrinter.h"
+
+#define PRINTJOB_MAX_OPS 48           // Ops held before the oldest are sent, long texts stream through
+#define PRINTJOB_LINE_DOTS 30         // Paper per text line: 24 dot font plus default line spacing
+#define PRINTJOB_ARENA_BYTES 192      // Text formatted for the current job (numbers, addresses), freed at end()
+
+enum PrintStyle : uint8_t {
+  STYLE_INVERSE,                                    // GS B n
+  STYLE_BOLD,                                       // ESC E n
+  STYLE_UNDERLINE,                                  // ESC - n
+  STYLE_SIZE,                                       // GS ! n, width in the high nibble
+  STYLE_ALIGN,                                      // ESC a n
+  STYLE_CODEPAGE,                                   // ESC ## SLAN n
+  STYLE_COUNT
+};
+
+enum PrintOpCode : uint8_t {
+  OP_TEXT,                                          // text run, no line end
+  OP_FILL,                                          // one byte repeated (block characters)
+  OP_LINE,                                          // end of line, CR LF
+  OP_FEED,                                          // advance n lines
+  OP_STYLE,                                         // set a style attribute
+  OP_RASTER                                         // bitmap, GS v 0
+};
+
+struct PrintOp {
+  PrintOpCode code;
+  uint8_t arg;                                      // style attribute, fill byte
+  uint16_t count;                                   // text length, fill count, lines, style value, raster rows
+  uint16_t width;                                   // raster width in dots
+  const uint8_t *data;                              // text or bitmap, owned by the caller
+};
+
+struct PrintCost {
+  uint32_t bytes;                                   // bytes the job sends (raster counted uncompressed)
+  uint32_t naiveBytes;                              // bytes before optimizing
+  uint32_t paperDots;                               // paper advanced, in dot rows
+  uint32_t ms;                                      // estimated time: paper travel or serial transfer, whichever is slower
+};
+
+// A receipt described as a short list of ops instead of direct printer calls.
+// Every op passes a peephole optimizer on the way in that knows the printer
+// state: style changes that change nothing or are overridden before any text
+// are dropped, adjacent text runs, fills and feeds are merged, and line ends
+// on an empty line become feeds. Ops are lowered to ThermalPrinter calls when
+// the buffer fills and at end(). Text and bitmaps are referenced, not copied,
+// so they must stay valid until end().
+//
+// The printer is assumed to be in its default style at begin(), end()
+// restores it.
+//
+// Text that has to be put together for a job (a number, an address) goes in
+// a fixed arena owned by the job instead of a String: format() writes it
+// there and it stays valid until end(), which empties the arena in one go.
+// Nothing is allocated on the heap, however long the device runs.
+class PrintJob {
+  public:
+    PrintJob(ThermalPrinter &printer, uint8_t defaultCodePage);
+
+    void begin();
+    void end();                                         // restore the default style and send the rest
+    void flush();                                       // send what is buffered, referenced text may change after
+
+    void text(const char *text, size_t length);
+    void text(const char *text) { this->text(text, strlen(text)); }
+    void fill(uint8_t c, uint16_t count);
+    void newline();
+    void line(const char *text) { this->text(text); newline(); }
+    void feed(uint8_t lines);
+    void style(PrintStyle attribute, uint8_t value);
+    void raster(uint16_t width, uint16_t height, const uint8_t *data);
+
+    void wrappedUpsideDown(const char *text, size_t length, uint8_t width); // wrapped lines, last first
+    void inverted(const char *text);                    // white on black between two blocks, needs PC437, no line end
+
+    char *allocate(size_t size);                        // arena space until end(), nullptr when it is used up
+    const char *format(const char *format, ...) __attribute__((format(printf, 2, 3))); // printf into the arena, cut short when full
+
+    const PrintCost &cost() const { return jobCost; }   // current / last job
+    uint32_t savedBytes() const { return savedTotal; }  // bytes removed by the optimizer since boot
+    uint32_t sentBytes() const { return bytesTotal; }   // bytes of all jobs since boot, with paperDots() the receipt mix
+    uint32_t paperDots() const { return dotsTotal; }    // dot rows of paper all jobs advanced since boot
+
+  private:
+    ThermalPrinter &printer;
+    uint8_t defaults[STYLE_COUNT];
+    uint8_t committed[STYLE_COUNT];                     // style in effect for the last buffered op that prints
+    PrintOp ops[PRINTJOB_MAX_OPS];
+    uint8_t opCount;
+    bool lineEmpty;                                     // nothing on the current line after the buffered ops
+    bool sentLineEmpty;                                 // same, after the ops already lowered
+    PrintCost jobCost;
+    uint32_t savedTotal;
+    uint32_t bytesTotal;
+    uint32_t dotsTotal;
+    char arena[PRINTJOB_ARENA_BYTES];
+    size_t arenaUsed;
+
+    void add(const PrintOp &op);
+    void commitStyles();
+    void lower(uint8_t count);
+    void estimate();
+    uint32_t opBytes(const PrintOp &op, bool emptyLine) const;
+};
+
+#endif
@@ -1,100 +1,170 @@
 #include "ThermalPrinter.h"
+#include "EscPos.h"
+#include "WordWrap.h"
 #define maxCharsPerLine 32
 
+using namespace EscPos;
+
 
 ThermalPrinter::ThermalPrinter(HardwareSerial &serialPort) {
   printer = &serialPort;
+  baudRate = 9600;
+  printSpeed = PRINT_SPEED_DEFAULT;
+  rasterCompression = true;
+  txLength = 0;
+  emitted = 0;
+  inJob = false;
+  currentJobStats = {0, 0, 0, 0};
+  allStats = {0, 0, 0, 0};
+  ringHead = 0;
+  ringTail = 0;
+  ringStats = {0, 0, 0, 0, 0};
+  rateStart = 0;
+  rateFilled = 0;
+  rateDrained = 0;
+  markFirst = 0;
+  markCount = 0;
 }
 
 void ThermalPrinter::begin(uint32_t baud) {
+  drain();                                                                  // queued bytes go out at the old rate
   printer->begin(baud);
+  baudRate = baud;
   delay(100);
 }
 
+bool ThermalPrinter::setBaudRate(uint32_t baud) {
+  if (!requestBaudRate(baud)) return false;
+  delay(50);                                                                // printer switches after the command
+  begin(baud);
+  return true;
+}
+
+bool ThermalPrinter::requestBaudRate(uint32_t baud) {
+  for (uint8_t n = 0; n < BAUD_RATE_COUNT; n++) {
+    if (BAUD_RATES[n] != baud) continue;
+    command(SET_BAUD, n);
+    drain();
+    printer->flush();                                                       // let the command leave at the old rate
+    return true;
+  }
+  return false;
+}
+
+void ThermalPrinter::switchBaudRate(uint32_t baud) {
+  drain();
+  printer->updateBaudRate(baud);
+  baudRate = baud;
+}
+
+bool ThermalPrinter::isOnline(uint32_t timeoutMs) {
+  flush();
+  drain();                                                                  // the answer must not be stuck behind queued output
+  while (printer->available()) printer->read();                             // drop stale input
+  emit(STATUS_PRINTER); done();
+  drain();
+
+  uint32_t start = millis();
+  while (millis() - start < timeoutMs) {
+    if (printer->available()) {
+      uint8_t status = printer->read();
+      return (status & 0x93) == 0x12;                                       // fixed bits: 1 and 4 set, 0 and 7 clear
+    }
+    yield();
+  }
+  return false;
+}
+
 void ThermalPrinter::init() {
-  printer->write(0x1B); printer->write('@');                                // ESC @ initialize printer
+  emit(INIT); done();                                                       // ESC @ initialize printer
 }
 
-void ThermalPrinter::setHeat(uint8_t heat) { // ESC ## STDP heat
-  byte cmd[] = {0x1B, 0x23, 0x23, 0x53, 0x54, 0x44, 0x50, heat};
-  printer->write(cmd, sizeof(cmd));                                         // (0-9, 0=light, 9=dark)
+void ThermalPrinter::setHeat(uint8_t heat) {
+  command(SET_HEAT, heat);                                                  // (0-9, 0=light, 9=dark)
 }
 
-void ThermalPrinter::setSpeed(uint8_t speed) { // ESC ## STSP speed
-  byte cmd[] = {0x1B, 0x23, 0x23, 0x53, 0x54, 0x53, 0x50, speed};
-  printer->write(cmd, sizeof(cmd));                                         // (0-9, 0=slow, 9=fast)
+void ThermalPrinter::setSpeed(uint8_t speed) {
+  command(SET_SPEED, speed);                                                // (0-9, 0=slow, 9=fast)
+  printSpeed = speed;
 }
 
 void ThermalPrinter::setCodePage(uint8_t n) {
-  // printer->write(0x1B); printer->write('t'); printer->write(n);          // (0=PC437, 1=Katakana, 2=PC850, 3=PC860, 4=PC863, 5=PC865, 6=West Europe, 7=Greek, 8=Hebrew, 9=East Europe, 10=Iran, 11=WPC1252)
-  byte cmd[] = {0x1B, 0x23, 0x23, 0x53, 0x4C, 0x41, 0x4E, n};
-  printer->write(cmd, sizeof(cmd));
+  // command(SELECT_CODEPAGE, n);                                           // (0=PC437, 1=Katakana, 2=PC850, 3=PC860, 4=PC863, 5=PC865, 6=West Europe, 7=Greek, 8=Hebrew, 9=East Europe, 10=Iran, 11=WPC1252)
+  command(SET_CODEPAGE, n);
 }
 
 void ThermalPrinter::setOrientationUpsideDown(bool on) {
-  printer->write(0x1B); printer->write('{'); printer->write(on ? 1 : 0);    // (0=normal, 1=180° rotated)
+  command(UPSIDE_DOWN, on ? 1 : 0);                                         // (0=normal, 1=180° rotated)
 }
 
 void ThermalPrinter::setAlign(uint8_t n) {
-  printer->write(0x1B); printer->write('a'); printer->write(n);             // (0=left, 1=center, 2=right)
+  command(ALIGN, n);                                                        // (0=left, 1=center, 2=right)
 }
 
 void ThermalPrinter::setBold(bool on) {
-  printer->write(0x1B); printer->write('E'); printer->write(on ? 1 : 0);    // (true = on, false = off)
+  command(BOLD, on ? 1 : 0);                                                // (true = on, false = off)
 }
 
 void ThermalPrinter::setUnderline(uint8_t n) {
-  printer->write(0x1B); printer->write('-'); printer->write(n);             // (0=off, 1=thin, 2=thick)
+  command(UNDERLINE, n);                                                    // (0=off, 1=thin, 2=thick)
 }
 
 void ThermalPrinter::setInverse(bool on) {
-  byte cmd[] = {0x1D, 0x42};
-  printer->write(cmd, sizeof(cmd));
-  printer->write(on ? 1 : 0);
-  // printer->write(0x1D); printer->write(0x42); printer->write(on ? 1 : 0);   // (true = on, false = off)
+  command(INVERSE, on ? 1 : 0);                                             // (true = on, false = off)
 }
 
 void ThermalPrinter::setCharSize(uint8_t width, uint8_t height) {
   uint8_t size = ((width & 0x07) << 4) | (height & 0x07);                   // width: 0-7, height: 0-7
-  printer->write(0x1D); printer->write('!'); printer->write(size);         
+  command(CHAR_SIZE, size);
 }
 
 void ThermalPrinter::setFont(uint8_t n) {
-  printer->write(0x1B); printer->write('M'); printer->write(n);             // (0=12x24, 1=9x17)
+  command(FONT, n);                                                         // (0=12x24, 1=9x17)
 }
 
 void ThermalPrinter::feed(uint8_t n) {
-  printer->write(0x1B); printer->write('d'); printer->write(n);             // (advance n lines)
+  command(FEED_LINES, n);                                                   // (advance n lines)
 }
 
 void ThermalPrinter::write(uint8_t c) {
-  printer->write(c);
+  emit(c); done();
 }
 
-void ThermalPrinter::print(String txt) {                                    // normal text
-  printer->print(txt);
+void ThermalPrinter::write(const uint8_t *data, size_t len) {
+  emit(data, len); done();
 }
 
-void ThermalPrinter::println(String txt) {                                  // normal text with newline
-  printer->println(txt);
+void ThermalPrinter::print(const char *text) {                              // normal text
+  print(text, strlen(text));
 }
 
-void ThermalPrinter::printInverted(String txt) {                            // inverted text with newline
+void ThermalPrinter::print(const char *text, size_t length) {
+  emit((const uint8_t*)text, length); done();
+}
+
+void ThermalPrinter::println(const char *text) {                            // normal text with newline
+  println(text, strlen(text));
+}
+
+void ThermalPrinter::println(const char *text, size_t length) {
+  emit((const uint8_t*)text, length); emit(CRLF); done();
+}
+
+void ThermalPrinter::printInverted(const char *txt) {                       // inverted text with newline
   // --- OPTION 1: Simple inversion (needs PC437)
   
-  printer->write(0xDB);  // full block character in PC437
-  setInverse(true);
+  emit(FULL_BLOCK);
+  emit(INVERSE_ON);
   for (int i = 0; txt[i]; i++) {
     if (txt[i] == ' ') {
-      setInverse(false);
-      printer->write(0xDB);  // full block character in PC437
-      setInverse(true);
+      emit(INVERTED_SPACE);                                                 // GS B 0, full block, GS B 1
     } else {
-      printer->write(txt[i]);
+      emit(txt[i]);
     }
   }
-  setInverse(false);
-  printer->write(0xDB);  // full block character in PC437
+  emit(INVERSE_OFF);
+  emit(FULL_BLOCK);
+  done();
 
   // OPTION 2: Print graphical black block
 
@@ -105,55 +175,135 @@ void ThermalPrinter::printInverted(String txt) {                            // i
   //   0xFF                    // 8 black pixels
   // };
 
-  // setInverse(true);
+  // emit(INVERSE_ON);
   // for (int i = 0; txt[i]; i++) {
   //   if (txt[i] == ' ') {
-  //     printer->write(blackBlock, sizeof(blackBlock));
+  //     emit(blackBlock, sizeof(blackBlock));
   //   } else {
-  //     printer->write(txt[i]);
+  //     emit(txt[i]);
   //   }
   // }
-  // setInverse(false);
+  // emit(INVERSE_OFF);
   
 }
 
-void ThermalPrinter::printWrappedUpsideDown(String text) {                  // print wrapped text upside down
-  String lines[100];
-  int lineCount = 0;
-  
-  while (text.length() > 0) {
-    // int breakIndex = maxCharsPerLine;
-    if (text.length() <= maxCharsPerLine) {
-      lines[lineCount++] = text;
-      break;
+void ThermalPrinter::printWrappedUpsideDown(const char *text) {             // print wrapped text upside down
+  printWrappedUpsideDown(text, strlen(text));
+}
+
+void ThermalPrinter::printWrappedUpsideDown(const char *text, size_t length) {
+  // Lines are sent last to first, the 180° rotation puts them back in reading order
+  WordWrap wrap(text, length, maxCharsPerLine);
+  wrap.forEachReversed([this](const char *line, size_t len) {
+    emit((const uint8_t*)line, len);
+    emit(CRLF);
+  });
+  done();
+}
+
+static bool isBlankRow(const uint8_t *row, uint16_t widthBytes) {
+  for (uint16_t x = 0; x < widthBytes; x++) {
+    if (row[x]) return false;
+  }
+  return true;
+}
+
+void ThermalPrinter::printBitmap(uint16_t width, uint16_t height, const uint8_t *data) {
+  uint16_t widthBytes = (width + 7) / 8;
+  if (!rasterCompression) {
+    printRasterBlock(data, widthBytes, 0, widthBytes, height);
+    done();
+    return;
+  }
+
+  // Split the image into blocks of inked rows. White stretches become paper feeds
+  // when that is cheaper than sending them, and each block only covers the
+  // columns that actually hold ink.
+  uint32_t emittedBefore = emitted;
+  uint16_t y = 0;
+  while (y < height) {
+    uint16_t lead = 0;                                                      // white rows before the block
+    while (y < height && isBlankRow(data + (size_t)y * widthBytes, widthBytes)) {
+      lead++;
+      y++;
+    }
+    if (lead > 0) {
+      feedDots(lead);
+      continue;
+    }
+
+    uint16_t start = y;
+    uint16_t left = widthBytes, right = 0;
+    uint16_t blankRun = 0;
+
+    while (y < height) {
+      const uint8_t *row = data + (size_t)y * widthBytes;
+      uint16_t l = 0;
+      while (l < widthBytes && row[l] == 0) l++;
+      if (l == widthBytes) {
+        blankRun++;
+      } else {
+        uint16_t r = widthBytes - 1;
+        while (row[r] == 0) r--;
+        if (blankRun > 0 && (uint32_t)blankRun * (right - left + 1) > RASTER_BLOCK_COST) break;
+        blankRun = 0;
+        if (l < left) left = l;
+        if (r > right) right = r;
+      }
+      y++;
+    }
+
+    uint16_t inked = y - start - blankRun;                                  // rows up to the last inked one
+    if (inked > 0) {
+      printRasterBlock(data + (size_t)start * widthBytes, widthBytes, left, right - left + 1, inked);
+    }
+    if (blankRun > 0) {
+      feedDots(blankRun);
     }
-    
-    int lastSpace = text.lastIndexOf(' ', maxCharsPerLine);
-    if (lastSpace == -1) lastSpace = maxCharsPerLine;
-    
-    lines[lineCount++] = text.substring(0, lastSpace);
-    text = text.substring(lastSpace);
-    text.trim();
   }
-  
-  for (int i = lineCount - 1; i >= 0; i--) {
-    printer->println(lines[i]);
+
+  uint32_t sent = emitted - emittedBefore;
+  uint32_t plain = 8 + (uint32_t)widthBytes * height;
+  if (plain > sent) {
+    currentJobStats.rasterSaved += plain - sent;
+    allStats.rasterSaved += plain - sent;
   }
+  done();
 }
 
-void ThermalPrinter::printBitmap(uint16_t width, uint16_t height, const uint8_t *data) {
-  // Use GS v 0 m xL xH yL yH d1...dk
-  uint8_t xL = width & 0xFF;
-  uint8_t xH = (width >> 8) & 0xFF;
-  uint8_t yL = height & 0xFF;
-  uint8_t yH = (height >> 8) & 0xFF;
+void ThermalPrinter::setRasterCompression(bool on) {
+  rasterCompression = on;
+}
 
-  printer->write(0x1D); printer->write('v'); printer->write('0'); printer->write(0); // m=0 normal
-  printer->write(xL); printer->write(xH);
-  printer->write(yL); printer->write(yH);
+void ThermalPrinter::feedDots(uint16_t dots) {
+  while (dots > 0) {
+    uint8_t n = dots > 255 ? 255 : dots;
+    emit(FEED_DOTS); emit(n);                                               // ESC J n
+    dots -= n;
+  }
+}
+
+void ThermalPrinter::printRasterBlock(const uint8_t *rows, uint16_t stride, uint16_t left, uint16_t widthBytes, uint16_t height) {
+  // A block trimmed on the left is moved back into place with the left margin
+  if (left > 0) {
+    uint16_t margin = left * 8;
+    emit(LEFT_MARGIN); emit(margin & 0xFF); emit((margin >> 8) & 0xFF);
+  }
+
+  // Use GS v 0 m xL xH yL yH d1...dk, x counts bytes per row
+  emit(RASTER);                                                             // m=0 normal
+  emit(widthBytes & 0xFF); emit((widthBytes >> 8) & 0xFF);
+  emit(height & 0xFF); emit((height >> 8) & 0xFF);
+
+  if (stride == widthBytes) {
+    emit(rows, (size_t)widthBytes * height);                                // untrimmed: one contiguous block
+  } else {
+    for (uint16_t y = 0; y < height; y++) emit(rows + (size_t)y * stride + left, widthBytes);
+  }
 
-  size_t len = (size_t)width * height;
-  printer->write(data, len);
+  if (left > 0) {
+    emit(LEFT_MARGIN); emit(0); emit(0);
+  }
 }
 
 void ThermalPrinter::printQRCode(const char *data) {
@@ -162,16 +312,69 @@ void ThermalPrinter::printQRCode(const char *data) {
   uint16_t len = strlen(data);
 
   // [Step 1] Store data
-  printer->write(0x1D); printer->write('('); printer->write('k');
-  printer->write((len + 3) & 0xFF);
-  printer->write(((len + 3) >> 8) & 0xFF);
-  printer->write(49); printer->write(80); printer->write(48);
-  printer->write((const uint8_t*)data, len);
+  emit(QR_STORE);
+  emit((len + 3) & 0xFF);
+  emit(((len + 3) >> 8) & 0xFF);
+  emit(49); emit(80); emit(48);
+  emit((const uint8_t*)data, len);
 
   // [Step 2] Print QR
-  printer->write(0x1D); printer->write('('); printer->write('k');
-  printer->write(3); printer->write(0);
-  printer->write(49); printer->write(81); printer->write(48);
+  emit(QR_PRINT);
+  done();
+}
+
+uint32_t ThermalPrinter::nvCapacity(uint32_t timeoutMs) {
+  flush();
+  drain();                                                                  // same as isOnline, the answer must not wait behind output
+  while (printer->available()) printer->read();
+  emit(NV_CAPACITY); done();
+  drain();
+
+  // 37h 30h, the size as decimal digits, NUL
+  uint32_t capacity = 0;
+  uint8_t got = 0;
+  uint32_t start = millis();
+  while (millis() - start < timeoutMs) {
+    if (!printer->available()) {
+      yield();
+      continue;
+    }
+    uint8_t c = printer->read();
+    if (got == 0 && c != 0x37) return 0;
+    if (got == 1 && c != 0x30) return 0;
+    if (got >= 2) {
+      if (c == 0) return capacity;
+      if (c < '0' || c > '9' || got > 11) return 0;
+      capacity = capacity * 10 + (c - '0');
+    }
+    got++;
+  }
+  return 0;                                                                 // silent or cut short: no NV graphics
+}
+
+void ThermalPrinter::defineNvGraphics(uint8_t kc1, uint8_t kc2, uint16_t width, uint16_t height) {
+  // GS ( L pL pH 48 67 48 kc1 kc2 b xL xH yL yH c d1...dk, one colour raster like GS v 0.
+  // A key code that is already defined is replaced.
+  uint32_t size = 11 + (uint32_t)((width + 7) / 8) * height;
+  emit(NV_GRAPHICS);
+  emit(size & 0xFF); emit((size >> 8) & 0xFF);
+  emit(48); emit(67); emit(48);
+  emit(kc1); emit(kc2);
+  emit(1);                                                                  // one colour
+  emit(width & 0xFF); emit((width >> 8) & 0xFF);
+  emit(height & 0xFF); emit((height >> 8) & 0xFF);
+  emit(49);                                                                 // colour 1 (black)
+  done();
+}
+
+void ThermalPrinter::printNvGraphics(uint8_t kc1, uint8_t kc2) {
+  // GS ( L 6 0 48 69 kc1 kc2 x y, x and y = 1 for normal size
+  emit(NV_GRAPHICS);
+  emit(6); emit(0);
+  emit(48); emit(69);
+  emit(kc1); emit(kc2);
+  emit(1); emit(1);
+  done();
 }
 
 void ThermalPrinter::printCodePages() {
@@ -180,21 +383,163 @@ void ThermalPrinter::printCodePages() {
   // Loop through first 10 code pages
   for (int n = 0; n < 10; n++) {
     // Select code page n
-    printer->write(0x1B);
-    printer->write(0x74);
-    printer->write(n);
+    emit(SELECT_CODEPAGE);
+    emit(n);
 
     // Print header
-    print("Code page ");
-    println((String) n);
+    char header[16];
+    snprintf(header, sizeof(header), "Code page %d", n);
+    println(header);
 
     // Print all 256 characters
     for (int c = 0; c < 256; c++) {
-      printer->write(c);
-      if ((c + 1) % 32 == 0) Serial.write('\n');
+      emit(c);
+      if ((c + 1) % 32 == 0) emit('\n');
     }
 
     feed(2);
+    flush();
     delay(2000); // pause between code pages
   }
-}
\ No newline at end of file
+}
+
+// === Output buffering ===
+void ThermalPrinter::beginJob() {
+  flush();
+  inJob = true;
+  currentJobStats = {0, 0, 0, 0};
+}
+
+void ThermalPrinter::endJob() {
+  inJob = false;
+  flush();
+}
+
+void ThermalPrinter::flush() {
+  if (txLength == 0) return;
+  sendToSerial(txBuffer, txLength);
+  txLength = 0;
+}
+
+void ThermalPrinter::emit(uint8_t b) {
+  emitted++;
+  if (txLength >= TX_BUFFER_SIZE) flush();
+  txBuffer[txLength++] = b;
+}
+
+void ThermalPrinter::emit(const uint8_t *data, size_t len) {
+  emitted += len;
+  if (len > TX_BUFFER_SIZE - txLength) flush();
+  if (len >= TX_BUFFER_SIZE) {                                              // large payloads (bitmaps) go to the ring directly
+    sendToSerial(data, len);
+    return;
+  }
+  memcpy(txBuffer + txLength, data, len);
+  txLength += len;
+}
+
+void ThermalPrinter::done() {
+  if (!inJob) flush();
+}
+
+void ThermalPrinter::sendToSerial(const uint8_t *data, size_t len) {
+  currentJobStats.bytes += len;
+  currentJobStats.writes++;
+  allStats.bytes += len;
+  allStats.writes++;
+
+  bool waited = false;
+  uint32_t waitStart = 0;
+  while (len > 0) {
+    size_t room = txFree();
+    if (room == 0) {
+      // Ring full: fall back to waiting for the UART, like a plain blocking write
+      if (!waited) {
+        waited = true;
+        waitStart = micros();
+        ringStats.stalls++;
+      }
+      pump();
+      yield();
+      continue;
+    }
+    size_t n = len < room ? len : room;
+    size_t at = ringHead & (TX_RING_SIZE - 1);
+    size_t first = n < TX_RING_SIZE - at ? n : TX_RING_SIZE - at;         // up to the end of the ring, then wrap
+    memcpy(ring + at, data, first);
+    memcpy(ring, data + first, n - first);
+    ringHead += n;
+    data += n;
+    len -= n;
+  }
+  if (txPending() > ringStats.highWater) ringStats.highWater = txPending();
+
+  if (waited) {
+    uint32_t spent = micros() - waitStart;
+    currentJobStats.serialMicros += spent;
+    allStats.serialMicros += spent;
+  }
+  pump();                                                                   // start the wire right away
+}
+
+void ThermalPrinter::pump() {
+  size_t room = printer->availableForWrite();                               // free space in the UART FIFO, writes up to it do not block
+  uint32_t moved = 0;
+  while (room > 0 && ringHead != ringTail) {
+    size_t at = ringTail & (TX_RING_SIZE - 1);
+    size_t n = txPending();
+    if (n > TX_RING_SIZE - at) n = TX_RING_SIZE - at;
+    if (n > room) n = room;
+    printer->write(ring + at, n);
+    ringTail += n;
+    ringStats.drained += n;
+    room -= n;
+    moved += n;
+  }
+
+  // Every receipt on its way is that much closer to the UART
+  for (uint8_t i = 0; i < markCount && moved > 0; i++) {
+    DrainMark &mark = marks[(markFirst + i) % TX_DRAIN_MARKS];
+    if (mark.left == 0) continue;
+    if (mark.left > moved) {
+      mark.left -= moved;
+    } else {
+      mark.left = 0;
+      mark.took += micros() - mark.since;
+    }
+  }
+
+  uint32_t now = millis();
+  uint32_t elapsed = now - rateStart;
+  if (elapsed >= TX_RATE_WINDOW_MS) {
+    ringStats.fillRate = (uint64_t)(allStats.bytes - rateFilled) * 1000 / elapsed;
+    ringStats.drainRate = (uint64_t)(ringStats.drained - rateDrained) * 1000 / elapsed;
+    rateStart = now;
+    rateFilled = allStats.bytes;
+    rateDrained = ringStats.drained;
+  }
+}
+
+void ThermalPrinter::markDrain(uint32_t stalledMicros) {
+  if (markCount == TX_DRAIN_MARKS) return;
+  DrainMark &mark = marks[(markFirst + markCount) % TX_DRAIN_MARKS];
+  mark.left = txPending() + txLength;                                       // a batch's buffer goes into the ring after what is there
+  mark.since = micros();
+  mark.took = stalledMicros;
+  markCount++;
+}
+
+bool ThermalPrinter::drained(uint32_t &micros) {
+  if (markCount == 0 || marks[markFirst].left > 0) return false;
+  micros = marks[markFirst].took;
+  markFirst = (markFirst + 1) % TX_DRAIN_MARKS;
+  markCount--;
+  return true;
+}
+
+void ThermalPrinter::drain() {
+  while (ringHead != ringTail) {
+    pump();
+    yield();
+  }
+}
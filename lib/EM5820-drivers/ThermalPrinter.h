@@ -3,15 +3,62 @@
 
 #include <Arduino.h>
 
+#define TX_BUFFER_SIZE 256            // Bytes collected before they are handed to the UART in one write
+#define TX_RING_SIZE 2048             // Software transmit ring in front of the 128 byte UART FIFO (power of two)
+#define TX_RATE_WINDOW_MS 1000        // Period over which fillRate and drainRate are measured
+#define TX_DRAIN_MARKS 4              // Receipts whose way through the ring is timed at once
+#define RASTER_BLOCK_COST 11          // Bytes a raster break costs: ESC J n plus a new GS v 0 header
+#define PAPER_DOTS_PER_SECOND_MIN 320 // Paper speed at ESC ## STSP 0, 40 mm/s at 8 dots/mm
+#define PAPER_DOTS_PER_SECOND_MAX 800 // At STSP 9, 100 mm/s
+#define PRINT_SPEED_DEFAULT 3         // STSP the printer is assumed to run at until setSpeed()
+
+// Dot rows per second the head burns at an ESC ## STSP setting, linear between
+// the two ends (480 at speed 3). The one paper speed model: print time
+// estimates, the calibration and scripts/escpos_emulator.py all use it.
+inline uint32_t paperDotsPerSecond(uint8_t speed) {
+  if (speed > 9) speed = 9;
+  return PAPER_DOTS_PER_SECOND_MIN + (PAPER_DOTS_PER_SECOND_MAX - PAPER_DOTS_PER_SECOND_MIN) * speed / 9;
+}
+
+struct PrinterStats {
+  uint32_t bytes;                                   // Bytes sent to the printer
+  uint32_t writes;                                  // Flushes into the transmit ring
+  uint32_t rasterSaved;                             // Bitmap bytes not sent thanks to raster compression
+  uint32_t serialMicros;                            // Time spent waiting for the UART because the transmit ring was full
+};
+
+// A receipt's bytes on their way out: how many bytes still have to leave the
+// ring before its last one, and micros() since it was marked. Only counts and
+// unsigned differences, so neither the ring counters nor micros() wrapping matter.
+struct DrainMark {
+  uint32_t left;                                    // bytes ahead of and including its last one
+  uint32_t since;                                   // micros() at markDrain()
+  uint32_t took;                                    // stalls plus the drain, valid once left is 0
+};
+
+struct TxStats {
+  uint32_t drained;                                 // Bytes moved from the ring into the UART
+  uint32_t stalls;                                  // Writes that found the ring full and had to wait
+  uint16_t highWater;                               // Fullest the ring has been
+  uint32_t fillRate;                                // Bytes per second into the ring, last window
+  uint32_t drainRate;                               // Bytes per second out to the UART, last window
+};
+
 class ThermalPrinter {
   public:
     ThermalPrinter(HardwareSerial &serialPort = Serial);
 
     void begin(uint32_t baud = 9600);
+    uint32_t baud() const { return baudRate; }          // current UART baud rate
+    bool setBaudRate(uint32_t baud);                    // ESC ## SBDR n, then switch the UART (false for unsupported rates)
+    bool requestBaudRate(uint32_t baud);                // only ESC ## SBDR n, sent and out of the UART when it returns
+    void switchBaudRate(uint32_t baud);                 // only reopen the UART at baud, no pause
+    bool isOnline(uint32_t timeoutMs = 100);            // DLE EOT 1, true when the printer answers with a valid status byte
 
     void init();                                        // ESC @ reset printer
     void setHeat(uint8_t heat);                         // ESC ## set print heat
     void setSpeed(uint8_t speed);                       // ESC ## set print speed
+    uint8_t speed() const { return printSpeed; }        // last speed sent, PRINT_SPEED_DEFAULT before
     void setCodePage(uint8_t n);                        // ESC t n (0=PC437, 1=Katakana, 2=PC850, 3=PC860, 4=PC863, 5=PC865, 6=West Europe, 7=Greek, 8=Hebrew, 9=East Europe, 10=Iran, 11=WPC1252)
     void setOrientationUpsideDown(bool on);             // ESC { n (0=normal, 1=180° rotated) 
     void setAlign(uint8_t n);                           // ESC a n (0=left, 1=center, 2=right)
@@ -22,19 +69,85 @@ class ThermalPrinter {
     void setFont(uint8_t n);                            // ESC M n (0=12x24, 1=9x17)
     void feed(uint8_t n = 1);                           // ESC d n (advance paper n lines)
     void write(uint8_t c);                              // write a single byte/character
-    void print(String txt);                             // normal text
-    void println(String txt);                           // normal text with newline
-    void printInverted(String txt);                     // Inverted text with newline without white spaces, needs code page 0 (PC437) for block character
-    void printWrappedUpsideDown(String text);           // print wrapped text upside down
+    void write(const uint8_t *data, size_t len);        // raw bytes, text or prepared commands
+    void print(const char *text);                       // normal text
+    void print(const char *text, size_t length);        // same, for a buffer that is not null-terminated
+    void println(const char *text);                     // normal text with newline
+    void println(const char *text, size_t length);
+    void printInverted(const char *text);               // Inverted text with newline without white spaces, needs code page 0 (PC437) for block character
+    void printWrappedUpsideDown(const char *text);      // print wrapped text upside down
+    void printWrappedUpsideDown(const char *text, size_t length); // same, for a buffer that is not null-terminated
 
     // Graphics / QR wrappers
-    void printBitmap(uint16_t width, uint16_t height, const uint8_t *data);
+    void printBitmap(uint16_t width, uint16_t height, const uint8_t *data); // GS v 0, width in dots, rows padded to full bytes
+    void setRasterCompression(bool on);                 // skip white rows and trim white columns in printBitmap (default on)
     void printQRCode(const char *data);
 
+    // NV graphics: images kept in the printer's flash under a two byte key code
+    // and printed with a few bytes. Not every printer has it, ask first.
+    uint32_t nvCapacity(uint32_t timeoutMs = 100);      // GS ( L fn 0, NV graphics memory in bytes, 0 when the printer does not answer
+    void defineNvGraphics(uint8_t kc1, uint8_t kc2, uint16_t width, uint16_t height); // GS ( L fn 67, the (width + 7) / 8 * height raster bytes follow with write()
+    void printNvGraphics(uint8_t kc1, uint8_t kc2);     // GS ( L fn 69 at normal size
+
     void printCodePages();                              // Print a test page of all code pages
 
+    // Output buffering. Outside a job every call is flushed when it returns,
+    // inside a job bytes are only flushed when the buffer fills or at endJob().
+    void beginJob();                                    // start collecting a job, resets jobStats()
+    void endJob();                                      // flush the rest of the job
+    void flush();                                       // hand buffered bytes to the UART in one write
+    const PrinterStats &jobStats() const { return currentJobStats; }   // stats of the current / last job
+    const PrinterStats &totalStats() const { return allStats; }        // stats since boot
+
+    // Transmit ring. Flushed bytes go into a software ring and pump() moves them
+    // into the UART FIFO as far as it has room, so the caller never waits for the
+    // wire. Only when the ring is full does a write wait for the UART, as every
+    // write used to; callers that must not stall check txFree() first.
+    void pump();                                        // top up the UART FIFO from the ring, call often
+    void drain();                                       // wait until the ring is empty
+    size_t txFree() const { return TX_RING_SIZE - (ringHead - ringTail); } // bytes that can be written without waiting
+    size_t txPending() const { return ringHead - ringTail; }
+    const TxStats &txStats() const { return ringStats; }
+
+    // Drain timing. markDrain() after a receipt is written starts a clock that
+    // stops when its last byte, buffered or in the ring, has gone into the UART
+    // FIFO; drained() hands out the finished ones in order. stalledMicros is the
+    // time its writes already waited for a full ring and is added to the result.
+    void markDrain(uint32_t stalledMicros);             // ignored while TX_DRAIN_MARKS receipts are on their way
+    bool drained(uint32_t &micros);                     // true with the time of the oldest finished receipt
+
   private:
     HardwareSerial *printer;
+    uint32_t baudRate;
+    uint8_t printSpeed;
+    bool rasterCompression;
+
+    uint8_t txBuffer[TX_BUFFER_SIZE];
+    size_t txLength;
+    uint32_t emitted;                                   // bytes handed to emit(), buffered or not
+    bool inJob;
+    PrinterStats currentJobStats;
+    PrinterStats allStats;
+
+    uint8_t ring[TX_RING_SIZE];
+    uint32_t ringHead;                                  // free-running write count, index is masked
+    uint32_t ringTail;                                  // free-running read count
+    TxStats ringStats;
+    uint32_t rateStart;                                 // millis() when the current rate window began
+    uint32_t rateFilled;                                // allStats.bytes at the start of the window
+    uint32_t rateDrained;                               // ringStats.drained at the start of the window
+    DrainMark marks[TX_DRAIN_MARKS];
+    uint8_t markFirst;
+    uint8_t markCount;
+
+    void emit(uint8_t b);
+    void emit(const uint8_t *data, size_t len);
+    template <size_t N> void emit(const uint8_t (&cmd)[N]) { emit(cmd, N); }
+    template <size_t N> void command(const uint8_t (&prefix)[N], uint8_t n) { emit(prefix, N); emit(n); done(); }
+    void done();                                        // end of a public call, flushes unless inside a job
+    void sendToSerial(const uint8_t *data, size_t len);
+    void feedDots(uint16_t dots);
+    void printRasterBlock(const uint8_t *rows, uint16_t stride, uint16_t left, uint16_t widthBytes, uint16_t height);
 };
 
 #endif
@@ -0,0 +1,63 @@
+#include "WordWrap.h"
+
+
+WordWrap::WordWrap(const char *text, size_t length, uint8_t width)
+  : text(text), length(length), width(width), pos(0) {
+}
+
+void WordWrap::rewind() {
+  pos = 0;
+}
+
+size_t WordWrap::countLines() {
+  rewind();
+  size_t n = 0;
+  WrapLine line;
+  while (next(line)) n++;
+  rewind();
+  return n;
+}
+
+bool WordWrap::next(WrapLine &line) {
+  if (pos >= length) return false;
+
+  size_t start = pos;
+  size_t limit = start + width;                                             // last index that may still end the line
+  size_t scanEnd = limit < length ? limit : length - 1;
+  size_t end = start;
+  bool newline = false;
+
+  // An explicit newline within reach ends the line
+  for (size_t i = start; i <= scanEnd; i++) {
+    if (text[i] == '\n') {
+      end = i;
+      pos = i + 1;
+      newline = true;
+      break;
+    }
+  }
+
+  if (!newline) {
+    if (length - start <= width) {                                          // the rest fits
+      end = length;
+      pos = length;
+    } else {
+      end = limit;                                                          // hard break when there is no space
+      for (size_t i = limit; i > start; i--) {
+        if (text[i] == ' ') {
+          end = i;
+          break;
+        }
+      }
+      pos = end;
+      while (pos < length && text[pos] == ' ') pos++;                       // drop the spaces at a soft break
+      if (pos < length && text[pos] == '\r') pos++;
+      if (pos < length && text[pos] == '\n') pos++;                         // and a newline right behind it
+    }
+  }
+
+  while (end > start && (text[end - 1] == ' ' || text[end - 1] == '\r')) end--;
+  line.start = start;
+  line.length = end - start;
+  return true;
+}
@@ -0,0 +1,107 @@
+#ifndef WORD_WRAP_H
+#define WORD_WRAP_H
+
+#include <Arduino.h>
+
+#define WRAP_INDEX_LINES 32           // Line offsets remembered per pass when emitting in reverse
+
+struct WrapLine {
+  size_t start;                                     // Offset of the first character in the source buffer
+  size_t length;                                    // Characters in the line, trailing blanks and CR removed
+};
+
+// Word wrapping over a plain character buffer. Lines are described as offsets
+// into the original text, nothing is copied or allocated.
+//
+// Rules (same as the old String based wrapper):
+// - a line holds at most width characters
+// - a long line is broken at the last space within width+1 characters,
+//   or hard-broken at width when there is none
+// - spaces at a soft break are dropped
+// - '\n' (or "\r\n") always ends a line, so to-do lists keep their layout
+class WordWrap {
+  public:
+    WordWrap(const char *text, size_t length, uint8_t width);
+
+    bool next(WrapLine &line);                          // next line in reading order, false at the end
+    void rewind();                                      // start again from the first line
+    size_t countLines();                                // total number of lines (rewinds)
+    size_t position() const { return pos; }             // where the next line starts
+
+    // Calls emit for every line from last to first. Uses fixed indexes of
+    // WRAP_INDEX_LINES entries: short texts take a single pass, longer texts
+    // are split into parts that are indexed on their own, one index per level
+    // on the stack (two levels to 1024 lines, three to 32768).
+    template <typename Emit>
+    void forEachReversed(Emit emit);
+
+    const char *data() const { return text; }
+
+  private:
+    template <typename Emit>
+    void emitReversed(size_t from, size_t lines, Emit &emit);   // a line starts at from
+    template <typename Emit>
+    void emitBlock(size_t from, size_t lines, Emit &emit);      // at most WRAP_INDEX_LINES lines
+
+    const char *text;
+    size_t length;
+    uint8_t width;
+    size_t pos;
+};
+
+template <typename Emit>
+void WordWrap::forEachReversed(Emit emit) {
+  WrapLine index[WRAP_INDEX_LINES];
+
+  // First pass: count lines, remembering the first block as we go
+  rewind();
+  size_t total = 0;
+  WrapLine line;
+  while (next(line)) {
+    if (total < WRAP_INDEX_LINES) index[total] = line;
+    total++;
+  }
+
+  // A short text was indexed by the first pass, a longer one is split up
+  if (total <= WRAP_INDEX_LINES) {
+    for (size_t n = total; n > 0; n--) emit(text + index[n - 1].start, index[n - 1].length);
+  } else {
+    emitReversed(0, total, emit);
+  }
+  rewind();
+}
+
+template <typename Emit>
+void WordWrap::emitReversed(size_t from, size_t lines, Emit &emit) {
+  // lines lines starting at offset from, last first. One scan remembers where
+  // each of up to WRAP_INDEX_LINES parts starts, then the parts go out last
+  // first the same way, so every level reads its span once: n log n over the
+  // text instead of a rescan from the start for every block.
+  if (lines <= WRAP_INDEX_LINES) {
+    emitBlock(from, lines, emit);
+    return;
+  }
+  size_t stride = (lines + WRAP_INDEX_LINES - 1) / WRAP_INDEX_LINES;
+  size_t starts[WRAP_INDEX_LINES];
+  size_t parts = 0;
+  WrapLine line;
+  pos = from;
+  for (size_t n = 0; n < lines; n++) {
+    if (n % stride == 0) starts[parts++] = pos;
+    next(line);
+  }
+  for (size_t part = parts; part > 0; part--) {
+    size_t count = part == parts ? lines - (parts - 1) * stride : stride;
+    emitReversed(starts[part - 1], count, emit);
+  }
+}
+
+template <typename Emit>
+void WordWrap::emitBlock(size_t from, size_t lines, Emit &emit) {
+  WrapLine index[WRAP_INDEX_LINES];
+  pos = from;
+  for (size_t n = 0; n < lines; n++) next(index[n]);
+  for (size_t n = lines; n > 0; n--) emit(text + index[n - 1].start, index[n - 1].length);
+}
+
+#endif
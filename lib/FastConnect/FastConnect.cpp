@@ -0,0 +1,116 @@
+#include "FastConnect.h"
+#include <LittleFS.h>
+
+#define WIFI_PARAMS_MAGIC 0x57494649  // "WIFI"
+
+
+FastConnect::FastConnect()
+  : ssid(nullptr), password(nullptr), current(CONNECT_OFFLINE), startedAt(0), cacheUsed(false), hasStatic(false) {
+  memset(staticIp, 0, sizeof(staticIp));
+  memset(&cached, 0, sizeof(cached));
+}
+
+void FastConnect::setStaticIp(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns) {
+  staticIp[0] = ip;
+  staticIp[1] = gateway;
+  staticIp[2] = subnet;
+  staticIp[3] = dns;
+  hasStatic = true;
+}
+
+void FastConnect::begin(const char *ssid, const char *password, bool reuseLease) {
+  this->ssid = ssid;
+  this->password = password;
+
+  WiFi.persistent(false);                                                   // the SDK would rewrite its own flash copy on every begin
+  WiFi.mode(WIFI_STA);
+
+  bool known = load();
+  if (hasStatic) {
+    WiFi.config(IPAddress(staticIp[0]), IPAddress(staticIp[1]), IPAddress(staticIp[2]), IPAddress(staticIp[3]));
+  } else if (known && reuseLease && cached.hasLease) {
+    WiFi.config(IPAddress(cached.ip), IPAddress(cached.gateway), IPAddress(cached.subnet), IPAddress(cached.dns));
+  }
+
+  if (known) {
+    WiFi.begin(ssid, password, cached.channel, cached.bssid);
+    current = CONNECT_FAST;
+  } else {
+    WiFi.begin(ssid, password);
+    current = CONNECT_SCAN;
+  }
+  startedAt = millis();
+}
+
+FastConnectState FastConnect::tick() {
+  if (current == CONNECT_UP) return current;
+
+  if (WiFi.status() == WL_CONNECTED) {
+    cacheUsed = current == CONNECT_FAST;
+    current = CONNECT_UP;
+    save();
+    return current;
+  }
+
+  uint32_t elapsed = millis() - startedAt;
+  if (current == CONNECT_FAST && elapsed >= FAST_CONNECT_TIMEOUT_MS) {
+    // Access point moved or gone: start over the slow way, with DHCP unless the address is fixed
+    WiFi.disconnect();
+    if (!hasStatic) WiFi.config(IPAddress(0u), IPAddress(0u), IPAddress(0u));
+    WiFi.begin(ssid, password);
+    current = CONNECT_SCAN;
+    startedAt = millis();
+  } else if (current == CONNECT_SCAN && elapsed >= FAST_CONNECT_SCAN_TIMEOUT_MS) {
+    current = CONNECT_OFFLINE;
+  }
+  return current;
+}
+
+uint32_t FastConnect::checksum(const WiFiParams &params) const {
+  // FNV-1a over everything before the check field, then the SSID
+  uint32_t hash = 2166136261UL;
+  const uint8_t *bytes = (const uint8_t*)&params;
+  for (size_t i = 0; i < offsetof(WiFiParams, check); i++) hash = (hash ^ bytes[i]) * 16777619UL;
+  for (const char *c = ssid; *c; c++) hash = (hash ^ (uint8_t)*c) * 16777619UL;
+  return hash;
+}
+
+bool FastConnect::load() {
+  // RTC memory first, it is there after a reset and costs no flash read
+  WiFiParams params;
+  bool valid = ESP.rtcUserMemoryRead(FAST_CONNECT_RTC_BLOCK, (uint32_t*)&params, sizeof(params)) &&
+               params.magic == WIFI_PARAMS_MAGIC && params.check == checksum(params);
+  if (!valid) {
+    File file = LittleFS.open(FAST_CONNECT_PATH, "r");
+    valid = file && file.read((uint8_t*)&params, sizeof(params)) == sizeof(params) &&
+            params.magic == WIFI_PARAMS_MAGIC && params.check == checksum(params);
+    if (file) file.close();
+  }
+
+  if (valid) cached = params;
+  else memset(&cached, 0, sizeof(cached));
+  return valid;
+}
+
+void FastConnect::save() {
+  WiFiParams params;
+  memset(&params, 0, sizeof(params));
+  params.magic = WIFI_PARAMS_MAGIC;
+  memcpy(params.bssid, WiFi.BSSID(), sizeof(params.bssid));
+  params.channel = WiFi.channel();
+  params.hasLease = !hasStatic;
+  params.ip = WiFi.localIP();
+  params.gateway = WiFi.gatewayIP();
+  params.subnet = WiFi.subnetMask();
+  params.dns = WiFi.dnsIP();
+  params.check = checksum(params);
+
+  if (memcmp(&params, &cached, sizeof(params)) == 0) return;               // same as stored, spare the flash
+  ESP.rtcUserMemoryWrite(FAST_CONNECT_RTC_BLOCK, (uint32_t*)&params, sizeof(params));
+  File file = LittleFS.open(FAST_CONNECT_PATH, "w");
+  if (file) {
+    file.write((const uint8_t*)&params, sizeof(params));
+    file.close();
+  }
+  cached = params;
+}
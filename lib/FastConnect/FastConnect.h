@@ -0,0 +1,66 @@
+#ifndef FAST_CONNECT_H
+#define FAST_CONNECT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define FAST_CONNECT_PATH "/wifi.bin"       // Flash copy of the last association, survives power cycles
+#define FAST_CONNECT_RTC_BLOCK 0            // RTC user memory block (4 byte units), survives resets, not power loss
+#define FAST_CONNECT_TIMEOUT_MS 3000        // Time the cached access point gets before a full scan
+#define FAST_CONNECT_SCAN_TIMEOUT_MS 30000  // Time the full scan gets before the WiFi watchdog takes over
+
+// Last good association: access point, channel and the address DHCP gave us
+struct WiFiParams {
+  uint32_t magic;
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t hasLease;                                 // 0 with a static address
+  uint32_t ip;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+  uint32_t check;                                   // over the fields and the SSID, a new network invalidates the cache
+};
+
+enum FastConnectState : uint8_t {
+  CONNECT_FAST,                                     // joining the cached access point on its channel, no scan
+  CONNECT_SCAN,                                     // normal association with scan and DHCP
+  CONNECT_UP,
+  CONNECT_OFFLINE                                   // gave up, WiFi.reconnect() from the watchdog may still bring it up
+};
+
+// Non-blocking station start that skips the channel scan and DHCP when the
+// last association is known. Parameters are kept in RTC memory for warm resets
+// and in LittleFS for cold boots (mount it first), and only written when they
+// change. If the access point moved, the fast attempt times out and a normal
+// association takes over. With reuseLease the cached lease is also set as a
+// static address, which nothing checks: association succeeds even when the
+// router has since given that address to another host, so only reuse it on
+// networks where the lease is reserved for this device.
+class FastConnect {
+  public:
+    FastConnect();
+
+    void setStaticIp(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns); // before begin(), replaces DHCP for good
+    void begin(const char *ssid, const char *password, bool reuseLease);
+    FastConnectState tick();                            // call until CONNECT_UP, never waits
+
+    FastConnectState state() const { return current; }
+    bool usedCache() const { return cacheUsed; }        // came up on the cached parameters
+
+  private:
+    const char *ssid;
+    const char *password;
+    FastConnectState current;
+    uint32_t startedAt;
+    bool cacheUsed;
+    bool hasStatic;
+    uint32_t staticIp[4];                               // ip, gateway, subnet, dns
+    WiFiParams cached;                                  // what is stored now, magic 0 when nothing valid
+
+    uint32_t checksum(const WiFiParams &params) const;
+    bool load();
+    void save();
+};
+
+#endif
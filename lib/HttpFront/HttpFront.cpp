@@ -0,0 +1,649 @@
+#include "HttpFront.h"
+
+static const char *statusText(int status) {
+  switch (status) {
+    case 200: return "OK";
+    case 202: return "Accepted";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 429: return "Too Many Requests";
+    case 503: return "Service Unavailable";
+    case 507: return "Insufficient Storage";
+    default: return "Internal Server Error";
+  }
+}
+
+// Value of a "Name: value" header line, nullptr for other headers
+static const char *headerValue(const char *line, const char *name) {
+  size_t length = strlen(name);
+  if (strncasecmp(line, name, length) != 0 || line[length] != ':') return nullptr;
+  const char *value = line + length + 1;
+  while (*value == ' ' || *value == '\t') value++;
+  return value;
+}
+
+static uint8_t hexDigit(uint8_t c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return 0; // Broken escape, decodes to something harmless instead of failing the request
+}
+
+// Copy a quoted or token value up to the closing quote or ';'
+static void copyParameter(char *out, size_t size, const char *value) {
+  bool quoted = *value == '"';
+  if (quoted) value++;
+  size_t n = 0;
+  while (*value && n < size - 1) {
+    if (quoted ? *value == '"' : (*value == ';' || *value == ' ')) break;
+    out[n++] = *value++;
+  }
+  out[n] = '\0';
+}
+
+
+// === HttpRequest ===
+
+HttpRequest::HttpRequest() : index(0) {
+  reset();
+}
+
+void HttpRequest::reset() {
+  state = FREE;
+  route = nullptr;
+  begun = false;
+  requestMethod = 0;
+  requestPath[0] = '\0';
+  etag[0] = '\0';
+  key[0] = '\0';
+  remote = 0;
+  mediaType[0] = '\0';
+  lineLength = 0;
+  chunked = false;
+  contentLength = 0;
+  received = 0;
+  acceptedAt = 0;
+  acceptedUs = 0;
+  lastActivity = 0;
+  bodyType = BODY_RAW;
+  formState = FORM_NAME;
+  percentDigits = 0;
+  percentValue = 0;
+  fieldName[0] = '\0';
+  fieldNameLength = 0;
+  fieldFlags = 0;
+  chunkLength = 0;
+  partState = PART_PREAMBLE;
+  delimiterLength = 0;
+  delimiterMatched = 0;
+  tailLength = 0;
+  hasResponded = false;
+  extraHeaders[0] = '\0';
+  extraHeadersLength = 0;
+  sendBody = nullptr;
+  sendRemaining = 0;
+}
+
+void HttpRequest::addHeader(const char *name, const char *value) {
+  size_t room = sizeof(extraHeaders) - extraHeadersLength;
+  int n = snprintf(extraHeaders + extraHeadersLength, room, "%s: %s\r\n", name, value);
+  if (n > 0 && (size_t)n < room) extraHeadersLength += n;
+  else extraHeaders[extraHeadersLength] = '\0'; // Does not fit, drop it rather than send half a header
+}
+
+void HttpRequest::writeHead(int status, const char *contentType, size_t length, bool knownLength) {
+  char head[128 + HTTP_EXTRA_HEADERS_SIZE];
+  char lengthHeader[32] = "";
+  if (knownLength) snprintf(lengthHeader, sizeof(lengthHeader), "Content-Length: %u\r\n", (unsigned)length);
+  int n = snprintf(head, sizeof(head),
+                   "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n%s%sConnection: close\r\n\r\n",
+                   status, statusText(status), contentType, lengthHeader, extraHeaders);
+  if (n > (int)sizeof(head) - 1) n = sizeof(head) - 1;
+  client.write((const uint8_t*)head, n);
+  hasResponded = true;
+  extraHeaders[0] = '\0';
+  extraHeadersLength = 0;
+}
+
+void HttpRequest::send(int status, const char *contentType, const char *body) {
+  if (hasResponded) return;
+  size_t length = strlen(body);
+  writeHead(status, contentType, length);
+  if (length > 0) client.write((const uint8_t*)body, length);
+}
+
+void HttpRequest::send_P(int status, const char *contentType, PGM_P body, size_t length) {
+  if (hasResponded) return;
+  writeHead(status, contentType, length);
+  sendBody = body;
+  sendRemaining = length;
+  pump();
+}
+
+void HttpRequest::pump() {
+  // Only hand the socket what it can take right now, the rest goes out on later passes
+  while (sendRemaining > 0) {
+    size_t room = client.availableForWrite();
+    if (room == 0) return;
+    uint8_t buffer[HTTP_CHUNK_SIZE];
+    size_t n = sendRemaining;
+    if (n > room) n = room;
+    if (n > sizeof(buffer)) n = sizeof(buffer);
+    memcpy_P(buffer, sendBody, n);
+    client.write(buffer, n);
+    sendBody += n;
+    sendRemaining -= n;
+    lastActivity = millis();
+  }
+}
+
+// === Form decoding ===
+
+void HttpRequest::dispatch(const uint8_t *data, size_t length, uint8_t flags) {
+  // Once answered, the rest of the request is only read to keep the connection orderly
+  if (route != nullptr && route->field != nullptr && !hasResponded) {
+    route->field(*this, fieldName, data, length, flags);
+  }
+}
+
+void HttpRequest::startField(uint8_t flags) {
+  fieldFlags = flags;
+  chunkLength = 0;
+  dispatch(nullptr, 0, HTTP_FIELD_START | fieldFlags);
+}
+
+void HttpRequest::fieldByte(uint8_t c) {
+  chunk[chunkLength++] = c;
+  if (chunkLength == sizeof(chunk)) {
+    dispatch(chunk, chunkLength, fieldFlags);
+    chunkLength = 0;
+  }
+}
+
+void HttpRequest::endField() {
+  dispatch(chunk, chunkLength, HTTP_FIELD_END | fieldFlags);
+  chunkLength = 0;
+  fieldName[0] = '\0';
+  fieldNameLength = 0;
+  fieldFlags = 0;
+}
+
+void HttpRequest::formByte(uint8_t c) {
+  // application/x-www-form-urlencoded: name=value&name=value with '+' and %XX escapes
+  if (percentDigits > 0) {
+    percentValue = (percentValue << 4) | hexDigit(c);
+    if (--percentDigits > 0) return;
+    c = percentValue; // Decoded byte is always data, even if it is '&' or '='
+  } else if (c == '%') {
+    percentDigits = 2;
+    percentValue = 0;
+    return;
+  } else if (c == '&') {
+    finishForm();
+    return;
+  } else if (c == '=' && formState == FORM_NAME) {
+    startField(0);
+    formState = FORM_VALUE;
+    return;
+  } else if (c == '+') {
+    c = ' ';
+  }
+
+  if (formState == FORM_VALUE) {
+    fieldByte(c);
+  } else if (fieldNameLength < sizeof(fieldName) - 1) {
+    fieldName[fieldNameLength++] = c;
+    fieldName[fieldNameLength] = '\0';
+  }
+}
+
+void HttpRequest::finishForm() {
+  if (formState == FORM_VALUE) {
+    endField();
+  } else if (fieldNameLength > 0) {
+    startField(0); // Name without '=', an empty field
+    endField();
+  }
+  formState = FORM_NAME;
+  percentDigits = 0;
+}
+
+void HttpRequest::parseBoundary(const char *contentType) {
+  const char *boundary = strstr(contentType, "boundary=");
+  if (boundary == nullptr) return;
+  memcpy(delimiter, "\r\n--", 4);
+  copyParameter(delimiter + 4, sizeof(delimiter) - 4, boundary + 9);
+  delimiterLength = strlen(delimiter);
+  if (delimiterLength > 4) bodyType = BODY_MULTIPART;
+}
+
+void HttpRequest::partByte(uint8_t c) {
+  // multipart/form-data: parts separated by "\r\n--boundary", each with its own header block.
+  // The boundary never contains CR, so a failed match can only restart at the current byte.
+  switch (partState) {
+    case PART_PREAMBLE:
+    case PART_DATA:
+      if (c == (uint8_t)delimiter[delimiterMatched]) {
+        if (++delimiterMatched == delimiterLength) {
+          if (partState == PART_DATA) endField();
+          partState = PART_DELIMITER_TAIL;
+          tailLength = 0;
+          delimiterMatched = 0;
+        }
+        return;
+      }
+      if (partState == PART_DATA) {
+        for (size_t i = 0; i < delimiterMatched; i++) fieldByte(delimiter[i]);
+      }
+      delimiterMatched = c == (uint8_t)delimiter[0] ? 1 : 0;
+      if (delimiterMatched == 0 && partState == PART_DATA) fieldByte(c);
+      return;
+
+    case PART_DELIMITER_TAIL:
+      // "--" ends the body, otherwise skip to the end of the line and read the next part's headers
+      if (c == '-' && tailLength < 2) {
+        if (++tailLength == 2) partState = PART_EPILOGUE;
+      } else if (c == '\n') {
+        partState = PART_HEADERS;
+        lineLength = 0;
+      } else {
+        tailLength = 2;
+      }
+      return;
+
+    case PART_HEADERS:
+      if (c == '\r') return;
+      if (c == '\n') {
+        if (lineLength == 0) {
+          startField(fieldFlags);
+          partState = PART_DATA;
+          delimiterMatched = 0;
+        } else {
+          partHeader();
+          lineLength = 0;
+        }
+      } else if (lineLength < sizeof(line) - 1) {
+        line[lineLength++] = c;
+      }
+      return;
+
+    case PART_EPILOGUE:
+      return;
+  }
+}
+
+void HttpRequest::partHeader() {
+  line[lineLength] = '\0';
+  const char *value = headerValue(line, "Content-Disposition");
+  if (value == nullptr) return;
+
+  // form-data; name="message"; filename="photo.pgm"
+  const char *p = value;
+  while ((p = strstr(p, "name=")) != nullptr) {
+    bool isFilename = p - value >= 4 && strncasecmp(p - 4, "file", 4) == 0;
+    p += 5;
+    if (isFilename) {
+      fieldFlags |= HTTP_FIELD_FILE;
+    } else {
+      copyParameter(fieldName, sizeof(fieldName), p);
+      fieldNameLength = strlen(fieldName);
+    }
+  }
+}
+
+
+// === HttpStream ===
+
+HttpStream::HttpStream(HttpRequest &request, int status, const char *contentType)
+    : request(request), open(!request.hasResponded), length(0) {
+  if (open) request.writeHead(status, contentType, 0, false);
+}
+
+HttpStream::~HttpStream() {
+  flush();
+}
+
+size_t HttpStream::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HttpStream::write(const uint8_t *data, size_t length) {
+  if (!open) return 0;
+  for (size_t i = 0; i < length; i++) {
+    if (this->length == sizeof(buffer)) flush();
+    buffer[this->length++] = data[i];
+  }
+  return length;
+}
+
+void HttpStream::flush() {
+  if (length > 0) request.client.write(buffer, length);
+  length = 0;
+  request.lastActivity = millis();
+}
+
+
+// === HttpFront ===
+
+HttpFront::HttpFront(uint16_t port)
+  : server(port), routeCount(0), dropCount(0), notFound(nullptr), rejectCount(0), timeoutCount(0) {
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) requests[i].index = i;
+}
+
+void HttpFront::begin() {
+  server.begin();
+  server.setNoDelay(true);
+}
+
+bool HttpFront::on(const char *path, uint8_t methods, HttpRequestHandler end) {
+  HttpRoute route = {path, methods, HTTP_SMALL_BODY, nullptr, nullptr, end, nullptr, nullptr};
+  return on(route);
+}
+
+bool HttpFront::on(const HttpRoute &route) {
+  if (routeCount >= HTTP_MAX_ROUTES) {
+    dropCount++;
+    return false;
+  }
+  routes[routeCount++] = route;
+  return true;
+}
+
+void HttpFront::onNotFound(HttpRequestHandler handler) {
+  notFound = handler;
+}
+
+uint8_t HttpFront::active() const {
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) {
+    if (requests[i].state != HttpRequest::FREE) count++;
+  }
+  return count;
+}
+
+bool HttpFront::handle(uint32_t budgetMs) {
+  uint32_t start = millis();
+  accept();
+
+  // Round-robin over the open connections, one read slice each per pass
+  bool waiting;
+  do {
+    waiting = false;
+    for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++) {
+      if (requests[i].state != HttpRequest::FREE && service(requests[i])) waiting = true;
+    }
+  } while (waiting && millis() - start < budgetMs);
+
+  return waiting;
+}
+
+void HttpFront::accept() {
+  while (server.hasClient()) {
+    WiFiClient client = server.accept();
+    if (!client) return;
+
+    HttpRequest *request = nullptr;
+    for (uint8_t i = 0; i < HTTP_MAX_CLIENTS && request == nullptr; i++) {
+      if (requests[i].state == HttpRequest::FREE) request = &requests[i];
+    }
+
+    if (request == nullptr) {
+      // All slots busy: answer right away instead of leaving the client in the backlog
+      static const char busy[] = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 1\r\n"
+                                 "Content-Length: 0\r\nConnection: close\r\n\r\n";
+      client.write((const uint8_t*)busy, sizeof(busy) - 1);
+      while (client.available() > 0) client.read(); // Unread input turns the close into a reset
+      client.stop(HTTP_CLOSE_WAIT_MS);
+      rejectCount++;
+      continue;
+    }
+
+    request->reset();
+    request->client = client;
+    request->remote = client.remoteIP();
+    request->client.setNoDelay(true);
+    request->state = HttpRequest::REQUEST_METHOD;
+    request->acceptedAt = millis();
+    request->acceptedUs = micros();
+    request->lastActivity = request->acceptedAt;
+  }
+}
+
+bool HttpFront::service(HttpRequest &request) {
+  uint32_t now = millis();
+  request.pump();
+
+  if (request.state == HttpRequest::CLOSING) {
+    // Close once the whole response has been handed to the socket
+    if (request.sendRemaining == 0 || !request.client.connected() ||
+        now - request.lastActivity >= HTTP_IDLE_TIMEOUT_MS) {
+      close(request);
+    }
+    return false;
+  }
+
+  if (!request.client.connected()) {
+    abortRequest(request);
+    close(request);
+    return false;
+  }
+
+  // Backpressure: the route cannot take more body yet, waiting for it is not idling
+  if (request.state == HttpRequest::BODY && !request.hasResponded && request.route != nullptr &&
+      request.route->ready != nullptr && !request.route->ready(request)) {
+    request.lastActivity = now;
+    return false;
+  }
+
+  bool inHeaders = request.state < HttpRequest::BODY;
+  if ((inHeaders && now - request.acceptedAt >= HTTP_HEADER_TIMEOUT_MS) ||
+      now - request.lastActivity >= HTTP_IDLE_TIMEOUT_MS) {
+    timeoutCount++;
+    reject(request, 408, "Request timeout");
+    return false;
+  }
+
+  int available = request.client.available();
+  if (available <= 0) return false;
+
+  uint8_t buffer[HTTP_READ_SLICE];
+  int n = request.client.read(buffer, available < (int)sizeof(buffer) ? available : sizeof(buffer));
+  if (n <= 0) return false;
+  request.lastActivity = now;
+
+  for (int i = 0; i < n && request.state != HttpRequest::CLOSING; i++) {
+    feed(request, buffer[i]);
+  }
+
+  return request.state != HttpRequest::CLOSING && request.client.available() > 0;
+}
+
+void HttpFront::feed(HttpRequest &request, uint8_t c) {
+  switch (request.state) {
+    case HttpRequest::REQUEST_METHOD:
+      if (c == ' ') {
+        request.line[request.lineLength] = '\0';
+        if (strcmp(request.line, "GET") == 0) request.requestMethod = HTTP_METHOD_GET;
+        else if (strcmp(request.line, "POST") == 0) request.requestMethod = HTTP_METHOD_POST;
+        else request.requestMethod = HTTP_METHOD_OTHER;
+        request.lineLength = 0;
+        request.state = HttpRequest::REQUEST_PATH;
+      } else if (c != '\r' && c != '\n' && request.lineLength < 7) {
+        request.line[request.lineLength++] = c;
+      }
+      return;
+
+    case HttpRequest::REQUEST_PATH:
+      if (c == '?' || c == ' ') {
+        request.lineLength = 0;
+        routeRequest(request);
+        request.state = c == '?' ? HttpRequest::REQUEST_QUERY : HttpRequest::REQUEST_VERSION;
+      } else if (request.lineLength >= sizeof(request.requestPath) - 1) {
+        reject(request, 414, "Path too long");
+      } else {
+        request.requestPath[request.lineLength++] = c;
+        request.requestPath[request.lineLength] = '\0';
+      }
+      return;
+
+    case HttpRequest::REQUEST_QUERY:
+      // Query fields reach the handler before the headers are read, like any other field
+      if (c == ' ') {
+        request.finishForm();
+        request.state = HttpRequest::REQUEST_VERSION;
+      } else {
+        request.formByte(c);
+      }
+      return;
+
+    case HttpRequest::REQUEST_VERSION:
+      if (c == '\n') request.state = HttpRequest::HEADER_LINE;
+      return;
+
+    case HttpRequest::HEADER_LINE:
+      if (c == '\r') return;
+      if (c == '\n') {
+        if (request.lineLength == 0) {
+          headersDone(request);
+        } else {
+          request.line[request.lineLength] = '\0';
+          headerLine(request);
+          request.lineLength = 0;
+        }
+      } else if (request.lineLength < sizeof(request.line) - 1) {
+        request.line[request.lineLength++] = c;
+      }
+      return;
+
+    case HttpRequest::BODY:
+      request.received++;
+      if (request.bodyType == HttpRequest::BODY_URLENCODED) request.formByte(c);
+      else if (request.bodyType == HttpRequest::BODY_MULTIPART) request.partByte(c);
+      else request.fieldByte(c);
+      if (request.received >= request.contentLength) finishRequest(request);
+      else if (request.hasResponded) endEarly(request);
+      return;
+
+    default:
+      return;
+  }
+}
+
+void HttpFront::routeRequest(HttpRequest &request) {
+  bool pathFound = false;
+  for (uint8_t i = 0; i < routeCount; i++) {
+    if (strcmp(routes[i].path, request.requestPath) != 0) continue;
+    pathFound = true;
+    if (routes[i].methods & request.requestMethod) {
+      request.route = &routes[i];
+      request.begun = true;
+      if (request.route->begin != nullptr) request.route->begin(request);
+      return;
+    }
+  }
+
+  // No handler: answer now, the headers are still read, a body is not
+  if (pathFound) request.send(405, "text/plain", "Method not allowed");
+  else if (dropCount > 0) request.send(500, "text/plain", "Route table full, raise HTTP_MAX_ROUTES");
+  else if (notFound != nullptr) notFound(request);
+  else request.send(404, "text/plain", "Not found");
+}
+
+void HttpFront::headerLine(HttpRequest &request) {
+  const char *value;
+  if ((value = headerValue(request.line, "Content-Length")) != nullptr) {
+    request.contentLength = strtoul(value, nullptr, 10);
+  } else if ((value = headerValue(request.line, "Content-Type")) != nullptr) {
+    copyParameter(request.mediaType, sizeof(request.mediaType), value);
+    if (strncasecmp(value, "application/x-www-form-urlencoded", 33) == 0) {
+      request.bodyType = HttpRequest::BODY_URLENCODED;
+    } else if (strncasecmp(value, "multipart/form-data", 19) == 0) {
+      request.parseBoundary(value);
+    }
+  } else if (headerValue(request.line, "Transfer-Encoding") != nullptr) {
+    request.chunked = true;
+  } else if ((value = headerValue(request.line, "If-None-Match")) != nullptr) {
+    strncpy(request.etag, value, sizeof(request.etag) - 1);
+    request.etag[sizeof(request.etag) - 1] = '\0';
+  } else if ((value = headerValue(request.line, "Idempotency-Key")) != nullptr) {
+    strncpy(request.key, value, sizeof(request.key) - 1);
+    request.key[sizeof(request.key) - 1] = '\0';
+  }
+}
+
+void HttpFront::headersDone(HttpRequest &request) {
+  size_t limit = request.route != nullptr ? request.route->maxBody : HTTP_SMALL_BODY;
+  if (request.chunked) {
+    reject(request, 411, "Send a Content-Length"); // Chunked uploads would need a decoder for no real client
+  } else if (request.contentLength > limit) {
+    reject(request, 413, "Request body too large");
+  } else if (request.contentLength == 0) {
+    finishRequest(request);
+  } else if (request.hasResponded) {
+    endEarly(request);
+  } else {
+    request.state = HttpRequest::BODY;
+    request.received = 0;
+    request.partState = HttpRequest::PART_PREAMBLE;
+    request.delimiterMatched = 2; // The first boundary has no CRLF in front of it
+    if (request.bodyType == HttpRequest::BODY_RAW) request.startField(0);
+  }
+}
+
+void HttpFront::finishRequest(HttpRequest &request) {
+  if (request.bodyType == HttpRequest::BODY_URLENCODED) {
+    request.finishForm();
+  } else if (request.bodyType == HttpRequest::BODY_MULTIPART) {
+    if (request.partState != HttpRequest::PART_EPILOGUE) {
+      reject(request, 400, "Incomplete multipart body");
+      return;
+    }
+  } else if (request.contentLength > 0) {
+    request.endField();
+  }
+
+  request.state = HttpRequest::CLOSING;
+  request.lastActivity = millis();
+  if (request.begun && !request.hasResponded) {
+    request.begun = false;
+    if (request.route->end != nullptr) request.route->end(request);
+  } else {
+    abortRequest(request);
+  }
+  request.send(500, "text/plain", "No response"); // Only if the handler did not answer
+}
+
+void HttpFront::endEarly(HttpRequest &request) {
+  // Answered before the body is in, e.g. a 413 from a field handler: reading
+  // the rest would only keep the slot busy, the client stops at the close
+  abortRequest(request);
+  request.state = HttpRequest::CLOSING;
+  request.lastActivity = millis();
+}
+
+void HttpFront::reject(HttpRequest &request, int status, const char *body) {
+  request.send(status, "text/plain", body);
+  endEarly(request);
+}
+
+void HttpFront::abortRequest(HttpRequest &request) {
+  if (!request.begun) return;
+  request.begun = false;
+  if (request.route->abort != nullptr) request.route->abort(request);
+}
+
+void HttpFront::close(HttpRequest &request) {
+  // Unread input would make the stack answer with a reset instead of delivering the response
+  uint8_t buffer[HTTP_CHUNK_SIZE];
+  while (request.client.available() > 0) {
+    if (request.client.read(buffer, sizeof(buffer)) <= 0) break;
+  }
+  request.client.stop(HTTP_CLOSE_WAIT_MS);
+  request.reset();
+}
@@ -0,0 +1,218 @@
+#ifndef HTTP_FRONT_H
+#define HTTP_FRONT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#define HTTP_MAX_CLIENTS 4            // Connections served at the same time, more get a 503 (lwIP has 5 TCP PCBs)
+#define HTTP_MAX_ROUTES 12            // Route table entries, on() returns false past it
+#define HTTP_PATH_SIZE 32             // Longest path (query string excluded), longer gets a 414
+#define HTTP_LINE_SIZE 128            // Header line buffer, the rest of a longer line is ignored
+#define HTTP_NAME_SIZE 24             // Form field name buffer
+#define HTTP_BOUNDARY_SIZE 76         // "\r\n--" plus the 70 character multipart boundary limit
+#define HTTP_ETAG_SIZE 24             // If-None-Match value buffer
+#define HTTP_KEY_SIZE 40              // Idempotency-Key value buffer (fits a UUID)
+#define HTTP_TYPE_SIZE 32             // Content-Type buffer (media type only, parameters dropped)
+#define HTTP_EXTRA_HEADERS_SIZE 96    // Response headers added by a handler
+#define HTTP_CHUNK_SIZE 128           // Decoded field bytes handed to a handler at once
+#define HTTP_READ_SLICE 256           // Bytes read from one connection before the next gets its turn
+#define HTTP_HEADER_TIMEOUT_MS 5000   // Request line and headers must arrive within this time
+#define HTTP_IDLE_TIMEOUT_MS 10000    // Max silence while a body is still incoming
+#define HTTP_CLOSE_WAIT_MS 5          // Max wait for the client's ACK on close, the stack sends the rest on its own
+#define HTTP_SMALL_BODY 256           // Body limit for routes that do not read a body
+#define HTTP_STREAM_BUFFER 256        // Bytes collected before a streamed response hits the socket
+
+// Request methods, combine with | when registering a route
+#define HTTP_METHOD_GET 0x01
+#define HTTP_METHOD_POST 0x02
+#define HTTP_METHOD_OTHER 0x80
+
+// Flags passed to a field handler
+#define HTTP_FIELD_START 0x01         // new field, no data yet
+#define HTTP_FIELD_END 0x02           // last piece of the field (may carry data)
+#define HTTP_FIELD_FILE 0x04          // multipart part with a filename
+
+class HttpRequest;
+
+// A field handler gets form fields from the query string and from urlencoded or
+// multipart bodies as they arrive, decoded, in pieces of up to HTTP_CHUNK_SIZE.
+// Any other body arrives as a single field with an empty name.
+typedef void (*HttpFieldHandler)(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags);
+typedef void (*HttpRequestHandler)(HttpRequest &request);
+typedef bool (*HttpReadyHandler)(HttpRequest &request);
+
+// Handlers of one path. For every request that reaches a route, begin runs once
+// the path is known, then fields arrive, then exactly one of end (whole request
+// read and no response sent yet) or abort (anything else: early response,
+// timeout, oversize body, client gone) runs. While ready returns false the
+// body is left in the socket, TCP flow control then holds the client back.
+struct HttpRoute {
+  const char *path;
+  uint8_t methods;
+  size_t maxBody;                                   // Larger Content-Length gets a 413 before any body byte is read
+  HttpRequestHandler begin;
+  HttpFieldHandler field;
+  HttpRequestHandler end;
+  HttpRequestHandler abort;
+  HttpReadyHandler ready;                           // optional, body bytes are only read while it returns true
+};
+
+// One connection slot. Handlers receive it to look at the request and to answer.
+// A response can be sent at any point. Once the headers are in, an early
+// response ends the request: the rest of the body is not read, only what has
+// already arrived is dropped, and the connection closes after the response.
+class HttpRequest {
+  public:
+    HttpRequest();
+
+    uint8_t slot() const { return index; }              // stable while the request lives, for per-connection handler state
+    uint8_t method() const { return requestMethod; }
+    const char *path() const { return requestPath; }
+    const char *ifNoneMatch() const { return etag; }     // empty without the header
+    const char *idempotencyKey() const { return key; }   // Idempotency-Key, empty without the header
+    uint32_t remoteAddress() const { return remote; }    // client IPv4 address
+    const char *contentType() const { return mediaType; } // "text/plain", empty without the header
+    bool responded() const { return hasResponded; }
+    uint32_t acceptedMicros() const { return acceptedUs; } // micros() when the connection was accepted
+
+    void addHeader(const char *name, const char *value); // for the next send()
+    void send(int status, const char *contentType, const char *body);
+    void send_P(int status, const char *contentType, PGM_P body, size_t length); // body streamed from flash as the socket drains
+
+  private:
+    friend class HttpFront;
+    friend class HttpStream;
+
+    enum State : uint8_t {
+      FREE, REQUEST_METHOD, REQUEST_PATH, REQUEST_QUERY, REQUEST_VERSION,
+      HEADER_LINE, BODY, CLOSING
+    };
+    enum BodyType : uint8_t { BODY_RAW, BODY_URLENCODED, BODY_MULTIPART };
+    enum FormState : uint8_t { FORM_NAME, FORM_VALUE };
+    enum PartState : uint8_t { PART_PREAMBLE, PART_HEADERS, PART_DATA, PART_DELIMITER_TAIL, PART_EPILOGUE };
+
+    WiFiClient client;
+    uint8_t index;
+    State state;
+    const HttpRoute *route;
+    bool begun;
+
+    uint8_t requestMethod;
+    char requestPath[HTTP_PATH_SIZE];
+    char etag[HTTP_ETAG_SIZE];
+    char key[HTTP_KEY_SIZE];
+    uint32_t remote;
+    char mediaType[HTTP_TYPE_SIZE];
+    char line[HTTP_LINE_SIZE];
+    size_t lineLength;
+    bool chunked;
+    size_t contentLength;
+    size_t received;
+    uint32_t acceptedAt;
+    uint32_t acceptedUs;
+    uint32_t lastActivity;
+
+    // Form decoding, shared by the query string, urlencoded and multipart bodies
+    BodyType bodyType;
+    FormState formState;
+    uint8_t percentDigits;                               // hex digits still expected after '%'
+    uint8_t percentValue;
+    char fieldName[HTTP_NAME_SIZE];
+    size_t fieldNameLength;
+    uint8_t fieldFlags;
+    uint8_t chunk[HTTP_CHUNK_SIZE];
+    size_t chunkLength;
+
+    // Multipart decoding
+    PartState partState;
+    char delimiter[HTTP_BOUNDARY_SIZE];                  // "\r\n--boundary"
+    size_t delimiterLength;
+    size_t delimiterMatched;
+    uint8_t tailLength;
+
+    // Response
+    bool hasResponded;
+    char extraHeaders[HTTP_EXTRA_HEADERS_SIZE];
+    size_t extraHeadersLength;
+    PGM_P sendBody;
+    size_t sendRemaining;
+
+    void reset();
+    void writeHead(int status, const char *contentType, size_t length, bool knownLength = true);
+    void pump();
+
+    void dispatch(const uint8_t *data, size_t length, uint8_t flags);
+    void startField(uint8_t flags);
+    void fieldByte(uint8_t c);
+    void endField();
+    void formByte(uint8_t c);
+    void finishForm();
+    void partByte(uint8_t c);
+    void partHeader();
+    void parseBoundary(const char *contentType);
+};
+
+// Response body of unknown length, written with print() from inside a handler.
+// Output is gathered in HTTP_STREAM_BUFFER bytes before each socket write and
+// the body ends when the connection closes, so no Content-Length is sent.
+// Writes wait for the socket, keep streamed responses small.
+class HttpStream : public Print {
+  public:
+    HttpStream(HttpRequest &request, int status, const char *contentType);
+    ~HttpStream();                                      // flushes the rest
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *data, size_t length) override;
+    void flush() override;
+
+  private:
+    HttpRequest &request;
+    bool open;                                          // false if the request had been answered already
+    uint8_t buffer[HTTP_STREAM_BUFFER];
+    size_t length;
+};
+
+// Event-driven HTTP/1.1 server over WiFiServer. Up to HTTP_MAX_CLIENTS
+// connections are read round-robin, a few hundred bytes at a time, so a slow
+// client only holds its own slot. Request bodies are never buffered: fields are
+// decoded on the fly and handed to the route's field handler. Every response
+// closes the connection (no keep-alive).
+class HttpFront {
+  public:
+    HttpFront(uint16_t port);
+
+    void begin();
+    bool on(const char *path, uint8_t methods, HttpRequestHandler end);   // route without a body
+    bool on(const HttpRoute &route);                    // false when the route table is full
+    void onNotFound(HttpRequestHandler handler);
+    uint8_t droppedRoutes() const { return dropCount; } // on() calls refused, unknown paths then get a 500
+    bool handle(uint32_t budgetMs);                     // accept and serve connections, true while input is waiting
+
+    uint8_t active() const;                             // connections currently open
+    uint32_t rejected() const { return rejectCount; }   // connections turned away with 503
+    uint32_t timeouts() const { return timeoutCount; }
+
+  private:
+    WiFiServer server;
+    HttpRequest requests[HTTP_MAX_CLIENTS];
+    HttpRoute routes[HTTP_MAX_ROUTES];
+    uint8_t routeCount;
+    uint8_t dropCount;
+    HttpRequestHandler notFound;
+    uint32_t rejectCount;
+    uint32_t timeoutCount;
+
+    void accept();
+    bool service(HttpRequest &request);
+    void feed(HttpRequest &request, uint8_t c);
+    void routeRequest(HttpRequest &request);
+    void headerLine(HttpRequest &request);
+    void headersDone(HttpRequest &request);
+    void finishRequest(HttpRequest &request);
+    void endEarly(HttpRequest &request);
+    void reject(HttpRequest &request, int status, const char *body);
+    void abortRequest(HttpRequest &request);
+    void close(HttpRequest &request);
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "ImageRaster.h"
+
+static const uint8_t bayer4[4][4] = {
+  { 0,  8,  2, 10},
+  {12,  4, 14,  6},
+  { 3, 11,  1,  9},
+  {15,  7, 13,  5}
+};
+
+
+RasterStream::RasterStream() {
+  begin(DITHER_FLOYD_STEINBERG, nullptr, nullptr);
+}
+
+void RasterStream::begin(DitherMode mode, BandSink sink, void *context) {
+  this->mode = mode;
+  this->sink = sink;
+  this->context = context;
+  state = MAGIC_P;
+  errorText = nullptr;
+  fieldCount = 0;
+  inNumber = false;
+  inComment = false;
+  outWidth = 0;
+  outRowsDone = 0;
+  bandRows = 0;
+}
+
+size_t RasterStream::write(const uint8_t *data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    uint8_t c = data[i];
+    switch (state) {
+      case MAGIC_P:
+        if (c == 'P') state = MAGIC_TYPE;
+        else fail("Not a PGM/PBM file");
+        break;
+      case MAGIC_TYPE:
+        if (c == '4' || c == '5') {
+          type = c;
+          state = HEADER;
+        } else {
+          fail("Only binary PGM (P5) and PBM (P4) are supported");
+        }
+        break;
+      case HEADER:
+        headerByte(c);
+        break;
+      case PIXELS:
+        if (type == '5') {
+          pixel(fields[2] == 255 ? c : (uint32_t)c * 255 / fields[2]);     // PGM: 0 = black, maxval = white
+        } else {
+          // PBM: 1 = black, 8 pixels per byte, rows padded to a full byte
+          for (bitPos = 0; bitPos < 8 && state == PIXELS; bitPos++) {
+            pixel((c & (0x80 >> bitPos)) ? 0 : 255);
+            if (srcX == 0) break;                                           // row ended, padding bits follow
+          }
+        }
+        break;
+      case DONE:
+        break;                                                              // trailing bytes are ignored
+      case FAILED:
+        return i;
+    }
+  }
+  return state == FAILED ? 0 : len;
+}
+
+bool RasterStream::end() {
+  if (state == FAILED) return false;
+  if (state != DONE) {
+    fail("Image data ended early");
+    return false;
+  }
+  return true;
+}
+
+void RasterStream::fail(const char *text) {
+  state = FAILED;
+  errorText = text;
+}
+
+// === Header ===
+void RasterStream::headerByte(uint8_t c) {
+  if (inComment) {
+    if (c == '\n' || c == '\r') inComment = false;
+    return;
+  }
+
+  bool whitespace = c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  uint8_t needed = type == '5' ? 3 : 2;                                     // PBM has no maxval
+
+  if (c >= '0' && c <= '9') {
+    if (!inNumber) fields[fieldCount] = 0;
+    inNumber = true;
+    fields[fieldCount] = fields[fieldCount] * 10 + (c - '0');
+    if (fields[fieldCount] > 65535) fail("Image header value out of range");
+  } else if (whitespace || c == '#') {
+    if (inNumber) {
+      inNumber = false;
+      fieldCount++;
+      if (fieldCount == needed) {                                           // exactly one whitespace byte before the pixels
+        startImage();
+        return;
+      }
+    }
+    if (c == '#') inComment = true;
+  } else {
+    fail("Broken image header");
+  }
+}
+
+void RasterStream::startImage() {
+  srcWidth = fields[0];
+  srcHeight = fields[1];
+  if (type == '4') fields[2] = 1;
+
+  if (srcWidth == 0 || srcHeight == 0) return fail("Image has no pixels");
+  if (type == '5' && (fields[2] == 0 || fields[2] > 255)) return fail("Only 8-bit PGM is supported");
+
+  outWidth = srcWidth > RASTER_MAX_WIDTH ? RASTER_MAX_WIDTH : srcWidth;
+  outHeight = (uint32_t)srcHeight * outWidth / srcWidth;
+  if (outHeight == 0) outHeight = 1;
+
+  srcX = 0;
+  srcY = 0;
+  outX = 0;
+  nextSrcX = 0;
+  nextSrcY = 0;
+  rowWanted = true;
+  memset(errorCurrent, 0, sizeof(errorCurrent));
+  memset(errorNext, 0, sizeof(errorNext));
+  memset(band, 0, sizeof(band));
+  state = PIXELS;
+}
+
+// === Pixels ===
+void RasterStream::pixel(uint8_t gray) {
+  // Nearest neighbour: keep the input pixel that lands on the next output column
+  if (rowWanted && srcX == nextSrcX && outX < outWidth) {
+    row[outX++] = gray;
+    nextSrcX = (uint32_t)outX * srcWidth / outWidth;
+  }
+
+  if (++srcX < srcWidth) return;
+
+  // End of an input row
+  if (rowWanted) finishRow();
+  srcX = 0;
+  outX = 0;
+  nextSrcX = 0;
+  srcY++;
+  rowWanted = srcY == nextSrcY;
+
+  if (srcY == srcHeight) {
+    flushBand();
+    state = DONE;
+  }
+}
+
+void RasterStream::finishRow() {
+  uint16_t widthBytes = (outWidth + 7) / 8;
+  uint8_t *bits = band + bandRows * widthBytes;
+  uint8_t y = outRowsDone & 3;
+
+  for (uint16_t x = 0; x < outWidth; x++) {
+    bool black;
+    if (mode == DITHER_FLOYD_STEINBERG) {
+      int16_t value = row[x] + errorCurrent[x + 1] / 16;                   // errors are kept in 1/16 steps
+      black = value < 128;
+      int16_t error = value - (black ? 0 : 255);
+      errorCurrent[x + 2] += error * 7;
+      errorNext[x] += error * 3;
+      errorNext[x + 1] += error * 5;
+      errorNext[x + 2] += error;
+    } else if (mode == DITHER_ORDERED) {
+      black = row[x] < bayer4[y][x & 3] * 16 + 8;
+    } else {
+      black = row[x] < 128;
+    }
+    if (black) bits[x >> 3] |= 0x80 >> (x & 7);
+  }
+
+  if (mode == DITHER_FLOYD_STEINBERG) {
+    memcpy(errorCurrent, errorNext, sizeof(errorCurrent));
+    memset(errorNext, 0, sizeof(errorNext));
+  }
+
+  outRowsDone++;
+  nextSrcY = outRowsDone * srcHeight / outHeight;
+  if (++bandRows == RASTER_BAND_ROWS) flushBand();
+}
+
+void RasterStream::flushBand() {
+  if (bandRows == 0) return;
+  if (sink) sink(band, outWidth, bandRows, context);
+  memset(band, 0, sizeof(band));
+  bandRows = 0;
+}
@@ -0,0 +1,76 @@
+#ifndef IMAGE_RASTER_H
+#define IMAGE_RASTER_H
+
+#include <Arduino.h>
+
+#define RASTER_MAX_WIDTH 384          // Printable dots per line on the EM5820
+#define RASTER_BAND_ROWS 24           // Rows per GS v 0 chunk sent to the printer
+#define RASTER_BAND_BYTES (RASTER_MAX_WIDTH / 8 * RASTER_BAND_ROWS)
+
+enum DitherMode {
+  DITHER_THRESHOLD,                                 // plain 50% cut
+  DITHER_ORDERED,                                   // 4x4 Bayer matrix, no state between rows
+  DITHER_FLOYD_STEINBERG                            // error diffusion over the current and next row
+};
+
+// Called for every finished band: rows * ((width + 7) / 8) bytes, 1 = black, MSB first
+typedef void (*BandSink)(const uint8_t *band, uint16_t width, uint16_t rows, void *context);
+
+// Turns a binary PGM (P5) or PBM (P4) byte stream into packed 1-bpp bands
+// without ever holding the whole image. Images wider than RASTER_MAX_WIDTH are
+// scaled down (nearest neighbour, aspect ratio kept). Memory use is one output
+// row, two error rows and one band, whatever the image size.
+class RasterStream {
+  public:
+    RasterStream();
+
+    void begin(DitherMode mode, BandSink sink, void *context);
+    size_t write(const uint8_t *data, size_t len);      // feed the next chunk, returns bytes used (less on error)
+    bool end();                                         // send the last partial band, false if the image was invalid or cut short
+
+    const char *error() const { return errorText; }     // nullptr while everything is fine
+    uint16_t width() const { return outWidth; }         // printed width in dots, known once the header is parsed
+    uint32_t rows() const { return outRowsDone; }       // rows produced so far
+
+  private:
+    enum State { MAGIC_P, MAGIC_TYPE, HEADER, PIXELS, DONE, FAILED };
+
+    State state;
+    DitherMode mode;
+    BandSink sink;
+    void *context;
+    const char *errorText;
+
+    // Header
+    char type;                                      // '4' (PBM) or '5' (PGM)
+    uint32_t fields[3];                             // width, height, maxval
+    uint8_t fieldCount;
+    bool inNumber;
+    bool inComment;
+
+    // Scaling
+    uint16_t srcWidth, srcHeight, outWidth, outHeight;
+    uint16_t srcX, srcY;                            // position of the next input pixel
+    uint8_t bitPos;                                 // PBM: next bit inside the current byte
+    uint16_t outX;                                  // next output column to fill in this row
+    uint32_t nextSrcX;                              // input column that feeds outX
+    uint32_t nextSrcY;                              // input row that feeds the next output row
+    bool rowWanted;
+    uint32_t outRowsDone;
+
+    // Buffers
+    uint8_t row[RASTER_MAX_WIDTH];
+    int16_t errorCurrent[RASTER_MAX_WIDTH + 2];
+    int16_t errorNext[RASTER_MAX_WIDTH + 2];
+    uint8_t band[RASTER_BAND_BYTES];
+    uint16_t bandRows;
+
+    void fail(const char *text);
+    void headerByte(uint8_t c);
+    void startImage();
+    void pixel(uint8_t gray);
+    void finishRow();
+    void flushBand();
+};
+
+#endif
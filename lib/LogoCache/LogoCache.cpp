@@ -0,0 +1,217 @@
+#include "LogoCache.h"
+
+#define LOGO_INDEX_PATH "/logos.idx"
+#define LOGO_PATH_NEW "/logo-new.bin"               // upload still arriving
+#define LOGO_INDEX_MAGIC 0x4F474F4CUL               // "LOGO"
+#define LOGO_NV_OVERHEAD 11                         // GS ( L fn 67 parameters stored with every image
+
+static uint32_t fnv1a(uint32_t hash, const void *data, size_t length) {
+  const uint8_t *p = (const uint8_t*)data;
+  while (length--) {
+    hash ^= *p++;
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+LogoCache::LogoCache(ThermalPrinter &printer)
+  : printer(printer), knownCapacity(0), nvBytes(0), mounted(false), storeId(-1), failure(nullptr), upload(-1), uploadLeft(0) {
+  memset(entries, 0, sizeof(entries));
+}
+
+void LogoCache::begin() {
+  mounted = true;
+  File index = LittleFS.open(LOGO_INDEX_PATH, "r");
+  if (!index) return;
+  uint32_t header[2];
+  Entry loaded[LOGO_SLOTS];
+  if (index.read((uint8_t*)header, sizeof(header)) == sizeof(header) && header[0] == LOGO_INDEX_MAGIC &&
+      index.read((uint8_t*)loaded, sizeof(loaded)) == sizeof(loaded)) {
+    knownCapacity = header[1];
+    memcpy(entries, loaded, sizeof(entries));
+  }
+  index.close();
+}
+
+void LogoCache::setCapacity(uint32_t bytes) {
+  nvBytes = bytes;
+  if (bytes == 0 || bytes == knownCapacity) return;                        // silent printer: keep what is known for when it answers again
+
+  // Another printer, or the first answer: it holds none of our images
+  for (uint8_t id = 0; id < LOGO_SLOTS; id++) entries[id].printerHash = 0;
+  knownCapacity = bytes;
+  saveIndex();
+}
+
+// === Storing ===
+
+bool LogoCache::beginStore(uint8_t id) {
+  discardStore();
+  failure = nullptr;
+  if (id >= LOGO_SLOTS) {
+    failure = "Unknown logo id";
+    return false;
+  }
+  if (upload == id) {
+    failure = "Logo is being sent to the printer";
+    return false;
+  }
+  storing = mounted ? LittleFS.open(LOGO_PATH_NEW, "w") : File();
+  if (!storing) {
+    failure = "No filesystem for logos";
+    return false;
+  }
+  storeId = id;
+  memset(&incoming, 0, sizeof(incoming));
+  incoming.hash = 2166136261UL;
+  return true;
+}
+
+void LogoCache::storeBand(const uint8_t *band, uint16_t width, uint16_t rows) {
+  if (storeId < 0 || failure != nullptr) return;
+  if (incoming.height + rows > LOGO_MAX_HEIGHT) {
+    failure = "Logo is taller than 160 dots";
+    return;
+  }
+  size_t length = (size_t)((width + 7) / 8) * rows;
+  if (storing.write(band, length) != length) {
+    failure = "Flash is full";
+    return;
+  }
+  incoming.width = width;
+  incoming.height += rows;
+  incoming.hash = fnv1a(incoming.hash, band, length);
+}
+
+bool LogoCache::finishStore() {
+  if (storeId < 0) return false;
+  if (failure == nullptr && incoming.height == 0) failure = "Send the logo as a multipart file upload";
+  storing.close();
+
+  char target[16];
+  path(target, sizeof(target), storeId);
+  if (failure == nullptr) {
+    LittleFS.remove(target);
+    if (!LittleFS.rename(LOGO_PATH_NEW, target)) failure = "Flash is full";
+  }
+  if (failure != nullptr) {
+    LittleFS.remove(LOGO_PATH_NEW);
+    storeId = -1;
+    return false;
+  }
+
+  // The size goes into the hash too, the same bytes at another width are another image
+  incoming.hash = fnv1a(incoming.hash, &incoming.width, sizeof(incoming.width));
+  if (incoming.hash == 0) incoming.hash = 1;                                // 0 means "nothing" in printerHash
+  incoming.printerHash = 0;                                                 // storing again sends it again, e.g. after a printer reset
+  entries[storeId] = incoming;
+  storeId = -1;
+  saveIndex();
+  return true;
+}
+
+void LogoCache::discardStore() {
+  if (storeId < 0) return;
+  storing.close();
+  LittleFS.remove(LOGO_PATH_NEW);
+  storeId = -1;
+}
+
+// === Printing ===
+
+bool LogoCache::stored(uint8_t id) const {
+  return exists(id) && nvBytes > 0 && upload != id && entries[id].printerHash == entries[id].hash;
+}
+
+bool LogoCache::print(uint8_t id) {
+  if (!exists(id)) return false;
+  if (stored(id)) {
+    printer.printNvGraphics(LOGO_KEY_CODE, '0' + id);
+    return true;
+  }
+
+  // Streaming, the raster path every image took before
+  char source[16];
+  path(source, sizeof(source), id);
+  File file = LittleFS.open(source, "r");
+  if (!file) return false;
+  const Entry &entry = entries[id];
+  uint16_t widthBytes = (entry.width + 7) / 8;
+  for (uint16_t y = 0; y < entry.height; y += LOGO_BAND_ROWS) {
+    uint16_t rows = entry.height - y < LOGO_BAND_ROWS ? entry.height - y : LOGO_BAND_ROWS;
+    size_t length = (size_t)widthBytes * rows;
+    if (file.read(band, length) != length) break;
+    printer.printBitmap(entry.width, rows, band);
+  }
+  file.close();
+  return true;
+}
+
+// === NV Upload ===
+
+int8_t LogoCache::due() const {
+  if (nvBytes == 0) return -1;
+  for (uint8_t id = 0; id < LOGO_SLOTS; id++) {
+    if (exists(id) && entries[id].printerHash != entries[id].hash && fits(id)) return id;
+  }
+  return -1;
+}
+
+bool LogoCache::fits(uint8_t id) const {
+  // Lower ids get the memory first, the rest is streamed
+  uint32_t used = 0;
+  for (uint8_t i = 0; i <= id; i++) {
+    if (exists(i)) used += rasterBytes(entries[i]) + LOGO_NV_OVERHEAD;
+  }
+  return used <= nvBytes;
+}
+
+bool LogoCache::step() {
+  if (upload < 0) {
+    int8_t next = due();
+    if (next < 0) return true;
+
+    char source[16];
+    path(source, sizeof(source), next);
+    uploadFile = LittleFS.open(source, "r");
+    const Entry &entry = entries[next];
+    if (!uploadFile || uploadFile.size() != rasterBytes(entry)) {
+      if (uploadFile) uploadFile.close();
+      memset(&entries[next], 0, sizeof(Entry));                             // file lost, forget the logo
+      saveIndex();
+      return false;
+    }
+    printer.defineNvGraphics(LOGO_KEY_CODE, '0' + next, entry.width, entry.height);
+    upload = next;
+    uploadLeft = rasterBytes(entry);
+    return false;
+  }
+
+  size_t n = uploadLeft < LOGO_UPLOAD_CHUNK ? uploadLeft : LOGO_UPLOAD_CHUNK;
+  size_t got = uploadFile.read(band, n);
+  if (got < n) memset(band + got, 0, n - got);                              // the printer counts on every byte announced
+  printer.write(band, n);
+  uploadLeft -= n;
+  if (uploadLeft > 0) return false;
+
+  uploadFile.close();
+  entries[upload].printerHash = entries[upload].hash;
+  upload = -1;
+  saveIndex();
+  return due() < 0;
+}
+
+// === Index ===
+
+void LogoCache::saveIndex() {
+  File index = LittleFS.open(LOGO_INDEX_PATH, "w");
+  if (!index) return;                                                       // next boot sends the logos again
+  uint32_t header[2] = {LOGO_INDEX_MAGIC, knownCapacity};
+  index.write((const uint8_t*)header, sizeof(header));
+  index.write((const uint8_t*)entries, sizeof(entries));
+  index.close();
+}
+
+void LogoCache::path(char *out, size_t size, uint8_t id) {
+  snprintf(out, size, "/logo-%u.bin", (unsigned)id);
+}
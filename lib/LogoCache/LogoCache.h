@@ -0,0 +1,82 @@
+#ifndef LOGO_CACHE_H
+#define LOGO_CACHE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ThermalPrinter.h>
+
+#define LOGO_SLOTS 4                  // Logos kept, referenced by id 0 to LOGO_SLOTS - 1 (one digit in templates, 10 at most)
+#define LOGO_MAX_WIDTH 384            // Printable dots per line on the EM5820
+#define LOGO_MAX_HEIGHT 160           // 384x160 is 7680 bytes, 8 s at 9600 baud every time it is streamed
+#define LOGO_BAND_ROWS 8              // Rows read from flash per printBitmap() when streaming
+#define LOGO_UPLOAD_CHUNK 256         // Raster bytes sent into the printer's NV memory per step()
+#define LOGO_KEY_CODE 'S'             // NV graphics key codes are "S0", "S1", ...
+
+// Logos and banners printed by reference from the printer's NV graphics memory.
+//
+// An uploaded logo is stored as raw 1-bit rows in "/logo-<id>.bin" and an
+// index file keeps its FNV-1a content hash next to the hash of the image the
+// printer holds under the logo's key code. When the two differ and the printer
+// reported NV graphics memory at boot, step() sends the rows into it with
+// GS ( L fn 67, a chunk per call; from then on print() sends 11 bytes instead
+// of the raster. Without NV graphics, for logos past the printer's capacity
+// and until an upload is complete, print() streams the rows from flash through
+// printBitmap() as before.
+//
+// Defining NV graphics writes the printer's flash, so an image is only sent
+// again when its hash changed or it was stored again. The printer's answer to
+// the capacity request is kept in the index as well: a different answer means
+// a different printer and everything is sent again.
+class LogoCache {
+  public:
+    LogoCache(ThermalPrinter &printer);
+
+    void begin();                                       // load the index, the filesystem must be mounted
+    void setCapacity(uint32_t bytes);                   // from ThermalPrinter::nvCapacity(), 0 = stream every logo
+    uint32_t capacity() const { return nvBytes; }
+
+    bool beginStore(uint8_t id);                        // false for an unknown id or without a filesystem
+    void storeBand(const uint8_t *band, uint16_t width, uint16_t rows); // RasterStream bands, in print order
+    bool finishStore();                                 // false with error(), the old logo then stays
+    void discardStore();
+    const char *error() const { return failure; }
+
+    bool exists(uint8_t id) const { return id < LOGO_SLOTS && entries[id].width > 0; }
+    bool stored(uint8_t id) const;                      // held by the printer, print() sends the key code
+    bool print(uint8_t id);                             // false when there is no such logo
+    bool uploading() const { return upload >= 0 || due() >= 0; } // NV bytes to send, nothing else may reach the printer in between
+    bool step();                                        // send the next chunk, true when nothing is left to upload
+
+  private:
+    struct Entry {
+      uint16_t width;                                   // dots, 0 = no logo
+      uint16_t height;
+      uint32_t hash;                                    // of the rows in flash
+      uint32_t printerHash;                             // of the rows the printer holds under the key code, 0 = none
+    };
+
+    ThermalPrinter &printer;
+    Entry entries[LOGO_SLOTS];
+    uint32_t knownCapacity;                             // capacity of the printer the hashes are for
+    uint32_t nvBytes;                                   // answer of this boot's printer
+    bool mounted;
+
+    File storing;
+    int8_t storeId;                                     // -1 when not storing
+    Entry incoming;
+    const char *failure;
+
+    File uploadFile;
+    int8_t upload;                                      // logo being sent to the printer, -1 for none
+    uint32_t uploadLeft;
+
+    uint8_t band[LOGO_BAND_ROWS * LOGO_MAX_WIDTH / 8];  // streaming buffer, also the upload chunk
+
+    int8_t due() const;                                 // next logo the printer should hold, -1 for none
+    bool fits(uint8_t id) const;
+    void saveIndex();
+    static uint32_t rasterBytes(const Entry &entry) { return (uint32_t)((entry.width + 7) / 8) * entry.height; }
+    static void path(char *out, size_t size, uint8_t id);
+};
+
+#endif
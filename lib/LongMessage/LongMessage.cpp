@@ -0,0 +1,210 @@
+#include "LongMessage.h"
+#include <Transcoder.h>
+
+#define LONG_PATH_NEW "/msg-new.txt"                // message still arriving
+
+
+static void longPath(char *out, size_t size, uint32_t id, const char *extension) {
+  snprintf(out, size, "/msg-%lu.%s", (unsigned long)id, extension);
+}
+
+// === Writer ===
+
+LongMessageWriter::LongMessageWriter() : open(false), codePage(0), used(0), written(0), maxBytes(0) {
+}
+
+bool LongMessageWriter::begin(uint8_t codePage) {
+  discard();
+  // A message may not take the flash the journal and its own page index still need
+  FSInfo info;
+  if (!LittleFS.info(info) || info.usedBytes + LONG_FLASH_RESERVE >= info.totalBytes) return false;
+  size_t room = info.totalBytes - info.usedBytes - LONG_FLASH_RESERVE;
+  maxBytes = room < LONG_MESSAGE_MAX ? room : LONG_MESSAGE_MAX;
+
+  file = LittleFS.open(LONG_PATH_NEW, "w");
+  open = (bool)file;
+  this->codePage = codePage;
+  used = 0;
+  written = 0;
+  return open;
+}
+
+bool LongMessageWriter::write(const uint8_t *data, size_t length) {
+  if (!open) return false;
+  while (length > 0) {
+    size_t n = sizeof(buffer) - used;
+    if (n > length) n = length;
+    memcpy(buffer + used, data, n);
+    used += n;
+    data += n;
+    length -= n;
+    if (used == sizeof(buffer) && !flush(false)) return false;
+  }
+  return true;
+}
+
+bool LongMessageWriter::finish(uint32_t id) {
+  if (!open) return false;
+  bool ok = flush(true);
+  file.close();
+  open = false;
+
+  char path[24];
+  longPath(path, sizeof(path), id, "txt");
+  LongMessageReader::remove(id);                                            // left over from a journal that started over
+  if (ok && LittleFS.rename(LONG_PATH_NEW, path)) return true;
+  LittleFS.remove(LONG_PATH_NEW);
+  return false;
+}
+
+void LongMessageWriter::discard() {
+  if (!open) return;
+  file.close();
+  open = false;
+  LittleFS.remove(LONG_PATH_NEW);
+}
+
+bool LongMessageWriter::flush(bool last) {
+  // Hold back a UTF-8 sequence that is cut off at the end, unless nothing more comes
+  size_t complete = used;
+  for (size_t back = 1; !last && back <= 3 && back <= used; back++) {
+    uint8_t c = buffer[used - back];
+    if ((c & 0xC0) == 0x80) continue;                                       // continuation byte
+    size_t need = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+    if (need > back) complete = used - back;
+    break;
+  }
+
+  size_t length = Transcoder::transcode(buffer, complete, codePage);
+  bool ok = written + length <= maxBytes && file.write((const uint8_t*)buffer, length) == length;
+  written += length;
+
+  used -= complete;
+  memmove(buffer, buffer + complete, used);
+  return ok;
+}
+
+// === Reader ===
+
+LongMessageReader::LongMessageReader() : id(0), width(0), size(0), indexed(0), pages(0), indexing(false) {
+}
+
+bool LongMessageReader::open(uint32_t id, uint8_t width) {
+  close();
+  char path[24];
+  longPath(path, sizeof(path), id, "txt");
+  text = LittleFS.open(path, "r");
+  longPath(path, sizeof(path), id, "idx");
+  index = LittleFS.open(path, "w");
+  if (!text || !index) {
+    close();
+    return false;
+  }
+
+  this->id = id;
+  this->width = width;
+  size = text.size();
+  indexed = 0;
+  pages = 0;
+  indexing = size > 0;
+  return true;
+}
+
+void LongMessageReader::close() {
+  if (text) text.close();
+  if (index) index.close();
+  indexing = false;
+  pages = 0;
+}
+
+void LongMessageReader::remove(uint32_t id) {
+  char path[24];
+  longPath(path, sizeof(path), id, "txt");
+  LittleFS.remove(path);
+  longPath(path, sizeof(path), id, "idx");
+  LittleFS.remove(path);
+}
+
+void LongMessageReader::indexPages() {
+  for (uint8_t n = 0; n < LONG_INDEX_PAGES && indexing; n++) {
+    uint32_t start = indexed;
+    text.seek(indexed, SeekSet);
+    size_t length = text.read((uint8_t*)page, sizeof(page));
+    if (length == 0) {
+      size = indexed;                                                       // file shorter than it claimed
+    } else if (indexed + length < size) {
+      // A line is only certain when the next one starts with room for a whole line
+      // behind it, the page ends at the last such start
+      WordWrap wrap(page, length, width);
+      WrapLine line;
+      size_t cut = 0;
+      while (wrap.next(line) && wrap.position() + width + 2 <= length) cut = wrap.position();
+      if (cut == 0) {
+        // One line, then blanks up to the page end that may run on in the file.
+        // The page ends where they do, it is cut to the buffer when printed.
+        wrap.rewind();
+        wrap.next(line);
+        cut = wrap.position();
+        char last = page[length - 1];
+        indexed = cut == length ? skipBlanks(indexed + cut, last) : indexed + cut;
+      } else {
+        indexed += cut;
+      }
+    } else {
+      indexed = size;
+    }
+
+    if (indexed > start) {
+      index.write((const uint8_t*)&indexed, sizeof(indexed));
+      pages++;
+    }
+    if (indexed >= size) {
+      // Reopen for reading back to front
+      char path[24];
+      longPath(path, sizeof(path), id, "idx");
+      index.close();
+      index = LittleFS.open(path, "r");
+      indexing = false;
+    }
+  }
+}
+
+uint32_t LongMessageReader::skipBlanks(uint32_t offset, char last) {
+  // Continues WordWrap's skip after a break: spaces, then one CR, then one LF
+  uint8_t phase = last == ' ' ? 0 : last == '\r' ? 2 : 3;
+  while (phase < 3) {
+    text.seek(offset, SeekSet);
+    size_t length = text.read((uint8_t*)page, sizeof(page));
+    if (length == 0) break;
+    size_t i = 0;
+    while (i < length && phase < 3) {
+      char c = page[i];
+      if (phase == 0) {
+        if (c == ' ') i++;
+        else phase = 1;
+      } else {
+        if (c == (phase == 1 ? '\r' : '\n')) i++;
+        phase++;
+      }
+    }
+    offset += i;
+  }
+  return offset;
+}
+
+size_t LongMessageReader::loadPage(uint32_t number) {
+  // The index holds page ends, a page starts where the one before it ends
+  uint32_t bounds[2] = {0, 0};
+  if (number > 0) {
+    index.seek((number - 1) * sizeof(uint32_t), SeekSet);
+    index.read((uint8_t*)bounds, sizeof(bounds));
+  } else {
+    index.seek(0, SeekSet);
+    index.read((uint8_t*)&bounds[1], sizeof(uint32_t));
+  }
+
+  size_t length = bounds[1] - bounds[0];
+  if (length > sizeof(page)) length = sizeof(page);
+  text.seek(bounds[0], SeekSet);
+  return text.read((uint8_t*)page, length);
+}
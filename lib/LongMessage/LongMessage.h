@@ -0,0 +1,94 @@
+#ifndef LONG_MESSAGE_H
+#define LONG_MESSAGE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <WordWrap.h>
+
+#ifndef LONG_MESSAGE_MAX
+#define LONG_MESSAGE_MAX 16384        // Longest message kept in flash, in printer bytes (the filesystem is 64 KB)
+#endif
+#define LONG_FLASH_RESERVE 8192       // Flash a message leaves free: a block for its page index, one for the journal
+#define LONG_PAGE_BYTES 1024          // Text wrapped at once when printing, the RAM a long message needs
+#define LONG_INDEX_PAGES 16           // Pages indexed per step before the first line prints
+#define LONG_WRITE_BUFFER 160         // Transcoded per flash write, plus a UTF-8 sequence cut at a chunk end
+
+// Message text too long for a Receipt, streamed to a LittleFS file as it
+// arrives. Text is converted to the printer code page on the way in, a UTF-8
+// sequence split across two writes is held back until its rest arrives.
+class LongMessageWriter {
+  public:
+    LongMessageWriter();
+
+    bool begin(uint8_t codePage);                       // false without a filesystem or without room for a message
+    bool write(const uint8_t *data, size_t length);     // false when the message is over limit()
+    uint32_t limit() const { return maxBytes; }         // LONG_MESSAGE_MAX, less when the free flash is smaller
+    bool finish(uint32_t id);                           // file it under the receipt id
+    void discard();
+
+    bool active() const { return open; }
+
+  private:
+    File file;
+    bool open;
+    uint8_t codePage;
+    char buffer[LONG_WRITE_BUFFER];
+    size_t used;
+    uint32_t written;
+    uint32_t maxBytes;
+
+    bool flush(bool last);
+};
+
+// Prints a long message upside down, last line first, in constant RAM.
+//
+// An index pass splits the file into pages of up to LONG_PAGE_BYTES that
+// start where a wrapped line starts, so wrapping every page on its own gives
+// the same lines as wrapping the whole text. Page ends are written to a
+// second file. Then the pages are read back last to first and each one is
+// emitted in reverse with WordWrap. Both passes run a bounded amount of work
+// per step() so the caller can interleave other tasks.
+//
+// Emitted lines point into the page buffer: use them before the next step().
+class LongMessageReader {
+  public:
+    LongMessageReader();
+
+    bool open(uint32_t id, uint8_t width);              // false when the file is missing
+    template <typename Emit>
+    bool step(Emit emit);                               // true when the whole message is out
+    void close();
+
+    static void remove(uint32_t id);                    // text and index
+
+  private:
+    File text;
+    File index;
+    uint32_t id;
+    uint8_t width;
+    uint32_t size;
+    uint32_t indexed;                                   // text bytes split into pages so far
+    uint32_t pages;                                     // pages still to print, counted down
+    bool indexing;
+    char page[LONG_PAGE_BYTES];
+
+    void indexPages();
+    uint32_t skipBlanks(uint32_t offset, char last);
+    size_t loadPage(uint32_t number);
+};
+
+template <typename Emit>
+bool LongMessageReader::step(Emit emit) {
+  if (indexing) {
+    indexPages();
+    return false;
+  }
+  if (pages == 0) return true;
+
+  size_t length = loadPage(--pages);
+  WordWrap wrap(page, length, width);
+  wrap.forEachReversed(emit);
+  return pages == 0;
+}
+
+#endif
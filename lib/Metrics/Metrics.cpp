@@ -0,0 +1,194 @@
+#include "Metrics.h"
+
+static const char *const stageNames[STAGE_COUNT] = {
+  "accept_to_enqueue_seconds", "queue_wait_seconds", "encode_seconds", "serial_drain_seconds"
+};
+static const char *const stageHelp[STAGE_COUNT] = {
+  "Time from accepting the connection to journaling the receipt",
+  "Time a receipt waited in the queue before printing started",
+  "CPU time spent building the ESC/POS bytes of a receipt",
+  "Time from a receipt's bytes being built until the last one reached the printer UART"
+};
+static const char *const rejectNames[REJECT_COUNT] = { "queue_full", "too_large", "invalid", "busy", "throttled" };
+
+
+MetricsWriter::MetricsWriter(Print &out, bool json) : out(out), json(json), first(true), groupOpen(false), lastName(nullptr) {
+  if (json) out.print('{');
+}
+
+void MetricsWriter::counter(const char *name, const char *help, uint32_t value, const char *label, const char *labelValue) {
+  series(name, help, "counter", value, label, labelValue);
+}
+
+void MetricsWriter::gauge(const char *name, const char *help, uint32_t value, const char *label, const char *labelValue) {
+  series(name, help, "gauge", value, label, labelValue);
+}
+
+void MetricsWriter::histogram(const char *name, const char *help, const Histogram &histogram) {
+  uint8_t last = METRICS_BUCKETS;                                          // JSON drops trailing empty buckets
+  while (json && last > 0 && histogram.buckets[last] == 0) last--;
+
+  if (json) {
+    closeGroup();
+    key(name);
+    out.print("{\"count\":");
+    out.print(histogram.count);
+    out.print(",\"sum\":");
+    seconds(histogram.sumMicros);
+    out.print(",\"buckets\":[");
+    for (uint8_t i = 0; i <= last; i++) {
+      if (i > 0) out.print(',');
+      out.print(histogram.buckets[i]);
+    }
+    out.print("]}");
+    lastName = name;
+    return;
+  }
+
+  out.print("# HELP ");
+  this->name(name);
+  out.print(' ');
+  out.print(help);
+  out.print('\n');
+  out.print("# TYPE ");
+  this->name(name);
+  out.print(" histogram");
+  out.print('\n');
+
+  uint32_t cumulative = 0;
+  for (uint8_t i = 0; i < METRICS_BUCKETS; i++) {
+    cumulative += histogram.buckets[i];
+    this->name(name, "_bucket{le=\"");
+    seconds((uint64_t)1 << i);
+    out.print("\"} ");
+    out.print(cumulative);
+    out.print('\n');
+  }
+  this->name(name, "_bucket{le=\"+Inf\"} ");
+  out.print(histogram.count);
+  out.print('\n');
+  this->name(name, "_sum ");
+  seconds(histogram.sumMicros);
+  out.print('\n');
+  this->name(name, "_count ");
+  out.print(histogram.count);
+  out.print('\n');
+  lastName = name;
+}
+
+void MetricsWriter::end() {
+  if (!json) return;
+  closeGroup();
+  out.print('}');
+}
+
+void MetricsWriter::series(const char *name, const char *help, const char *type, uint32_t value, const char *label, const char *labelValue) {
+  bool sameName = lastName != nullptr && strcmp(lastName, name) == 0;
+  lastName = name;
+
+  if (json) {
+    if (sameName && groupOpen) {
+      out.print(',');
+    } else {
+      closeGroup();
+      key(name);
+      if (label != nullptr) {
+        out.print('{');
+        groupOpen = true;
+      }
+    }
+    if (label != nullptr) {                                                 // {"queue_full":3,"invalid":1}
+      out.print('"');
+      out.print(labelValue);
+      out.print("\":");
+    }
+    out.print(value);
+    return;
+  }
+
+  if (!sameName) {
+    out.print("# HELP ");
+    this->name(name);
+    out.print(' ');
+    out.print(help);
+    out.print('\n');
+    out.print("# TYPE ");
+    this->name(name);
+    out.print(' ');
+    out.print(type);
+    out.print('\n');
+  }
+  this->name(name);
+  if (label != nullptr) {
+    out.print('{');
+    out.print(label);
+    out.print("=\"");
+    out.print(labelValue);
+    out.print("\"}");
+  }
+  out.print(' ');
+  out.print(value);
+  out.print('\n');
+}
+
+void MetricsWriter::key(const char *name) {
+  if (!first) out.print(',');
+  first = false;
+  out.print('"');
+  out.print(name);
+  out.print("\":");
+}
+
+void MetricsWriter::closeGroup() {
+  if (groupOpen) out.print('}');
+  groupOpen = false;
+}
+
+void MetricsWriter::name(const char *name, const char *suffix) {
+  out.print(METRICS_PREFIX);
+  out.print(name);
+  out.print(suffix);
+}
+
+// Whole seconds and six decimals, without going through float
+void MetricsWriter::seconds(uint64_t micros) {
+  char text[24];
+  snprintf(text, sizeof(text), "%lu.%06lu", (unsigned long)(micros / 1000000), (unsigned long)(micros % 1000000));
+  out.print(text);
+}
+
+
+Metrics::Metrics() {
+  memset(histograms, 0, sizeof(histograms));
+  memset(rejects, 0, sizeof(rejects));
+  maxDepth = 0;
+  waitValid = 0;
+}
+
+void Metrics::enqueued(uint32_t id, uint32_t depth) {
+  uint8_t slot = id % METRICS_WAIT_TRACKED;
+  waitIds[slot] = id;
+  waitSince[slot] = micros();
+  waitSinceMs[slot] = millis();
+  waitValid |= 1UL << slot;
+  if (depth > maxDepth) maxDepth = depth;
+}
+
+void Metrics::printing(uint32_t id) {
+  uint8_t slot = id % METRICS_WAIT_TRACKED;
+  if (!(waitValid & (1UL << slot)) || waitIds[slot] != id) return;        // replayed after a reset, or overwritten
+  waitValid &= ~(1UL << slot);
+  // Differences only: micros() is exact until it wraps, a spilled receipt can wait longer than that
+  uint32_t waitedMs = millis() - waitSinceMs[slot];
+  uint32_t waited = micros() - waitSince[slot];
+  if (waitedMs >= METRICS_MICROS_SPAN_MS) waited = waitedMs < UINT32_MAX / 1000 ? waitedMs * 1000 : UINT32_MAX;
+  histograms[STAGE_QUEUE_WAIT].record(waited);
+}
+
+void Metrics::write(MetricsWriter &writer) const {
+  for (uint8_t i = 0; i < STAGE_COUNT; i++) writer.histogram(stageNames[i], stageHelp[i], histograms[i]);
+  for (uint8_t i = 0; i < REJECT_COUNT; i++) {
+    writer.counter("jobs_rejected_total", "Receipts refused by the web server", rejects[i], "reason", rejectNames[i]);
+  }
+  writer.gauge("queue_depth_high_water", "Most receipts waiting at once since boot", maxDepth);
+}
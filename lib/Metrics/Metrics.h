@@ -0,0 +1,98 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <Arduino.h>
+
+#define METRICS_BUCKETS 26            // log2 buckets, upper bounds 1 us .. 2^25 us (33.5 s), plus +Inf
+#define METRICS_WAIT_TRACKED 32       // Receipts whose enqueue time is remembered for the queue wait histogram
+#define METRICS_PREFIX "scribe_"      // Prometheus names only, the JSON keys go without it
+#define METRICS_MICROS_SPAN_MS 3600000UL // micros() wraps after 71.6 min, longer queue waits are timed with millis()
+
+// Stages of a receipt's way through the device, each with its own histogram
+enum MetricStage {
+  STAGE_ACCEPT_TO_ENQUEUE,                          // connection accepted until the receipt is journaled
+  STAGE_QUEUE_WAIT,                                 // journaled until the printer starts on it
+  STAGE_ENCODE,                                     // building the ESC/POS bytes (CPU time)
+  STAGE_SERIAL_DRAIN,                               // waits for a full ring, then until the last byte reached the UART
+  STAGE_COUNT
+};
+
+enum RejectReason {
+  REJECT_QUEUE_FULL,                                // 503, queue and journal full
+  REJECT_TOO_LARGE,                                 // 413
+  REJECT_INVALID,                                   // 400
+  REJECT_BUSY,                                      // 503, another batch or image holds the printer
+  REJECT_THROTTLED,                                 // 429, client over its rate limit
+  REJECT_COUNT
+};
+
+// Log-bucketed latency histogram in microseconds. record() is a count-leading-
+// zeros and three adds, cheap enough for the print path.
+struct Histogram {
+  uint32_t buckets[METRICS_BUCKETS + 1];            // not cumulative, last one is +Inf
+  uint32_t count;
+  uint64_t sumMicros;
+
+  void record(uint32_t micros) {
+    uint8_t bucket = micros <= 1 ? 0 : 32 - __builtin_clz(micros - 1);   // smallest i with micros <= 2^i
+    if (bucket > METRICS_BUCKETS) bucket = METRICS_BUCKETS;
+    buckets[bucket]++;
+    count++;
+    sumMicros += micros;
+  }
+};
+
+// Writes metrics as Prometheus text (\n line ends) or as one compact JSON
+// object. Series that share a name and differ by label must be written one
+// after another.
+class MetricsWriter {
+  public:
+    MetricsWriter(Print &out, bool json);
+
+    void counter(const char *name, const char *help, uint32_t value, const char *label = nullptr, const char *labelValue = nullptr);
+    void gauge(const char *name, const char *help, uint32_t value, const char *label = nullptr, const char *labelValue = nullptr);
+    void histogram(const char *name, const char *help, const Histogram &histogram);
+    void end();
+
+  private:
+    Print &out;
+    bool json;
+    bool first;
+    bool groupOpen;                                     // JSON object of a labelled series not closed yet
+    const char *lastName;                               // last series written, to group labels and print HELP once
+
+    void series(const char *name, const char *help, const char *type, uint32_t value, const char *label, const char *labelValue);
+    void key(const char *name);
+    void closeGroup();
+    void seconds(uint64_t micros);
+    void name(const char *name, const char *suffix = "");
+};
+
+// Fixed-size instrumentation: one histogram per stage, reject counters and the
+// deepest queue seen. Nothing is allocated, the whole object is a few hundred bytes.
+class Metrics {
+  public:
+    Metrics();
+
+    void record(MetricStage stage, uint32_t micros) { histograms[stage].record(micros); }
+    void rejected(RejectReason reason) { rejects[reason]++; }
+    void enqueued(uint32_t id, uint32_t depth);         // receipt journaled, depth = receipts now waiting
+    void printing(uint32_t id);                         // printer starts on a receipt, records its queue wait
+
+    uint32_t depthHighWater() const { return maxDepth; }
+    void write(MetricsWriter &writer) const;            // histograms, rejects and the queue high-water mark
+
+  private:
+    Histogram histograms[STAGE_COUNT];
+    uint32_t rejects[REJECT_COUNT];
+    uint32_t maxDepth;
+
+    // Enqueue times by id. Receipts that waited behind more than METRICS_WAIT_TRACKED
+    // newer ones have lost their slot and are not sampled.
+    uint32_t waitIds[METRICS_WAIT_TRACKED];
+    uint32_t waitSince[METRICS_WAIT_TRACKED];           // micros()
+    uint32_t waitSinceMs[METRICS_WAIT_TRACKED];         // millis(), for waits past METRICS_MICROS_SPAN_MS
+    uint32_t waitValid;                                 // bit per slot, METRICS_WAIT_TRACKED is at most 32
+};
+
+#endif
@@ -0,0 +1,178 @@
+#include "PrinterProfile.h"
+#include <EEPROM.h>
+#include <EscPos.h>
+
+#define PROFILE_MAGIC 0x53435232      // "SCR2"
+
+using EscPos::BAUD_RATES;
+using EscPos::BAUD_RATE_COUNT;
+
+struct StoredProfile {
+  uint32_t magic;
+  PrinterProfile profile;
+  uint32_t check;                                   // magic ^ baud ^ heat/speed, catches erased or torn records
+};
+
+static uint32_t profileCheck(const PrinterProfile &p) {
+  return PROFILE_MAGIC ^ p.baud ^ ((uint32_t)p.heat << 8) ^ p.speed;
+}
+
+// === Throughput model ===
+uint32_t linkDotLinesPerSecond(uint32_t baud, uint32_t mixBytes, uint32_t mixDots) {
+  if (mixBytes == 0) return UINT32_MAX;                                     // nothing to send, never the limit
+  return (uint64_t)(baud / 10) * mixDots / mixBytes;                        // 8N1, 10 bits per byte
+}
+
+PrinterProfile profileForBaud(uint32_t baud, uint32_t mixBytes, uint32_t mixDots, uint8_t baseHeat, uint8_t baseSpeed) {
+  if (mixDots == 0) {
+    mixBytes = PROFILE_MIX_BYTES;
+    mixDots = PROFILE_MIX_DOTS;
+  }
+  PrinterProfile p = {baud, baseHeat, baseSpeed};
+
+  // Raise the speed while the link still keeps the head fed
+  uint32_t link = linkDotLinesPerSecond(baud, mixBytes, mixDots);
+  while (p.speed < 9 && paperDotsPerSecond(p.speed + 1) <= link) p.speed++;
+
+  // Faster paper spends less time under the head, add one heat step per two speed steps
+  uint8_t extraHeat = (p.speed - baseSpeed) / 2;
+  p.heat = baseHeat + extraHeat > 15 ? 15 : baseHeat + extraHeat;
+  return p;
+}
+
+// === Calibration ===
+PrinterCalibration::PrinterCalibration(ThermalPrinter &printer)
+  : printer(&printer), state(CALIBRATION_IDLE), mixBytes(0), mixDots(0), good(0), next(0), searched(0), ok(false) {
+  profile = defaults = {0, 0, 0};
+}
+
+PrinterProfile PrinterCalibration::load(const PrinterProfile &defaults) {
+  StoredProfile stored;
+  EEPROM.begin(PROFILE_EEPROM_SIZE);
+  EEPROM.get(PROFILE_EEPROM_ADDR, stored);
+  EEPROM.end();
+
+  if (stored.magic != PROFILE_MAGIC || stored.check != profileCheck(stored.profile)) return defaults;
+  return stored.profile;
+}
+
+bool PrinterCalibration::save(const PrinterProfile &profile) {
+  StoredProfile stored = {PROFILE_MAGIC, profile, profileCheck(profile)};
+  EEPROM.begin(PROFILE_EEPROM_SIZE);
+  EEPROM.put(PROFILE_EEPROM_ADDR, stored);
+  bool ok = EEPROM.commit();
+  EEPROM.end();
+  return ok;
+}
+
+bool PrinterCalibration::connect(PrinterProfile &profile) {
+  printer->switchBaudRate(profile.baud);
+  if (printer->isOnline()) return true;
+
+  // The printer keeps its own baud setting, it may differ from ours after a reflash
+  for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++) {
+    if (BAUD_RATES[i] == profile.baud) continue;
+    printer->switchBaudRate(BAUD_RATES[i]);
+    if (printer->isOnline()) {
+      profile.baud = BAUD_RATES[i];
+      return true;
+    }
+  }
+
+  printer->switchBaudRate(profile.baud);                                    // nobody answered, no RX wiring: keep the configured rate
+  return false;
+}
+
+void PrinterCalibration::apply(const PrinterProfile &profile) {
+  printer->setHeat(profile.heat);
+  printer->setSpeed(profile.speed);
+}
+
+void PrinterCalibration::start(const PrinterProfile &defaults, uint32_t mixBytes, uint32_t mixDots) {
+  this->defaults = defaults;
+  this->mixBytes = mixBytes;
+  this->mixDots = mixDots;
+  profile = defaults;
+  ok = false;
+  state = CALIBRATION_START;
+}
+
+uint32_t PrinterCalibration::step() {
+  switch (state) {
+    case CALIBRATION_START:
+      if (!linkStable()) return finish(false);                              // no status replies, nothing to measure
+      good = printer->baud();
+      next = 0;
+      while (next < BAUD_RATE_COUNT && BAUD_RATES[next] <= good) next++;
+      state = CALIBRATION_RAISE;
+      return 0;
+
+    case CALIBRATION_RAISE:
+      if (next >= BAUD_RATE_COUNT) return finish(true);
+      printer->requestBaudRate(BAUD_RATES[next]);
+      state = CALIBRATION_TRY;
+      return CALIBRATION_SWITCH_MS;
+
+    case CALIBRATION_TRY:
+      printer->switchBaudRate(BAUD_RATES[next]);
+      if (linkStable()) {
+        good = BAUD_RATES[next++];
+        state = CALIBRATION_RAISE;
+        return 0;
+      }
+      // Step back: ask for the good rate at the new one, it may hear us without being heard
+      printer->requestBaudRate(good);
+      searched = 0;
+      state = CALIBRATION_RETURN;
+      return CALIBRATION_SWITCH_MS;
+
+    case CALIBRATION_SEARCH: {
+      // Starting with the rate it was asked for, one probe per step
+      uint32_t rate = BAUD_RATES[(next + searched) % BAUD_RATE_COUNT];
+      searched++;
+      printer->switchBaudRate(rate);
+      if (printer->isOnline(CALIBRATION_PROBE_MS)) {
+        if (rate == good) return finish(true);
+        printer->requestBaudRate(good);
+        next = (next + searched - 1) % BAUD_RATE_COUNT;                     // where it answered, in case it stays there
+        state = CALIBRATION_RETURN;
+        return CALIBRATION_SWITCH_MS;
+      }
+      if (searched < BAUD_RATE_COUNT) return 0;
+      printer->switchBaudRate(good);                                        // lost: keep the rate it last answered at
+      return finish(false);
+    }
+
+    case CALIBRATION_RETURN:
+      printer->switchBaudRate(good);
+      if (linkStable()) return finish(true);
+      if (searched == 0) {                                                  // it did not hear us or went elsewhere
+        state = CALIBRATION_SEARCH;
+        return 0;
+      }
+      good = BAUD_RATES[next];                                              // found but did not come back, stay where it answers
+      printer->switchBaudRate(good);
+      return finish(true);
+
+    case CALIBRATION_IDLE:
+    case CALIBRATION_DONE:
+      break;
+  }
+  return 0;
+}
+
+uint32_t PrinterCalibration::finish(bool answered) {
+  state = CALIBRATION_DONE;
+  if (!answered) return 0;
+  profile = profileForBaud(good, mixBytes, mixDots, defaults.heat, defaults.speed);
+  apply(profile);
+  ok = save(profile);
+  return 0;
+}
+
+bool PrinterCalibration::linkStable() {
+  for (uint8_t i = 0; i < CALIBRATION_PROBES; i++) {
+    if (!printer->isOnline(CALIBRATION_PROBE_MS)) return false;
+  }
+  return true;
+}
@@ -0,0 +1,85 @@
+#ifndef PRINTER_PROFILE_H
+#define PRINTER_PROFILE_H
+
+#include <Arduino.h>
+#include <ThermalPrinter.h>
+
+#define PROFILE_EEPROM_ADDR 0         // EEPROM offset of the saved profile
+#define PROFILE_EEPROM_SIZE 64        // Bytes reserved for it
+#define CALIBRATION_PROBES 3          // Status requests that must all succeed at a new baud rate
+#define CALIBRATION_PROBE_MS 50       // Timeout of one of them
+#define CALIBRATION_SWITCH_MS 50      // Printer switching its UART after ESC ## SBDR
+#define PROFILE_MIX_BYTES 4           // Bytes per dot row of paper assumed before any receipt was printed:
+#define PROFILE_MIX_DOTS 1            // text needs about 1, a full-width raster row 48
+
+struct PrinterProfile {
+  uint32_t baud;
+  uint8_t heat;                                     // ESC ## STDP value
+  uint8_t speed;                                    // ESC ## STSP value
+};
+
+// === Throughput model ===
+// What the receipts need from the link is measured as bytes sent per dot row
+// of paper (PrintJob::sentBytes() / paperDots()): plain text takes about one
+// byte per row, bitmaps up to 48. The link delivers baud / 10 bytes per
+// second, so it feeds the head baud / 10 * dots / bytes rows per second; the
+// head burns paperDotsPerSecond(speed). profileForBaud() raises the speed from
+// the configured one as far as the link keeps up. Past that the head would
+// only stop and wait for data, which prints unevenly; below the configured
+// speed text, which never waits for the link, would print slower.
+uint32_t linkDotLinesPerSecond(uint32_t baud, uint32_t mixBytes, uint32_t mixDots);
+PrinterProfile profileForBaud(uint32_t baud, uint32_t mixBytes, uint32_t mixDots, uint8_t baseHeat, uint8_t baseSpeed);
+
+enum CalibrationStep : uint8_t {
+  CALIBRATION_IDLE,
+  CALIBRATION_START,                                // check the printer answers at the current rate
+  CALIBRATION_RAISE,                                // ask for the next rate up
+  CALIBRATION_TRY,                                  // switch to it and probe
+  CALIBRATION_RETURN,                               // asked back to the last good rate, probe there
+  CALIBRATION_SEARCH,                               // printer lost: probe one rate per step
+  CALIBRATION_DONE
+};
+
+// Finds and stores the fastest baud rate the printer link handles reliably.
+// Needs the printer TX line wired to the ESP RX pin, without it the printer
+// never answers status requests and the default profile is kept.
+//
+// Calibration runs as a sequence of step() calls from a scheduler task, each
+// sends at most one command or probes one rate and returns how long to wait
+// before the next, so the web server keeps running while it searches. A rate
+// only counts once the printer answered CALIBRATION_PROBES status requests at
+// it. Otherwise it is asked back to the last good rate; if it does not answer
+// there either, every rate is probed until it is found and asked again.
+class PrinterCalibration {
+  public:
+    PrinterCalibration(ThermalPrinter &printer);
+
+    PrinterProfile load(const PrinterProfile &defaults); // saved profile, or defaults when nothing valid is stored
+    bool save(const PrinterProfile &profile);
+    bool connect(PrinterProfile &profile);              // at profile.baud, search the other rates if the printer is silent
+    void apply(const PrinterProfile &profile);          // send heat and speed
+
+    void start(const PrinterProfile &defaults, uint32_t mixBytes, uint32_t mixDots); // mix as in profileForBaud(), 0 dots for the default
+    uint32_t step();                                    // next part, returns ms until the next call
+    bool running() const { return state != CALIBRATION_IDLE && state != CALIBRATION_DONE; }
+    bool finished() const { return state == CALIBRATION_DONE; } // until start() again
+    bool succeeded() const { return ok; }
+    const PrinterProfile &result() const { return profile; }
+
+  private:
+    ThermalPrinter *printer;
+    CalibrationStep state;
+    PrinterProfile defaults;
+    PrinterProfile profile;
+    uint32_t mixBytes;
+    uint32_t mixDots;
+    uint32_t good;                                      // fastest rate confirmed so far
+    uint8_t next;                                       // BAUD_RATES index being tried or searched
+    uint8_t searched;
+    bool ok;
+
+    bool linkStable();
+    uint32_t finish(bool answered);
+};
+
+#endif
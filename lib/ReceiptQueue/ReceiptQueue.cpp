@@ -0,0 +1,84 @@
+#include "ReceiptQueue.h"
+
+
+ReceiptQueue::ReceiptQueue() : currentRound(0), batchSlot(-1), enqueueCount(0), dequeueCount(0), rejectCount(0) {
+  for (uint8_t i = 0; i < RECEIPT_QUEUE_SLOTS; i++) order[i] = i;
+}
+
+Receipt *ReceiptQueue::push(const Receipt &receipt) {
+  if (isFull()) {
+    rejectCount++;
+    return nullptr;
+  }
+
+  // The free position at the tail holds a free slot number
+  uint8_t count = size();
+  uint8_t slot = order[enqueueCount % RECEIPT_QUEUE_SLOTS];
+  slots[slot] = receipt;
+
+  uint8_t position = count;
+  uint32_t round = currentRound;
+  if (batchSlot >= 0) {
+    // Rest of a batch: right behind its predecessor, at the front if that one is printed already
+    position = 0;
+    round = currentRound;
+    for (uint8_t i = 0; i < count; i++) {
+      if (order[(dequeueCount + i) % RECEIPT_QUEUE_SLOTS] == batchSlot) {
+        position = i + 1;
+        round = rounds[batchSlot];
+      }
+    }
+  } else {
+    // Next turn of this client, after everyone else's receipts of that round
+    for (uint8_t i = 0; i < count; i++) {
+      uint8_t queued = order[(dequeueCount + i) % RECEIPT_QUEUE_SLOTS];
+      if (slots[queued].client == receipt.client && rounds[queued] >= round) round = rounds[queued] + 1;
+    }
+    while (position > 0 && rounds[order[(dequeueCount + position - 1) % RECEIPT_QUEUE_SLOTS]] > round) position--;
+  }
+  rounds[slot] = round;
+  batchSlot = (receipt.flags & RECEIPT_BATCH_MORE) ? slot : -1;
+
+  for (uint8_t i = count; i > position; i--) {
+    order[(dequeueCount + i) % RECEIPT_QUEUE_SLOTS] = order[(dequeueCount + i - 1) % RECEIPT_QUEUE_SLOTS];
+  }
+  order[(dequeueCount + position) % RECEIPT_QUEUE_SLOTS] = slot;
+
+  enqueueCount++;                                                           // publish only after the slot is filled
+  return &slots[slot];
+}
+
+Receipt *ReceiptQueue::front() const {
+  if (isEmpty()) return nullptr;
+  return &slots[order[dequeueCount % RECEIPT_QUEUE_SLOTS]];
+}
+
+void ReceiptQueue::advance() {
+  if (isEmpty()) return;
+  currentRound = rounds[order[dequeueCount % RECEIPT_QUEUE_SLOTS]];         // it is printing now, nothing may be queued ahead of it
+}
+
+void ReceiptQueue::pop() {
+  if (isEmpty()) return;
+  currentRound = rounds[order[dequeueCount % RECEIPT_QUEUE_SLOTS]];
+  dequeueCount++;                                                           // its slot number stays behind as a free one
+}
+
+uint8_t ReceiptQueue::size() const {
+  return enqueueCount - dequeueCount;                                       // wrap-safe for unsigned counters
+}
+
+bool ReceiptQueue::isEmpty() const {
+  return enqueueCount == dequeueCount;
+}
+
+bool ReceiptQueue::isFull() const {
+  return size() >= RECEIPT_QUEUE_SLOTS;
+}
+
+bool ReceiptQueue::holds(uint32_t client) const {
+  for (uint8_t i = 0; i < size(); i++) {
+    if (slots[order[(dequeueCount + i) % RECEIPT_QUEUE_SLOTS]].client == client) return true;
+  }
+  return false;
+}
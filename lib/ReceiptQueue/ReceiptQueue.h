@@ -0,0 +1,72 @@
+#ifndef RECEIPT_QUEUE_H
+#define RECEIPT_QUEUE_H
+
+#include <Arduino.h>
+
+#define RECEIPT_QUEUE_SLOTS 8         // Receipts that can wait for the printer at once (power of two)
+#define MAX_MESSAGE_LENGTH 512        // Max message bytes per receipt (the web form limits to 200)
+#define MAX_TIMESTAMP_LENGTH 24       // "Sat, 06 Jun 2025" with some headroom
+#define MAX_LAYOUT_LENGTH 15          // Template name
+#define MAX_QR_LENGTH 80              // QR payload for templates with a {qr} placeholder
+
+// Receipt flags
+#define RECEIPT_BATCH_MORE 0x01       // Another receipt of the same batch follows, keep the printer session open
+#define RECEIPT_COMPACT 0x02          // Separate it from the next one with a cut line instead of a full feed
+#define RECEIPT_LONG 0x04             // Message is in a flash file named after the id, message is empty
+#define RECEIPT_TEMPLATE 0x08         // Printed from the template named in layout instead of the built-in layout
+
+struct Receipt {
+  uint32_t id;                                      // Receipt number, unique across reboots when the spool is on
+  char message[MAX_MESSAGE_LENGTH + 1];
+  char timestamp[MAX_TIMESTAMP_LENGTH + 1];
+  uint8_t codePage;                                 // Printer code page the message text is encoded in
+  uint8_t flags;                                    // RECEIPT_* flags
+  uint32_t client;                                  // Sender's IPv4 address for fair ordering, 0 in journals written before it was kept
+  char layout[MAX_LAYOUT_LENGTH + 1];               // Template name, with RECEIPT_TEMPLATE
+  char qr[MAX_QR_LENGTH + 1];                       // Template {qr} value, with RECEIPT_TEMPLATE
+};
+
+// Fixed-capacity queue of receipts waiting to be printed. All storage is static,
+// nothing is allocated after boot. The free-running enqueue/dequeue counters
+// index a ring of slot numbers, so size() is simply their difference.
+//
+// Receipts are served round-robin by client: each one gets a round, one past
+// the sender's last queued receipt but never behind the round being printed,
+// and is inserted after everything of an earlier or equal round. A client with
+// many receipts waiting thus gets one turn per round like everyone else. The
+// rest of a batch (RECEIPT_BATCH_MORE) must be the next push, it goes right
+// behind its predecessor and shares its round, so a batch stays together as
+// one turn. Only the slot numbers move, receipts stay where they were copied in.
+//
+// advance() marks the front receipt as printing: its round becomes the
+// current one, so nothing pushed later can get ahead of it while it prints.
+class ReceiptQueue {
+  public:
+    ReceiptQueue();
+
+    Receipt *push(const Receipt &receipt);              // copy a receipt in at its turn, nullptr when full (counted as rejected)
+    Receipt *front() const;                             // next receipt to print, nullptr when empty; changes nothing
+    void advance();                                     // the front receipt starts printing, later pushes queue behind it
+    void pop();                                         // release the front receipt after printing
+
+    uint8_t size() const;
+    bool isEmpty() const;
+    bool isFull() const;
+    bool holds(uint32_t client) const;                  // a receipt of client is queued or printing
+
+    uint32_t enqueued() const { return enqueueCount; }  // Total receipts accepted since boot
+    uint32_t dequeued() const { return dequeueCount; }  // Total receipts printed since boot
+    uint32_t rejected() const { return rejectCount; }   // Total receipts refused because the queue was full
+
+  private:
+    mutable Receipt slots[RECEIPT_QUEUE_SLOTS];         // front() hands out a receipt to print from a const queue
+    uint32_t rounds[RECEIPT_QUEUE_SLOTS];               // per slot
+    uint8_t order[RECEIPT_QUEUE_SLOTS];                 // slot numbers, queued from the dequeue position on, free ones after
+    uint32_t currentRound;                              // round of the receipt printed last
+    int8_t batchSlot;                                   // slot of the last receipt pushed if a batch continues after it, else -1
+    uint32_t enqueueCount;
+    uint32_t dequeueCount;
+    uint32_t rejectCount;
+};
+
+#endif
@@ -0,0 +1,421 @@
+#include "ReceiptTemplate.h"
+#include <EscPos.h>
+#include <WordWrap.h>
+#include <Transcoder.h>
+#include <LogoCache.h>
+
+using namespace EscPos;
+
+#define TEMPLATE_MAGIC 0x5054         // "TP"
+
+enum TemplateItemKind : uint8_t {
+  ITEM_TEXT, ITEM_INVERTED, ITEM_QR, ITEM_FEED, ITEM_CUT, ITEM_SLOT
+};
+
+// === Built-in Templates ===
+// Same format as an upload, compiled when first printed
+
+static const char TODO_SOURCE[] PROGMEM =
+  "feed 5\n"
+  "inverted {timestamp}\n"
+  "text\n"
+  "bold on\n"
+  "text TO DO\n"
+  "bold off\n"
+  "checklist {message}\n";
+
+static const char TICKET_SOURCE[] PROGMEM =
+  "feed 5\n"
+  "inverted {timestamp}\n"
+  "text\n"
+  "align center\n"
+  "size 2 2\n"
+  "text TICKET\n"
+  "size 1 1\n"
+  "text {message}\n"
+  "text\n"
+  "qr {qr}\n";
+
+static const char BANNER_SOURCE[] PROGMEM =
+  "feed 5\n"
+  "inverted {timestamp}\n"
+  "text\n"
+  "bold on\n"
+  "size 2 2\n"
+  "text {message}\n";
+
+struct BuiltinTemplate {
+  const char *name;
+  PGM_P source;
+};
+
+static const BuiltinTemplate BUILTINS[] = {
+  {"todo", TODO_SOURCE},
+  {"ticket", TICKET_SOURCE},
+  {"banner", BANNER_SOURCE}
+};
+
+
+static bool matches(const char *word, size_t length, const char *name) {
+  return length == strlen(name) && memcmp(word, name, length) == 0;
+}
+
+static void templatePath(char *out, size_t size, const char *name) {
+  snprintf(out, size, "/tpl-%s.bin", name);
+}
+
+// === Compiler ===
+
+TemplateCompiler::TemplateCompiler(uint8_t lineWidth, uint8_t codePage)
+  : lineWidth(lineWidth), codePage(codePage), itemCount(0), out(nullptr), overflow(false) {
+  errorText[0] = '\0';
+}
+
+bool TemplateCompiler::compile(char *source, size_t length, CompiledTemplate &out) {
+  errorText[0] = '\0';
+  itemCount = 0;
+  Style style = {0, 0, 0, 0};
+  uint16_t number = 0;
+  size_t pos = 0;
+  while (pos < length) {
+    size_t end = pos;
+    while (end < length && source[end] != '\n') end++;
+    size_t lineLength = end - pos;
+    if (lineLength > 0 && source[pos + lineLength - 1] == '\r') lineLength--;
+    if (!parseLine(source + pos, lineLength, style, ++number)) return false;
+    pos = end + 1;
+  }
+  if (itemCount == 0) return fail(0, "Template is empty");
+
+  // Bottom of the receipt first, it prints first on the rotated paper
+  this->out = &out;
+  out.magic = TEMPLATE_MAGIC;
+  out.length = 0;
+  out.slotCount = 0;
+  overflow = false;
+  const Style defaults = {0, 0, 0, 0};
+  Style current = defaults;
+  for (uint8_t i = itemCount; i > 0; i--) {
+    const Item &item = items[i - 1];
+    if (item.kind != ITEM_FEED) emitStyle(current, item.style);
+    emitItem(item);
+  }
+  emitStyle(current, defaults);
+  if (overflow) return fail(0, "Template too large or too many placeholders");
+  return true;
+}
+
+bool TemplateCompiler::parseLine(char *line, size_t length, Style &style, uint16_t number) {
+  while (length > 0 && (*line == ' ' || *line == '\t')) {
+    line++;
+    length--;
+  }
+  if (length == 0 || *line == '#') return true;
+
+  // Directive word, then its argument without surrounding blanks
+  size_t wordLength = 0;
+  while (wordLength < length && line[wordLength] != ' ' && line[wordLength] != '\t') wordLength++;
+  char *arg = line + wordLength;
+  size_t argLength = length - wordLength;
+  while (argLength > 0 && (*arg == ' ' || *arg == '\t')) {
+    arg++;
+    argLength--;
+  }
+  while (argLength > 0 && (arg[argLength - 1] == ' ' || arg[argLength - 1] == '\t')) argLength--;
+
+  // Styles change the state the following directives print in
+  if (matches(line, wordLength, "bold")) {
+    if (!matches(arg, argLength, "on") && !matches(arg, argLength, "off")) return fail(number, "bold takes on or off");
+    style.bold = matches(arg, argLength, "on");
+    return true;
+  }
+  if (matches(line, wordLength, "underline")) {
+    if (argLength != 1 || arg[0] < '0' || arg[0] > '2') return fail(number, "underline takes 0, 1 or 2");
+    style.underline = arg[0] - '0';
+    return true;
+  }
+  if (matches(line, wordLength, "size")) {
+    if (argLength != 3 || arg[0] < '1' || arg[0] > '8' || arg[1] != ' ' || arg[2] < '1' || arg[2] > '8') {
+      return fail(number, "size takes width and height, 1 to 8");
+    }
+    style.size = ((arg[0] - '1') << 4) | (arg[2] - '1');
+    return true;
+  }
+  if (matches(line, wordLength, "align")) {
+    if (matches(arg, argLength, "left")) style.align = 0;
+    else if (matches(arg, argLength, "center")) style.align = 1;
+    else if (matches(arg, argLength, "right")) style.align = 2;
+    else return fail(number, "align takes left, center or right");
+    return true;
+  }
+
+  // Everything else prints something
+  if (itemCount == TEMPLATE_MAX_ITEMS) return fail(number, "Too many lines");
+  Item &item = items[itemCount];
+  item.style = style;
+  item.text = arg;
+  item.length = argLength;
+  item.arg = 0;
+
+  bool message = matches(arg, argLength, "{message}");
+  bool timestamp = matches(arg, argLength, "{timestamp}");
+  bool qr = matches(arg, argLength, "{qr}");
+  bool placeholder = message || timestamp || qr;
+
+  if (matches(line, wordLength, "text")) {
+    if (qr) return fail(number, "{qr} only works with qr");
+    item.kind = placeholder ? ITEM_SLOT : ITEM_TEXT;
+    item.arg = message ? SLOT_MESSAGE : SLOT_TIMESTAMP;
+  } else if (matches(line, wordLength, "inverted")) {
+    if (message || qr) return fail(number, "inverted takes text or {timestamp}");
+    item.kind = timestamp ? ITEM_SLOT : ITEM_INVERTED;
+    item.arg = SLOT_TIMESTAMP_INVERTED;
+  } else if (matches(line, wordLength, "checklist")) {
+    if (!message) return fail(number, "checklist takes {message}");
+    item.kind = ITEM_SLOT;
+    item.arg = SLOT_CHECKLIST;
+  } else if (matches(line, wordLength, "qr")) {
+    if (message || timestamp || argLength == 0) return fail(number, "qr takes text or {qr}");
+    item.kind = qr ? ITEM_SLOT : ITEM_QR;
+    item.arg = SLOT_QR;
+  } else if (matches(line, wordLength, "logo")) {
+    if (argLength != 1 || arg[0] < '0' || arg[0] - '0' >= LOGO_SLOTS) {
+      char reason[32];
+      snprintf(reason, sizeof(reason), "logo takes an id, 0 to %u", (unsigned)(LOGO_SLOTS - 1));
+      return fail(number, reason);
+    }
+    item.kind = ITEM_SLOT;
+    item.arg = SLOT_LOGO;
+  } else if (matches(line, wordLength, "feed")) {
+    uint16_t lines = 0;
+    for (size_t i = 0; i < argLength && lines <= 255; i++) {
+      if (arg[i] < '0' || arg[i] > '9') return fail(number, "feed takes a number of lines");
+      lines = lines * 10 + (arg[i] - '0');
+    }
+    if (lines == 0 || lines > 255) return fail(number, "feed takes 1 to 255 lines");
+    item.kind = ITEM_FEED;
+    item.arg = lines;
+  } else if (matches(line, wordLength, "cut")) {
+    item.kind = ITEM_CUT;
+  } else {
+    return fail(number, "unknown directive");
+  }
+
+  // Literal text is stored in the printer code page like a message
+  if (item.kind == ITEM_TEXT || item.kind == ITEM_INVERTED) {
+    item.length = Transcoder::transcode(item.text, item.length, codePage);
+  }
+  itemCount++;
+  return true;
+}
+
+void TemplateCompiler::emitItem(const Item &item) {
+  switch (item.kind) {
+    case ITEM_TEXT: {
+      if (item.length == 0) {
+        emit(CRLF, sizeof(CRLF));                                         // blank line
+        break;
+      }
+      WordWrap wrap(item.text, item.length, widthFor(item.style));
+      wrap.forEachReversed([this](const char *line, size_t length) {
+        emit((const uint8_t*)line, length);
+        emit(CRLF, sizeof(CRLF));
+      });
+      break;
+    }
+    case ITEM_INVERTED:
+      emit(FULL_BLOCK);
+      emit(INVERSE_ON, sizeof(INVERSE_ON));
+      for (uint16_t i = 0; i < item.length; i++) {
+        if (item.text[i] == ' ') emit(INVERTED_SPACE, sizeof(INVERTED_SPACE));
+        else emit(item.text[i]);
+      }
+      emit(INVERSE_OFF, sizeof(INVERSE_OFF));
+      emit(FULL_BLOCK);
+      emit(CRLF, sizeof(CRLF));
+      break;
+    case ITEM_QR:
+      emit(QR_STORE, sizeof(QR_STORE));
+      emit((item.length + 3) & 0xFF);
+      emit((item.length + 3) >> 8);
+      emit(49); emit(80); emit(48);
+      emit((const uint8_t*)item.text, item.length);
+      emit(QR_PRINT, sizeof(QR_PRINT));
+      break;
+    case ITEM_FEED:
+      emit(FEED_LINES, sizeof(FEED_LINES));
+      emit(item.arg);
+      break;
+    case ITEM_CUT: {
+      uint8_t width = widthFor(item.style);
+      for (uint8_t i = 0; i + 1 < width; i++) emit(i & 1 ? ' ' : '-');   // "- - - -", no trailing blank
+      emit(CRLF, sizeof(CRLF));
+      break;
+    }
+    case ITEM_SLOT:
+      slot(item.arg, item.arg == SLOT_LOGO ? item.text[0] - '0' : widthFor(item.style));
+      break;
+  }
+}
+
+void TemplateCompiler::emitStyle(Style &current, const Style &wanted) {
+  if (current.bold != wanted.bold) {
+    emit(BOLD, sizeof(BOLD));
+    emit(wanted.bold);
+  }
+  if (current.underline != wanted.underline) {
+    emit(UNDERLINE, sizeof(UNDERLINE));
+    emit(wanted.underline);
+  }
+  if (current.size != wanted.size) {
+    emit(CHAR_SIZE, sizeof(CHAR_SIZE));
+    emit(wanted.size);
+  }
+  if (current.align != wanted.align) {
+    emit(ALIGN, sizeof(ALIGN));
+    emit(wanted.align);
+  }
+  current = wanted;
+}
+
+void TemplateCompiler::emit(const uint8_t *data, size_t length) {
+  if (out->length + length > TEMPLATE_MAX_BYTES) {
+    overflow = true;
+    return;
+  }
+  memcpy(out->bytes + out->length, data, length);
+  out->length += length;
+}
+
+void TemplateCompiler::slot(uint8_t kind, uint8_t width) {
+  if (out->slotCount == TEMPLATE_MAX_SLOTS) {
+    overflow = true;
+    return;
+  }
+  TemplateSlot &slot = out->slots[out->slotCount++];
+  slot.offset = out->length;
+  slot.kind = kind;
+  slot.width = width;
+}
+
+uint8_t TemplateCompiler::widthFor(const Style &style) const {
+  uint8_t width = lineWidth / ((style.size >> 4) + 1);
+  return width > 0 ? width : 1;
+}
+
+bool TemplateCompiler::fail(uint16_t line, const char *message) {
+  if (line > 0) snprintf(errorText, sizeof(errorText), "Line %u: %s", line, message);
+  else snprintf(errorText, sizeof(errorText), "%s", message);
+  return false;
+}
+
+// === Store ===
+
+TemplateStore::TemplateStore(uint8_t lineWidth, uint8_t codePage)
+  : compiler(lineWidth, codePage), clock(0), failure(nullptr), noFlash(false) {
+  memset(cache, 0, sizeof(cache));
+}
+
+const CompiledTemplate *TemplateStore::find(const char *name) {
+  if (!validName(name)) return nullptr;
+  for (uint8_t i = 0; i < TEMPLATE_CACHE; i++) {
+    if (strcmp(cache[i].name, name) == 0) {
+      cache[i].used = ++clock;
+      return &cache[i].compiled;
+    }
+  }
+
+  Entry &entry = victim();
+  entry.name[0] = '\0';
+  if (!load(name, entry.compiled)) return nullptr;
+  strcpy(entry.name, name);
+  entry.used = ++clock;
+  return &entry.compiled;
+}
+
+bool TemplateStore::exists(const char *name) {
+  if (!validName(name)) return false;
+  char path[TEMPLATE_NAME_SIZE + 12];
+  templatePath(path, sizeof(path), name);
+  return builtin(name) != nullptr || LittleFS.exists(path);
+}
+
+bool TemplateStore::save(const char *name, char *source, size_t length) {
+  // Compiled into the cache, the entry of the old version if it is there
+  Entry *entry = nullptr;
+  for (uint8_t i = 0; i < TEMPLATE_CACHE; i++) {
+    if (strcmp(cache[i].name, name) == 0) entry = &cache[i];
+  }
+  if (entry == nullptr) entry = &victim();
+  entry->name[0] = '\0';
+  noFlash = false;
+  if (!compiler.compile(source, length, entry->compiled)) {
+    failure = compiler.error();
+    return false;
+  }
+
+  char path[TEMPLATE_NAME_SIZE + 12];
+  templatePath(path, sizeof(path), name);
+  size_t size = offsetof(CompiledTemplate, bytes) + entry->compiled.length;
+  File file = LittleFS.open(path, "w");
+  bool ok = file && file.write((const uint8_t*)&entry->compiled, size) == size;
+  if (file) file.close();
+  if (!ok) {
+    LittleFS.remove(path);
+    failure = "Not enough flash for the template";
+    noFlash = true;
+    return false;
+  }
+
+  strcpy(entry->name, name);
+  entry->used = ++clock;
+  return true;
+}
+
+bool TemplateStore::validName(const char *name) {
+  size_t length = strlen(name);
+  if (length == 0 || length >= TEMPLATE_NAME_SIZE) return false;
+  for (size_t i = 0; i < length; i++) {
+    char c = name[i];
+    if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_' || c == '-')) return false;
+  }
+  return true;
+}
+
+TemplateStore::Entry &TemplateStore::victim() {
+  Entry *entry = &cache[0];
+  for (uint8_t i = 0; i < TEMPLATE_CACHE; i++) {
+    if (cache[i].name[0] == '\0') return cache[i];
+    if (cache[i].used < entry->used) entry = &cache[i];
+  }
+  return *entry;
+}
+
+bool TemplateStore::load(const char *name, CompiledTemplate &out) {
+  // An upload wins over the built-in of the same name
+  char path[TEMPLATE_NAME_SIZE + 12];
+  templatePath(path, sizeof(path), name);
+  File file = LittleFS.open(path, "r");
+  if (file) {
+    size_t header = offsetof(CompiledTemplate, bytes);
+    bool ok = file.read((uint8_t*)&out, header) == header && out.magic == TEMPLATE_MAGIC &&
+              out.length <= TEMPLATE_MAX_BYTES && out.slotCount <= TEMPLATE_MAX_SLOTS &&
+              file.read(out.bytes, out.length) == out.length;
+    file.close();
+    if (ok) return true;
+  }
+
+  PGM_P source = builtin(name);
+  if (source == nullptr) return false;
+  char text[TEMPLATE_BUILTIN_SIZE];
+  strncpy_P(text, source, sizeof(text) - 1);
+  text[sizeof(text) - 1] = '\0';
+  return compiler.compile(text, strlen(text), out);
+}
+
+const char *TemplateStore::builtin(const char *name) {
+  for (const BuiltinTemplate &entry : BUILTINS) {
+    if (strcmp(entry.name, name) == 0) return entry.source;
+  }
+  return nullptr;
+}
@@ -0,0 +1,130 @@
+#ifndef RECEIPT_TEMPLATE_H
+#define RECEIPT_TEMPLATE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#define TEMPLATE_MAX_SOURCE 1024      // Template text accepted by an upload
+#define TEMPLATE_BUILTIN_SIZE 320     // Longest built-in template, copied to the stack to compile
+#define TEMPLATE_MAX_ITEMS 24         // Directives per template
+#define TEMPLATE_MAX_BYTES 512        // Compiled printer bytes per template
+#define TEMPLATE_MAX_SLOTS 6          // Placeholders per template
+#define TEMPLATE_NAME_SIZE 16         // Name plus NUL, [a-z0-9_-]
+#define TEMPLATE_CACHE 2              // Compiled templates kept in RAM, the least recently printed is replaced
+#define TEMPLATE_ERROR_SIZE 48
+
+enum TemplateSlotKind : uint8_t {
+  SLOT_MESSAGE,                                     // text {message}: the message, wrapped, last line first
+  SLOT_CHECKLIST,                                   // checklist {message}: same with a box in front of every line
+  SLOT_TIMESTAMP,                                   // text {timestamp}
+  SLOT_TIMESTAMP_INVERTED,                          // inverted {timestamp}: white on black header
+  SLOT_QR,                                          // qr {qr}: QR symbol of the request's qr field
+  SLOT_LOGO                                         // logo <id>: stored logo, the id is kept in width
+};
+
+struct TemplateSlot {
+  uint16_t offset;                                  // where in the bytes the value goes
+  uint8_t kind;                                     // TemplateSlotKind
+  uint8_t width;                                    // characters per line at the slot's character size
+};
+
+// A template after compiling: printer bytes with gaps for the values that
+// change per receipt. Slots are in byte order. Stored as is in flash.
+struct CompiledTemplate {
+  uint16_t magic;
+  uint16_t length;
+  uint8_t slotCount;
+  TemplateSlot slots[TEMPLATE_MAX_SLOTS];
+  uint8_t bytes[TEMPLATE_MAX_BYTES];
+};
+
+// Turns template text into a CompiledTemplate. One directive per line, in
+// reading order from the top of the receipt; '#' starts a comment:
+//
+//   text <text>              wrapped to the line width
+//   inverted <text>          white on black, one line
+//   checklist {message}      message lines behind "[ ] " boxes
+//   qr <text>                QR symbol
+//   logo <id>                logo stored with /print-image?logo=<id>, 0 to LOGO_SLOTS - 1
+//   feed <lines>
+//   cut                      dashed line
+//   bold on|off, underline 0|1|2, size <width> <height>, align left|center|right
+//
+// Placeholders stand in for the text: {message} or {timestamp} with text,
+// {timestamp} with inverted, {qr} with qr. Styles hold until changed. The printer is mounted upside down, so the
+// compiler emits the directives last to first, with the style changes between
+// them worked out for that order, and ends in the default style.
+class TemplateCompiler {
+  public:
+    TemplateCompiler(uint8_t lineWidth, uint8_t codePage);
+
+    bool compile(char *source, size_t length, CompiledTemplate &out); // source is changed (literals transcoded)
+    const char *error() const { return errorText; }
+
+  private:
+    struct Style {
+      uint8_t bold;
+      uint8_t underline;
+      uint8_t size;                                 // GS ! value, width - 1 in the high nibble
+      uint8_t align;
+    };
+    struct Item {
+      uint8_t kind;
+      uint8_t arg;                                  // slot kind or feed lines
+      Style style;
+      char *text;
+      uint16_t length;
+    };
+
+    uint8_t lineWidth;
+    uint8_t codePage;
+    Item items[TEMPLATE_MAX_ITEMS];
+    uint8_t itemCount;
+    CompiledTemplate *out;
+    bool overflow;
+    char errorText[TEMPLATE_ERROR_SIZE];
+
+    bool parseLine(char *line, size_t length, Style &style, uint16_t number);
+    void emitItem(const Item &item);
+    void emitStyle(Style &current, const Style &wanted);
+    void emit(const uint8_t *data, size_t length);
+    void emit(uint8_t c) { emit(&c, 1); }
+    void slot(uint8_t kind, uint8_t width);
+    uint8_t widthFor(const Style &style) const;
+    bool fail(uint16_t line, const char *message);
+};
+
+// Named templates: built-ins kept in program flash and uploads compiled once
+// and stored as "/tpl-<name>.bin". An upload of a built-in name replaces it.
+// The most recently printed ones stay in RAM.
+class TemplateStore {
+  public:
+    TemplateStore(uint8_t lineWidth, uint8_t codePage);
+
+    const CompiledTemplate *find(const char *name);     // nullptr when there is no such template
+    bool exists(const char *name);
+    bool save(const char *name, char *source, size_t length); // compile and store, false with error()
+    const char *error() const { return failure; }
+    bool storageError() const { return noFlash; }       // the error is flash, not the template
+
+    static bool validName(const char *name);
+
+  private:
+    struct Entry {
+      char name[TEMPLATE_NAME_SIZE];                  // empty = free
+      uint32_t used;                                  // LRU stamp
+      CompiledTemplate compiled;
+    };
+
+    TemplateCompiler compiler;
+    Entry cache[TEMPLATE_CACHE];
+    uint32_t clock;
+    const char *failure;
+    bool noFlash;
+
+    Entry &victim();
+    bool load(const char *name, CompiledTemplate &out);
+    static const char *builtin(const char *name);       // PROGMEM source, nullptr when not built in
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include "Scheduler.h"
+
+
+Scheduler::Scheduler() : taskCount(0), dropCount(0) {
+}
+
+bool Scheduler::add(const char *name, TaskFunction fn, uint16_t budgetMs) {
+  if (taskCount >= MAX_TASKS) {
+    dropCount++;
+    return false;
+  }
+
+  Task &t = tasks[taskCount++];
+  t.name = name;
+  t.run = fn;
+  t.budgetMs = budgetMs;
+  t.nextRun = millis();                                                     // first slice runs right away
+  t.runs = 0;
+  t.overruns = 0;
+  t.maxRunMs = 0;
+  return true;
+}
+
+void Scheduler::wake(const char *name) {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    if (strcmp(tasks[i].name, name) == 0) tasks[i].nextRun = millis();
+  }
+}
+
+void Scheduler::run() {
+  for (uint8_t i = 0; i < taskCount; i++) {
+    Task &t = tasks[i];
+    uint32_t start = millis();
+    if ((int32_t)(start - t.nextRun) < 0) continue;                          // not due yet (wrap-safe)
+
+    uint32_t sleepMs = t.run(t.budgetMs);
+
+    uint32_t end = millis();
+    uint32_t took = end - start;
+    t.runs++;
+    if (took > t.budgetMs) t.overruns++;
+    if (took > t.maxRunMs) t.maxRunMs = took;
+    t.nextRun = end + sleepMs;
+  }
+
+  // Idle until the earliest deadline
+  uint32_t now = millis();
+  uint32_t idle = MAX_IDLE_MS;
+  for (uint8_t i = 0; i < taskCount; i++) {
+    int32_t until = (int32_t)(tasks[i].nextRun - now);
+    if (until <= 0) return;                                                 // something is already due
+    if ((uint32_t)until < idle) idle = until;
+  }
+  delay(idle);
+}
@@ -0,0 +1,46 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <Arduino.h>
+
+#ifndef MAX_TASKS
+#define MAX_TASKS 12                  // Max number of tasks the scheduler can hold, main.cpp adds 8
+#endif
+#define MAX_IDLE_MS 50                // Upper bound for a single idle period
+
+// A task runs one slice of work and returns how many milliseconds it wants to
+// sleep before its next slice. It should try to return within budgetMs.
+typedef uint32_t (*TaskFunction)(uint32_t budgetMs);
+
+struct Task {
+  const char *name;
+  TaskFunction run;
+  uint16_t budgetMs;                                // Time a single slice is allowed to take
+  uint32_t nextRun;                                 // millis() deadline of the next slice
+  uint32_t runs;                                    // Slices executed
+  uint32_t overruns;                                // Slices that took longer than budgetMs
+  uint32_t maxRunMs;                                // Longest slice seen
+};
+
+// Cooperative round-robin scheduler. run() executes every task whose deadline
+// has passed, then idles until the earliest next deadline (delay() on the
+// ESP8266 yields to the WiFi stack while idling).
+class Scheduler {
+  public:
+    Scheduler();
+
+    bool add(const char *name, TaskFunction fn, uint16_t budgetMs);    // false when the task table is full
+    void wake(const char *name);                        // make a task due immediately
+    void run();                                         // call from loop()
+
+    uint8_t count() const { return taskCount; }
+    uint8_t dropped() const { return dropCount; }       // add() calls refused for a full table
+    const Task &task(uint8_t i) const { return tasks[i]; }
+
+  private:
+    Task tasks[MAX_TASKS];
+    uint8_t taskCount;
+    uint8_t dropCount;
+};
+
+#endif
@@ -0,0 +1,493 @@
+#include "Spool.h"
+
+#define RECORD_MAGIC 0x5352           // "SR"
+#define RECORD_ENQUEUE 1
+#define RECORD_COMMIT 2
+#define RECORD_CLIENT 0x80            // In header.flags, not a receipt flag: the sender's address follows the header
+
+struct RecordHeader {
+  uint16_t magic;
+  uint8_t type;
+  uint8_t codePage;
+  uint32_t id;
+  uint16_t messageLength;
+  uint8_t timestampLength;
+  uint8_t flags;                                    // Receipt flags and RECORD_CLIENT, 0 in journals written before batches existed
+  uint32_t crc;                                     // CRC-32 over the header (crc = 0) and the payload
+};
+
+// Follows the timestamp when flags has RECEIPT_TEMPLATE, then the layout name and QR text
+struct RecordLayout {
+  uint8_t layoutLength;
+  uint8_t qrLength;
+};
+
+// One record buffer for begin(), refill(), commit() and compact(), they never
+// run at the same time, one replay bitmap (1 = journaled, not committed) and
+// one of the receipts in flash only (1 = spilled, not loaded yet), by id - firstId
+static Receipt scratch;
+static uint8_t pendingBits[SPOOL_MAX_JOBS / 8];
+static uint8_t spilledBits[SPOOL_MAX_JOBS / 8];
+
+// Reads records at offset: from the journal up to what reached flash, from the write buffer after that
+struct SpoolCursor {
+  File &file;
+  uint32_t flashed;
+  const uint8_t *buffer;
+  size_t bufferLength;
+  uint32_t offset;
+
+  bool read(void *to, size_t length) {
+    if (offset < flashed) {
+      if (file.position() != offset && !file.seek(offset, SeekSet)) return false;
+      if (file.read((uint8_t*)to, length) != length) return false;
+    } else {
+      size_t at = offset - flashed;
+      if (at > bufferLength || length > bufferLength - at) return false;
+      memcpy(to, buffer + at, length);
+    }
+    offset += length;
+    return true;
+  }
+};
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (uint8_t k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+static uint32_t recordCrc(RecordHeader header, const Receipt &receipt, const RecordLayout &layout) {
+  header.crc = 0;
+  uint32_t crc = crc32(0, (const uint8_t*)&header, sizeof(header));
+  if (header.flags & RECORD_CLIENT) crc = crc32(crc, (const uint8_t*)&receipt.client, sizeof(receipt.client));
+  crc = crc32(crc, (const uint8_t*)receipt.message, header.messageLength);
+  crc = crc32(crc, (const uint8_t*)receipt.timestamp, header.timestampLength);
+  if (!(header.flags & RECEIPT_TEMPLATE)) return crc;
+  crc = crc32(crc, (const uint8_t*)&layout, sizeof(layout));
+  crc = crc32(crc, (const uint8_t*)receipt.layout, layout.layoutLength);
+  return crc32(crc, (const uint8_t*)receipt.qr, layout.qrLength);
+}
+
+// One record through read(to, length), which is false when it cannot give all length bytes
+template <typename Read>
+static bool decodeRecord(Read read, uint8_t &type, Receipt &receipt) {
+  RecordHeader header;
+  if (!read(&header, sizeof(header))) return false;
+  if (header.magic != RECORD_MAGIC || header.messageLength > MAX_MESSAGE_LENGTH
+      || header.timestampLength > MAX_TIMESTAMP_LENGTH) return false;
+
+  receipt.client = 0;                                                       // older records share one turn
+  if ((header.flags & RECORD_CLIENT) && !read(&receipt.client, sizeof(receipt.client))) return false;
+  if (!read(receipt.message, header.messageLength)) return false;
+  if (!read(receipt.timestamp, header.timestampLength)) return false;
+  RecordLayout layout = {0, 0};
+  if (header.flags & RECEIPT_TEMPLATE) {
+    if (!read(&layout, sizeof(layout))) return false;
+    if (layout.layoutLength > MAX_LAYOUT_LENGTH || layout.qrLength > MAX_QR_LENGTH) return false;
+    if (!read(receipt.layout, layout.layoutLength)) return false;
+    if (!read(receipt.qr, layout.qrLength)) return false;
+  }
+  if (recordCrc(header, receipt, layout) != header.crc) return false;
+
+  receipt.message[header.messageLength] = '\0';
+  receipt.timestamp[header.timestampLength] = '\0';
+  receipt.layout[layout.layoutLength] = '\0';
+  receipt.qr[layout.qrLength] = '\0';
+  receipt.id = header.id;
+  receipt.codePage = header.codePage;
+  receipt.flags = header.flags & ~RECORD_CLIENT;
+  type = header.type;
+  return true;
+}
+
+// Type, id and sender of the record at the cursor, which moves past it without reading the text
+static bool peekRecord(SpoolCursor &cursor, RecordHeader &header, uint32_t &client) {
+  if (!cursor.read(&header, sizeof(header)) || header.magic != RECORD_MAGIC) return false;
+  client = 0;
+  if ((header.flags & RECORD_CLIENT) && !cursor.read(&client, sizeof(client))) return false;
+  cursor.offset += header.messageLength + header.timestampLength;
+  if (!(header.flags & RECEIPT_TEMPLATE)) return true;
+  RecordLayout layout;
+  if (!cursor.read(&layout, sizeof(layout))) return false;
+  cursor.offset += layout.layoutLength + layout.qrLength;
+  return true;
+}
+
+
+ReceiptSpool::ReceiptSpool()
+  : mounted(false), idCounter(0), firstId(0), pendingCount(0), spilledCount(0),
+    readOffset(0), batchOpen(false), batchNextId(0), writeCount(0), compactCount(0), compactedSize(0),
+    bufferLength(0), bufferSince(0) {
+}
+
+bool ReceiptSpool::begin(ReceiptQueue &queue) {
+  mounted = LittleFS.begin();
+  if (!mounted) return false;
+  LittleFS.remove(SPOOL_PATH_NEW);                                          // compaction cut short, the old journal is intact
+
+  memset(pendingBits, 0, sizeof(pendingBits));
+  memset(spilledBits, 0, sizeof(spilledBits));
+  Receipt &receipt = scratch;
+  uint8_t type;
+  bool first = true;
+  uint32_t validEnd = 0;
+
+  // Pass 1: find unprinted receipts and the end of the last intact record
+  File file = LittleFS.open(SPOOL_PATH, "r");
+  if (file) {
+    while (readRecord(file, type, receipt)) {
+      if (first) firstId = receipt.id;
+      first = false;
+      uint32_t slot = receipt.id - firstId;
+      if (slot < SPOOL_MAX_JOBS) {
+        if (type == RECORD_ENQUEUE) pendingBits[slot >> 3] |= 1 << (slot & 7);
+        else pendingBits[slot >> 3] &= ~(1 << (slot & 7));
+      }
+      if (receipt.id >= idCounter) idCounter = receipt.id + 1;
+      // A batch is only valid once its last receipt is in, a cut-off batch is dropped like a torn record
+      if (type != RECORD_ENQUEUE || !(receipt.flags & RECEIPT_BATCH_MORE)) validEnd = file.position();
+    }
+    file.close();
+  }
+
+  // Pass 2: queue them again in journal order, the rest stays spilled
+  file = LittleFS.open(SPOOL_PATH, "r");
+  if (file) {
+    uint32_t offset = 0;
+    while (offset < validEnd && readRecord(file, type, receipt)) {
+      uint32_t slot = receipt.id - firstId;
+      if (type == RECORD_ENQUEUE && slot < SPOOL_MAX_JOBS && (pendingBits[slot >> 3] & (1 << (slot & 7)))) {
+        pendingCount++;
+        if (spilledCount == 0 && queue.push(receipt) != nullptr) {
+          batchOpen = receipt.flags & RECEIPT_BATCH_MORE;                   // the rest of it is the first to load
+          batchNextId = receipt.id + 1;
+        } else {
+          if (spilledCount == 0) readOffset = offset;
+          markSpilled(receipt.id, true);
+          spilledCount++;
+        }
+      }
+      offset = file.position();
+    }
+    file.close();
+  }
+
+  journal = LittleFS.open(SPOOL_PATH, "a");
+  if (journal && journal.size() > validEnd) journal.truncate(validEnd);    // drop a torn record
+  if (first) firstId = idCounter;
+  sweepMessages();
+  return (bool)journal;
+}
+
+void ReceiptSpool::sweepMessages() {
+  // A long message is renamed to /msg-<id>.txt just before its receipt is
+  // journaled: a power cut in between leaves a file nothing prints or removes.
+  // Removing while a directory is read may skip entries, so the scan starts
+  // over after each one; there is at most one per power cut.
+  for (bool removed = true; removed;) {
+    removed = false;
+    char path[32];
+    Dir dir = LittleFS.openDir("/");
+    while (!removed && dir.next()) {
+      File file = dir.openFile("r");
+      if (!file) continue;
+      unsigned long id;
+      char extension[4];
+      if (sscanf(file.name(), "msg-%lu.%3s", &id, extension) == 2 && !isPending(id)) {
+        snprintf(path, sizeof(path), "/%s", file.name());
+        removed = true;
+      }
+      file.close();
+    }
+    if (removed) LittleFS.remove(path);
+  }
+}
+
+bool ReceiptSpool::isPending(uint32_t id) const {
+  uint32_t slot = id - firstId;
+  return slot < SPOOL_MAX_JOBS && (pendingBits[slot >> 3] & (1 << (slot & 7)));
+}
+
+bool ReceiptSpool::isSpilled(uint32_t id) const {
+  uint32_t slot = id - firstId;
+  return slot < SPOOL_MAX_JOBS && (spilledBits[slot >> 3] & (1 << (slot & 7)));
+}
+
+void ReceiptSpool::markSpilled(uint32_t id, bool spilled) {
+  uint32_t slot = id - firstId;
+  if (slot >= SPOOL_MAX_JOBS) return;
+  if (spilled) spilledBits[slot >> 3] |= 1 << (slot & 7);
+  else spilledBits[slot >> 3] &= ~(1 << (slot & 7));
+}
+
+uint32_t ReceiptSpool::nextId() {
+  return idCounter++;
+}
+
+bool ReceiptSpool::accept(const Receipt &receipt, ReceiptQueue &queue) {
+  if (!mounted) return queue.push(receipt) != nullptr;
+
+  // Ids of one journal must fit the replay bitmap, compacting moves it up to the oldest pending receipt
+  if (receipt.id - firstId >= SPOOL_MAX_JOBS) compact(receipt.id);
+  if (receipt.id - firstId >= SPOOL_MAX_JOBS) return false;
+
+  // Keep the order: once something is spilled, newer receipts queue up behind it in flash
+  bool spill = spilledCount > 0 || queue.isFull();
+  uint32_t offset = journal.size() + bufferLength;                          // where this record will land
+  if (!append(RECORD_ENQUEUE, receipt)) return false;
+  pendingCount++;
+
+  if (spill) {
+    if (spilledCount == 0) readOffset = offset;
+    markSpilled(receipt.id, true);
+    spilledCount++;
+  } else {
+    queue.push(receipt);
+    batchOpen = receipt.flags & RECEIPT_BATCH_MORE;                         // should the rest spill, it is the first to load
+    batchNextId = receipt.id + 1;
+  }
+  return true;
+}
+
+bool ReceiptSpool::reserve(uint16_t count, size_t messageBytes, const ReceiptQueue &queue) {
+  if (!mounted) return RECEIPT_QUEUE_SLOTS - queue.size() >= count;
+  if (!journal) return false;
+
+  // The next count ids must fit the replay bitmap
+  if (idCounter + count - firstId > SPOOL_MAX_JOBS) compact(idCounter);
+  if (idCounter + count - firstId > SPOOL_MAX_JOBS) return false;
+
+  // And their records the buffer, or the flash once the buffer is written out
+  size_t bytes = count * (sizeof(RecordHeader) + MAX_TIMESTAMP_LENGTH) + messageBytes;
+  if (bytes <= SPOOL_WRITE_BUFFER - bufferLength) return true;
+  if (!flush()) return false;
+  FSInfo info;
+  return bytes <= SPOOL_WRITE_BUFFER || (LittleFS.info(info) && info.usedBytes + bytes <= info.totalBytes);
+}
+
+void ReceiptSpool::commit(uint32_t id) {
+  if (!mounted) return;
+  scratch.id = id;
+  scratch.message[0] = '\0';
+  scratch.timestamp[0] = '\0';
+  scratch.codePage = 0;
+  scratch.flags = 0;
+  scratch.client = 0;
+  append(RECORD_COMMIT, scratch);
+  if (pendingCount > 0) pendingCount--;
+}
+
+void ReceiptSpool::refill(ReceiptQueue &queue) {
+  if (!mounted || spilledCount == 0 || queue.isFull()) return;
+
+  if (readOffset >= journal.size()) flush();                                // next spilled record still sits in the buffer
+  File file = LittleFS.open(SPOOL_PATH, "r");
+  SpoolCursor cursor = {file, (uint32_t)journal.size(), buffer, bufferLength, readOffset};
+
+  // Pass 0 finishes a batch loaded in part, it must be the next push. Pass 1
+  // gives every sender with nothing in RAM a turn with its oldest receipt, so
+  // one sender's backlog in flash does not hold back those who came after it.
+  // Pass 2 fills the rest in journal order. A batch's records follow each other.
+  RecordHeader header;
+  uint32_t client;
+  uint8_t type;
+  for (uint8_t pass = batchOpen ? 0 : 1; pass <= 2; pass++) {
+    cursor.offset = readOffset;
+    while (spilledCount > 0 && !queue.isFull() && (pass > 0 || batchOpen)) {
+      uint32_t at = cursor.offset;
+      if (!peekRecord(cursor, header, client)) break;
+      if (header.type != RECORD_ENQUEUE || !isSpilled(header.id)) continue;
+      if (batchOpen ? header.id != batchNextId : pass == 1 && queue.holds(client)) continue;
+      cursor.offset = at;
+      if (!decodeRecord([&](void *to, size_t length) { return cursor.read(to, length); }, type, scratch)) break;
+      queue.push(scratch);
+      markSpilled(scratch.id, false);
+      spilledCount--;
+      batchOpen = scratch.flags & RECEIPT_BATCH_MORE;
+      batchNextId = scratch.id + 1;
+    }
+  }
+
+  // Skip what is loaded now, commits of loaded receipts included
+  cursor.offset = readOffset;
+  while (spilledCount > 0 && peekRecord(cursor, header, client)) {
+    if (header.type == RECORD_ENQUEUE && isSpilled(header.id)) break;
+    readOffset = cursor.offset;
+  }
+  file.close();
+}
+
+void ReceiptSpool::tick() {
+  if (bufferLength > 0 && millis() - bufferSince >= SPOOL_FLUSH_MS && !flush()) {
+    bufferSince = millis();                                                 // flash full, try again later
+    if (pendingCount == 0) compact(idCounter);                              // or start over once everything is printed
+  }
+  // Rewrite once the journal is mostly printed receipts: past SPOOL_COMPACT_BYTES, and
+  // twice what the last rewrite left so a large backlog is not copied on every tick
+  uint32_t size = journal ? journal.size() + bufferLength : 0;
+  if (size > SPOOL_COMPACT_BYTES && size > 2 * compactedSize) compact(idCounter);
+}
+
+bool ReceiptSpool::append(uint8_t type, const Receipt &receipt) {
+  if (recordSize(receipt) > SPOOL_WRITE_BUFFER - bufferLength && !flush()) return false; // flash full, the buffer keeps what it has
+  if (!journal) return false;
+
+  if (bufferLength == 0) bufferSince = millis();
+  bufferLength += encode(type, receipt, buffer + bufferLength);
+  return true;
+}
+
+size_t ReceiptSpool::recordSize(const Receipt &receipt) {
+  size_t size = sizeof(RecordHeader) + strlen(receipt.message) + strlen(receipt.timestamp);
+  if (receipt.client != 0) size += sizeof(receipt.client);
+  if (receipt.flags & RECEIPT_TEMPLATE) size += sizeof(RecordLayout) + strlen(receipt.layout) + strlen(receipt.qr);
+  return size;
+}
+
+size_t ReceiptSpool::encode(uint8_t type, const Receipt &receipt, uint8_t *out) {
+  RecordHeader header;
+  header.magic = RECORD_MAGIC;
+  header.type = type;
+  header.codePage = receipt.codePage;
+  header.id = receipt.id;
+  header.messageLength = strlen(receipt.message);
+  header.timestampLength = strlen(receipt.timestamp);
+  header.flags = receipt.flags | (receipt.client != 0 ? RECORD_CLIENT : 0);
+  RecordLayout layout = {0, 0};
+  if (header.flags & RECEIPT_TEMPLATE) {
+    layout.layoutLength = strlen(receipt.layout);
+    layout.qrLength = strlen(receipt.qr);
+  }
+  header.crc = recordCrc(header, receipt, layout);
+
+  size_t length = 0;
+  memcpy(out + length, &header, sizeof(header));
+  length += sizeof(header);
+  if (header.flags & RECORD_CLIENT) {
+    memcpy(out + length, &receipt.client, sizeof(receipt.client));
+    length += sizeof(receipt.client);
+  }
+  memcpy(out + length, receipt.message, header.messageLength);
+  length += header.messageLength;
+  memcpy(out + length, receipt.timestamp, header.timestampLength);
+  length += header.timestampLength;
+  if (header.flags & RECEIPT_TEMPLATE) {
+    memcpy(out + length, &layout, sizeof(layout));
+    length += sizeof(layout);
+    memcpy(out + length, receipt.layout, layout.layoutLength);
+    length += layout.layoutLength;
+    memcpy(out + length, receipt.qr, layout.qrLength);
+    length += layout.qrLength;
+  }
+  return length;
+}
+
+bool ReceiptSpool::flush() {
+  if (!journal) return false;
+  if (bufferLength == 0) return true;
+
+  // A short write (flash full) is cut off again, a torn tail would end the replay early
+  uint32_t size = journal.size();
+  if (journal.write(buffer, bufferLength) != bufferLength) {
+    if (journal.size() > size) journal.truncate(size);
+    return false;
+  }
+  journal.flush();
+  bufferLength = 0;
+  writeCount++;
+  return true;
+}
+
+bool ReceiptSpool::compact(uint32_t nextId) {
+  if (!journal) return false;
+  if (pendingCount == 0) {
+    // Nothing to keep, buffered commits included: start over, this also frees a full flash
+    bufferLength = 0;
+    memset(spilledBits, 0, sizeof(spilledBits));
+    batchOpen = false;
+    journal.close();
+    LittleFS.remove(SPOOL_PATH);
+    journal = LittleFS.open(SPOOL_PATH, "a");
+    firstId = nextId;
+    readOffset = 0;
+    compactedSize = 0;
+    compactCount++;
+    return (bool)journal;
+  }
+  if (!flush()) {
+    compactedSize = journal.size() + bufferLength;                          // flash full, tick() tries again once it doubled
+    return false;
+  }
+
+  // Pass 1: which receipts are still waiting
+  File file = LittleFS.open(SPOOL_PATH, "r");
+  if (!file) return false;
+  memset(pendingBits, 0, sizeof(pendingBits));
+  uint8_t type;
+  while (readRecord(file, type, scratch)) {
+    uint32_t slot = scratch.id - firstId;
+    if (slot >= SPOOL_MAX_JOBS) continue;
+    if (type == RECORD_ENQUEUE) pendingBits[slot >> 3] |= 1 << (slot & 7);
+    else pendingBits[slot >> 3] &= ~(1 << (slot & 7));
+  }
+  uint32_t live = 0;
+  for (uint32_t slot = 0; slot < SPOOL_MAX_JOBS; slot++) {
+    if (pendingBits[slot >> 3] & (1 << (slot & 7))) live++;
+  }
+
+  // Pass 2: copy their ENQUEUE records, oldest first, into a new journal that replaces the old one
+  // in one rename. A power cut before that leaves the old journal and SPOOL_PATH_NEW, which begin() removes.
+  File out = LittleFS.open(SPOOL_PATH_NEW, "w");
+  if (!out) {
+    file.close();
+    return false;
+  }
+  file.seek(0, SeekSet);
+  uint32_t copied = 0, oldest = nextId, newReadOffset = 0;
+  bool ok = true, spilledSeen = false;
+  while (ok && readRecord(file, type, scratch)) {
+    uint32_t slot = scratch.id - firstId;
+    if (type != RECORD_ENQUEUE || slot >= SPOOL_MAX_JOBS || !(pendingBits[slot >> 3] & (1 << (slot & 7)))) continue;
+    if (copied == 0) oldest = scratch.id;
+    if (!spilledSeen && isSpilled(scratch.id)) newReadOffset = out.size() + bufferLength; // the oldest one in flash only
+    spilledSeen |= isSpilled(scratch.id);
+    if (recordSize(scratch) > SPOOL_WRITE_BUFFER - bufferLength) {
+      ok = out.write(buffer, bufferLength) == bufferLength;
+      bufferLength = 0;
+    }
+    bufferLength += encode(RECORD_ENQUEUE, scratch, buffer + bufferLength);
+    copied++;
+  }
+  if (ok && bufferLength > 0) ok = out.write(buffer, bufferLength) == bufferLength;
+  bufferLength = 0;
+  file.close();
+  out.close();
+
+  if (!ok || copied != live) {
+    LittleFS.remove(SPOOL_PATH_NEW);                                        // flash full, the old journal stays
+    compactedSize = journal.size();                                         // tick() tries again once it doubled
+    return false;
+  }
+  journal.close();
+  if (!LittleFS.rename(SPOOL_PATH_NEW, SPOOL_PATH)) {
+    LittleFS.remove(SPOOL_PATH_NEW);
+    journal = LittleFS.open(SPOOL_PATH, "a");
+    return false;
+  }
+  journal = LittleFS.open(SPOOL_PATH, "a");
+  for (uint32_t slot = 0; slot < SPOOL_MAX_JOBS; slot++) markSpilled(firstId + slot, isSpilled(oldest + slot)); // the bitmap starts at oldest
+  firstId = oldest;
+  pendingCount = live;
+  if (spilledCount > 0) readOffset = newReadOffset;
+  compactedSize = journal.size();
+  compactCount++;
+  return (bool)journal;
+}
+
+bool ReceiptSpool::readRecord(File &file, uint8_t &type, Receipt &receipt) {
+  return decodeRecord([&](void *to, size_t length) { return file.read((uint8_t*)to, length) == length; }, type, receipt);
+}
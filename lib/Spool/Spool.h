@@ -0,0 +1,98 @@
+#ifndef SPOOL_H
+#define SPOOL_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <ReceiptQueue.h>
+
+#define SPOOL_PATH "/spool.log"
+#define SPOOL_PATH_NEW "/spool.new"   // Journal being rewritten by compaction
+#define SPOOL_WRITE_BUFFER 1024       // Records collected in RAM before they are written to flash
+#define SPOOL_FLUSH_MS 250            // Max time a record waits in RAM, the window a power cut can lose
+#define SPOOL_MAX_JOBS 1024           // Receipts one journal can hold (sizes the replay bitmap)
+#define SPOOL_COMPACT_BYTES 32768     // Rewrite the journal with only the pending receipts past this size
+
+// Append-only receipt journal on LittleFS.
+//
+// Every accepted receipt is written as an ENQUEUE record and a COMMIT record
+// follows once it has been printed. On boot, recover() replays ENQUEUE records
+// without a COMMIT into the RAM queue. Receipts that do not fit the RAM queue
+// stay "spilled" in the journal and are loaded by refill() as slots free up,
+// so a burst can be much larger than RAM. Records keep the sender's address:
+// refill() first gives each sender with nothing in RAM its oldest receipt,
+// then loads the rest in journal order, so one sender's backlog in flash
+// does not hold back everyone who came after it. Long message files
+// ("/msg-<id>.txt" and its page index) of receipts that are not pending are
+// removed at the same time, a power cut can leave one behind.
+//
+// Records are CRC-checked; a torn record at the end of the file (power cut
+// during a write) ends the replay and is cut off. Writes are batched in a RAM
+// buffer and reach flash at most SPOOL_FLUSH_MS later, or earlier when the
+// buffer fills. When the flash is full they stay in the buffer, refill()
+// loads spilled receipts from there, and accept() fails once the buffer is
+// full too, instead of answering for receipts that never reach flash.
+//
+// A batch of receipts is journaled as consecutive ENQUEUE records, all but
+// the last flagged RECEIPT_BATCH_MORE. Replay treats a batch without its last
+// record like a torn record, so a batch comes back whole or not at all.
+//
+// The journal is compacted by copying only the receipts still pending into a
+// new file that replaces it with one rename, so it happens under load too:
+// when it has grown past SPOOL_COMPACT_BYTES and when the ids of one journal
+// would no longer fit the replay bitmap. The bitmap then starts at the oldest
+// pending id, and only SPOOL_MAX_JOBS receipts waiting at once fill it up.
+//
+// A receipt printed from a template (RECEIPT_TEMPLATE) carries the template
+// name and QR text behind its timestamp, the sender's address follows the
+// header when a flag says so. Other records are laid out as in journals
+// written before templates existed, their receipts replay as sender 0.
+class ReceiptSpool {
+  public:
+    ReceiptSpool();
+
+    bool begin(ReceiptQueue &queue);                    // mount, replay unprinted receipts, false if no filesystem (spool then stays off)
+    uint32_t nextId();                                  // id for the next receipt, unique across reboots
+
+    bool accept(const Receipt &receipt, ReceiptQueue &queue); // journal a receipt and queue it in RAM or spill it, false when full
+    bool reserve(uint16_t count, size_t messageBytes, const ReceiptQueue &queue); // true when the next count accept() calls will succeed
+    void commit(uint32_t id);                           // receipt has been printed
+    void refill(ReceiptQueue &queue);                   // move spilled receipts into free RAM slots
+    void tick();                                        // flush old buffered records, call regularly
+
+    bool enabled() const { return mounted; }
+    uint32_t pending() const { return pendingCount; }   // journaled but not yet printed
+    uint32_t spilled() const { return spilledCount; }   // waiting in flash only
+    uint32_t flashWrites() const { return writeCount; } // flushes to flash since boot
+    uint32_t compactions() const { return compactCount; }
+
+  private:
+    bool mounted;
+    File journal;
+    uint32_t idCounter;
+    uint32_t firstId;                                   // lowest id in the current journal
+    uint32_t pendingCount;
+    uint32_t spilledCount;
+    uint32_t readOffset;                                // oldest spilled record not loaded yet
+    bool batchOpen;                                     // the last receipt loaded has more of its batch after it
+    uint32_t batchNextId;                               // id of that next one
+    uint32_t writeCount;
+    uint32_t compactCount;
+    uint32_t compactedSize;                             // journal size right after the last compaction
+
+    uint8_t buffer[SPOOL_WRITE_BUFFER];
+    size_t bufferLength;
+    uint32_t bufferSince;                               // millis() of the oldest buffered byte
+
+    bool append(uint8_t type, const Receipt &receipt);
+    bool flush();                                       // false when the flash is full, the buffer then keeps the records
+    bool compact(uint32_t nextId);                      // keep only pending receipts, nextId starts an empty journal
+    void sweepMessages();                               // remove long message files of receipts the journal does not hold
+    bool isPending(uint32_t id) const;                  // by the replay bitmap, only valid during begin()
+    bool isSpilled(uint32_t id) const;                  // in flash only, not loaded into RAM yet
+    void markSpilled(uint32_t id, bool spilled);
+    static size_t recordSize(const Receipt &receipt);
+    static size_t encode(uint8_t type, const Receipt &receipt, uint8_t *out); // record into out, returns its size
+    bool readRecord(File &file, uint8_t &type, Receipt &receipt);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "TimeFormat.h"
+
+static const char dayNames[7][4] PROGMEM = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
+static const char monthNames[12][4] PROGMEM = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                               "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+
+uint8_t daysInMonth(int year, int month) {
+  static const uint8_t days[12] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+  bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  return month == 2 && leap ? 29 : days[month - 1];
+}
+
+void civilFromDays(int32_t days, int &year, int &month, int &day) {
+  // Inverse of daysFromCivil (H. Hinnant's civil_from_days)
+  days += 719468;
+  int32_t era = (days >= 0 ? days : days - 146096) / 146097;
+  uint32_t doe = days - era * 146097;
+  uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  uint32_t mp = (5 * doy + 2) / 153;
+  day = doy - (153 * mp + 2) / 5 + 1;
+  month = mp < 10 ? mp + 3 : mp - 9;
+  year = yoe + era * 400 + (month <= 2);
+}
+
+void formatDate(char *out, int year, int month, int day) {
+  // Format: "Sat, 06 Jun 2025"
+  uint8_t dayOfWeek = weekdayFromDays(daysFromCivil(year, month, day));
+  memcpy_P(out, dayNames[dayOfWeek], 3);
+  out[3] = ','; out[4] = ' ';
+  out[5] = '0' + day / 10; out[6] = '0' + day % 10;
+  out[7] = ' ';
+  memcpy_P(out + 8, monthNames[month - 1], 3);
+  out[11] = ' ';
+  out[12] = '0' + year / 1000 % 10; out[13] = '0' + year / 100 % 10;
+  out[14] = '0' + year / 10 % 10; out[15] = '0' + year % 10;
+  out[16] = '\0';
+}
+
+void formatDateHeader(char *out, unsigned long epochTime) {
+  int year, month, day;
+  civilFromDays(epochTime / 86400, year, month, day);
+  formatDate(out, year, month, day);
+}
+
+// Reads an unsigned number, returns the position after it or nullptr if there is none
+static const char *readNumber(const char *s, int &value) {
+  if (*s < '0' || *s > '9') return nullptr;
+  value = 0;
+  while (*s >= '0' && *s <= '9' && value < 100000) value = value * 10 + (*s++ - '0');
+  return s;
+}
+
+bool parseCustomDate(const char *customDate, int &year, int &month, int &day) {
+  // Expected format: YYYY-MM-DD or DD/MM/YYYY
+  int a = 0, b = 0, c = 0;
+  const char *s = readNumber(customDate, a);
+  if (s == nullptr || (*s != '-' && *s != '/')) return false;
+  char separator = *s;
+  s = readNumber(s + 1, b);
+  if (s == nullptr || *s != separator) return false;
+  if (readNumber(s + 1, c) == nullptr) return false;
+
+  if (separator == '-') { year = a; month = b; day = c; }
+  else { day = a; month = b; year = c; }
+
+  // Validate parsed values
+  if (month < 1 || month > 12 || year < 1900 || year > 2100) return false;
+  return day >= 1 && day <= daysInMonth(year, month);
+}
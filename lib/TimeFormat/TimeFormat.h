@@ -0,0 +1,36 @@
+#ifndef TIME_FORMAT_H
+#define TIME_FORMAT_H
+
+#include <Arduino.h>
+
+// Receipt date formatting. Only depends on Arduino.h, no WiFi or NTP, so it
+// can be compiled and measured off-device. Nothing here allocates.
+
+#define DATE_HEADER_SIZE 17           // "Sat, 06 Jun 2025" plus '\0'
+
+// Days since 1970-01-01 for a proleptic Gregorian date (H. Hinnant's days_from_civil)
+constexpr int32_t daysFromCivil(int32_t y, uint32_t m, uint32_t d) {
+  y -= m <= 2;
+  const int32_t era = (y >= 0 ? y : y - 399) / 400;
+  const uint32_t yoe = y - era * 400;                                       // [0, 399]
+  const uint32_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;     // [0, 365], year starts in March
+  const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;               // [0, 146096]
+  return era * 146097 + (int32_t)doe - 719468;
+}
+
+// 0=Sunday ... 6=Saturday for a day count from daysFromCivil
+constexpr uint8_t weekdayFromDays(int32_t days) {
+  return days >= -4 ? (days + 4) % 7 : (days + 5) % 7 + 6;
+}
+
+static_assert(weekdayFromDays(daysFromCivil(1970, 1, 1)) == 4, "1970-01-01 was a Thursday");
+static_assert(weekdayFromDays(daysFromCivil(2025, 6, 7)) == 6, "2025-06-07 was a Saturday");
+static_assert(daysFromCivil(2000, 3, 1) == 11017, "days_from_civil");
+
+uint8_t daysInMonth(int year, int month);
+void civilFromDays(int32_t days, int &year, int &month, int &day);
+void formatDate(char *out, int year, int month, int day);                  // "Sat, 06 Jun 2025", out holds DATE_HEADER_SIZE bytes
+void formatDateHeader(char *out, unsigned long epochTime);                 // same for a (local) epoch time
+bool parseCustomDate(const char *customDate, int &year, int &month, int &day); // YYYY-MM-DD or DD/MM/YYYY, false if invalid
+
+#endif
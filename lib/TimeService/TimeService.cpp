@@ -0,0 +1,91 @@
+#include "TimeService.h"
+#include <ESP8266WiFi.h>
+
+#define SEVENTY_YEARS 2208988800UL    // NTP counts from 1900, Unix from 1970
+
+
+TimeService::TimeService(const char *server, long utcOffsetSeconds, uint32_t refreshMs)
+  : server(server), resolved(false), utcOffset(utcOffsetSeconds), refreshMs(refreshMs),
+    synced(false), waiting(false), requestSentAt(0), failures(0), lastSyncAt(0), syncedEpoch(0), cachedDay(-1) {
+}
+
+void TimeService::begin() {
+  udp.begin(NTP_LOCAL_PORT);
+}
+
+uint32_t TimeService::tick() {
+  if (waiting) {
+    if (readAnswer()) {
+      waiting = false;
+      failures = 0;
+      return refreshMs;
+    }
+    if (millis() - requestSentAt < NTP_TIMEOUT_MS) return 50;              // poll for the answer
+    waiting = false;
+    if (failures + 1 >= NTP_RESOLVE_AFTER) resolved = false;               // pool address may have moved, look it up again
+    return retryMs();
+  }
+
+  if (WiFi.status() != WL_CONNECTED) return NTP_RETRY_MS;
+  if (synced && millis() - lastSyncAt < refreshMs) return refreshMs - (millis() - lastSyncAt);
+
+  if (!sendRequest()) return retryMs();
+  return 50;
+}
+
+unsigned long TimeService::epoch() const {
+  return syncedEpoch + (millis() - lastSyncAt) / 1000;
+}
+
+const char *TimeService::header() {
+  int32_t today = epoch() / 86400;
+  if (today != cachedDay) {
+    formatDateHeader(cachedHeader, epoch());
+    cachedDay = today;
+  }
+  return cachedHeader;
+}
+
+bool TimeService::sendRequest() {
+  if (!resolved) {
+    resolved = WiFi.hostByName(server, serverIp, NTP_DNS_TIMEOUT_MS) == 1;
+    if (!resolved) return false;
+  }
+
+  uint8_t packet[NTP_PACKET_SIZE];
+  memset(packet, 0, sizeof(packet));
+  packet[0] = 0b11100011;                                                   // LI unknown, version 4, client mode
+
+  while (udp.parsePacket() > 0) udp.flush();                                // drop late answers to older requests
+  udp.beginPacket(serverIp, NTP_PORT);
+  udp.write(packet, sizeof(packet));
+  udp.endPacket();
+
+  waiting = true;
+  requestSentAt = millis();
+  return true;
+}
+
+uint32_t TimeService::retryMs() {
+  uint32_t ms = NTP_RETRY_MS;
+  for (uint8_t i = 0; i < failures && ms < NTP_RETRY_MAX_MS; i++) ms *= 2;
+  if (failures < 255) failures++;
+  return ms < NTP_RETRY_MAX_MS ? ms : NTP_RETRY_MAX_MS;
+}
+
+bool TimeService::readAnswer() {
+  if (udp.parsePacket() < NTP_PACKET_SIZE) return false;
+
+  uint8_t packet[NTP_PACKET_SIZE];
+  udp.read(packet, sizeof(packet));
+
+  // Transmit timestamp, seconds part, big endian
+  unsigned long seconds = ((unsigned long)packet[40] << 24) | ((unsigned long)packet[41] << 16)
+                          | ((unsigned long)packet[42] << 8) | packet[43];
+  if (seconds == 0) return false;                                           // server not synchronised itself
+
+  syncedEpoch = (uint32_t)(seconds - SEVENTY_YEARS) + utcOffset;           // 32-bit wrap also covers the 2036 NTP era change
+  lastSyncAt = millis();
+  synced = true;
+  return true;
+}
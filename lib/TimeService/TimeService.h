@@ -0,0 +1,61 @@
+#ifndef TIME_SERVICE_H
+#define TIME_SERVICE_H
+
+#include <Arduino.h>
+#include <WiFiUdp.h>
+#include <TimeFormat.h>
+
+#define NTP_PORT 123
+#define NTP_LOCAL_PORT 2390
+#define NTP_PACKET_SIZE 48
+#define NTP_TIMEOUT_MS 2000           // Give up on an answer after this long
+#define NTP_RETRY_MS 10000            // Retry interval after a failed exchange, doubled per failure in a row
+#define NTP_RETRY_MAX_MS 600000       // Longest retry interval, 10 min
+#define NTP_DNS_TIMEOUT_MS 750        // hostByName() blocks the loop, give up on the name server after this long
+#define NTP_RESOLVE_AFTER 3           // Look the pool name up again after this many unanswered requests
+
+// Non-blocking SNTP client plus a cached receipt date header.
+//
+// tick() runs from the main loop and never waits: it sends a request, and on
+// later calls picks up the answer if one has arrived. Everything else only
+// reads the local clock, so HTTP handlers never touch the network.
+//
+// The one blocking call is the DNS lookup of the server name, bounded by
+// NTP_DNS_TIMEOUT_MS. The address is kept across unanswered requests and only
+// looked up again after NTP_RESOLVE_AFTER of them; failed lookups and
+// exchanges back off from NTP_RETRY_MS to NTP_RETRY_MAX_MS.
+class TimeService {
+  public:
+    TimeService(const char *server, long utcOffsetSeconds, uint32_t refreshMs);
+
+    void begin();
+    uint32_t tick();                                    // advance the exchange, returns ms until it wants to run again
+
+    bool isSet() const { return synced; }               // at least one answer received
+    unsigned long epoch() const;                        // local time in seconds since 1970
+    const char *header();                               // "Sat, 06 Jun 2025" for today, only rebuilt when the date changes
+
+  private:
+    WiFiUDP udp;
+    const char *server;
+    IPAddress serverIp;
+    bool resolved;
+    long utcOffset;
+    uint32_t refreshMs;
+
+    bool synced;
+    bool waiting;                                       // request sent, answer outstanding
+    uint32_t requestSentAt;
+    uint8_t failures;                                   // failed lookups and exchanges in a row
+    uint32_t lastSyncAt;                                // millis() of the last answer
+    unsigned long syncedEpoch;                          // local epoch at lastSyncAt
+
+    int32_t cachedDay;
+    char cachedHeader[DATE_HEADER_SIZE];
+
+    bool sendRequest();                                 // false when the server name could not be resolved
+    bool readAnswer();
+    uint32_t retryMs();                                 // count a failure and return the backoff
+};
+
+#endif
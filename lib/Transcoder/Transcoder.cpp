@@ -0,0 +1,99 @@
+#include "Transcoder.h"
+#include "CodePageTables.h"
+
+
+// Decodes one UTF-8 sequence. Malformed input yields U+FFFD and consumes one byte.
+static size_t decodeUtf8(const uint8_t *s, size_t length, uint32_t &codePoint) {
+  uint8_t b = s[0];
+  size_t n;
+  if (b < 0x80) { codePoint = b; return 1; }
+  else if ((b & 0xE0) == 0xC0) { codePoint = b & 0x1F; n = 2; }
+  else if ((b & 0xF0) == 0xE0) { codePoint = b & 0x0F; n = 3; }
+  else if ((b & 0xF8) == 0xF0) { codePoint = b & 0x07; n = 4; }
+  else { codePoint = 0xFFFD; return 1; }
+
+  if (n > length) { codePoint = 0xFFFD; return 1; }
+  for (size_t i = 1; i < n; i++) {
+    if ((s[i] & 0xC0) != 0x80) { codePoint = 0xFFFD; return 1; }
+    codePoint = (codePoint << 6) | (s[i] & 0x3F);
+  }
+  return n;
+}
+
+static uint16_t symbolOf(uint32_t codePoint) {
+  if (codePoint >= 0x10000) return 0;
+  uint8_t block = pgm_read_byte(&CODEPOINT_BLOCK_INDEX[codePoint >> 7]);
+  if (block == 0) return 0;
+  return pgm_read_word(&CODEPOINT_SLOTS[block - 1][codePoint & 0x7F]);
+}
+
+static int pageIndex(uint8_t codePage) {
+  for (uint8_t i = 0; i < CODEPAGE_COUNT; i++) {
+    if (pgm_read_byte(&CODEPAGE_IDS[i]) == codePage) return i;
+  }
+  return -1;
+}
+
+namespace Transcoder {
+
+  bool isSupported(uint8_t codePage) {
+    return pageIndex(codePage) >= 0;
+  }
+
+  size_t transcode(char *text, size_t length, uint8_t codePage) {
+    int page = pageIndex(codePage);
+    uint8_t *s = (uint8_t*)text;
+    size_t in = 0, out = 0;
+
+    while (in < length) {
+      if (s[in] < 0x80) {                                                   // ASCII is the same in every page
+        s[out++] = s[in++];
+        continue;
+      }
+
+      uint32_t codePoint;
+      in += decodeUtf8(s + in, length - in, codePoint);
+      uint16_t symbol = symbolOf(codePoint);
+
+      uint8_t b = page >= 0 ? pgm_read_byte(&CODEPAGE_BYTES[page][symbol]) : 0;
+      if (b != 0) {
+        s[out++] = b;
+      } else {
+        uint16_t from = pgm_read_word(&TRANSLIT_OFFSETS[symbol]);
+        uint16_t to = pgm_read_word(&TRANSLIT_OFFSETS[symbol + 1]);
+        for (uint16_t i = from; i < to; i++) s[out++] = pgm_read_byte(&TRANSLIT_POOL[i]);
+      }
+    }
+
+    if (out < length) s[out] = '\0';
+    return out;
+  }
+
+  uint8_t bestCodePage(const char *text, size_t length, uint8_t fallback) {
+    uint16_t printable[CODEPAGE_COUNT] = {0};
+    const uint8_t *s = (const uint8_t*)text;
+
+    for (size_t in = 0; in < length;) {
+      if (s[in] < 0x80) { in++; continue; }
+      uint32_t codePoint;
+      in += decodeUtf8(s + in, length - in, codePoint);
+      uint16_t symbol = symbolOf(codePoint);
+      if (symbol == 0) continue;
+      for (uint8_t p = 0; p < CODEPAGE_COUNT; p++) {
+        if (pgm_read_byte(&CODEPAGE_BYTES[p][symbol])) printable[p]++;
+      }
+    }
+
+    int current = pageIndex(fallback);
+    uint16_t best = current >= 0 ? printable[current] : 0;
+    uint8_t choice = fallback;
+    for (uint8_t p = 0; p < CODEPAGE_COUNT; p++) {
+      if (printable[p] > best) {
+        best = printable[p];
+        choice = pgm_read_byte(&CODEPAGE_IDS[p]);
+      }
+    }
+    return choice;
+  }
+
+}
@@ -0,0 +1,25 @@
+#ifndef TRANSCODER_H
+#define TRANSCODER_H
+
+#include <Arduino.h>
+
+// UTF-8 to printer code page conversion. Uses the tables generated into
+// CodePageTables.h by scripts/build_codepages.py: every character costs a
+// fixed number of flash reads and nothing is allocated. Characters a page
+// lacks are replaced by an ASCII transliteration ("ß" -> "ss", "€" -> "EUR").
+namespace Transcoder {
+
+  bool isSupported(uint8_t codePage);                   // setCodePage number with a generated table
+
+  // Converts text in place and returns the new length. The output is never
+  // longer than the UTF-8 input, so the caller's buffer always suffices.
+  // Writes a terminating '\0' when the text got shorter.
+  size_t transcode(char *text, size_t length, uint8_t codePage);
+
+  // Supported page that can print the most non-ASCII characters of text.
+  // Returns fallback unless another page prints strictly more of them.
+  uint8_t bestCodePage(const char *text, size_t length, uint8_t fallback);
+
+}
+
+#endif
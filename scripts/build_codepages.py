@@ -0,0 +1,197 @@
+"""Pre-build step: generate the UTF-8 to printer code page lookup tables.
+
+Runs automatically from platformio.ini (extra_scripts) and can also be run by
+hand with `python scripts/build_codepages.py`. Writes
+lib/Transcoder/CodePageTables.h, which is generated and not checked in.
+
+Layout (all PROGMEM, every lookup is a fixed number of array reads):
+  code point -> BLOCK_INDEX[cp >> 7] -> SLOTS[block][cp & 127] -> symbol
+  symbol     -> PAGE_BYTES[page][symbol]   byte in that code page, 0 = missing
+  symbol     -> TRANSLIT_*                 ASCII stand-in, never longer than
+                                           the UTF-8 sequence it replaces
+"""
+import os
+import unicodedata
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+TARGET = os.path.join(PROJECT_DIR, "lib", "Transcoder", "CodePageTables.h")
+
+# Printer code page numbers as used by ThermalPrinter::setCodePage, with the
+# matching Python codec. West Europe (6) and Iran (10) have no known codec.
+CODE_PAGES = [
+    (0, "PC437", "cp437"),
+    (1, "Katakana", "jisx0201"),
+    (2, "PC850", "cp850"),
+    (3, "PC860", "cp860"),
+    (4, "PC863", "cp863"),
+    (5, "PC865", "cp865"),
+    (7, "Greek", "cp737"),
+    (8, "Hebrew", "cp862"),
+    (9, "East Europe", "cp852"),
+    (11, "WPC1252", "cp1252"),
+]
+
+# Characters no supported page has, but which show up in typed text
+EXTRA = (
+    [chr(c) for c in range(0x0400, 0x0460)]               # Cyrillic, transliterated
+    + list("‘’‚‛“”„‟‐‑‒–—―…•′″‹›€™✓✔✗✘☐☑☒→←↑↓≠")
+)
+
+SPECIAL = {
+    "ß": "ss", "æ": "ae", "Æ": "AE", "œ": "oe", "Œ": "OE", "ø": "o", "Ø": "O",
+    "ł": "l", "Ł": "L", "đ": "d", "Đ": "D", "ð": "d", "Ð": "D", "þ": "th", "Þ": "TH",
+    "ı": "i", "ƒ": "f", "¡": "!", "¿": "?", "«": "<<", "»": ">>", "°": "o",
+    "±": "+-", "×": "x", "÷": "/", "·": ".", "¢": "c", "£": "L", "¥": "Y",
+    "§": "S", "¶": "P", "©": "(C)", "®": "(R)", "¬": "-", "¦": "|", "µ": "u",
+    "‘": "'", "’": "'", "‚": ",", "‛": "'", "“": '"', "”": '"', "„": '"', "‟": '"',
+    "‐": "-", "‑": "-", "‒": "-", "–": "-", "—": "-", "―": "-", "…": "...",
+    "•": "*", "′": "'", "″": '"', "‹": "<", "›": ">", "€": "EUR", "™": "TM",
+    "✓": "v", "✔": "v", "✗": "x", "✘": "x", "☐": "[ ]", "☑": "[v]", "☒": "[x]",
+    "→": "->", "←": "<-", "↑": "^", "↓": "v", "≠": "!=", "≤": "<=", "≥": ">=",
+    "√": "v", "∞": "oo", "≈": "~", "≡": "=", "∙": ".", "⌐": "-",
+}
+
+LETTER_NAMES = {
+    # Greek
+    "ALPHA": "a", "BETA": "b", "GAMMA": "g", "DELTA": "d", "EPSILON": "e", "ZETA": "z",
+    "ETA": "i", "THETA": "th", "IOTA": "i", "KAPPA": "k", "LAMDA": "l", "MU": "m",
+    "NU": "n", "XI": "x", "OMICRON": "o", "PI": "p", "RHO": "r", "SIGMA": "s",
+    "TAU": "t", "UPSILON": "y", "PHI": "f", "CHI": "ch", "PSI": "ps", "OMEGA": "o",
+    # Cyrillic
+    "A": "a", "BE": "b", "VE": "v", "GHE": "g", "DE": "d", "IE": "e", "IO": "e",
+    "ZHE": "zh", "ZE": "z", "I": "i", "SHORT I": "i", "KA": "k", "EL": "l", "EM": "m",
+    "EN": "n", "O": "o", "PE": "p", "ER": "r", "ES": "s", "TE": "t", "U": "u",
+    "EF": "f", "HA": "kh", "TSE": "ts", "CHE": "ch", "SHA": "sh", "SHCHA": "shch",
+    "HARD SIGN": "'", "YERU": "y", "SOFT SIGN": "'", "E": "e", "YU": "yu", "YA": "ya",
+    "UKRAINIAN IE": "ye", "BYELORUSSIAN-UKRAINIAN I": "i", "YI": "yi", "JE": "j",
+    "DZE": "dz", "LJE": "lj", "NJE": "nj", "DJE": "dj", "TSHE": "c", "KJE": "k",
+    "GJE": "g", "SHORT U": "u", "DZHE": "dz",
+    # Hebrew
+    "ALEF": "'", "BET": "b", "GIMEL": "g", "DALET": "d", "HE": "h", "VAV": "v",
+    "ZAYIN": "z", "HET": "h", "TET": "t", "YOD": "y", "KAF": "k", "LAMED": "l",
+    "MEM": "m", "NUN": "n", "SAMEKH": "s", "AYIN": "'", "PE": "p", "TSADI": "ts",
+    "QOF": "q", "RESH": "r", "SHIN": "sh", "TAV": "t",
+}
+
+BOX = {"HORIZONTAL": "-", "VERTICAL": "|"}
+
+
+def decode_page(codec):
+    table = {}
+    for b in range(0x80, 0x100):
+        if codec == "jisx0201":
+            ch = chr(0xFF61 + b - 0xA1) if 0xA1 <= b <= 0xDF else None
+        else:
+            try:
+                ch = bytes([b]).decode(codec)
+            except UnicodeDecodeError:
+                ch = None
+        if ch and ord(ch) >= 0x80 and ch not in table:
+            table[ch] = b
+    return table
+
+
+def transliterate(ch):
+    if ch in SPECIAL:
+        text = SPECIAL[ch]
+    else:
+        name = unicodedata.name(ch, "")
+        decomposed = unicodedata.normalize("NFKD", ch)
+        text = "".join(c for c in decomposed if ord(c) < 0x80 and c.isprintable())
+        if not text:
+            upper = " CAPITAL LETTER " in name
+            for prefix in ("GREEK SMALL LETTER ", "GREEK CAPITAL LETTER ",
+                           "CYRILLIC SMALL LETTER ", "CYRILLIC CAPITAL LETTER ",
+                           "HEBREW LETTER FINAL ", "HEBREW LETTER "):
+                if name.startswith(prefix):
+                    word = name[len(prefix):].split(" WITH ")[0]
+                    text = LETTER_NAMES.get(word, "")
+                    if upper:
+                        text = text[:1].upper() + text[1:]
+                    break
+        if not text and name.startswith("BOX DRAWINGS"):
+            text = next((v for k, v in BOX.items() if k in name and "AND" not in name), "+")
+        if not text and name in ("NO-BREAK SPACE",):
+            text = " "
+    text = text or "?"
+    return text[:len(ch.encode("utf-8"))]                   # never longer than the input, allows in-place use
+
+
+def c_rows(values, fmt, per_row=16, indent="  "):
+    values = list(values)
+    return "\n".join(indent + ", ".join(fmt % v for v in values[i:i + per_row]) + ","
+                     for i in range(0, len(values), per_row))
+
+
+def main():
+    pages = [(n, label, decode_page(codec)) for n, label, codec in CODE_PAGES]
+
+    symbols = sorted({ch for _, _, t in pages for ch in t} | set(EXTRA), key=ord)
+    symbol_of = {ch: i + 1 for i, ch in enumerate(symbols)}       # 0 = unknown code point
+    assert len(symbols) < 0xFFFF and all(ord(ch) < 0x10000 for ch in symbols)
+
+    blocks = sorted({ord(ch) >> 7 for ch in symbols})
+    block_index = [0] * 512
+    for i, b in enumerate(blocks):
+        block_index[b] = i + 1                                     # 0 = block has no symbols
+    slots = []
+    for b in blocks:
+        slots.append([symbol_of.get(chr((b << 7) | i), 0) for i in range(128)])
+
+    pool, offsets = "?", [0]                                       # symbol 0 prints as "?"
+    for ch in symbols:
+        offsets.append(len(pool))
+        pool += transliterate(ch)
+    offsets.append(len(pool))
+
+    out = [
+        "// Generated by scripts/build_codepages.py, do not edit.",
+        "#ifndef CODE_PAGE_TABLES_H",
+        "#define CODE_PAGE_TABLES_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "#define CODEPAGE_COUNT %d" % len(pages),
+        "#define CODEPOINT_BLOCKS %d" % len(blocks),
+        "#define SYMBOL_COUNT %d           // symbol 0 is 'unknown'" % (len(symbols) + 1),
+        "",
+        "// setCodePage numbers of the supported pages: %s" % ", ".join("%d=%s" % (n, l) for n, l, _ in pages),
+        "static constexpr uint8_t CODEPAGE_IDS[CODEPAGE_COUNT] PROGMEM = {%s};" % ", ".join(str(n) for n, _, _ in pages),
+        "",
+        "// Code point >> 7 -> block + 1, BMP only",
+        "static constexpr uint8_t CODEPOINT_BLOCK_INDEX[512] PROGMEM = {",
+        c_rows(block_index, "%d", 32),
+        "};",
+        "",
+        "// Code point & 127 inside a block -> symbol",
+        "static constexpr uint16_t CODEPOINT_SLOTS[CODEPOINT_BLOCKS][128] PROGMEM = {",
+    ]
+    for b, row in zip(blocks, slots):
+        out += ["  { // U+%04X" % (b << 7), c_rows(row, "%d", 16, "    "), "  },"]
+    out += ["};", "", "// Symbol -> byte in each code page, 0 = not available",
+            "static constexpr uint8_t CODEPAGE_BYTES[CODEPAGE_COUNT][SYMBOL_COUNT] PROGMEM = {"]
+    for n, label, table in pages:
+        row = [0] + [table.get(ch, 0) for ch in symbols]
+        out += ["  { // %d %s" % (n, label), c_rows(row, "0x%02x", 16, "    "), "  },"]
+    out += ["};", "", "// Symbol -> ASCII stand-in, TRANSLIT_POOL[offset[s] .. offset[s + 1])",
+            "static constexpr uint16_t TRANSLIT_OFFSETS[SYMBOL_COUNT + 1] PROGMEM = {",
+            c_rows(offsets, "%d", 16), "};",
+            "static constexpr char TRANSLIT_POOL[] PROGMEM = \"%s\";" % "".join(
+                "\\\\" if c == "\\" else '\\"' if c == '"' else "\\?" if c == "?" else c for c in pool),
+            "", "#endif", ""]
+    text = "\n".join(out)
+
+    if os.path.exists(TARGET):
+        with open(TARGET, encoding="utf-8") as f:
+            if f.read() == text:
+                return
+    with open(TARGET, "w", encoding="utf-8") as f:
+        f.write(text)
+
+
+main()
@@ -0,0 +1,70 @@
+"""Pre-build step: minify web/index.html, gzip it and emit it as a PROGMEM array.
+
+Runs automatically from platformio.ini (extra_scripts) and can also be run by
+hand with `python scripts/build_web.py`. The output, include/web_index.h, is
+generated and not checked in.
+"""
+import gzip
+import hashlib
+import os
+import re
+
+try:
+    Import("env")  # noqa: F821 - provided by PlatformIO
+    PROJECT_DIR = env.subst("$PROJECT_DIR")  # noqa: F821
+except NameError:
+    PROJECT_DIR = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+SOURCE = os.path.join(PROJECT_DIR, "web", "index.html")
+TARGET = os.path.join(PROJECT_DIR, "include", "web_index.h")
+
+
+def minify(html):
+    # Conservative: drop comments and indentation, keep line breaks so inline
+    # JavaScript without semicolons still parses. gzip takes care of the rest.
+    html = re.sub(r"<!--.*?-->", "", html, flags=re.S)
+    html = re.sub(r"/\*.*?\*/", "", html, flags=re.S)
+    html = re.sub(r"^\s*//.*$", "", html, flags=re.M)
+    lines = (line.strip() for line in html.splitlines())
+    return "\n".join(line for line in lines if line)
+
+
+def main():
+    with open(SOURCE, encoding="utf-8") as f:
+        page = minify(f.read()).encode("utf-8")
+
+    packed = gzip.compress(page, compresslevel=9, mtime=0)  # mtime=0 keeps the output (and ETag) reproducible
+    etag = hashlib.sha1(packed).hexdigest()[:16]
+
+    rows = []
+    for i in range(0, len(packed), 16):
+        rows.append("  " + ", ".join("0x%02x" % b for b in packed[i:i + 16]) + ",")
+
+    header = "\n".join([
+        "// Generated by scripts/build_web.py from web/index.html, do not edit.",
+        "#ifndef WEB_INDEX_H",
+        "#define WEB_INDEX_H",
+        "",
+        "#include <Arduino.h>",
+        "",
+        "#define WEB_INDEX_ETAG \"\\\"%s\\\"\"" % etag,
+        "#define WEB_INDEX_GZ_LEN %d         // %d bytes before compression" % (len(packed), len(page)),
+        "",
+        "static const uint8_t WEB_INDEX_GZ[] PROGMEM = {",
+        *rows,
+        "};",
+        "",
+        "#endif",
+        "",
+    ])
+
+    # Only touch the file when it changed, so the firmware is not rebuilt for nothing
+    if os.path.exists(TARGET):
+        with open(TARGET, encoding="utf-8") as f:
+            if f.read() == header:
+                return
+    with open(TARGET, "w", encoding="utf-8") as f:
+        f.write(header)
+
+
+main()
@@ -0,0 +1,586 @@
+"""Host-side EM5820 emulator: render a captured ESC/POS stream and estimate print time.
+
+Feed it the bytes the driver sent to the printer (a capture of the serial
+line, e.g. `cat /dev/ttyUSB0 > receipt.bin` on a USB-serial adapter wired to
+the printer RX pin) and it draws the paper as a 384 dot wide PBM or PNG and
+reports how long the job takes at a given baud rate and print speed:
+
+    python scripts/escpos_emulator.py receipt.bin --png receipt.png
+    python scripts/escpos_emulator.py receipt.bin --golden golden/receipt.pbm
+    python scripts/escpos_emulator.py captures/*.bin --baud 115200 --json
+
+Understood: ESC @, ESC {, ESC a, ESC E, ESC -, ESC M, ESC t, ESC d, ESC J,
+ESC 2/3, ESC ## STDP/STSP/SBDR/SLAN, GS B, GS !, GS L, GS v 0, GS ( k (QR),
+GS ( L (NV graphics: define, print, delete), DLE EOT, CR and LF. Anything
+else is counted and skipped.
+
+Text uses a built-in 5x7 font scaled into the 12x24 (font A) or 9x17 (font B)
+cell, so images are the same on every machine and only meant to show layout,
+styles and line breaks, not the printer's exact glyphs. QR codes are drawn as
+real symbols when the `qrcode` package is installed, otherwise as a marked
+square of the right size. With ESC { 1 in the stream (the Scribe mounts the
+printer upside down) every line is turned on the paper and the image is shown
+the way the receipt is read; --view paper shows it as it leaves the printer.
+
+Time model: bytes arrive at baud / 10 per second, a line burns once its last
+byte is in, one line at a time, at the paper speed of the ESC ## STSP setting
+(paperDotsPerSecond() in ThermalPrinter.h, 480 dot rows/s at speed 3). Heat changes darkness,
+not time, here. --golden compares against a stored PBM and exits 1 on a
+difference (--update writes it), so captures can back regression tests;
+--json prints the numbers for throughput benchmarks.
+
+NV graphics live as long as the stream. A receipt that prints a logo by key
+code was usually captured long after the logo went into the printer, so
+--preload runs the capture with the GS ( L define first and only keeps the
+images it stored:
+
+    python scripts/escpos_emulator.py receipt.bin --preload logo-upload.bin --png receipt.png
+"""
+import argparse
+import json
+import sys
+import unicodedata
+import zlib
+
+PAPER_DOTS = 384
+LINE_PITCH = 30                       # 24 dot font plus the default line spacing (PRINTJOB_LINE_DOTS)
+DOTS_PER_MM = 8
+BITS_PER_BYTE = 10                    # start + 8 data + stop bit
+PAPER_DOTS_PER_SECOND_MIN = 320       # ThermalPrinter.h, STSP 0
+PAPER_DOTS_PER_SECOND_MAX = 800       # STSP 9
+SPEED_DOTS_PER_SECOND = [PAPER_DOTS_PER_SECOND_MIN + (PAPER_DOTS_PER_SECOND_MAX - PAPER_DOTS_PER_SECOND_MIN) * n // 9
+                         for n in range(10)]                                # paperDotsPerSecond(), ESC ## STSP 0-9
+BAUD_RATES = [9600, 19200, 38400, 57600, 115200]                          # EscPos::BAUD_RATES, ESC ## SBDR 0-4
+FONTS = [(12, 24, 2, 3), (9, 17, 1, 2)]  # cell width, height and glyph scale of font A and B
+FULL_BLOCK = 0xDB
+
+# Printer code page numbers with the matching Python codec (see build_codepages.py)
+CODECS = {0: "cp437", 2: "cp850", 3: "cp860", 4: "cp863", 5: "cp865",
+          7: "cp737", 8: "cp862", 9: "cp852", 11: "cp1252"}
+
+# 5x7 font for ASCII 32-126, five columns per glyph, bit 0 is the top row
+FONT_5X7 = bytes.fromhex(
+    "0000000000" "00005f0000" "0007000700" "147f147f14" "242a7f2a12" "2313086462" "3649552250" "0005030000"
+    "001c224100" "0041221c00" "082a1c2a08" "08083e0808" "0050300000" "0808080808" "0060600000" "2010080402"
+    "3e5149453e" "00427f4000" "4261514946" "2141454b31" "1814127f10" "2745454539" "3c4a494930" "0171090503"
+    "3649494936" "064949291e" "0036360000" "0056360000" "0814224100" "1414141414" "0041221408" "0201510906"
+    "324979413e" "7e1111117e" "7f49494936" "3e41414122" "7f4141221c" "7f49494941" "7f09090101" "3e41415132"
+    "7f0808087f" "00417f4100" "2040413f01" "7f08142241" "7f40404040" "7f0204027f" "7f0408107f" "3e4141413e"
+    "7f09090906" "3e4151215e" "7f09192946" "4649494931" "01017f0101" "3f4040403f" "1f2040201f" "7f2018207f"
+    "6314081463" "0304780403" "6151494543" "007f414100" "0204081020" "0041417f00" "0402010204" "4040404040"
+    "0001020400" "2054545478" "7f48444438" "3844444420" "384444487f" "3854545418" "087e090102" "081454543c"
+    "7f08040478" "00447d4000" "2040443d00" "007f102844" "00417f4000" "7c04180478" "7c08040478" "3844444438"
+    "7c14141408" "081414187c" "7c08040408" "4854545420" "043f444020" "3c4040207c" "1c2040201c" "3c4030403c"
+    "4428102844" "0c5050503c" "4464544c44" "0008364100" "00007f0000" "0041360800" "08082a1c08")
+
+QR_CAPACITY = [17, 32, 53, 78, 106, 134, 154, 192, 230, 271]  # byte mode, level L, versions 1-10
+
+
+class Style:
+    def __init__(self):
+        self.bold = 0
+        self.underline = 0
+        self.inverse = 0
+        self.width = 1
+        self.height = 1
+        self.font = 0
+        self.align = 0
+
+    def copy(self):
+        style = Style()
+        style.__dict__.update(self.__dict__)
+        return style
+
+
+class Printer:
+    """Runs a byte stream through the printer state and collects paper and timing."""
+
+    def __init__(self, baud=9600, speed=3, render=True):
+        self.render = render
+        self.rows = []                                 # paper, one bytearray per dot row, 1 = black
+        self.line = []                                 # (byte, code page, width, height, style) waiting for LF
+        self.line_dots = 0
+        self.style = Style()
+        self.upside_down = False
+        self.ever_upside_down = False
+        self.code_page = 0
+        self.left_margin = 0
+        self.pitch = LINE_PITCH
+        self.heat = None
+        self.qr_data = b""
+        self.qr_module = 3
+        self.qr_level = 48
+        self.nv = {}                                   # key code -> (width in bytes, height, raster rows)
+
+        self.baud = baud
+        self.speed = speed
+        self.clock = 0.0                               # transmit time of the bytes read so far
+        self.burn_end = 0.0                            # when the last queued paper movement is done
+        self.burn_time = 0.0
+        self.paper_dots = 0
+        self.bytes = 0
+        self.lines = 0
+        self.commands = {}
+        self.unknown = 0
+
+    # === Stream ===
+
+    def run(self, data):
+        self.data = data
+        self.pos = 0
+        while self.pos < len(data):
+            c = self.take(1)[0]
+            if c == 0x1B:
+                self.escape()
+            elif c == 0x1D:
+                self.group()
+            elif c == 0x10:
+                self.count("DLE EOT")
+                self.take(2)                           # status request, the answer goes back to the driver
+            elif c == 0x0A:
+                self.print_line(feed_empty=True)
+            elif c >= 0x20:
+                self.add_char(c)
+        self.print_line(feed_empty=False)
+        return self
+
+    def take(self, n):
+        chunk = self.data[self.pos:self.pos + n]
+        self.pos += len(chunk)
+        self.bytes += len(chunk)
+        self.clock += len(chunk) * BITS_PER_BYTE / self.baud
+        return chunk + bytes(n - len(chunk))
+
+    def count(self, name):
+        self.commands[name] = self.commands.get(name, 0) + 1
+
+    def escape(self):
+        c = self.take(1)[0]
+        name = "ESC " + chr(c)
+        if c == ord("@"):
+            self.print_line(feed_empty=False)
+            self.style = Style()
+            self.upside_down = False
+            self.code_page = 0
+            self.left_margin = 0
+            self.pitch = LINE_PITCH
+        elif c == ord("{"):
+            self.upside_down = bool(self.take(1)[0] & 1)
+            self.ever_upside_down |= self.upside_down
+        elif c == ord("a"):
+            self.style.align = min(self.take(1)[0] & 0x0F, 2)
+        elif c == ord("E"):
+            self.style.bold = self.take(1)[0] & 1
+        elif c == ord("-"):
+            self.style.underline = min(self.take(1)[0] & 0x0F, 2)
+        elif c == ord("M"):
+            self.style.font = self.take(1)[0] & 1
+        elif c == ord("t"):
+            self.code_page = self.take(1)[0]
+        elif c == ord("d"):
+            lines = self.take(1)[0]
+            self.print_line(feed_empty=False)
+            self.feed(lines * self.pitch)
+        elif c == ord("J"):
+            dots = self.take(1)[0]
+            self.print_line(feed_empty=False)
+            self.feed(dots)
+        elif c == ord("2"):
+            self.pitch = LINE_PITCH
+        elif c == ord("3"):
+            self.pitch = max(self.take(1)[0], 1)
+        elif c == ord("#") and self.data[self.pos:self.pos + 1] == b"#":
+            self.take(1)
+            setting = self.take(4).decode("ascii", "replace")
+            value = self.take(1)[0]
+            name = "ESC ## " + setting
+            if setting == "STDP":
+                self.heat = value
+            elif setting == "STSP":
+                self.speed = min(value, len(SPEED_DOTS_PER_SECOND) - 1)
+            elif setting == "SBDR" and value < len(BAUD_RATES):
+                self.baud = BAUD_RATES[value]          # the driver reopens the port at the new rate right after
+            elif setting == "SLAN":
+                self.code_page = value
+        else:
+            name = "unknown"
+            self.unknown += 1
+        self.count(name)
+
+    def group(self):
+        c = self.take(1)[0]
+        name = "GS " + chr(c)
+        if c == ord("B"):
+            self.style.inverse = self.take(1)[0] & 1
+        elif c == ord("!"):
+            n = self.take(1)[0]
+            self.style.width = (n >> 4 & 7) + 1
+            self.style.height = (n & 7) + 1
+        elif c == ord("L"):
+            low, high = self.take(2)
+            self.left_margin = min(low | high << 8, PAPER_DOTS - 8)
+        elif c == ord("v"):
+            name = "GS v 0"
+            self.take(2)                               # '0' and mode
+            xl, xh, yl, yh = self.take(4)
+            self.raster(xl | xh << 8, yl | yh << 8)
+        elif c == ord("("):
+            kind = self.take(1)[0]
+            name = "GS ( " + chr(kind)
+            low, high = self.take(2)
+            block = self.take(low | high << 8)
+            if kind == ord("k"):
+                self.qr(block)
+            elif kind == ord("L"):
+                self.graphics(block)
+            else:
+                name = "unknown"
+                self.unknown += 1
+        else:
+            name = "unknown"
+            self.unknown += 1
+        self.count(name)
+
+    # === Paper ===
+
+    def feed(self, dots):
+        self.burn(dots, None)
+
+    def burn(self, dots, bitmap):
+        # A movement starts once its bytes are in and the one before it is done
+        start = max(self.burn_end, self.clock)
+        seconds = dots / SPEED_DOTS_PER_SECOND[self.speed]
+        self.burn_end = start + seconds
+        self.burn_time += seconds
+        self.paper_dots += dots
+        if not self.render:
+            return
+        if bitmap is None:
+            self.rows.extend(bytearray(PAPER_DOTS) for _ in range(dots))
+        else:
+            self.rows.extend(bitmap)
+
+    def add_char(self, c):
+        cell_width, cell_height, _, _ = FONTS[self.style.font]
+        width = cell_width * self.style.width
+        if self.line_dots + width > PAPER_DOTS - self.left_margin:
+            self.print_line(feed_empty=False)        # the printer wraps on its own
+        height = cell_height * self.style.height
+        self.line.append((c, self.code_page, width, height, self.style.copy()))
+        self.line_dots += width
+
+    def print_line(self, feed_empty):
+        if not self.line:
+            if feed_empty:
+                self.feed(self.pitch)
+            return
+        tallest = max(height for _, _, _, height, _ in self.line)
+        pitch = max(self.pitch, tallest + LINE_PITCH - 24)
+        bitmap = None
+        if self.render:
+            bitmap = [bytearray(PAPER_DOTS) for _ in range(pitch)]
+            x = self.left_margin + self.offset(self.line_dots, self.line[0][4].align)
+            for c, page, width, height, style in self.line:
+                self.draw_cell(bitmap, x, tallest - height, c, page, width, height, style)
+                x += width
+            bitmap = self.turned(bitmap)
+        self.line = []
+        self.line_dots = 0
+        self.lines += 1
+        self.burn(pitch, bitmap)
+
+    def offset(self, used, align):
+        room = PAPER_DOTS - self.left_margin - used
+        return 0 if align == 0 else room // 2 if align == 1 else room
+
+    def turned(self, bitmap):
+        # Upside-down mode turns each line by 180 degrees where it is on the paper
+        if not self.upside_down:
+            return bitmap
+        return [bytearray(reversed(row)) for row in reversed(bitmap)]
+
+    def draw_cell(self, bitmap, x, y, c, page, width, height, style):
+        cell_width, cell_height, scale_x, scale_y = FONTS[style.font]
+        columns = glyph(c, page)
+        for row in range(height):
+            for col in range(width):
+                if x + col >= PAPER_DOTS:
+                    break
+                gx = col // style.width
+                gy = row // style.height
+                on = False
+                if columns == "block":
+                    on = True
+                elif columns is not None:
+                    on = font_dot(columns, gx, gy, scale_x, scale_y) or (
+                        style.bold and font_dot(columns, gx - 1, gy, scale_x, scale_y))
+                elif 1 <= gx < cell_width - 1 and 1 <= gy < cell_height - 1:
+                    on = gx in (1, cell_width - 2) or gy in (1, cell_height - 2)  # box for a missing glyph
+                if style.underline and gy >= cell_height - style.underline:
+                    on = True
+                if style.inverse:
+                    on = not on
+                bitmap[y + row][x + col] = 1 if on else 0
+
+    def raster(self, width_bytes, height):
+        # Rows go out as sent, ESC { does not turn images
+        self.print_line(feed_empty=False)
+        for _ in range(height):
+            self.raster_row(self.take(width_bytes))
+
+    def raster_row(self, data):
+        if not self.render:
+            self.burn(1, None)
+            return
+        row = bytearray(PAPER_DOTS)
+        for i, byte in enumerate(data):
+            for bit in range(8):
+                x = self.left_margin + i * 8 + bit
+                if x < PAPER_DOTS and byte & (0x80 >> bit):
+                    row[x] = 1
+        self.burn(1, [row])
+
+    def graphics(self, block):
+        # GS ( L m fn ..., the parameters after pL pH
+        if len(block) < 2 or block[0] != 48:
+            return
+        fn = block[1]
+        if fn == 67 and len(block) >= 11:              # define raster: a kc1 kc2 b xL xH yL yH c d1...dk
+            width_bytes = (block[6] | block[7] << 8) // 8 + (1 if block[6] & 7 else 0)
+            height = block[8] | block[9] << 8
+            self.nv[bytes(block[3:5])] = (width_bytes, height, bytes(block[11:]))
+        elif fn == 69 and len(block) >= 4:             # print: kc1 kc2 x y, a key code nobody defined prints nothing
+            image = self.nv.get(bytes(block[2:4]))
+            if image is None:
+                return
+            self.print_line(feed_empty=False)
+            width_bytes, height, data = image
+            for y in range(height):
+                self.raster_row(data[y * width_bytes:(y + 1) * width_bytes])
+        elif fn == 66 and len(block) >= 4:             # delete one
+            self.nv.pop(bytes(block[2:4]), None)
+
+    def qr(self, block):
+        if len(block) < 3:
+            return
+        fn = block[1]
+        if fn == 80:                                   # store data, after cn fn m
+            self.qr_data = bytes(block[3:])
+        elif fn == 67:                                 # module size
+            self.qr_module = max(1, min(block[2], 16))
+        elif fn == 69:                                 # error correction level
+            self.qr_level = block[2]
+        elif fn == 81:                                 # print the stored symbol
+            self.print_line(feed_empty=False)
+            matrix = qr_matrix(self.qr_data, self.qr_level)
+            size = len(matrix) * self.qr_module
+            bitmap = None
+            if self.render:
+                bitmap = [bytearray(PAPER_DOTS) for _ in range(size)]
+                x0 = self.left_margin + self.offset(size, self.style.align)
+                for y in range(size):
+                    for x in range(min(size, PAPER_DOTS - x0)):
+                        bitmap[y][x0 + x] = matrix[y // self.qr_module][x // self.qr_module]
+                bitmap = self.turned(bitmap)
+            self.burn(size, bitmap)
+
+    # === Results ===
+
+    def image(self, view):
+        rows = self.rows
+        if view == "reader" or (view == "auto" and self.ever_upside_down):
+            rows = [bytearray(reversed(row)) for row in reversed(rows)]
+        return rows
+
+    def report(self):
+        transmit = self.clock
+        total = max(self.burn_end, transmit)
+        return {
+            "bytes": self.bytes,
+            "lines": self.lines,
+            "paper_mm": round(self.paper_dots / DOTS_PER_MM, 1),
+            "baud": self.baud,
+            "speed": self.speed,
+            "heat": self.heat,
+            "transmit_s": round(transmit, 3),
+            "burn_s": round(self.burn_time, 3),
+            "total_s": round(total, 3),
+            "bound": "serial" if transmit > self.burn_time else "paper",
+            "commands": dict(sorted(self.commands.items())),
+            "unknown": self.unknown,
+        }
+
+
+def glyph(c, page):
+    # Five font columns, "block" for the full block, None when the font has no such character
+    if c == FULL_BLOCK and page == 0:
+        return "block"
+    if c < 0x80:
+        text = chr(c)
+    else:
+        codec = CODECS.get(page)
+        if codec is None:
+            return None
+        text = bytes([c]).decode(codec, "replace")
+        text = unicodedata.normalize("NFKD", text).encode("ascii", "ignore").decode() or text
+    code = ord(text[0])
+    if 32 <= code <= 126:
+        return FONT_5X7[(code - 32) * 5:(code - 32) * 5 + 5]
+    return None
+
+
+def font_dot(columns, gx, gy, scale_x, scale_y):
+    # 5x7 glyph scaled into the cell, one dot of margin left and top
+    fx = (gx - 1) // scale_x if gx >= 1 else -1
+    fy = (gy - 1) // scale_y if gy >= 1 else -1
+    if not (0 <= fx < 5 and 0 <= fy < 7):
+        return False
+    return bool(columns[fx] >> fy & 1)
+
+
+def qr_matrix(data, level):
+    try:
+        import qrcode
+        levels = {48: qrcode.constants.ERROR_CORRECT_L, 49: qrcode.constants.ERROR_CORRECT_M,
+                  50: qrcode.constants.ERROR_CORRECT_Q, 51: qrcode.constants.ERROR_CORRECT_H}
+        code = qrcode.QRCode(border=0, error_correction=levels.get(level, qrcode.constants.ERROR_CORRECT_L))
+        code.add_data(data)
+        code.make(fit=True)
+        return [[1 if dot else 0 for dot in row] for row in code.get_matrix()]
+    except ImportError:
+        pass
+    # Stand-in of the same size: outline, three finder squares and a cross
+    version = next((v + 1 for v, cap in enumerate(QR_CAPACITY) if len(data) <= cap), len(QR_CAPACITY))
+    size = 17 + 4 * version
+    matrix = [[0] * size for _ in range(size)]
+    for y in range(size):
+        for x in range(size):
+            edge = x in (0, size - 1) or y in (0, size - 1) or x == y or x == size - 1 - y
+            for fx, fy in ((0, 0), (size - 7, 0), (0, size - 7)):
+                if fx <= x < fx + 7 and fy <= y < fy + 7:
+                    edge = not (fx + 1 <= x < fx + 6 and fy + 1 <= y < fy + 6) or (fx + 2 <= x < fx + 5 and fy + 2 <= y < fy + 5)
+            matrix[y][x] = 1 if edge else 0
+    return matrix
+
+
+# === Image Files ===
+
+def pack(rows, black=1):
+    out = bytearray()
+    for row in rows:
+        for i in range(0, PAPER_DOTS, 8):
+            byte = 0
+            for bit in range(8):
+                if row[i + bit] == black:
+                    byte |= 0x80 >> bit
+            out.append(byte)
+    return bytes(out)
+
+
+def write_pbm(path, rows):
+    with open(path, "wb") as f:
+        f.write(b"P4\n%d %d\n" % (PAPER_DOTS, len(rows)))
+        f.write(pack(rows))
+
+
+def read_pbm(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    fields = data.split(None, 3)                       # P4, width, height, bits (no comments written)
+    width, height = int(fields[1]), int(fields[2])
+    return width, height, fields[3][:width * height // 8]
+
+
+def write_png(path, rows):
+    # 1 bit grayscale, where 0 is black
+    stride = PAPER_DOTS // 8
+    packed = pack(rows, black=0)
+    raw = b"".join(b"\0" + packed[i * stride:(i + 1) * stride] for i in range(len(rows)))
+
+    def chunk(kind, body):
+        return (len(body).to_bytes(4, "big") + kind + body +
+                zlib.crc32(kind + body).to_bytes(4, "big"))
+
+    header = PAPER_DOTS.to_bytes(4, "big") + max(len(rows), 1).to_bytes(4, "big") + bytes([1, 0, 0, 0, 0])
+    with open(path, "wb") as f:
+        f.write(b"\x89PNG\r\n\x1a\n" + chunk(b"IHDR", header) + chunk(b"IDAT", zlib.compress(raw, 9)) +
+                chunk(b"IEND", b""))
+
+
+def compare_golden(path, rows, update):
+    # 0 = same, 1 = different; a missing golden image is written with --update
+    bits = pack(rows)
+    try:
+        width, height, golden = read_pbm(path)
+    except FileNotFoundError:
+        if not update:
+            print("%s: no golden image, run with --update to create it" % path)
+            return 1
+        write_pbm(path, rows)
+        print("%s: written" % path)
+        return 0
+    if width == PAPER_DOTS and height == len(rows) and golden == bits:
+        return 0
+    if update:
+        write_pbm(path, rows)
+        print("%s: updated" % path)
+        return 0
+    stride = PAPER_DOTS // 8
+    first = next((i // stride for i in range(min(len(golden), len(bits))) if golden[i] != bits[i]),
+                 min(height, len(rows)))
+    print("%s: differs from row %d (golden %dx%d, rendered %dx%d)" % (path, first, width, height, PAPER_DOTS, len(rows)))
+    return 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("captures", nargs="+", help="files with the bytes sent to the printer, - for stdin")
+    parser.add_argument("--baud", type=int, default=9600, help="serial rate the stream starts at")
+    parser.add_argument("--speed", type=int, default=3, choices=range(10), help="ESC ## STSP setting in effect")
+    parser.add_argument("--pbm", help="write the paper as PBM (one capture only)")
+    parser.add_argument("--png", help="write the paper as PNG (one capture only)")
+    parser.add_argument("--golden", help="compare with this PBM, exit 1 when it differs (one capture only)")
+    parser.add_argument("--update", action="store_true", help="write the golden image instead of failing")
+    parser.add_argument("--view", choices=("auto", "reader", "paper"), default="auto",
+                        help="reader turns the paper to read an upside-down receipt, auto does so after ESC { 1")
+    parser.add_argument("--json", action="store_true", help="print the reports as JSON")
+    parser.add_argument("--preload", metavar="CAPTURE", help="run this capture first and keep only the NV graphics it defined")
+    args = parser.parse_args()
+
+    images = args.pbm or args.png or args.golden
+    if images and len(args.captures) > 1:
+        parser.error("--pbm, --png and --golden take one capture")
+
+    nv = {}
+    if args.preload:
+        nv = Printer(args.baud, args.speed, render=False).run(open(args.preload, "rb").read()).nv
+
+    status = 0
+    reports = {}
+    for name in args.captures:
+        data = sys.stdin.buffer.read() if name == "-" else open(name, "rb").read()
+        printer = Printer(args.baud, args.speed, render=bool(images))
+        printer.nv = dict(nv)
+        printer.run(data)
+        reports[name] = printer.report()
+        if images:
+            rows = printer.image(args.view)
+            if args.pbm:
+                write_pbm(args.pbm, rows)
+            if args.png:
+                write_png(args.png, rows)
+            if args.golden:
+                status |= compare_golden(args.golden, rows, args.update)
+
+    if args.json:
+        print(json.dumps(reports, indent=2))
+    else:
+        for name, r in reports.items():
+            print("%s: %d bytes, %d lines, %.1f mm paper, transmit %.2f s + burn %.2f s -> %.2f s (%s bound, %d baud, speed %d)%s" % (
+                name, r["bytes"], r["lines"], r["paper_mm"], r["transmit_s"], r["burn_s"], r["total_s"],
+                r["bound"], r["baud"], r["speed"], ", %d unknown commands" % r["unknown"] if r["unknown"] else ""))
+    sys.exit(status)
+
+
+if __name__ == "__main__":
+    main()
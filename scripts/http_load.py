@@ -0,0 +1,207 @@
+"""Concurrent load generator for the printer web server.
+
+Opens many connections at once and mixes well-behaved submits with the
+clients that used to stall the old single-client server: slow senders that
+trickle their body, oversized bodies and clients that connect and say
+nothing. Prints status counts and latency percentiles per scenario.
+
+    python scripts/http_load.py 192.168.1.50 --clients 16 --requests 200
+
+Point it at the board, or at a host build of the server on localhost. Every
+submit that gets a 200 prints a receipt, so keep the numbers small against
+real hardware.
+
+With --soak the load repeats for that many minutes and the heap gauges of
+/metrics.json are read after every round. The largest free block is what
+fragmentation eats away, so it should stay flat over hours of uptime:
+
+    python scripts/http_load.py 192.168.1.50 --soak 240 --requests 50 --min-block 8000
+"""
+import argparse
+import asyncio
+import json
+import random
+import time
+import urllib.parse
+from collections import defaultdict
+
+BOUNDARY = "----scribe-load-test"
+
+
+def urlencoded_submit(message):
+    body = urllib.parse.urlencode({"message": message, "codepage": "auto"}).encode()
+    head = ("POST /submit HTTP/1.1\r\nHost: printer\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\n"
+            "Content-Length: %d\r\n\r\n" % len(body)).encode()
+    return head + body
+
+
+def multipart_submit(message):
+    body = ("--%s\r\nContent-Disposition: form-data; name=\"message\"\r\n\r\n%s\r\n"
+            "--%s\r\nContent-Disposition: form-data; name=\"date\"\r\n\r\n2025-06-06\r\n"
+            "--%s--\r\n" % (BOUNDARY, message, BOUNDARY, BOUNDARY)).encode()
+    head = ("POST /submit HTTP/1.1\r\nHost: printer\r\n"
+            "Content-Type: multipart/form-data; boundary=%s\r\n"
+            "Content-Length: %d\r\n\r\n" % (BOUNDARY, len(body))).encode()
+    return head + body
+
+
+def query_submit(message):
+    return ("GET /submit?message=%s HTTP/1.1\r\nHost: printer\r\n\r\n"
+            % urllib.parse.quote(message)).encode()
+
+
+def page_request():
+    return b"GET / HTTP/1.1\r\nHost: printer\r\nAccept-Encoding: gzip\r\n\r\n"
+
+
+def oversized_submit():
+    body = b"message=" + b"x" * 8000
+    head = ("POST /submit HTTP/1.1\r\nHost: printer\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\n"
+            "Content-Length: %d\r\n\r\n" % len(body)).encode()
+    return head + body
+
+
+async def exchange(host, port, payload, trickle=0.0, timeout=30.0):
+    """Send payload (byte by byte with `trickle` seconds between bytes) and
+    return the HTTP status, or a short error name."""
+    try:
+        reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+    except (OSError, asyncio.TimeoutError):
+        return "connect-failed"
+    try:
+        if trickle > 0:
+            for i in range(len(payload)):
+                writer.write(payload[i:i + 1])
+                await writer.drain()
+                await asyncio.sleep(trickle)
+        elif payload:
+            writer.write(payload)
+            await writer.drain()
+        status_line = await asyncio.wait_for(reader.readline(), timeout)
+        await asyncio.wait_for(reader.read(), timeout)
+        parts = status_line.split()
+        return parts[1].decode() if len(parts) > 1 else "no-response"
+    except (ConnectionError, asyncio.TimeoutError, asyncio.IncompleteReadError):
+        return "reset"
+    finally:
+        writer.close()
+
+
+async def fetch_heap(host, port, timeout=10.0):
+    """Heap gauges from /metrics.json, None when the board does not answer."""
+    try:
+        reader, writer = await asyncio.wait_for(asyncio.open_connection(host, port), timeout)
+    except (OSError, asyncio.TimeoutError):
+        return None
+    try:
+        writer.write(b"GET /metrics.json HTTP/1.1\r\nHost: printer\r\n\r\n")
+        await writer.drain()
+        response = await asyncio.wait_for(reader.read(), timeout)  # the server closes after the body
+        metrics = json.loads(response.split(b"\r\n\r\n", 1)[1])
+        return {name: metrics.get("heap_" + name) for name in ("free_bytes", "max_block_bytes", "fragmentation_percent")}
+    except (ConnectionError, asyncio.TimeoutError, IndexError, ValueError):
+        return None
+    finally:
+        writer.close()
+
+
+async def worker(args, jobs, results):
+    while True:
+        try:
+            index = jobs.pop()
+        except IndexError:
+            return
+        message = "load %d %s" % (index, "äöü € ✓" if index % 3 == 0 else "plain")
+        roll = random.random()
+        trickle = 0.0
+        if roll < args.slow:
+            scenario, payload, trickle = "slow", urlencoded_submit(message), args.trickle
+        elif roll < args.slow + args.idle:
+            scenario, payload = "idle", b""
+        elif roll < args.slow + args.idle + 0.05:
+            scenario, payload = "oversized", oversized_submit()
+        else:
+            scenario, payload = random.choice([
+                ("urlencoded", urlencoded_submit(message)),
+                ("multipart", multipart_submit(message)),
+                ("query", query_submit(message)),
+                ("page", page_request()),
+            ])
+        start = time.monotonic()
+        status = await exchange(args.host, args.port, payload, trickle)
+        results[scenario].append((status, time.monotonic() - start))
+
+
+def percentile(values, fraction):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(fraction * len(values)))]
+
+
+async def soak(args):
+    # Rounds of load until the time is up, the heap read after each one
+    end = time.monotonic() + args.soak * 60
+    samples = []
+    round_number = 0
+    while time.monotonic() < end:
+        round_number += 1
+        await run(args)
+        await asyncio.sleep(args.settle)               # let the queue drain so only lasting damage shows
+        heap = await fetch_heap(args.host, args.port)
+        if heap is None:
+            print("round %d: no metrics" % round_number)
+            continue
+        samples.append(heap["max_block_bytes"])
+        print("round %d: free %s B, largest block %s B, fragmentation %s%%" % (
+            round_number, heap["free_bytes"], heap["max_block_bytes"], heap["fragmentation_percent"]))
+
+    if not samples:
+        print("no heap samples")
+        return 1
+    print("largest block: first %d B, lowest %d B, last %d B (%+d B over %d rounds)" % (
+        samples[0], min(samples), samples[-1], samples[-1] - samples[0], len(samples)))
+    return 1 if args.min_block and min(samples) < args.min_block else 0
+
+
+async def run(args):
+    jobs = list(range(args.requests))
+    results = defaultdict(list)
+    start = time.monotonic()
+    await asyncio.gather(*(worker(args, jobs, results) for _ in range(args.clients)))
+    elapsed = time.monotonic() - start
+
+    print("%d requests, %d concurrent clients, %.1f s" % (args.requests, args.clients, elapsed))
+    for scenario in sorted(results):
+        samples = results[scenario]
+        counts = defaultdict(int)
+        for status, _ in samples:
+            counts[status] += 1
+        latencies = [latency * 1000 for _, latency in samples]
+        print("  %-10s n=%-4d p50=%6.0f ms  p95=%6.0f ms  max=%6.0f ms  %s" % (
+            scenario, len(samples), percentile(latencies, 0.5), percentile(latencies, 0.95),
+            max(latencies), " ".join("%s:%d" % item for item in sorted(counts.items()))))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--clients", type=int, default=8, help="connections open at the same time")
+    parser.add_argument("--requests", type=int, default=100)
+    parser.add_argument("--slow", type=float, default=0.1, help="share of clients that trickle their request")
+    parser.add_argument("--trickle", type=float, default=0.02, help="seconds between bytes of a slow client")
+    parser.add_argument("--idle", type=float, default=0.05, help="share of clients that connect and send nothing")
+    parser.add_argument("--seed", type=int, default=1)
+    parser.add_argument("--soak", type=float, default=0, help="minutes to repeat the load, reading the heap after every round")
+    parser.add_argument("--settle", type=float, default=5.0, help="seconds between a soak round and its heap reading")
+    parser.add_argument("--min-block", type=int, default=0, help="soak fails (exit 1) when the largest free block drops below this")
+    args = parser.parse_args()
+    random.seed(args.seed)
+    if args.soak > 0:
+        raise SystemExit(asyncio.run(soak(args)))
+    asyncio.run(run(args))
+
+
+if __name__ == "__main__":
+    main()
@@ -1,8 +1,24 @@
 #include <ESP8266WiFi.h>
-#include <ESP8266WebServer.h>
-#include <WiFiUdp.h>
-#include <NTPClient.h>
+#include <HttpFront.h>          // Multi-client web server with streaming form parsing
 #include <ThermalPrinter.h>     // New printer driver for EM5820 Thermal Printer
+#include <PrintJob.h>           // Receipts as optimized op lists
+#include <ReceiptQueue.h>       // Fixed-size queue of receipts waiting for the printer
+#include <Scheduler.h>          // Cooperative task scheduler for loop()
+#include <PrinterProfile.h>     // Baud rate and heat/speed calibration
+#include <TimeFormat.h>         // Receipt date formatting
+#include <TimeService.h>        // Non-blocking NTP and cached date header
+#include <ImageRaster.h>        // Streaming PGM/PBM to printer raster conversion
+#include <Transcoder.h>         // UTF-8 to printer code page conversion
+#include <Spool.h>              // Flash journal of receipts, survives reboots
+#include <BatchParser.h>        // Message lists for /submit-batch
+#include <Metrics.h>            // Latency histograms and counters for /metrics
+#include <FastConnect.h>        // WiFi association from cached parameters
+#include <Admission.h>          // Duplicate detection and per-client rate limits
+#include <LongMessage.h>        // Messages too long for RAM, kept in flash and printed page by page
+#include <ReceiptTemplate.h>    // Receipt layouts compiled once to printer bytes with placeholders
+#include <LogoCache.h>          // Logos kept in the printer's NV memory and printed by reference
+#include "web_index.h"          // Generated at build time from web/index.html
+#include "WebRoutes.h"          // Paths and handlers of the web server
 #include <WIFI_credentials.h>   // Put your SSID and PASSWORD in this file
 
 
@@ -11,365 +27,1214 @@
 #define HEAT 15     // Printer heat (0-15), higher values print darker
 #define SPEED 3     // Print speed (0-9), higher values print faster
 #define maxCharsPerLine 32 // Max characters per line for the printer
+#define BAUD 9600   // Printer baud rate until a calibration found a faster one
+
+// === Queue Configuration ===
+#define RETRY_AFTER_SECONDS "10" // Retry-After hint sent with 503 when the queue is full
+
+// === Web Server Configuration ===
+#define SUBMIT_MAX_BODY (3 * LONG_MESSAGE_MAX + 1024) // Form body limit: the longest message kept in flash, all of it percent-encoded, and the other fields
+#define IMAGE_MAX_BODY 2097152  // Image upload limit
+#define FORM_VALUE_SIZE 16      // Short form fields (date, codepage, dither)
+#define BATCH_MAX_BODY 16384    // Batch body limit (JSON escapes make it larger than the messages)
+#define TEMPLATE_MAX_BODY 4096  // Template upload limit (urlencoded forms are larger than the text, TEMPLATE_MAX_SOURCE)
+
+// === Batch Configuration ===
+#define CUT_LINE "- - - - - - - - - - - - - - - -" // Compact separator between receipts of a batch
+
+// === Task Configuration ===
+#define HTTP_POLL_MS 2          // How often the web server looks for new clients
+#define HTTP_BUDGET_MS 5
+#define PRINT_IDLE_MS 250       // Print task poll interval while the queue is empty (submits wake it up)
+#define PRINT_BUDGET_MS 50      // Receipts are started only while inside this budget
+#define NTP_REFRESH_MS 60000    // Time between NTP exchanges once the clock is set
+#define NTP_BUDGET_MS 5
+#define WIFI_CHECK_MS 5000      // WiFi watchdog interval
+#define WIFI_BUDGET_MS 5
+#define SPOOL_TICK_MS 50        // Journal flush check interval
+#define SPOOL_BUDGET_MS 20
+#define TX_POLL_MS 5            // Printer transmit ring top-up interval while bytes are waiting (FIFO lasts 11 ms at 115200)
+#define TX_IDLE_MS 50
+#define TX_BUDGET_MS 2
+#define CALIBRATE_IDLE_MS 1000  // Calibration task interval while nothing was requested (a request wakes it)
+#define CALIBRATE_BUDGET_MS 200 // A step probes one baud rate, a silent printer takes CALIBRATION_PROBE_MS per probe
+
+#define BOOT_POLL_MS 10          // Boot step interval while the printer is being set up
+#define BOOT_WAIT_MS 100         // Boot check interval while only WiFi or NTP are outstanding
+#define BOOT_DONE_MS 60000
+#define BOOT_BUDGET_MS 25
+
+// === Boot Configuration ===
+#define PRINTER_PROBE_MS 20      // Status request timeout while waiting for the printer to come up
+#define PRINTER_BOOT_MS 1000     // Printer silent this long: search the other baud rates (or its TX is not wired)
+#define PRINTER_SETTLE_MS 500    // Longest pause after ESC @ and stored settings, the delay() setup used to have; a printer that answers a status request ends it early
+#define PRINTER_NV_PROBE_MS 100  // NV graphics capacity request timeout, no answer = logos are streamed
+#define WIFI_REUSE_LEASE false   // Skip DHCP with the address of the last boot, only when the router reserves it for us (nothing checks it is free)
+
+// === Printer Backpressure ===
+#define PRINT_TX_RESERVE 1024   // Ring room a receipt is started with, enough to never wait for the UART
+#define IMAGE_TX_RESERVE (RASTER_BAND_BYTES + 64) // Ring room needed before more image body is read
+#define LONG_TX_RESERVE (LONG_PAGE_BYTES + 128) // Ring room for one page of a long message and its line ends
+#define LOGO_TX_RESERVE (LOGO_UPLOAD_CHUNK + 32) // Ring room for the next chunk of a logo going into NV memory
 
 // === Function Declarations ===
-void connectToWiFi();
 void setupWebServer();
-void handleRoot();
-void handleSubmit();
-void handle404();
-String getFormattedDateTime();
-String formatCustomDate(String customDate);
-void initializePrinter();
-void printReceipt();
+void handleRoot(HttpRequest &request);
+void beginSubmit(HttpRequest &request);
+void submitField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags);
+void endSubmit(HttpRequest &request);
+void abortSubmit(HttpRequest &request);
+void handleCalibrate(HttpRequest &request);
+void beginImage(HttpRequest &request);
+void imageField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags);
+void endImage(HttpRequest &request);
+void abortImage(HttpRequest &request);
+void printImageBand(const uint8_t *band, uint16_t width, uint16_t rows, void *context);
+void storeLogoBand(const uint8_t *band, uint16_t width, uint16_t rows, void *context);
+void beginBatch(HttpRequest &request);
+void batchField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags);
+void endBatch(HttpRequest &request);
+void abortBatch(HttpRequest &request);
+void writeBatchIds(uint32_t firstId, uint16_t count);
+void beginTemplate(HttpRequest &request);
+void templateField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags);
+void endTemplate(HttpRequest &request);
+void abortTemplate(HttpRequest &request);
+void handle404(HttpRequest &request);
+void handleMetrics(HttpRequest &request);
+void handleMetricsJson(HttpRequest &request);
+void writeMetrics(HttpRequest &request, bool json);
+uint32_t queueDepth();
+uint32_t submissionKey(HttpRequest &request, const char *formKey, uint32_t content, uint32_t &lifetimeMs);
+bool throttled(HttpRequest &request, uint16_t receipts);
+void appendField(char *out, size_t size, const uint8_t *data, size_t length, uint8_t flags);
+const char *getFormattedDateTime();
+void formatCustomDate(const char *customDate, char *out);
+uint32_t bootTask(uint32_t budgetMs);
+void printerBoot();
+bool printerSettled(uint32_t now);
+void announceBoot();
+void printReceipt(const Receipt &receipt);
+bool printLongStep(const Receipt &receipt);
+void beginReceipt(const Receipt &receipt);
+void finishReceipt(const Receipt &receipt);
+void printTemplate(const CompiledTemplate &layout, const Receipt &receipt);
+void checklistUpsideDown(const char *message, uint8_t width);
 void printServerInfo();
+void printCalibration();
+uint32_t httpTask(uint32_t budgetMs);
+uint32_t printTask(uint32_t budgetMs);
+uint32_t ntpTask(uint32_t budgetMs);
+uint32_t wifiTask(uint32_t budgetMs);
+uint32_t spoolTask(uint32_t budgetMs);
+uint32_t txTask(uint32_t budgetMs);
+uint32_t calibrateTask(uint32_t budgetMs);
+bool imageReady(HttpRequest &request);
 
 // === WiFi Configuration ===
 const char* ssid = SSID;
 const char* password = PASSWORD;
 
+FastConnect fastConnect;
+
 // === Time Configuration ===
 const long utcOffsetInSeconds = 3600; // UTC offset in seconds (0 for UTC, 3600 for UTC+1, etc.)
-WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "pool.ntp.org", utcOffsetInSeconds, 60000);
+TimeService timeService("pool.ntp.org", utcOffsetInSeconds, NTP_REFRESH_MS);
 
 // === Web Server ===
-ESP8266WebServer server(80);
+HttpFront server(80);
 
 // === Printer Setup ===
 ThermalPrinter printer(Serial);
+PrintJob job(printer, CODEPAGE);
+PrinterCalibration calibration(printer);
+const PrinterProfile defaultProfile = {BAUD, HEAT, SPEED};
+PrinterProfile printerProfile = defaultProfile;
+bool calibrationRequested = false;
+
+// === Boot ===
+// Printer setup, WiFi association and NTP run side by side from the boot task
+enum PrinterBootStep : uint8_t {
+  PRINTER_PROBE, PRINTER_SEARCH, PRINTER_RESET, PRINTER_CODEPAGE, PRINTER_PROFILE, PRINTER_GRAPHICS, PRINTER_ORIENTATION, PRINTER_READY
+};
+PrinterBootStep printerStep = PRINTER_PROBE;
+uint32_t printerStepAt = 0;          // millis() from which the current step may run
+uint32_t printerSettleFrom = 0;      // millis() of the last command the printer needs time for
+uint32_t printerSettleMax = 0;       // longest the printer took to answer after one, for /metrics
+bool printerAnswers = false;         // answered a status request at boot, so it can end the pauses
+bool bootAnnounced = false;
+
+struct BootTimes {                   // millis() since reset when each phase finished, 0 = not yet
+  uint32_t printer;
+  uint32_t wifi;
+  uint32_t ntp;
+  uint32_t firstReceipt;
+};
+BootTimes bootTimes = {0, 0, 0, 0};
+
+// === Image Upload ===
+RasterStream imageStream;
+int8_t imageOwner = -1;              // Connection slot that is printing an image, the printer is its own until then
+char imageDither[FORM_VALUE_SIZE];
+char imageLogo[FORM_VALUE_SIZE];     // Logo id from the form: store the image instead of printing it
+bool imageStoring = false;           // Bands go to the logo cache
+
+// === Logos ===
+LogoCache logos(printer);
 
 
 // === Storage for form data ===
-struct Receipt {
-  String message;
-  String timestamp;
-  bool hasData;
+ReceiptQueue receiptQueue;
+ReceiptSpool spool;
+
+// Every connection fills its own form, so receipts from clients sending at the same time do not mix
+struct SubmitForm {
+  Receipt receipt;
+  size_t messageLength;
+  bool hasMessage;
+  bool isLong;                       // Message outgrew the receipt and streams into flash
+  uint32_t hash;                     // Over the message as it arrives, for duplicate detection
+  char date[FORM_VALUE_SIZE];
+  char codePage[FORM_VALUE_SIZE];
+  char key[HTTP_KEY_SIZE];           // Idempotency key as a form field, for links that cannot set headers
+  char layout[TEMPLATE_NAME_SIZE + 1]; // One more than a name holds, so a longer one is refused and not cut
+  size_t qrLength;                   // The qr field collects into the receipt, a longer one is refused
 };
+SubmitForm forms[HTTP_MAX_CLIENTS];
+
+// === Long Messages ===
+LongMessageWriter longWriter;
+int8_t longOwner = -1;               // Connection slot writing a long message to flash, one at a time
+LongMessageReader longReader;
+bool longPrinting = false;           // Front receipt's message is being printed from flash, page by page
+uint32_t longEncodeMicros = 0;       // Summed over its pages for the encode and serial histograms
+uint32_t longSerialMicros = 0;
+
+// === Batch Submission ===
+BatchParser batch;
+int8_t batchOwner = -1;              // Connection slot whose batch is being read, one batch at a time
+bool batchHasMessages = false;
+char batchDate[FORM_VALUE_SIZE];
+char batchCodePage[FORM_VALUE_SIZE];
+char batchSeparator[FORM_VALUE_SIZE];
+char batchKey[HTTP_KEY_SIZE];
+char batchResponse[BATCH_MAX_ITEMS * 11 + 16]; // {"ids":[...]}
+bool batchPrinting = false;          // Printer job held open between the receipts of a batch
+
+// === Templates ===
+TemplateStore templates(maxCharsPerLine, CODEPAGE);
+int8_t templateOwner = -1;           // Connection slot uploading a template, one at a time
+char templateName[TEMPLATE_NAME_SIZE + 1];
+char templateSource[TEMPLATE_MAX_SOURCE];
+size_t templateLength = 0;
+
+// === Admission ===
+// Retries and prefetched links are answered from here instead of printing twice
+IdempotencyCache recentSubmissions;
+ClientBuckets clientBuckets;
+char retryAfterText[12];
+
+// === Instrumentation ===
+Metrics metrics;
 
-Receipt currentReceipt = {"", "", false};
+// === Main Loop Tasks ===
+Scheduler scheduler;
 
 void setup() {
-  // Initialize printer
-  initializePrinter();
+  // Open the printer link at the saved baud rate, the boot task sets the printer up from here
+  printerProfile = calibration.load(defaultProfile);
+  printer.begin(printerProfile.baud);
   
-  // Connect to WiFi
-  connectToWiFi();
+  // Reload receipts that were not printed before the last reset (also mounts the filesystem for the WiFi cache)
+  spool.begin(receiptQueue);
+  if (spool.enabled()) logos.begin(); // Which logos the printer already holds
   
-  // Initialize time client
-  timeClient.begin();
-  printer.println("Time client initialized");
+  // Start joining WiFi, straight to the last access point when it is known
+#ifdef STATIC_IP
+  fastConnect.setStaticIp(IPAddress(STATIC_IP), IPAddress(STATIC_GATEWAY), IPAddress(STATIC_SUBNET), IPAddress(STATIC_DNS));
+#endif
+  fastConnect.begin(ssid, password, WIFI_REUSE_LEASE);
   
-  // Setup web server routes
+  // Time client and web server listen right away, they work once WiFi is up
+  timeService.begin();
   setupWebServer();
-  
-  // Start the server
   server.begin();
-  printer.println("Web server starting...");
-  
-  // Print server info
-  printServerInfo();
 
+  // Register main loop tasks (run in this order when due at the same time)
+  scheduler.add("boot", bootTask, BOOT_BUDGET_MS);
+  scheduler.add("http", httpTask, HTTP_BUDGET_MS);
+  scheduler.add("print", printTask, PRINT_BUDGET_MS);
+  scheduler.add("ntp", ntpTask, NTP_BUDGET_MS);
+  scheduler.add("wifi", wifiTask, WIFI_BUDGET_MS);
+  scheduler.add("spool", spoolTask, SPOOL_BUDGET_MS);
+  scheduler.add("tx", txTask, TX_BUDGET_MS);
+  scheduler.add("calibrate", calibrateTask, CALIBRATE_BUDGET_MS);
+
+  // A task that did not fit would never run: say so on paper, the only output there is
+  if (scheduler.dropped() > 0) printer.println("Task table full, raise MAX_TASKS");
 }
 
 void loop() {
-  // Handle web server requests
-  server.handleClient();
+  // Run due tasks, then sleep until the next deadline
+  scheduler.run();
+}
+
+// === Main Loop Tasks ===
+uint32_t httpTask(uint32_t budgetMs) {
+  bool waiting = server.handle(budgetMs);
+  return waiting ? 0 : HTTP_POLL_MS; // Come back right away while clients are still sending
+}
+
+uint32_t printTask(uint32_t budgetMs) {
+  if (printerStep != PRINTER_READY) return PRINT_IDLE_MS; // Still booting
+  if (imageOwner >= 0) return PRINT_IDLE_MS; // An image is streaming to the printer, receipts wait for it
+  if (calibration.running()) return PRINT_IDLE_MS; // The baud rate is changing, receipts wait for it
   
-  // Update time client
-  timeClient.update();
+  // A changed logo goes into the printer's NV memory between receipts, nothing may come between its bytes
+  if (logos.uploading() && !batchPrinting && !longPrinting) {
+    if (printer.txFree() < LOGO_TX_RESERVE) return TX_POLL_MS;
+    logos.step();
+    scheduler.wake("tx");
+    return 0;
+  }
   
-  // Check if we have a new receipt to print
-  if (currentReceipt.hasData) {
-    printReceipt();
-    currentReceipt.hasData = false; // Reset flag
+  // Print waiting receipts while inside the budget, at least one per slice
+  uint32_t start = millis();
+  do {
+    spool.refill(receiptQueue);
+    Receipt *receipt = receiptQueue.front();
+    if (receipt == nullptr) {
+      if (batchPrinting) {
+        printer.endJob(); // Rest of the batch went missing, do not hold the printer job
+        batchPrinting = false;
+      }
+      if (calibrationRequested) scheduler.wake("calibrate");
+      return PRINT_IDLE_MS;
+    }
+    uint16_t reserve = (receipt->flags & RECEIPT_LONG) ? LONG_TX_RESERVE : PRINT_TX_RESERVE;
+    if (printer.txFree() < reserve) return TX_POLL_MS; // Would wait for the UART, let the ring drain first
+    receiptQueue.advance(); // Printing it now, a long message stays in front over several passes
+    if (receipt->flags & RECEIPT_LONG) {
+      if (!longPrinting) metrics.printing(receipt->id);
+      bool done = printLongStep(*receipt);
+      scheduler.wake("tx");
+      if (!done) continue; // One page per pass, the loop checks the budget
+    } else {
+      metrics.printing(receipt->id);
+      printReceipt(*receipt);
+    }
+    if (bootTimes.firstReceipt == 0) bootTimes.firstReceipt = millis();
+    spool.commit(receipt->id);
+    receiptQueue.pop();
+    scheduler.wake("tx");
+  } while (millis() - start < budgetMs);
+
+  return 0; // More receipts waiting, come back right after the web server had its turn
+}
+
+uint32_t ntpTask(uint32_t budgetMs) {
+  return timeService.tick(); // Sends a request or picks up the answer, never waits for the network
+
+}
+
+uint32_t spoolTask(uint32_t budgetMs) {
+  spool.tick(); // Batched journal writes reach flash here
+  return SPOOL_TICK_MS;
+}
+
+uint32_t txTask(uint32_t budgetMs) {
+  printer.pump(); // Moves what the UART FIFO has room for, never waits
+  uint32_t drainMicros;
+  while (printer.drained(drainMicros)) metrics.record(STAGE_SERIAL_DRAIN, drainMicros);
+  return printer.txPending() > 0 ? TX_POLL_MS : TX_IDLE_MS;
+}
+
+uint32_t calibrateTask(uint32_t budgetMs) {
+  if (calibration.running()) {
+    uint32_t wait = calibration.step(); // One rate per step, the pauses are deadlines instead of delay()
+    if (calibration.running()) return wait;
+    if (calibration.succeeded()) printerProfile = calibration.result();
+    printerProfile.baud = printer.baud(); // Where the printer answers, also when a step went wrong
+    printCalibration();
+    scheduler.wake("print");
+    return CALIBRATE_IDLE_MS;
   }
+  if (!calibrationRequested) return CALIBRATE_IDLE_MS;
   
-  delay(1000); // Small delay to prevent excessive CPU usage (OG value: 10ms)
+  // Only on an idle printer: everything queued has to go out at the old rate
+  bool busy = receiptQueue.front() != nullptr || spool.pending() > 0 || batchPrinting || longPrinting || imageOwner >= 0 || logos.uploading();
+  if (printerStep != PRINTER_READY || busy || printer.txPending() > 0) return PRINT_IDLE_MS;
+  calibrationRequested = false;
+  calibration.start(defaultProfile, job.sentBytes(), job.paperDots()); // Speed for what the receipts so far needed from the link
+  return 0;
 }
 
-// === WiFi Connection ===
-void connectToWiFi() {
-  // Serial.print("Connecting to WiFi: ");
-  // Serial.println(ssid);
+uint32_t bootTask(uint32_t budgetMs) {
+  printerBoot();
   
-  WiFi.begin(ssid, password);
+  if (fastConnect.tick() == CONNECT_UP && bootTimes.wifi == 0) {
+    bootTimes.wifi = millis();
+    scheduler.wake("ntp"); // It backed off while WiFi was down
+  }
+  if (bootTimes.ntp == 0 && timeService.isSet()) bootTimes.ntp = millis();
   
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-    delay(1000);
-    // Serial.print(".");
-    attempts++;
+  // Banner once the printer is ready and WiFi has come up or given up
+  FastConnectState wifi = fastConnect.state();
+  if (!bootAnnounced && printerStep == PRINTER_READY && !logos.uploading() && wifi != CONNECT_FAST && wifi != CONNECT_SCAN) {
+    announceBoot();
+    bootAnnounced = true;
   }
   
-  if (WiFi.status() == WL_CONNECTED) {
-    printer.feed(1);
-    printer.println("WiFi connected successfully!");
-    printer.print("IP address: ");
-    printer.println(WiFi.localIP().toString());
-  } else {
-    printer.feed(1);
-    printer.println("Failed to connect to WiFi");
+  if (printerStep != PRINTER_READY) return BOOT_POLL_MS;
+  if (!bootAnnounced || bootTimes.wifi == 0 || bootTimes.ntp == 0) return BOOT_WAIT_MS;
+  return BOOT_DONE_MS;
+}
+
+uint32_t wifiTask(uint32_t budgetMs) {
+  if (fastConnect.state() == CONNECT_FAST || fastConnect.state() == CONNECT_SCAN) return WIFI_CHECK_MS; // Boot is still joining
+  
+  // Kick the WiFi stack if the connection dropped, reconnect() does not block
+  if (WiFi.status() != WL_CONNECTED) {
+    WiFi.reconnect();
   }
+  return WIFI_CHECK_MS;
 }
 
 // === Web Server Setup ===
+// The routes are listed in WebRoutes.h. One past HTTP_MAX_ROUTES is refused: unknown paths then answer 500 and http_routes_dropped shows it
 void setupWebServer() {
-  // Serve the main page
-  server.on("/", HTTP_GET, handleRoot);
-  
-  // Handle form submission
-  server.on("/submit", HTTP_POST, handleSubmit);
-
-  // ADD THIS LINE to also handle submission via URL
-  server.on("/submit", HTTP_GET, handleSubmit);
+  #define ROUTE(path, methods, end) server.on(path, methods, end);
+  #define BODY_ROUTE(path, methods, maxBody, begin, field, end, abort, ready) server.on({path, methods, maxBody, begin, field, end, abort, ready});
+  WEB_ROUTES(ROUTE, BODY_ROUTE)
+  #undef ROUTE
+  #undef BODY_ROUTE
   
   // Handle 404
   server.onNotFound(handle404);
 }
 
 // === Web Server Handlers ===
-void handleRoot() {
-  String html = R"rawliteral(
-<!DOCTYPE html>
-<html lang="en" class="bg-gray-50 text-gray-900">
-<head>
-  <meta charset="UTF-8" />
-  <meta name="viewport" content="width=device-width, initial-scale=1" />
-  <title>Life Receipt</title>
-  <script src="https://cdn.tailwindcss.com"></script>
-  <script src="https://cdn.jsdelivr.net/npm/canvas-confetti@1.6.0/dist/confetti.browser.min.js"></script>
-  <script defer>
-    function handleInput(el) {
-      const counter = document.getElementById('char-counter');
-      const remaining = 200 - el.value.length;
-      counter.textContent = `${remaining} characters left`;
-      counter.classList.toggle('text-red-500', remaining <= 20);
+void handleRoot(HttpRequest &request) {
+  // Page is built from web/index.html by scripts/build_web.py: minified, gzipped and kept in flash
+  request.addHeader("ETag", WEB_INDEX_ETAG);
+  request.addHeader("Cache-Control", "no-cache"); // Browser keeps its copy but revalidates with If-None-Match
+  
+  if (strcmp(request.ifNoneMatch(), WEB_INDEX_ETAG) == 0) {
+    request.send(304, "text/html", "");
+    return;
+  }
+  
+  request.addHeader("Content-Encoding", "gzip");
+  request.send_P(200, "text/html", (PGM_P)WEB_INDEX_GZ, WEB_INDEX_GZ_LEN); // Streamed from flash as the socket drains
+}
+
+void beginSubmit(HttpRequest &request) {
+  SubmitForm &form = forms[request.slot()];
+  form.messageLength = 0;
+  form.hasMessage = false;
+  form.isLong = false;
+  form.date[0] = '\0';
+  form.codePage[0] = '\0';
+  form.key[0] = '\0';
+  form.layout[0] = '\0';
+  form.qrLength = 0;
+  form.receipt.qr[0] = '\0';
+}
+
+void submitField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags) {
+  SubmitForm &form = forms[request.slot()];
+  
+  if (strcmp(name, "message") == 0) {
+    if (flags & HTTP_FIELD_START) {
+      abortSubmit(request); // A second message field starts over
+      form.hasMessage = true;
+      form.isLong = false;
+      form.messageLength = 0;
+      form.hash = ADMISSION_HASH_SEED;
     }
-    function handleSubmit(e) {
-      e.preventDefault();
-      const formData = new FormData(e.target);
-      fetch('/submit', {
-        method: 'POST',
-        body: formData
-      }).then(() => {
-        const form = document.getElementById('receipt-form');
-        const message = document.getElementById('thank-you');
-        form.classList.add('hidden');
-        message.classList.remove('hidden');
-        confetti({
-          particleCount: 100,
-          spread: 70,
-          origin: { y: 0.6 },
-        });
-      });
+    form.hash = admissionHash(form.hash, data, length);
+    
+    if (!form.isLong && form.messageLength + length > MAX_MESSAGE_LENGTH) {
+      // Too long for a receipt: move what came so far to flash and stream the rest after it
+      if (longOwner >= 0) {
+        metrics.rejected(REJECT_BUSY);
+        request.addHeader("Retry-After", RETRY_AFTER_SECONDS);
+        request.send(503, "text/plain", "Another long message is being received, please try again later");
+        return;
+      }
+      if (!spool.enabled() || !longWriter.begin(CODEPAGE)) {
+        metrics.rejected(REJECT_TOO_LARGE);
+        request.send(413, "text/plain", "Message too long"); // HttpFront closes without reading the rest of the body
+        return;
+      }
+      longOwner = request.slot();
+      form.isLong = true;
+      longWriter.write((const uint8_t*)form.receipt.message, form.messageLength);
     }
-  </script>
-</head>
-<body class="flex flex-col min-h-screen justify-between items-center py-12 px-4 font-sans">
-  <main class="w-full max-w-md text-center">
-    <h1 class="text-3xl font-semibold mb-10 text-gray-900 tracking-tight">Life Receipt:</h1>
-    <form id="receipt-form" onsubmit="handleSubmit(event)" action="/submit" method="post" class="bg-white shadow-2xl rounded-3xl p-8 space-y-6 border border-gray-100">
-      <textarea
-        name="message"
-        maxlength="200"
-        oninput="handleInput(this)"
-        placeholder="Type your receipt…"
-        class="w-full p-4 rounded-xl border border-gray-200 focus:outline-none focus:ring-2 focus:ring-gray-400 focus:border-transparent resize-none text-gray-800 placeholder-gray-400"
-        rows="4"
-        required
-        autofocus
-      ></textarea>
-      <div id="char-counter" class="text-sm text-gray-500 text-right">200 characters left</div>
-      <button type="submit" class="w-full bg-gray-900 hover:bg-gray-800 text-white py-3 rounded-xl font-medium transition-all duration-200 hover:scale-[1.02] hover:shadow-lg">
-        Send
-      </button>
-    </form>
-    <div id="thank-you" class="hidden text-gray-700 font-semibold text-xl mt-8 animate-fade-in">
-      🎉 Receipt submitted. You did it!
-    </div>
-  </main>
-  <footer class="text-sm text-gray-400 mt-16">
-    Designed with love by <a href="https://urbancircles.club" target="_blank" class="text-gray-500 hover:text-gray-700 transition-colors duration-200 underline decoration-gray-300 hover:decoration-gray-500 underline-offset-2">Peter / Urban Circles</a>
-  </footer>
-  <style>
-    @keyframes fade-in {
-      from { opacity: 0; transform: translateY(8px); }
-      to { opacity: 1; transform: translateY(0); }
+    if (form.isLong) {
+      if (!longWriter.write(data, length)) {
+        metrics.rejected(REJECT_TOO_LARGE);
+        request.send(413, "text/plain", "Message too long or flash full");
+      }
+    } else if (length > 0) {
+      memcpy(form.receipt.message + form.messageLength, data, length);
     }
-    .animate-fade-in {
-      animation: fade-in 0.6s ease-out forwards;
+    form.messageLength += length;
+  } else if (strcmp(name, "date") == 0) {
+    appendField(form.date, sizeof(form.date), data, length, flags);
+  } else if (strcmp(name, "codepage") == 0) {
+    appendField(form.codePage, sizeof(form.codePage), data, length, flags);
+  } else if (strcmp(name, "key") == 0) {
+    appendField(form.key, sizeof(form.key), data, length, flags);
+  } else if (strcmp(name, "template") == 0) {
+    appendField(form.layout, sizeof(form.layout), data, length, flags);
+  } else if (strcmp(name, "qr") == 0) {
+    if (flags & HTTP_FIELD_START) form.qrLength = 0;
+    form.qrLength += length;
+    appendField(form.receipt.qr, sizeof(form.receipt.qr), data, length, flags);
+  }
+}
+
+void endSubmit(HttpRequest &request) {
+  SubmitForm &form = forms[request.slot()];
+  Receipt &receipt = form.receipt;
+  
+  if (!form.hasMessage) {
+    metrics.rejected(REJECT_INVALID);
+    request.send(400, "text/plain", "Missing message parameter");
+    return;
+  }
+  if (!form.isLong) receipt.message[form.messageLength] = '\0';
+  
+  // A template is checked now, the receipt prints with the built-in layout should it go missing later
+  bool templated = form.layout[0] != '\0';
+  if (templated && !templates.exists(form.layout)) {
+    metrics.rejected(REJECT_INVALID);
+    request.send(400, "text/plain", "Unknown template");
+  } else if (templated && form.isLong) {
+    metrics.rejected(REJECT_TOO_LARGE);
+    request.send(413, "text/plain", "Message too long for a template");
+  } else if (form.qrLength > MAX_QR_LENGTH) {
+    metrics.rejected(REJECT_TOO_LARGE);
+    request.send(413, "text/plain", "QR text too long");
+  }
+  if (request.responded()) {
+    abortSubmit(request);
+    return;
+  }
+  
+  // Same request again: answer like the first time, print nothing
+  uint32_t content = admissionHash(form.hash, "", 1);
+  content = admissionHash(content, form.date, strlen(form.date) + 1);
+  content = admissionHash(content, form.codePage, strlen(form.codePage) + 1);
+  content = admissionHash(content, form.layout, strlen(form.layout) + 1);
+  content = admissionHash(content, receipt.qr, strlen(receipt.qr));
+  uint32_t lifetimeMs;
+  uint32_t key = submissionKey(request, form.key, content, lifetimeMs);
+  uint32_t firstId;
+  uint16_t count;
+  if (recentSubmissions.find(key, firstId, count)) {
+    abortSubmit(request);
+    request.addHeader("Idempotent-Replayed", "true");
+    request.send(200, "text/plain", "Receipt received and will be printed!");
+    return;
+  }
+  if (throttled(request, 1)) {
+    abortSubmit(request);
+    return;
+  }
+  
+  receipt.flags = templated ? RECEIPT_TEMPLATE : 0;
+  receipt.client = request.remoteAddress();
+  strcpy(receipt.layout, form.layout);
+  
+  // Check if a custom date was provided
+  if (form.date[0] != '\0') {
+    formatCustomDate(form.date, receipt.timestamp);
+  } else {
+    strcpy(receipt.timestamp, getFormattedDateTime());
+  }
+  
+  // Convert the UTF-8 form text to the printer code page, codepage=auto picks the page that fits the text best
+  receipt.codePage = CODEPAGE;
+  if (form.isLong) {
+    // Converted to the default page on the way into flash, auto would need the whole text up front
+    receipt.message[0] = '\0';
+    receipt.flags = RECEIPT_LONG;
+  } else {
+    if (strcmp(form.codePage, "auto") == 0) {
+      receipt.codePage = Transcoder::bestCodePage(receipt.message, form.messageLength, CODEPAGE);
     }
-  </style>
-</body>
-</html>
-)rawliteral";
+    Transcoder::transcode(receipt.message, form.messageLength, receipt.codePage);
+  }
+  
+  // Journal it, then queue it in RAM (or leave it in flash while RAM is full)
+  receipt.id = spool.nextId();
+  if (form.isLong) {
+    longOwner = -1;
+    if (!longWriter.finish(receipt.id)) {
+      metrics.rejected(REJECT_TOO_LARGE);
+      request.send(507, "text/plain", "Not enough flash for the message");
+      return;
+    }
+  }
+  if (!spool.accept(receipt, receiptQueue)) {
+    // Queue and journal full: tell the client to come back instead of dropping the receipt
+    if (form.isLong) LongMessageReader::remove(receipt.id);
+    metrics.rejected(REJECT_QUEUE_FULL);
+    request.addHeader("Retry-After", RETRY_AFTER_SECONDS);
+    request.send(503, "text/plain", "Printer queue is full, please try again later");
+    return;
+  }
+  
+  clientBuckets.charge(receipt.client, 1);
+  recentSubmissions.remember(key, receipt.id, 1, lifetimeMs);
+  
+  metrics.record(STAGE_ACCEPT_TO_ENQUEUE, micros() - request.acceptedMicros());
+  metrics.enqueued(receipt.id, queueDepth());
+  scheduler.wake("print");
+  request.send(200, "text/plain", "Receipt received and will be printed!");
+}
 
-// function handleKeyPress(e) {                                   Note: Was located last in <head> section
-//   if (e.key === 'Enter' && !e.shiftKey) {
-//     e.preventDefault();
-//     document.getElementById('receipt-form').dispatchEvent(new Event('submit'));
-//   }
-// }
+void abortSubmit(HttpRequest &request) {
+  // Drops a long message that will not be queued
+  if (longOwner != request.slot()) return;
+  longWriter.discard();
+  longOwner = -1;
+}
 
-// onkeypress="handleKeyPress(event)"                             Note: was located in <textarea> element         
+void beginBatch(HttpRequest &request) {
+  if (batchOwner >= 0) {
+    metrics.rejected(REJECT_BUSY);
+    request.addHeader("Retry-After", RETRY_AFTER_SECONDS);
+    request.send(503, "text/plain", "Another batch is being submitted, please try again later");
+    return;
+  }
+  batchOwner = request.slot();
+  batchHasMessages = false;
+  batchDate[0] = '\0';
+  batchCodePage[0] = '\0';
+  batchSeparator[0] = '\0';
+  batchKey[0] = '\0';
+}
 
+void batchField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags) {
+  // The body (or a form field "messages") holds the messages, options come as query or form fields
+  if (name[0] == '\0' || strcmp(name, "messages") == 0) {
+    if (flags & HTTP_FIELD_START) {
+      bool json = name[0] == '\0' && strcmp(request.contentType(), "application/json") == 0;
+      batch.begin(json ? BATCH_JSON : BATCH_LINES);
+      batchHasMessages = true;
+    }
+    batch.write(data, length);
+    if (batch.error() != nullptr) {
+      metrics.rejected(batch.overLimit() ? REJECT_TOO_LARGE : REJECT_INVALID);
+      request.send(batch.overLimit() ? 413 : 400, "text/plain", batch.error()); // Nothing is queued
+    }
+  } else if (strcmp(name, "date") == 0) {
+    appendField(batchDate, sizeof(batchDate), data, length, flags);
+  } else if (strcmp(name, "codepage") == 0) {
+    appendField(batchCodePage, sizeof(batchCodePage), data, length, flags);
+  } else if (strcmp(name, "separator") == 0) {
+    appendField(batchSeparator, sizeof(batchSeparator), data, length, flags);
+  } else if (strcmp(name, "key") == 0) {
+    appendField(batchKey, sizeof(batchKey), data, length, flags);
+  }
+}
+
+void endBatch(HttpRequest &request) {
+  // Check the whole batch before queueing any of it
+  if (!batchHasMessages) {
+    metrics.rejected(REJECT_INVALID);
+    request.send(400, "text/plain", "Send the messages as the request body");
+  } else if (!batch.end()) {
+    metrics.rejected(batch.overLimit() ? REJECT_TOO_LARGE : REJECT_INVALID);
+    request.send(batch.overLimit() ? 413 : 400, "text/plain", batch.error());
+  } else if (batch.count() == 0) {
+    metrics.rejected(REJECT_INVALID);
+    request.send(400, "text/plain", "No messages in batch");
+  }
+  if (request.responded()) {
+    abortBatch(request);
+    return;
+  }
+  
+  // Same batch again: the ids it got the first time, nothing queued
+  uint32_t content = admissionHash(ADMISSION_HASH_SEED, "batch", 5);
+  content = admissionHash(content, batch.all(), batch.allLength());
+  content = admissionHash(content, batchDate, strlen(batchDate) + 1);
+  content = admissionHash(content, batchCodePage, strlen(batchCodePage) + 1);
+  content = admissionHash(content, batchSeparator, strlen(batchSeparator));
+  uint32_t lifetimeMs;
+  uint32_t key = submissionKey(request, batchKey, content, lifetimeMs);
+  uint32_t firstId;
+  uint16_t count;
+  if (recentSubmissions.find(key, firstId, count)) {
+    writeBatchIds(firstId, count);
+    request.addHeader("Idempotent-Replayed", "true");
+    request.send(200, "application/json", batchResponse);
+  } else if (throttled(request, batch.count())) {
+    // 429 sent
+  } else if (!spool.reserve(batch.count(), batch.allLength(), receiptQueue)) {
+    metrics.rejected(REJECT_QUEUE_FULL);
+    request.addHeader("Retry-After", RETRY_AFTER_SECONDS);
+    request.send(503, "text/plain", "Printer queue is full, please try again later");
+  }
+  if (request.responded()) {
+    abortBatch(request);
+    return;
+  }
+  
+  // One date, code page and separator for the whole batch
+  Receipt &receipt = forms[request.slot()].receipt;
+  if (batchDate[0] != '\0') {
+    formatCustomDate(batchDate, receipt.timestamp);
+  } else {
+    strcpy(receipt.timestamp, getFormattedDateTime());
+  }
+  receipt.codePage = CODEPAGE;
+  if (strcmp(batchCodePage, "auto") == 0) {
+    receipt.codePage = Transcoder::bestCodePage(batch.all(), batch.allLength(), CODEPAGE);
+  }
+  uint8_t separator = strcmp(batchSeparator, "compact") == 0 ? RECEIPT_COMPACT : 0;
+  receipt.client = request.remoteAddress();
+  
+  // Journal them back to back, all but the last marked so the printer keeps its session open
+  firstId = spool.nextId();
+  for (uint8_t i = 0; i < batch.count(); i++) {
+    memcpy(receipt.message, batch.item(i), batch.itemLength(i) + 1);
+    Transcoder::transcode(receipt.message, batch.itemLength(i), receipt.codePage);
+    receipt.flags = separator | (i + 1 < batch.count() ? RECEIPT_BATCH_MORE : 0);
+    receipt.id = i == 0 ? firstId : spool.nextId(); // Consecutive, the answer lists them as a range
+    spool.accept(receipt, receiptQueue); // Cannot fail after reserve()
+    metrics.enqueued(receipt.id, queueDepth());
+  }
+  clientBuckets.charge(receipt.client, batch.count());
+  recentSubmissions.remember(key, firstId, batch.count(), lifetimeMs);
+  writeBatchIds(firstId, batch.count());
+  metrics.record(STAGE_ACCEPT_TO_ENQUEUE, micros() - request.acceptedMicros());
   
-  server.send(200, "text/html", html);
+  scheduler.wake("print");
+  request.send(200, "application/json", batchResponse);
+  abortBatch(request);
 }
 
-void handleSubmit() {
-  if (server.hasArg("message")) {
-    currentReceipt.message = server.arg("message");
-    
-    // Check if a custom date was provided
-    if (server.hasArg("date")) {
-      String customDate = server.arg("date");
-      currentReceipt.timestamp = formatCustomDate(customDate);
-      // Serial.println("Using custom date: " + customDate);
-    } else {
-      currentReceipt.timestamp = getFormattedDateTime();
-      // Serial.println("Using current date");
+void abortBatch(HttpRequest &request) {
+  if (batchOwner != request.slot()) return; // Turned away in beginBatch
+  batchOwner = -1;
+}
+
+void writeBatchIds(uint32_t firstId, uint16_t count) {
+  // {"ids":[12,13,14]}
+  size_t used = snprintf(batchResponse, sizeof(batchResponse), "{\"ids\":[");
+  for (uint16_t i = 0; i < count; i++) {
+    used += snprintf(batchResponse + used, sizeof(batchResponse) - used, "%s%lu", i > 0 ? "," : "", (unsigned long)(firstId + i));
+  }
+  snprintf(batchResponse + used, sizeof(batchResponse) - used, "]}");
+}
+
+void beginTemplate(HttpRequest &request) {
+  if (templateOwner >= 0) {
+    metrics.rejected(REJECT_BUSY);
+    request.addHeader("Retry-After", RETRY_AFTER_SECONDS);
+    request.send(503, "text/plain", "Another template is being uploaded, please try again later");
+    return;
+  }
+  templateOwner = request.slot();
+  templateName[0] = '\0';
+  templateLength = 0;
+}
+
+void templateField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags) {
+  // The body (or a form field "source") holds the template text, the name comes as a query or form field
+  if (name[0] == '\0' || strcmp(name, "source") == 0) {
+    if (flags & HTTP_FIELD_START) templateLength = 0;
+    if (templateLength + length > sizeof(templateSource)) {
+      metrics.rejected(REJECT_TOO_LARGE);
+      request.send(413, "text/plain", "Template too long");
+      return;
     }
-    
-    currentReceipt.hasData = true;
-    
-    // Serial.println("=== New Receipt Received ===");
-    // Serial.println("Message: " + currentReceipt.message);
-    // Serial.println("Time: " + currentReceipt.timestamp);
-    // Serial.println("============================");
-    
-    server.send(200, "text/plain", "Receipt received and will be printed!");
+    memcpy(templateSource + templateLength, data, length);
+    templateLength += length;
+  } else if (strcmp(name, "name") == 0) {
+    appendField(templateName, sizeof(templateName), data, length, flags);
+  }
+}
+
+void endTemplate(HttpRequest &request) {
+  // Compiled right away, so a mistake is reported to the uploader and not found at print time
+  if (!TemplateStore::validName(templateName)) {
+    metrics.rejected(REJECT_INVALID);
+    request.send(400, "text/plain", "Template name must be 1 to 15 of a-z, 0-9, _ and -");
+  } else if (templateLength == 0) {
+    metrics.rejected(REJECT_INVALID);
+    request.send(400, "text/plain", "Send the template as the request body");
+  } else if (!spool.enabled()) {
+    request.send(507, "text/plain", "No filesystem for templates");
+  } else if (!templates.save(templateName, templateSource, templateLength)) {
+    metrics.rejected(templates.storageError() ? REJECT_TOO_LARGE : REJECT_INVALID);
+    request.send(templates.storageError() ? 507 : 400, "text/plain", templates.error());
   } else {
-    server.send(400, "text/plain", "Missing message parameter");
+    request.send(200, "text/plain", "Template saved");
   }
+  abortTemplate(request);
 }
 
-void handle404() {
-  server.send(404, "text/plain", "Page not found");
+void abortTemplate(HttpRequest &request) {
+  if (templateOwner != request.slot()) return; // Turned away in beginTemplate
+  templateOwner = -1;
 }
 
-// === Time Utilities ===
-String getFormattedDateTime() {
-  timeClient.update();
-  
-  // Get epoch time
-  unsigned long epochTime = timeClient.getEpochTime();
-  
-  // Convert to struct tm
-  time_t rawTime = epochTime;
-  struct tm * timeInfo = gmtime(&rawTime);
-  
-  // Day names and month names
-  String dayNames[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-  String monthNames[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
-                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
-  
-  // Format: "Sat, 06 Jun 2025"
-  String formatted = dayNames[timeInfo->tm_wday] + ", ";
-  formatted += String(timeInfo->tm_mday < 10 ? "0" : "") + String(timeInfo->tm_mday) + " ";
-  formatted += monthNames[timeInfo->tm_mon] + " ";
-  formatted += String(timeInfo->tm_year + 1900);
+void beginImage(HttpRequest &request) {
+  // One image at a time, its bands go straight to the printer
+  if (imageOwner >= 0 || batchPrinting || longPrinting || logos.uploading()) {
+    metrics.rejected(REJECT_BUSY);
+    request.addHeader("Retry-After", RETRY_AFTER_SECONDS);
+    request.send(503, "text/plain", "Another image is printing, please try again later");
+    return;
+  }
+  imageOwner = request.slot();
+  imageDither[0] = '\0';
+  imageLogo[0] = '\0';
+  imageStream.begin(DITHER_FLOYD_STEINBERG, nullptr, nullptr); // No file part seen yet
+}
+
+void imageField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags) {
+  // Called for every chunk of the uploaded file, bands go to the printer as soon as they are complete.
+  // Rows print in upload order, so for the upside-down mounted printer upload the image rotated by 180°.
+  // With a logo field before the file the image is stored under that id instead (template: logo <id>).
+  if (!(flags & HTTP_FIELD_FILE)) {
+    if (strcmp(name, "dither") == 0) appendField(imageDither, sizeof(imageDither), data, length, flags);
+    if (strcmp(name, "logo") == 0) appendField(imageLogo, sizeof(imageLogo), data, length, flags);
+    return;
+  }
   
-  return formatted;
+  bool storing = imageLogo[0] != '\0';
+  if (flags & HTTP_FIELD_START) {
+    DitherMode mode = DITHER_FLOYD_STEINBERG;
+    if (strcmp(imageDither, "ordered") == 0) mode = DITHER_ORDERED;
+    else if (strcmp(imageDither, "none") == 0) mode = DITHER_THRESHOLD;
+    if (storing) {
+      uint8_t id = imageLogo[1] == '\0' && isdigit(imageLogo[0]) ? imageLogo[0] - '0' : LOGO_SLOTS;
+      imageStoring = logos.beginStore(id);
+      imageStream.begin(mode, imageStoring ? storeLogoBand : nullptr, nullptr);
+    } else {
+      imageStream.begin(mode, printImageBand, nullptr);
+      printer.beginJob();
+    }
+  }
+  if (length > 0) imageStream.write(data, length);
+  if ((flags & HTTP_FIELD_END) && storing) {
+    imageStream.end();
+  } else if (flags & HTTP_FIELD_END) {
+    imageStream.end();
+    printer.feed(3);
+    printer.endJob();
+  }
+}
+
+void endImage(HttpRequest &request) {
+  if (imageStream.width() == 0 && imageStream.error() == nullptr) {
+    request.send(400, "text/plain", "Send the image as a multipart file upload");
+  } else if (imageStream.error() != nullptr) {
+    request.send(400, "text/plain", imageStream.error());
+  } else if (imageLogo[0] != '\0' && !(imageStoring && logos.finishStore())) {
+    request.send(spool.enabled() ? 400 : 507, "text/plain", logos.error());
+  } else if (imageLogo[0] != '\0') {
+    request.send(200, "text/plain", logos.capacity() > 0 ? "Logo stored, it is sent to the printer's memory next" : "Logo stored");
+  } else {
+    request.send(200, "text/plain", "Image printed");
+  }
+  abortImage(request); // Release the printer
+}
+
+void abortImage(HttpRequest &request) {
+  if (imageOwner != request.slot()) return; // Turned away in beginImage
+  printer.endJob();
+  if (imageStoring) logos.discardStore(); // Cut short, the old logo stays
+  imageStoring = false;
+  imageStream.begin(DITHER_FLOYD_STEINBERG, nullptr, nullptr); // Reset for the next upload
+  imageOwner = -1;
+  scheduler.wake("print");
+}
+
+bool imageReady(HttpRequest &request) {
+  return printerStep == PRINTER_READY && !calibration.running() && printer.txFree() >= IMAGE_TX_RESERVE;
+}
+
+void printImageBand(const uint8_t *band, uint16_t width, uint16_t rows, void *context) {
+  printer.printBitmap(width, rows, band);
+  scheduler.wake("tx");
 }
 
-String formatCustomDate(String customDate) {
-  // Expected format: YYYY-MM-DD or DD/MM/YYYY or similar
-  // This function will try to parse common date formats and return formatted string
+void storeLogoBand(const uint8_t *band, uint16_t width, uint16_t rows, void *context) {
+  logos.storeBand(band, width, rows);
+}
+
+void handleCalibrate(HttpRequest &request) {
+  calibrationRequested = true;
+  scheduler.wake("calibrate");
+  request.send(202, "text/plain", "Calibration will run once the print queue is empty");
+}
+
+void handle404(HttpRequest &request) {
+  request.send(404, "text/plain", "Page not found");
+}
+
+void handleMetrics(HttpRequest &request) {
+  writeMetrics(request, false);
+}
+
+void handleMetricsJson(HttpRequest &request) {
+  writeMetrics(request, true);
+}
+
+void writeMetrics(HttpRequest &request, bool json) {
+  // Streamed straight into the socket, a few KB of text that is never held in RAM as a whole
+  HttpStream out(request, 200, json ? "application/json" : "text/plain; version=0.0.4");
+  MetricsWriter writer(out, json);
+  metrics.write(writer);
   
-  String dayNames[] = {"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"};
-  String monthNames[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
-                        "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+  const PrinterStats &stats = printer.totalStats();
+  writer.counter("printer_bytes_total", "Bytes sent to the printer", stats.bytes);
+  writer.counter("printer_writes_total", "Serial writes to the printer", stats.writes);
+  const TxStats &tx = printer.txStats();
+  writer.gauge("printer_tx_pending_bytes", "Bytes in the transmit ring", printer.txPending());
+  writer.gauge("printer_tx_high_water_bytes", "Fullest the transmit ring has been", tx.highWater);
+  writer.counter("printer_tx_drained_bytes_total", "Bytes moved from the ring to the UART", tx.drained);
+  writer.counter("printer_tx_stalls_total", "Writes that waited for the UART because the ring was full", tx.stalls);
+  writer.gauge("printer_tx_fill_bytes_per_second", "Ring fill rate", tx.fillRate);
+  writer.gauge("printer_tx_drain_bytes_per_second", "Ring drain rate", tx.drainRate);
+  writer.gauge("printer_nv_graphics_bytes", "NV graphics memory the printer reported, 0 = logos are streamed", logos.capacity());
+  writer.counter("printjob_bytes_saved_total", "Bytes the print job optimizer removed", job.savedBytes());
+  writer.gauge("printjob_last_bytes", "Bytes of the last print job", job.cost().bytes);
+  writer.gauge("printjob_last_estimate_ms", "Estimated print time of the last print job", job.cost().ms);
+  writer.gauge("queue_depth", "Receipts waiting to be printed", queueDepth());
+  writer.gauge("queue_spilled", "Receipts waiting in flash only", spool.spilled());
+  writer.counter("jobs_duplicate_total", "Repeated submissions answered without printing", recentSubmissions.duplicates());
+  writer.gauge("clients_tracked", "Clients with a rate limit bucket", clientBuckets.tracked());
+  writer.counter("spool_flash_writes_total", "Journal flushes to flash", spool.flashWrites());
   
-  int day = 0, month = 0, year = 0;
+  writer.counter("http_rejected_total", "Connections turned away because all slots were busy", server.rejected());
+  writer.counter("http_timeouts_total", "Requests that timed out", server.timeouts());
+  writer.gauge("http_active", "Connections open", server.active());
+  writer.gauge("http_routes_dropped", "Routes that did not fit HTTP_MAX_ROUTES, should be 0", server.droppedRoutes());
+  writer.gauge("scheduler_tasks_dropped", "Tasks that did not fit MAX_TASKS and never run, should be 0", scheduler.dropped());
   
-  // Try to parse YYYY-MM-DD format
-  if (customDate.indexOf('-') != -1) {
-    int firstDash = customDate.indexOf('-');
-    int secondDash = customDate.indexOf('-', firstDash + 1);
-    
-    if (firstDash != -1 && secondDash != -1) {
-      year = customDate.substring(0, firstDash).toInt();
-      month = customDate.substring(firstDash + 1, secondDash).toInt();
-      day = customDate.substring(secondDash + 1).toInt();
-    }
+  // One series per task, grouped by name
+  for (uint8_t i = 0; i < scheduler.count(); i++) {
+    writer.counter("task_runs_total", "Slices run per task", scheduler.task(i).runs, "task", scheduler.task(i).name);
   }
-  // Try to parse DD/MM/YYYY format
-  else if (customDate.indexOf('/') != -1) {
-    int firstSlash = customDate.indexOf('/');
-    int secondSlash = customDate.indexOf('/', firstSlash + 1);
-    
-    if (firstSlash != -1 && secondSlash != -1) {
-      day = customDate.substring(0, firstSlash).toInt();
-      month = customDate.substring(firstSlash + 1, secondSlash).toInt();
-      year = customDate.substring(secondSlash + 1).toInt();
-    }
+  for (uint8_t i = 0; i < scheduler.count(); i++) {
+    writer.counter("task_overruns_total", "Slices over budget per task", scheduler.task(i).overruns, "task", scheduler.task(i).name);
   }
-  
-  // Validate parsed values
-  if (day < 1 || day > 31 || month < 1 || month > 12 || year < 1900 || year > 2100) {
-    // Serial.println("Invalid date format, using current date");
-    return getFormattedDateTime();
+  for (uint8_t i = 0; i < scheduler.count(); i++) {
+    writer.gauge("task_max_run_ms", "Longest slice per task", scheduler.task(i).maxRunMs, "task", scheduler.task(i).name);
   }
   
-  // Calculate day of week (simplified algorithm - may not be 100% accurate for all dates)
-  // For a more accurate calculation, you might want to use a proper date library
-  int dayOfWeek = 0; // Default to Sunday if we can't calculate
+  // Boot phases, time-to-first-receipt included
+  writer.gauge("boot_phase_ms", "Milliseconds from reset until the phase finished, 0 = not yet", bootTimes.printer, "phase", "printer");
+  writer.gauge("boot_phase_ms", "", bootTimes.wifi, "phase", "wifi");
+  writer.gauge("boot_phase_ms", "", bootTimes.ntp, "phase", "ntp");
+  writer.gauge("boot_phase_ms", "", bootTimes.firstReceipt, "phase", "first_receipt");
+  writer.gauge("boot_printer_settle_ms", "Longest the printer took to answer after a reset or a stored setting", printerSettleMax);
+  writer.gauge("boot_fast_connect", "1 when WiFi came up on the cached access point", fastConnect.usedCache());
   
-  // Format: "Sat, 06 Jun 2025"
-  String formatted = dayNames[dayOfWeek] + ", ";
-  formatted += String(day < 10 ? "0" : "") + String(day) + " ";
-  formatted += monthNames[month - 1] + " ";
-  formatted += String(year);
+  writer.gauge("heap_free_bytes", "Free heap", ESP.getFreeHeap());
+  writer.gauge("heap_max_block_bytes", "Largest allocatable heap block", ESP.getMaxFreeBlockSize());
+  writer.gauge("heap_fragmentation_percent", "Heap fragmentation", ESP.getHeapFragmentation());
+  writer.end();
+}
+
+uint32_t queueDepth() {
+  // The journal counts receipts spilled to flash as well, the RAM queue alone without a filesystem
+  return spool.enabled() ? spool.pending() : receiptQueue.size();
+}
+
+uint32_t submissionKey(HttpRequest &request, const char *formKey, uint32_t content, uint32_t &lifetimeMs) {
+  // The key=... form field wins over the Idempotency-Key header, scoped to the sender and the route
+  const char *key = formKey[0] != '\0' ? formKey : request.idempotencyKey();
+  return admissionKey(key, request.remoteAddress(), request.path(), content, lifetimeMs);
+}
+
+bool throttled(HttpRequest &request, uint16_t receipts) {
+  // Client used up its share of the printer: tell it when to come back
+  uint32_t waitMs = clientBuckets.retryAfter(request.remoteAddress(), receipts);
+  if (waitMs == 0) return false;
+  metrics.rejected(REJECT_THROTTLED);
+  snprintf(retryAfterText, sizeof(retryAfterText), "%lu", (unsigned long)((waitMs + 999) / 1000));
+  request.addHeader("Retry-After", retryAfterText);
+  request.send(429, "text/plain", "Too many receipts, please try again later");
+  return true;
+}
+
+void appendField(char *out, size_t size, const uint8_t *data, size_t length, uint8_t flags) {
+  // Collects a short form field, longer values are cut off
+  if (flags & HTTP_FIELD_START) out[0] = '\0';
+  size_t used = strlen(out);
+  while (length-- > 0 && used < size - 1) out[used++] = *data++;
+  out[used] = '\0';
+}
+
+// === Time Utilities ===
+const char *getFormattedDateTime() {
+  // Format: "Sat, 06 Jun 2025", cached by the time service until the date changes
+  return timeService.header();
+}
+
+void formatCustomDate(const char *customDate, char *out) {
+  // Parses YYYY-MM-DD or DD/MM/YYYY, out must hold DATE_HEADER_SIZE bytes
+  int day, month, year;
+  if (!parseCustomDate(customDate, year, month, day)) {
+    strcpy(out, getFormattedDateTime()); // Invalid date format, using current date
+    return;
+  }
   
-  return formatted;
+  formatDate(out, year, month, day);
 }
 
 // === Printer Functions ===
-void initializePrinter() {
-  // Initialize printer
-  printer.begin(9600);
-  delay(500);
-  printer.init();
-  delay(500);  
-  printer.feed(2);
-  delay(500);
+void printerBoot() {
+  // One step per call, pauses are deadlines instead of delay()
+  uint32_t now = millis();
+  if (printerStep == PRINTER_READY || (int32_t)(now - printerStepAt) < 0) return;
   
-  // Configure printer settings  
-  printer.setCodePage(CODEPAGE); // PC437
-  delay(500);
-  printer.setHeat(HEAT);  // Printer heat/depth
-  delay(500);
-  printer.setSpeed(SPEED); // Print speed
-  delay(500);
-  printer.setOrientationUpsideDown(true); // Enable 180° rotation (which also reverses the line order)
+  switch (printerStep) {
+    case PRINTER_PROBE:
+      // Ready as soon as it answers a status request at the saved rate
+      if (printer.isOnline(PRINTER_PROBE_MS)) {
+        printerAnswers = true;
+        printerStep = PRINTER_RESET;
+      } else if (now >= PRINTER_BOOT_MS) {
+        printerStep = PRINTER_SEARCH;
+      }
+      break;
+    case PRINTER_SEARCH:
+      printerAnswers = calibration.connect(printerProfile); // Other baud rates, keeps the saved one if the printer stays silent
+      printerStep = PRINTER_RESET;
+      break;
+    case PRINTER_RESET:
+      printer.init();
+      printerStep = PRINTER_CODEPAGE;
+      printerSettleFrom = now;
+      break;
+    case PRINTER_CODEPAGE:
+      if (!printerSettled(now)) break;
+      printer.feed(2);
+      printer.setCodePage(CODEPAGE); // PC437
+      printerStep = PRINTER_PROFILE;
+      printerSettleFrom = millis();
+      break;
+    case PRINTER_PROFILE:
+      if (!printerSettled(now)) break;
+      calibration.apply(printerProfile); // Printer heat/depth and print speed
+      printerStep = PRINTER_GRAPHICS;
+      printerSettleFrom = millis();
+      break;
+    case PRINTER_GRAPHICS:
+      if (!printerSettled(now)) break;
+      logos.setCapacity(printer.nvCapacity(PRINTER_NV_PROBE_MS)); // Silent printers get logos as raster images
+      printerStep = PRINTER_ORIENTATION;
+      break;
+    case PRINTER_ORIENTATION:
+      printer.setOrientationUpsideDown(true); // Enable 180° rotation (which also reverses the line order)
+      printer.println("Printer initialized.");
+      printerStep = PRINTER_READY;
+      bootTimes.printer = millis();
+      scheduler.wake("print"); // Receipts left from before the reset
+      break;
+    case PRINTER_READY:
+      break;
+  }
+}
+
+bool printerSettled(uint32_t now) {
+  // The datasheet gives no times for ESC @ or the settings kept in flash, so
+  // they are measured: the printer takes commands again once it answers a
+  // status request. One that never answers gets the full pause.
+  uint32_t waited = now - printerSettleFrom;
+  if (waited >= PRINTER_SETTLE_MS) return true;
+  if (!printerAnswers || !printer.isOnline(PRINTER_PROBE_MS)) return false;
+  waited = millis() - printerSettleFrom;
+  if (waited > printerSettleMax) printerSettleMax = waited;
+  return true;
+}
+
+void announceBoot() {
+  printer.beginJob();
+  job.begin();
+  job.feed(1);
+  if (fastConnect.state() == CONNECT_UP) {
+    job.line("WiFi connected successfully!");
+    IPAddress ip = WiFi.localIP();
+    job.line(job.format("IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]));
+  } else {
+    job.line("Failed to connect to WiFi");
+  }
+  job.line("Time client initialized");
+  job.line("Web server starting...");
+  printServerInfo();
+  job.end();
+  printer.endJob();
+}
+
+void printReceipt(const Receipt &receipt) {
+  uint32_t start = micros();
+  uint32_t serialBefore = printer.totalStats().serialMicros;
+  const CompiledTemplate *layout = (receipt.flags & RECEIPT_TEMPLATE) ? templates.find(receipt.layout) : nullptr;
+  if (layout != nullptr) {
+    printTemplate(*layout, receipt);
+  } else {
+    beginReceipt(receipt);
+    job.wrappedUpsideDown(receipt.message, strlen(receipt.message), maxCharsPerLine);
+    finishReceipt(receipt);
+  }
   
-  printer.println("Printer initialized.");
+  // Building bytes is encode time, waits for a full ring count towards the drain, which txTask records once its bytes are out
+  uint32_t serial = printer.totalStats().serialMicros - serialBefore;
+  printer.markDrain(serial);
+  metrics.record(STAGE_ENCODE, micros() - start - serial);
+}
 
+bool printLongStep(const Receipt &receipt) {
+  // A message from flash, one page per call after the index pass, last page first like a short message
+  uint32_t start = micros();
+  uint32_t serialBefore = printer.totalStats().serialMicros;
+  bool done;
+  if (!longPrinting) {
+    beginReceipt(receipt);
+    longPrinting = true;
+    longEncodeMicros = 0;
+    longSerialMicros = 0;
+    done = !longReader.open(receipt.id, maxCharsPerLine); // File lost with a power cut right after printing: header only
+  } else {
+    done = longReader.step([](const char *line, size_t length) {
+      job.text(line, length);
+      job.newline();
+    });
+    job.flush(); // Lines point into the reader's page, which the next step overwrites
+  }
+  
+  if (done) {
+    longReader.close();
+    LongMessageReader::remove(receipt.id); // Before the commit, so a reset cannot leave the file behind
+    finishReceipt(receipt);
+    longPrinting = false;
+  }
+  
+  uint32_t serial = printer.totalStats().serialMicros - serialBefore;
+  longSerialMicros += serial;
+  longEncodeMicros += micros() - start - serial;
+  if (done) {
+    printer.markDrain(longSerialMicros);
+    metrics.record(STAGE_ENCODE, longEncodeMicros);
+  }
+  return done;
 }
 
-void printReceipt() {
+void beginReceipt(const Receipt &receipt) {
+  // Receipts of a batch share one printer job, it stays open until the last one
+  if (!batchPrinting) printer.beginJob();
+  job.begin(); // Code page and style changes that are already in effect are dropped by the job
   
   // Print wrapped message first (appears at bottom after rotation)
-  printer.printWrappedUpsideDown(currentReceipt.message);
+  job.style(STYLE_CODEPAGE, receipt.codePage);
+}
+
+void finishReceipt(const Receipt &receipt) {
+  job.style(STYLE_CODEPAGE, CODEPAGE); // Header needs the PC437 full block
   
   // Print header last (appears at top after rotation)
-  printer.printInverted(currentReceipt.timestamp);
+  job.inverted(receipt.timestamp);
   
-  // Advance paper
-  printer.feed(5);
+  // Advance paper, or only mark the cut between receipts of a compact batch
+  batchPrinting = receipt.flags & RECEIPT_BATCH_MORE;
+  if (batchPrinting && (receipt.flags & RECEIPT_COMPACT)) {
+    job.newline();
+    job.line(CUT_LINE);
+  } else {
+    job.feed(5);
+  }
+  job.end();
   
+  if (!batchPrinting) printer.endJob();
+}
+
+void printTemplate(const CompiledTemplate &layout, const Receipt &receipt) {
+  // Compiled bytes go out as they are, only the placeholders are worked out for this receipt
+  if (!batchPrinting) printer.beginJob(); // A batch whose rest went missing hands its job over
+  batchPrinting = false;
+  job.begin();
+  uint16_t sent = 0;
+  for (uint8_t i = 0; i < layout.slotCount; i++) {
+    const TemplateSlot &slot = layout.slots[i];
+    printer.write(layout.bytes + sent, slot.offset - sent);
+    sent = slot.offset;
+    
+    switch (slot.kind) {
+      case SLOT_MESSAGE:
+        job.style(STYLE_CODEPAGE, receipt.codePage);
+        job.wrappedUpsideDown(receipt.message, strlen(receipt.message), slot.width);
+        job.style(STYLE_CODEPAGE, CODEPAGE); // Template text is PC437
+        break;
+      case SLOT_CHECKLIST:
+        job.style(STYLE_CODEPAGE, receipt.codePage);
+        checklistUpsideDown(receipt.message, slot.width);
+        job.style(STYLE_CODEPAGE, CODEPAGE);
+        break;
+      case SLOT_TIMESTAMP:
+        job.line(receipt.timestamp);
+        break;
+      case SLOT_TIMESTAMP_INVERTED:
+        job.inverted(receipt.timestamp);
+        job.newline();
+        break;
+      case SLOT_QR:
+        if (receipt.qr[0] != '\0') printer.printQRCode(receipt.qr); // Nothing buffered in the job here
+        break;
+      case SLOT_LOGO:
+        logos.print(slot.width); // Key code of the printer's copy, or the raster from flash; nothing if there is no such logo
+        break;
+    }
+    job.flush(); // Before the next template bytes
+  }
+  printer.write(layout.bytes + sent, layout.length - sent);
+  job.end();
+  printer.endJob();
+}
+
+void checklistUpsideDown(const char *message, uint8_t width) {
+  // A box in front of the first line of every message line, wrapped lines indented under it
+  WordWrap wrap(message, strlen(message), width > 8 ? width - 4 : width);
+  wrap.forEachReversed([message](const char *line, size_t length) {
+    bool first = line == message || line[-1] == '\n';
+    if (length > 0) job.text(first ? "[ ] " : "    ", 4);
+    job.text(line, length);
+    job.newline();
+  });
+}
+
+void printCalibration() {
+  bool ok = calibration.succeeded();
+
+  // Last line first, the page is rotated
+  printer.beginJob();
+  job.begin();
+  job.line(job.format("Baud %lu, heat %u, speed %u", (unsigned long)printerProfile.baud, printerProfile.heat, printerProfile.speed));
+  job.line(ok ? "Calibration saved" : "Calibration failed, printer did not answer");
+  job.feed(3);
+  job.end();
+  printer.endJob();
 }
 
 void printServerInfo() {
-  // Print server info on the thermal printer
-  String serverInfo = "Server started at " + WiFi.localIP().toString();
-  printer.printWrappedUpsideDown(serverInfo);
+  // Part of the boot announcement's job, the address lives in the job arena until it ends
+  IPAddress ip = WiFi.localIP();
+  const char *serverInfo = job.format("Server started at %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
+  job.wrappedUpsideDown(serverInfo, strlen(serverInfo), maxCharsPerLine);
   
-  printer.printInverted("PRINTER SERVER READY");
+  job.inverted("PRINTER SERVER READY");
   
-  printer.feed(5);
-
+  job.feed(5);
 }
 
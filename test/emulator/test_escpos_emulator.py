@@ -0,0 +1,220 @@
+"""Golden images and a throughput benchmark for scripts/escpos_emulator.py.
+
+    python -m unittest discover -s test/emulator -v
+    UPDATE_GOLDEN=1 python -m unittest discover -s test/emulator    # after an intended change, then look at the images
+
+Each case builds the byte stream the driver sends for one kind of receipt and
+compares the rendered paper with test/emulator/golden/<case>.pbm. The QR
+stand-in is forced, so the images do not depend on the qrcode package.
+"""
+import os
+import sys
+import time
+import unittest
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "..", "scripts"))
+sys.modules["qrcode"] = None                          # import fails, the stand-in symbol is drawn
+
+import escpos_emulator as emulator  # noqa: E402
+
+GOLDEN = os.path.join(HERE, "golden")
+UPDATE = os.environ.get("UPDATE_GOLDEN") == "1"
+
+ESC = b"\x1b"
+GS = b"\x1d"
+
+
+# === Streams, as lib/EM5820-drivers/EscPos.h lays them out ===
+
+def init():
+    return ESC + b"@"
+
+
+def setting(name, value):
+    return ESC + b"##" + name + bytes([value])
+
+
+def text(line):
+    return line.encode("ascii") + b"\r\n"
+
+
+def raster(width, rows):
+    width_bytes = (width + 7) // 8
+    head = GS + b"v0\x00" + bytes([width_bytes & 0xFF, width_bytes >> 8, len(rows) & 0xFF, len(rows) >> 8])
+    return head + b"".join(rows)
+
+
+def qr(data):
+    store = bytes([49, 80, 48]) + data
+    return (GS + b"(k" + bytes([len(store) & 0xFF, len(store) >> 8]) + store +
+            GS + b"(k\x03\x00\x31\x51\x30")
+
+
+def nv_define(key, width, rows):
+    block = bytes([48, 67, 48]) + key + bytes([1, width & 0xFF, width >> 8, len(rows) & 0xFF, len(rows) >> 8, 49])
+    block += b"".join(rows)
+    return GS + b"(L" + bytes([len(block) & 0xFF, len(block) >> 8]) + block
+
+
+def nv_print(key):
+    return GS + b"(L\x06\x00\x30\x45" + key + b"\x01\x01"
+
+
+def checkers(width, height, cell):
+    width_bytes = (width + 7) // 8
+    rows = []
+    for y in range(height):
+        row = bytearray(width_bytes)
+        for x in range(width):
+            if (x // cell + y // cell) % 2 == 0:
+                row[x // 8] |= 0x80 >> (x % 8)
+        rows.append(bytes(row))
+    return rows
+
+
+def receipt(lines):
+    # Header, message and feed of a plain receipt, upside down like the Scribe prints it
+    out = init() + ESC + b"{\x01"
+    out += GS + b"B\x01" + text("Sat, 06 Jun 2025") + GS + b"B\x00"
+    for line in reversed(lines):
+        out += text(line)
+    return out + ESC + b"d\x02"
+
+
+CASES = {
+    "text_styles": (
+        init() +
+        text("plain font A") +
+        ESC + b"E\x01" + text("bold") + ESC + b"E\x00" +
+        ESC + b"-\x01" + text("thin underline") + ESC + b"-\x02" + text("thick underline") + ESC + b"-\x00" +
+        GS + b"B\x01" + text("inverted") + GS + b"B\x00" +
+        GS + b"!\x11" + text("double") + GS + b"!\x00" +
+        ESC + b"M\x01" + text("font B is narrower and shorter") + ESC + b"M\x00" +
+        ESC + b"a\x01" + text("centred") + ESC + b"a\x02" + text("right") + ESC + b"a\x00" +
+        text("a line that is longer than the paper wraps on the printer") +
+        ESC + b"d\x01"),
+    "upside_down": receipt(["Buy milk", "Call the plumber", "- eggs", "- bread"]),
+    "code_page": (
+        init() + ESC + b"t\x02" + b"Caf\x82 cr\x88me br\x81l\x82e\r\n" +
+        ESC + b"t\x00" + b"\xdb\xdb full blocks \xdb\xdb\r\n" +
+        b"\xb0 no glyph\r\n"),
+    "raster": (
+        init() + text("checkers, 200 dots at 40") +
+        GS + b"L\x28\x00" + raster(200, checkers(200, 48, 8)) + GS + b"L\x00\x00" +
+        text("after the image")),
+    "qr": (
+        init() + ESC + b"a\x01" + text("scan me") + qr(b"https://example.com/receipt/42") +
+        ESC + b"a\x00" + text("done")),
+    "nv_graphics": (
+        init() + nv_define(b"S0", 96, checkers(96, 24, 4)) +
+        text("logo from NV memory:") + nv_print(b"S0") +
+        text("unknown key prints nothing:") + nv_print(b"S9") + text("end")),
+}
+
+
+class GoldenImages(unittest.TestCase):
+
+    def check(self, name):
+        printer = emulator.Printer().run(CASES[name])
+        self.assertEqual(0, printer.unknown, "the stream has commands the emulator does not know")
+        path = os.path.join(GOLDEN, name + ".pbm")
+        self.assertEqual(0, emulator.compare_golden(path, printer.image("auto"), UPDATE),
+                         "%s differs, check the change and run with UPDATE_GOLDEN=1" % path)
+
+    def test_text_styles(self):
+        self.check("text_styles")
+
+    def test_upside_down(self):
+        self.check("upside_down")
+
+    def test_code_page(self):
+        self.check("code_page")
+
+    def test_raster(self):
+        self.check("raster")
+
+    def test_qr(self):
+        self.check("qr")
+
+    def test_nv_graphics(self):
+        self.check("nv_graphics")
+
+    def test_paper_view_is_turned(self):
+        # What leaves the printer is the reader's view turned by 180 degrees
+        printer = emulator.Printer().run(CASES["upside_down"])
+        reader, paper = printer.image("reader"), printer.image("paper")
+        self.assertEqual(len(reader), len(paper))
+        self.assertEqual([bytearray(reversed(row)) for row in reversed(paper)], reader)
+
+    def test_preload_keeps_only_graphics(self):
+        # A capture that prints a logo by key code, with the define from another capture
+        upload = emulator.Printer(render=False).run(nv_define(b"S1", 96, checkers(96, 24, 4)) + text("not kept"))
+        alone = emulator.Printer().run(init() + nv_print(b"S1"))
+        printer = emulator.Printer()
+        printer.nv = dict(upload.nv)
+        printer.run(init() + nv_print(b"S1"))
+        self.assertEqual(0, alone.paper_dots)
+        self.assertEqual(24, printer.paper_dots)
+        self.assertEqual(0, printer.lines)
+
+
+class Throughput(unittest.TestCase):
+    """Modelled print time of a receipt at every baud rate and speed, and the emulator's own speed."""
+
+    LINES = ["line %02d of a receipt with a to-do list in it" % n for n in range(40)]
+
+    def test_transmit_time_follows_baud(self):
+        data = receipt(self.LINES)
+        for baud in emulator.BAUD_RATES:
+            r = emulator.Printer(baud, 3, render=False).run(data).report()
+            self.assertEqual(len(data), r["bytes"])
+            self.assertAlmostEqual(len(data) * 10 / baud, r["transmit_s"], places=2)
+
+    def test_pipeline_bounds(self):
+        # Burning overlaps the transfer: the total is at least the slower of the two and at most both in a row
+        jobs = {"text": receipt(self.LINES), "image": init() + raster(384, checkers(384, 160, 8))}
+        print()
+        print("%6s %8s %6s %10s %8s %8s %7s %9s" % ("job", "baud", "speed", "transmit s", "burn s", "total s", "bound", "jobs/min"))
+        for job, data in jobs.items():
+            for baud in emulator.BAUD_RATES:
+                for speed in (0, 3, 9):
+                    r = emulator.Printer(baud, speed, render=False).run(data).report()
+                    self.assertGreaterEqual(r["total_s"] + 0.002, max(r["transmit_s"], r["burn_s"]))
+                    self.assertLessEqual(r["total_s"], r["transmit_s"] + r["burn_s"] + 0.002)
+                    print("%6s %8d %6d %10.2f %8.2f %8.2f %7s %9.1f" % (
+                        job, baud, speed, r["transmit_s"], r["burn_s"], r["total_s"], r["bound"], 60 / r["total_s"]))
+
+        # Text keeps the head busy at any rate, a full width image (48 bytes a dot row) waits for the wire at every rate
+        for baud in emulator.BAUD_RATES:
+            text_job = emulator.Printer(baud, 3, render=False).run(jobs["text"]).report()
+            image_job = emulator.Printer(baud, 3, render=False).run(jobs["image"]).report()
+            self.assertEqual("paper", text_job["bound"])
+            self.assertEqual("serial", image_job["bound"])
+
+    def test_speed_setting_in_the_stream(self):
+        # ESC ## STSP in the stream wins over the starting speed
+        data = setting(b"STSP", 9) + receipt(self.LINES)
+        ran = emulator.Printer(115200, 0, render=False).run(data).report()
+        told = emulator.Printer(115200, 9, render=False).run(receipt(self.LINES)).report()
+        self.assertEqual(9, ran["speed"])
+        self.assertAlmostEqual(told["burn_s"], ran["burn_s"], places=3)
+
+    def test_emulator_keeps_up_with_the_wire(self):
+        # Reading a live capture: the model must take bytes faster than 115200 baud delivers them
+        data = receipt(self.LINES) * 200
+        rendered = receipt(self.LINES) * 5
+        start = time.perf_counter()
+        emulator.Printer(115200, 3, render=False).run(data)
+        model = len(data) / (time.perf_counter() - start)
+        start = time.perf_counter()
+        emulator.Printer(115200, 3, render=True).run(rendered)
+        drawn = len(rendered) / (time.perf_counter() - start)
+        print()
+        print("timing only %9.0f bytes/s, %6.1fx 115200 baud" % (model, model * 10 / 115200))
+        print("rendering   %9.0f bytes/s, %6.1fx 115200 baud" % (drawn, drawn * 10 / 115200))
+        self.assertGreater(model, 115200 / 10)
+
+
+if __name__ == "__main__":
+    unittest.main()
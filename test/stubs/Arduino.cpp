@@ -0,0 +1,98 @@
+#include <Arduino.h>
+
+static uint64_t clockMicros = 0;
+
+unsigned long millis() { return (unsigned long)(clockMicros / 1000); }
+unsigned long micros() { return (unsigned long)clockMicros; }
+void delay(unsigned long ms) { clockMicros += (uint64_t)ms * 1000; }
+void yield() { clockMicros += NATIVE_YIELD_MICROS; }
+void nativeAdvanceMicros(uint32_t us) { clockMicros += us; }
+void nativeResetClock() { clockMicros = 0; }
+
+HardwareSerial Serial;
+EspClass ESP;
+
+// === UART Mock ===
+
+#define NATIVE_FIFO_SIZE 128
+
+HardwareSerial::HardwareSerial() : written(0), recording(true), rate(9600), wire(false), fifo(0), fifoAt(0) {
+}
+
+void HardwareSerial::begin(unsigned long baud) {
+  rate = baud;
+  fifo = 0;
+  fifoAt = micros();
+}
+
+void HardwareSerial::drainFifo() {
+  uint32_t now = micros();
+  uint64_t gone = (uint64_t)(now - fifoAt) * rate / 10 / 1000000;          // 10 bits per byte
+  if (gone == 0) return;
+  if (gone >= fifo) {
+    fifo = 0;
+    fifoAt = now;                                                           // idle wire, the next byte starts from here
+  } else {
+    fifo -= (uint32_t)gone;
+    fifoAt += (uint32_t)(gone * 10 * 1000000 / rate);                       // keep the part of a byte already on the wire
+  }
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (wire) {
+    drainFifo();
+    while (fifo >= NATIVE_FIFO_SIZE) {                                      // the real write blocks here
+      nativeAdvanceMicros(10000000 / rate);
+      drainFifo();
+    }
+    if (fifo == 0) fifoAt = micros();
+    fifo++;
+  }
+  if (recording) sent.push_back(c);
+  written++;
+  onByte(c);
+  return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *data, size_t length) {
+  for (size_t i = 0; i < length; i++) write(data[i]);
+  return length;
+}
+
+int HardwareSerial::read() {
+  if (received.empty()) return -1;
+  uint8_t c = received.front();
+  received.pop_front();
+  return c;
+}
+
+int HardwareSerial::availableForWrite() {
+  if (!wire) return 4096;
+  drainFifo();
+  return NATIVE_FIFO_SIZE - fifo;
+}
+
+void HardwareSerial::flush() {
+  if (!wire) return;
+  drainFifo();
+  while (fifo > 0) {
+    nativeAdvanceMicros(10000000 / rate);
+    drainFifo();
+  }
+}
+
+// === RTC Memory ===
+
+static uint32_t rtcMemory[128];                                             // 512 bytes of user RTC memory
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > sizeof(rtcMemory)) return false;
+  memcpy(data, (const uint8_t*)rtcMemory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+  if (offset * 4 + size > sizeof(rtcMemory)) return false;
+  memcpy((uint8_t*)rtcMemory + offset * 4, data, size);
+  return true;
+}
@@ -0,0 +1,143 @@
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+// Host stand-in for the parts of the ESP8266 Arduino core the libraries use,
+// so they build in the native env (pio test -e native). Time is a fake clock
+// that only moves when the code waits (delay(), yield()) or a test moves it,
+// which makes timeouts and rates reproducible.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <deque>
+#include <vector>
+
+#define PROGMEM
+#define PGM_P const char *
+#define PSTR(s) (s)
+#define F(s) (s)
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define pgm_read_word(p) (*(const uint16_t*)(p))
+#define pgm_read_dword(p) (*(const uint32_t*)(p))
+#define pgm_read_ptr(p) (*(const void* const*)(p))
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define snprintf_P snprintf
+
+#define NATIVE_YIELD_MICROS 100       // Fake time a yield() takes, so polling loops reach their deadlines
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void nativeAdvanceMicros(uint32_t us);                                    // move the fake clock
+void nativeResetClock();
+uint32_t nativeHeapFree();                                                  // modelled heap, see Bench.h
+uint32_t nativeHeapMaxBlock();
+
+template <class T> T min(T a, T b) { return a < b ? a : b; }
+template <class T> T max(T a, T b) { return a > b ? a : b; }
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *data, size_t length) {
+      for (size_t i = 0; i < length; i++) write(data[i]);
+      return length;
+    }
+    size_t write(const char *text) { return write((const uint8_t*)text, strlen(text)); }
+    size_t write(const char *text, size_t length) { return write((const uint8_t*)text, length); }
+    size_t print(const char *text) { return write(text); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned long long n) { char b[24]; snprintf(b, sizeof(b), "%llu", n); return write(b); }
+    size_t print(long long n) { char b[24]; snprintf(b, sizeof(b), "%lld", n); return write(b); }
+    size_t print(unsigned long n) { return print((unsigned long long)n); }
+    size_t print(long n) { return print((long long)n); }
+    size_t print(unsigned int n) { return print((unsigned long long)n); }
+    size_t print(int n) { return print((long long)n); }
+    size_t print(double n, int digits = 2) { char b[32]; snprintf(b, sizeof(b), "%.*f", digits, n); return write(b); }
+    size_t println(const char *text) { return print(text) + print("\r\n"); }
+    size_t println() { return print("\r\n"); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+    virtual int peek() { return -1; }
+    void setTimeout(unsigned long) {}
+};
+
+// UART mock. Everything written is kept in sent (unless recording is off)
+// and received holds what the other end answers. Without modelWire() the wire
+// is infinitely fast; with it the 128 byte FIFO drains at baud / 10 bytes per
+// second of fake time and a write into a full FIFO waits like the real one.
+// Printer models derive from it and answer in onByte().
+class HardwareSerial : public Stream {
+  public:
+    HardwareSerial();
+
+    virtual void begin(unsigned long baud);
+    virtual void updateBaudRate(unsigned long baud) { rate = baud; }
+    void end() {}
+    unsigned long baud() const { return rate; }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t *data, size_t length) override;
+    using Print::write;
+    int available() override { return (int)received.size(); }
+    int read() override;
+    int peek() override { return received.empty() ? -1 : received.front(); }
+    int availableForWrite() override;
+    void flush() override;                                                  // wait until the FIFO is empty
+
+    void modelWire(bool on) { wire = on; fifo = 0; fifoAt = micros(); }
+    void clear() { sent.clear(); received.clear(); written = 0; }
+
+    std::vector<uint8_t> sent;
+    std::deque<uint8_t> received;
+    uint64_t written;                                                       // bytes ever written, also when not recording
+    bool recording;
+
+  protected:
+    virtual void onByte(uint8_t c) {}                                      // every byte written, in order
+
+  private:
+    unsigned long rate;
+    bool wire;
+    uint32_t fifo;                                                          // bytes in the FIFO
+    uint32_t fifoAt;                                                        // micros() of the last drain update
+    void drainFifo();
+};
+
+extern HardwareSerial Serial;
+
+class EspClass {
+  public:
+    uint32_t getFreeHeap() { return nativeHeapFree(); }
+    uint32_t getMaxFreeBlockSize() { return nativeHeapMaxBlock(); }
+    uint8_t getHeapFragmentation() { return 100 - (uint64_t)nativeHeapMaxBlock() * 100 / max(nativeHeapFree(), 1U); }
+    uint32_t getChipId() { return 0x123456; }
+    uint32_t getCycleCount() { return (uint32_t)micros() * 80; }
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+    void restart() {}
+};
+
+extern EspClass ESP;
+
+#endif
@@ -0,0 +1,104 @@
+#include "Bench.h"
+#include <new>
+
+static uint64_t allocations = 0;
+static int untrackedDepth = 0;
+
+uint64_t benchAllocations() {
+  return allocations;
+}
+
+BenchUntracked::BenchUntracked() {
+  untrackedDepth++;
+}
+
+BenchUntracked::~BenchUntracked() {
+  untrackedDepth--;
+}
+
+// === Heap model ===
+// Live blocks sorted by offset, placed first-fit in 8 byte units like umm_malloc
+
+struct HeapBlock {
+  void *p;
+  uint32_t offset;
+  uint32_t size;
+};
+
+static HeapBlock heapBlocks[NATIVE_HEAP_BLOCKS];
+static uint32_t heapCount = 0;
+
+static void heapPlace(void *p, size_t size) {
+  uint32_t need = (uint32_t)((size + 4 + 7) & ~(size_t)7);                  // with umm's block header
+  if (heapCount == NATIVE_HEAP_BLOCKS) return;
+  uint32_t at = 0, index = 0;
+  for (; index < heapCount; index++) {
+    if (heapBlocks[index].offset - at >= need) break;
+    at = heapBlocks[index].offset + heapBlocks[index].size;
+  }
+  if (index == heapCount && NATIVE_HEAP_BYTES - at < need) return;          // would not fit on the chip, only counted
+  memmove(&heapBlocks[index + 1], &heapBlocks[index], (heapCount - index) * sizeof(HeapBlock));
+  heapBlocks[index] = {p, at, need};
+  heapCount++;
+}
+
+static void heapRelease(void *p) {
+  for (uint32_t i = 0; i < heapCount; i++) {
+    if (heapBlocks[i].p != p) continue;
+    memmove(&heapBlocks[i], &heapBlocks[i + 1], (heapCount - i - 1) * sizeof(HeapBlock));
+    heapCount--;
+    return;
+  }
+}
+
+uint32_t nativeHeapFree() {
+  uint32_t used = 0;
+  for (uint32_t i = 0; i < heapCount; i++) used += heapBlocks[i].size;
+  return NATIVE_HEAP_BYTES - used;
+}
+
+uint32_t nativeHeapMaxBlock() {
+  uint32_t at = 0, largest = 0;
+  for (uint32_t i = 0; i < heapCount; i++) {
+    if (heapBlocks[i].offset - at > largest) largest = heapBlocks[i].offset - at;
+    at = heapBlocks[i].offset + heapBlocks[i].size;
+  }
+  return NATIVE_HEAP_BYTES - at > largest ? NATIVE_HEAP_BYTES - at : largest;
+}
+
+void benchReport(const char *name, size_t size, const BenchResult &result) {
+  printf("%-32s %7u B %12.1f ns/op %8.2f allocs/op %10.1f bytes/op\n",
+         name, (unsigned)size, result.nsPerOp, result.allocsPerOp, result.bytesPerOp);
+}
+
+// Counting allocator for every operator new in the test binary
+void *operator new(size_t size) {
+  void *p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  if (untrackedDepth == 0) {
+    allocations++;
+    heapPlace(p, size);
+  }
+  return p;
+}
+
+void *operator new[](size_t size) {
+  return operator new(size);
+}
+
+void operator delete(void *p) noexcept {
+  if (p) heapRelease(p);
+  free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  operator delete(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  operator delete(p);
+}
@@ -0,0 +1,53 @@
+#ifndef NATIVE_BENCH_H
+#define NATIVE_BENCH_H
+
+#include <Arduino.h>
+#include <chrono>
+
+// Micro-benchmarks for the native env. Times a call over many iterations on
+// the host clock (not the fake Arduino one) and counts heap allocations made
+// through operator new and the bytes a serial mock received, per call.
+// Numbers are for comparing changes on one machine, not ESP8266 timings.
+//
+// Every counted allocation is also placed first-fit in a model of the chip's
+// heap (NATIVE_HEAP_BYTES), which is what ESP.getFreeHeap() and
+// ESP.getMaxFreeBlockSize() report, so a leak or fragmentation shows there.
+// Stubs allocate for things that are not heap on the chip (flash contents,
+// file handles): they do it inside a BenchUntracked scope, which keeps those
+// out of both.
+
+struct BenchResult {
+  double nsPerOp;
+  double allocsPerOp;
+  double bytesPerOp;
+};
+
+#define NATIVE_HEAP_BYTES 40960       // Heap left on the chip once WiFi and the firmware's statics are in
+#define NATIVE_HEAP_BLOCKS 1024       // Live allocations the model places, more are only counted
+
+uint64_t benchAllocations();                                                // operator new calls since start
+
+struct BenchUntracked {                                                     // scope in a stub whose allocations are not the chip's heap
+  BenchUntracked();
+  ~BenchUntracked();
+};
+
+template <typename Fn>
+BenchResult bench(uint32_t iterations, HardwareSerial *serial, Fn fn) {
+  fn();                                                                     // warm up, first-call setup is not measured
+  uint64_t allocations = benchAllocations();
+  uint64_t bytes = serial ? serial->written : 0;
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; i < iterations; i++) fn();
+  auto end = std::chrono::steady_clock::now();
+
+  BenchResult result;
+  result.nsPerOp = std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+  result.allocsPerOp = (double)(benchAllocations() - allocations) / iterations;
+  result.bytesPerOp = serial ? (double)(serial->written - bytes) / iterations : 0;
+  return result;
+}
+
+void benchReport(const char *name, size_t size, const BenchResult &result);  // one aligned line on stdout
+
+#endif
@@ -0,0 +1,31 @@
+#include "EEPROM.h"
+
+EEPROMClass EEPROM;
+
+EEPROMClass::EEPROMClass() : commits(0), failCommit(false), size(0) {
+  erase();
+}
+
+void EEPROMClass::begin(size_t size) {
+  this->size = size < NATIVE_EEPROM_SIZE ? size : NATIVE_EEPROM_SIZE;
+  memcpy(ram, flash, sizeof(ram));
+}
+
+bool EEPROMClass::commit() {
+  if (size == 0 || failCommit) return false;
+  memcpy(flash, ram, size);
+  commits++;
+  return true;
+}
+
+bool EEPROMClass::end() {
+  bool ok = commit();
+  size = 0;
+  return ok;
+}
+
+void EEPROMClass::erase() {
+  memset(flash, 0xFF, sizeof(flash));
+  memset(ram, 0xFF, sizeof(ram));
+  commits = 0;
+}
@@ -0,0 +1,40 @@
+#ifndef NATIVE_EEPROM_H
+#define NATIVE_EEPROM_H
+
+#include <Arduino.h>
+
+#define NATIVE_EEPROM_SIZE 4096       // Emulated flash sector, the ESP8266 core's maximum
+
+// EEPROM emulation of the ESP8266 core: begin() maps the bytes, put() only
+// changes the RAM copy, commit() makes it stick. What was not committed is
+// gone at the next begin(), like after a reset.
+class EEPROMClass {
+  public:
+    EEPROMClass();
+
+    void begin(size_t size);
+    bool commit();
+    bool end();
+
+    template <typename T> T &get(int address, T &value) {
+      memcpy(&value, ram + address, sizeof(T));
+      return value;
+    }
+    template <typename T> const T &put(int address, const T &value) {
+      memcpy(ram + address, &value, sizeof(T));
+      return value;
+    }
+
+    void erase();                                                           // all 0xFF, a fresh chip
+    uint32_t commits;
+    bool failCommit;                                                        // the next commits fail, as with a worn sector
+
+  private:
+    uint8_t flash[NATIVE_EEPROM_SIZE];
+    uint8_t ram[NATIVE_EEPROM_SIZE];
+    size_t size;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,78 @@
+#include "ESP8266WiFi.h"
+#include <map>
+
+using NativeNet::Socket;
+
+static std::map<uint16_t, WiFiServer*> listening;
+
+// === WiFiClient ===
+
+size_t WiFiClient::write(const uint8_t *data, size_t length) {
+  if (!socket || socket->closed || socket->clientGone) return 0;
+  socket->outgoing.append((const char*)data, length);
+  return length;
+}
+
+int WiFiClient::available() {
+  return socket && !socket->closed ? (int)socket->incoming.size() : 0;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *data, size_t length) {
+  size_t n = 0;
+  while (n < length && available() > 0) {
+    data[n++] = socket->incoming.front();
+    socket->incoming.pop_front();
+  }
+  if (socket) socket->consumed += n;
+  return (int)n;
+}
+
+int WiFiClient::peek() {
+  return available() > 0 ? socket->incoming.front() : -1;
+}
+
+int WiFiClient::availableForWrite() {
+  return socket && !socket->closed && !socket->clientGone ? NATIVE_TCP_SND_BUF : 0;
+}
+
+bool WiFiClient::connected() {
+  return socket && !socket->closed && (!socket->clientGone || !socket->incoming.empty());
+}
+
+bool WiFiClient::stop(unsigned int maxWaitMs) {
+  if (!socket || socket->closed) return true;
+  socket->reset = !socket->incoming.empty();
+  socket->closed = true;
+  return true;
+}
+
+// === WiFiServer ===
+
+WiFiServer::~WiFiServer() {
+  if (listening.count(port) && listening[port] == this) listening.erase(port);
+}
+
+void WiFiServer::begin() {
+  listening[port] = this;
+}
+
+WiFiClient WiFiServer::accept() {
+  if (backlog.empty()) return WiFiClient();
+  std::shared_ptr<Socket> socket = backlog.front();
+  backlog.pop_front();
+  return WiFiClient(socket);
+}
+
+std::shared_ptr<Socket> WiFiServer::connect(uint16_t port, uint32_t remote) {
+  auto socket = std::make_shared<Socket>();
+  socket->remote = remote;
+  auto found = listening.find(port);
+  if (found == listening.end()) socket->closed = true;                      // refused
+  else found->second->backlog.push_back(socket);
+  return socket;
+}
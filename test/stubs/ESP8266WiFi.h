@@ -0,0 +1,76 @@
+#ifndef NATIVE_ESP8266WIFI_H
+#define NATIVE_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <deque>
+#include <memory>
+#include <string>
+
+#define NATIVE_TCP_SND_BUF 2920       // lwIP send buffer of the core's default build, 2 * MSS
+
+namespace NativeNet {
+  // Both ends of one TCP connection. The test plays the client: it puts
+  // request bytes into incoming and reads the response from outgoing.
+  struct Socket {
+    std::deque<uint8_t> incoming;                                           // sent by the client, not read by the server yet
+    std::string outgoing;                                                   // everything the server wrote
+    uint32_t remote = 0;
+    size_t consumed = 0;                                                    // bytes the server read
+    bool clientGone = false;                                                // client closed its end
+    bool closed = false;                                                    // server called stop()
+    bool reset = false;                                                     // stop() with unread input, the stack sends RST
+
+    void send(const std::string &bytes) { incoming.insert(incoming.end(), bytes.begin(), bytes.end()); }
+  };
+}
+
+// Socket stand-ins for HttpFront: no network, connections are made by the
+// test with WiFiServer::connect() and served from memory. Like the core,
+// connected() stays true while received bytes are unread, and stopping a
+// connection with unread input resets it instead of closing it.
+class WiFiClient : public Stream {
+  public:
+    WiFiClient() {}
+    explicit WiFiClient(std::shared_ptr<NativeNet::Socket> socket) : socket(socket) {}
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t *data, size_t length) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int read(uint8_t *data, size_t length);
+    int peek() override;
+    int availableForWrite() override;
+    void flush() override {}
+
+    bool connected();
+    void stop() { stop(0); }
+    bool stop(unsigned int maxWaitMs);
+    IPAddress remoteIP() const { return socket ? IPAddress(socket->remote) : IPAddress(); }
+    void setNoDelay(bool) {}
+    operator bool() const { return socket != nullptr; }
+
+  private:
+    std::shared_ptr<NativeNet::Socket> socket;
+};
+
+class WiFiServer {
+  public:
+    WiFiServer(uint16_t port) : port(port) {}
+    ~WiFiServer();
+
+    void begin();
+    void setNoDelay(bool) {}
+    bool hasClient() const { return !backlog.empty(); }
+    WiFiClient accept();
+
+    // Test side: open a connection to the server listening on port
+    static std::shared_ptr<NativeNet::Socket> connect(uint16_t port, uint32_t remote);
+
+  private:
+    uint16_t port;
+    std::deque<std::shared_ptr<NativeNet::Socket>> backlog;
+};
+
+#endif
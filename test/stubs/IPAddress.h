@@ -0,0 +1,21 @@
+#ifndef NATIVE_IPADDRESS_H
+#define NATIVE_IPADDRESS_H
+
+#include <Arduino.h>
+
+// IPv4 address as the ESP8266 core keeps it: the first octet in the low byte
+class IPAddress {
+  public:
+    IPAddress() : address(0) {}
+    IPAddress(uint32_t address) : address(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+      : address((uint32_t)a | (uint32_t)b << 8 | (uint32_t)c << 16 | (uint32_t)d << 24) {}
+
+    operator uint32_t() const { return address; }
+    uint8_t operator[](int index) const { return address >> (8 * index); }
+
+  private:
+    uint32_t address;
+};
+
+#endif
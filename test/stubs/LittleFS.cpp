@@ -0,0 +1,226 @@
+#include "LittleFS.h"
+#include "Bench.h"
+
+NativeLittleFs LittleFS;
+
+using NativeFs::Handle;
+using NativeFs::Node;
+
+// Flash contents, directory entries and handles are not heap on the chip:
+// every function that allocates opens a BenchUntracked scope
+
+static size_t blocks(size_t bytes) {
+  return (bytes + NATIVE_FS_BLOCK - 1) / NATIVE_FS_BLOCK;
+}
+
+// === File ===
+
+File::operator bool() const {
+  return handle && handle->node && handle->generation == LittleFS.generation;
+}
+
+const std::vector<uint8_t> &File::content() const {
+  return handle->writable ? handle->working : handle->node->data;
+}
+
+size_t File::read(uint8_t *data, size_t length) {
+  if (!*this) return 0;
+  const std::vector<uint8_t> &bytes = content();
+  if (handle->position >= bytes.size()) return 0;
+  size_t n = bytes.size() - handle->position < length ? bytes.size() - handle->position : length;
+  memcpy(data, bytes.data() + handle->position, n);
+  handle->position += n;
+  return n;
+}
+
+int File::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::available() {
+  if (!*this) return 0;
+  return (int)(content().size() - handle->position);
+}
+
+size_t File::write(const uint8_t *data, size_t length) {
+  BenchUntracked untracked;
+  if (!*this || !handle->writable) return 0;
+  if (handle->append) handle->position = handle->working.size();
+  size_t end = handle->position + length;
+  if (end > handle->working.size() && LittleFS.usedBlocks(handle.get(), end) * NATIVE_FS_BLOCK > LittleFS.capacity) return 0;
+  if (end > handle->working.size()) handle->working.resize(end);
+  memcpy(handle->working.data() + handle->position, data, length);
+  handle->position = end;
+  handle->dirty = true;
+  return length;
+}
+
+bool File::seek(uint32_t position, SeekMode mode) {
+  if (!*this) return false;
+  size_t base = mode == SeekSet ? 0 : mode == SeekCur ? handle->position : content().size();
+  if (base + position > content().size()) return false;
+  handle->position = base + position;
+  return true;
+}
+
+size_t File::position() const {
+  return *this ? handle->position : 0;
+}
+
+size_t File::size() const {
+  return *this ? content().size() : 0;
+}
+
+bool File::truncate(uint32_t size) {
+  BenchUntracked untracked;
+  if (!*this || !handle->writable || size > handle->working.size()) return false;
+  handle->working.resize(size);
+  if (handle->position > size) handle->position = size;
+  handle->dirty = true;
+  return true;
+}
+
+void File::flush() {
+  BenchUntracked untracked;
+  if (!*this || !handle->dirty) return;
+  handle->node->data = handle->working;                                     // the sync is atomic, as in LittleFS
+  handle->dirty = false;
+  handle->truncated = false;
+}
+
+void File::close() {
+  BenchUntracked untracked;
+  if (!handle) return;
+  flush();
+  handle->node.reset();
+  handle.reset();
+}
+
+const char *File::name() const {
+  return handle ? handle->name.c_str() : "";
+}
+
+// === Dir ===
+
+bool Dir::next() {
+  if (index >= entries.size()) return false;
+  index++;
+  return true;
+}
+
+File Dir::openFile(const char *mode) const {
+  BenchUntracked untracked;
+  if (index == 0) return File();
+  std::string path = "/" + entries[index - 1].first;
+  return LittleFS.open(path.c_str(), mode);
+}
+
+size_t Dir::fileSize() const {
+  return index == 0 ? 0 : entries[index - 1].second;
+}
+
+// === Filesystem ===
+
+bool NativeLittleFs::begin() {
+  mounted = !failMount;
+  return mounted;
+}
+
+File NativeLittleFs::open(const char *path, const char *mode) {
+  BenchUntracked untracked;
+  if (!mounted) return File();
+  auto found = files.find(path);
+  bool read = mode[0] == 'r';
+  if (found == files.end()) {
+    if (read) return File();
+    if (usedBlocks(nullptr, 0) + 1 > capacity / NATIVE_FS_BLOCK) return File();  // no block for the new entry
+    found = files.emplace(path, std::make_shared<Node>()).first;            // the entry exists right away
+  }
+
+  auto handle = std::make_shared<Handle>();
+  handle->node = found->second;
+  const char *slash = strrchr(path, '/');
+  handle->name = slash ? slash + 1 : path;
+  handle->writable = !read || mode[1] == '+';
+  handle->append = mode[0] == 'a';
+  handle->dirty = mode[0] == 'w';
+  handle->truncated = mode[0] == 'w';
+  handle->generation = generation;
+  if (handle->writable && mode[0] != 'w') handle->working = handle->node->data;
+  handle->position = handle->append ? handle->working.size() : 0;
+  return File(handle);
+}
+
+bool NativeLittleFs::exists(const char *path) const {
+  BenchUntracked untracked;
+  return mounted && files.count(path) > 0;
+}
+
+bool NativeLittleFs::remove(const char *path) {
+  BenchUntracked untracked;
+  return mounted && files.erase(path) > 0;
+}
+
+bool NativeLittleFs::rename(const char *from, const char *to) {
+  BenchUntracked untracked;
+  if (!mounted) return false;
+  auto found = files.find(from);
+  if (found == files.end()) return false;
+  std::shared_ptr<Node> node = found->second;
+  files.erase(found);
+  files[to] = node;                                                         // replaces an existing file, atomically
+  return true;
+}
+
+bool NativeLittleFs::info(FSInfo &info) const {
+  if (!mounted) return false;
+  info.totalBytes = capacity;
+  info.usedBytes = usedBlocks(nullptr, 0) * NATIVE_FS_BLOCK;
+  info.blockSize = NATIVE_FS_BLOCK;
+  info.pageSize = 256;
+  info.maxOpenFiles = 5;
+  info.maxPathLength = 32;
+  return true;
+}
+
+Dir NativeLittleFs::openDir(const char *path) const {
+  BenchUntracked untracked;
+  Dir dir;
+  if (!mounted) return dir;
+  for (auto &file : files) dir.entries.push_back({file.first.substr(1), file.second->data.size()});
+  return dir;
+}
+
+void NativeLittleFs::format() {
+  BenchUntracked untracked;
+  files.clear();
+  capacity = NATIVE_FS_BYTES;
+  generation++;
+  mounted = false;
+  failMount = false;
+}
+
+void NativeLittleFs::powerCut() {
+  generation++;                                                             // every open handle is dead
+  mounted = false;
+}
+
+size_t NativeLittleFs::fileSize(const char *path) const {
+  BenchUntracked untracked;
+  auto found = files.find(path);
+  return found == files.end() ? 0 : found->second->data.size();
+}
+
+size_t NativeLittleFs::usedBlocks(const Handle *growing, size_t newSize) const {
+  size_t used = NATIVE_FS_RESERVED;
+  for (auto &file : files) used += blocks(file.second->data.size()) > 0 ? blocks(file.second->data.size()) : 1;
+  if (!growing) return used;
+
+  // Until the sync the old blocks stay: a rewritten file needs all new ones, an
+  // appended one its new blocks and a copy of the last block it changes
+  size_t synced = growing->node->data.size();
+  if (growing->truncated) return used + blocks(newSize);
+  if (newSize > synced) used += blocks(newSize) - blocks(synced);
+  return used + 1;
+}
@@ -0,0 +1,111 @@
+#ifndef NATIVE_LITTLEFS_H
+#define NATIVE_LITTLEFS_H
+
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <string>
+
+#define NATIVE_FS_BYTES 65536         // eagle.flash.1m64.ld gives LittleFS 64 KB
+#define NATIVE_FS_BLOCK 4096          // Erase block, files take whole blocks
+#define NATIVE_FS_RESERVED 2          // Blocks the superblock and directory take
+
+enum SeekMode { SeekSet, SeekCur, SeekEnd };
+
+struct FSInfo {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+namespace NativeFs {
+  struct Node {
+    std::vector<uint8_t> data;                                              // what survives a power cut
+  };
+  struct Handle {
+    std::shared_ptr<Node> node;
+    std::string name;
+    std::vector<uint8_t> working;                                           // writer's copy until flush()/close()
+    bool writable;
+    bool append;
+    bool dirty;
+    bool truncated;                                                         // opened with "w", rewrites every block
+    size_t position;
+    uint32_t generation;                                                    // power cut count when opened
+  };
+}
+
+// In-memory LittleFS with its failure behaviour. Like LittleFS, what a file
+// handle writes only becomes durable at flush() or close(): a power cut
+// (LittleFS.powerCut()) before that leaves the file as it was, never half
+// written. rename() and remove() are atomic. Space is counted in whole
+// blocks; a write that does not fit writes nothing and returns 0.
+class File {
+  public:
+    File() {}
+    explicit File(std::shared_ptr<NativeFs::Handle> handle) : handle(handle) {}
+
+    operator bool() const;
+    size_t read(uint8_t *data, size_t length);
+    int read();
+    int available();
+    size_t write(const uint8_t *data, size_t length);
+    size_t write(uint8_t c) { return write(&c, 1); }
+    bool seek(uint32_t position, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    bool truncate(uint32_t size);
+    void flush();
+    void close();
+    const char *name() const;
+
+  private:
+    std::shared_ptr<NativeFs::Handle> handle;
+    const std::vector<uint8_t> &content() const;
+};
+
+class Dir {
+  public:
+    bool next();
+    File openFile(const char *mode) const;          // the core's fileName() returns a String, name() of the file does not
+    size_t fileSize() const;
+
+  private:
+    friend class NativeLittleFs;
+    std::vector<std::pair<std::string, size_t>> entries;
+    size_t index = 0;
+};
+
+class NativeLittleFs {
+  public:
+    bool begin();
+    void end() { mounted = false; }
+    File open(const char *path, const char *mode);
+    bool exists(const char *path) const;
+    bool remove(const char *path);
+    bool rename(const char *from, const char *to);
+    bool info(FSInfo &info) const;
+    Dir openDir(const char *path) const;
+
+    // Test controls
+    void format();                                                          // empty and unmounted, capacity back to NATIVE_FS_BYTES
+    void powerCut();                                                        // unsynced writes are lost, open handles die
+    void setCapacity(size_t bytes) { capacity = bytes; }
+    size_t fileSize(const char *path) const;                                // durable size, 0 when missing
+    bool failMount = false;
+
+  private:
+    friend class File;
+    std::map<std::string, std::shared_ptr<NativeFs::Node>> files;
+    size_t capacity = NATIVE_FS_BYTES;
+    uint32_t generation = 0;
+    bool mounted = false;
+    size_t usedBlocks(const NativeFs::Handle *growing, size_t newSize) const;
+};
+
+extern NativeLittleFs LittleFS;
+
+#endif
@@ -0,0 +1,142 @@
+// Duplicate detection and per-client rate limits on the fake clock: repeats
+// within their window and only there, keys that stay with their sender and
+// route, and token buckets that refill, cap, and carry a batch's debt.
+#include <unity.h>
+#include <Admission.h>
+
+#define ALICE 0x0A000001
+#define BOB 0x0A000002
+
+void setUp() {
+  nativeResetClock();
+}
+
+void tearDown() {
+}
+
+static uint32_t content(const char *message) {
+  return admissionHash(ADMISSION_HASH_SEED, message, strlen(message));
+}
+
+void test_duplicate_within_the_window() {
+  IdempotencyCache cache;
+  uint32_t lifetimeMs;
+  uint32_t key = admissionKey("", ALICE, "/submit", content("Buy milk"), lifetimeMs);
+  TEST_ASSERT_EQUAL(IDEMPOTENCY_CONTENT_MS, lifetimeMs);
+  uint32_t firstId = 0;
+  uint16_t count = 0;
+  TEST_ASSERT_FALSE(cache.find(key, firstId, count));
+  cache.remember(key, 40, 3, lifetimeMs);
+
+  delay(IDEMPOTENCY_CONTENT_MS - 1);
+  TEST_ASSERT_TRUE(cache.find(key, firstId, count));                         // answered with the original ids
+  TEST_ASSERT_EQUAL(40, firstId);
+  TEST_ASSERT_EQUAL(3, count);
+  delay(1);
+  TEST_ASSERT_FALSE(cache.find(key, firstId, count));                        // the same message may print again
+  TEST_ASSERT_FALSE(cache.find(key, firstId, count));
+  TEST_ASSERT_EQUAL(1, cache.duplicates());
+}
+
+void test_keys_scoped_per_client_and_route() {
+  IdempotencyCache cache;
+  uint32_t lifetimeMs, firstId;
+  uint16_t count;
+  uint32_t key = admissionKey("order-17", ALICE, "/submit", content("a"), lifetimeMs);
+  TEST_ASSERT_EQUAL(IDEMPOTENCY_KEY_MS, lifetimeMs);
+  cache.remember(key, 7, 1, lifetimeMs);
+
+  // The client key decides, not the content
+  TEST_ASSERT_TRUE(cache.find(admissionKey("order-17", ALICE, "/submit", content("b"), lifetimeMs), firstId, count));
+  TEST_ASSERT_EQUAL(7, firstId);
+  // The same key from someone else, or for a batch, is another request
+  TEST_ASSERT_FALSE(cache.find(admissionKey("order-17", BOB, "/submit", content("a"), lifetimeMs), firstId, count));
+  TEST_ASSERT_FALSE(cache.find(admissionKey("order-17", ALICE, "/submit-batch", content("a"), lifetimeMs), firstId, count));
+  TEST_ASSERT_FALSE(cache.find(admissionKey("order-18", ALICE, "/submit", content("a"), lifetimeMs), firstId, count));
+
+  // Without a key the content is only a repeat from the same address
+  cache.remember(admissionKey("", ALICE, "/submit", content("a"), lifetimeMs), 8, 1, lifetimeMs);
+  TEST_ASSERT_FALSE(cache.find(admissionKey("", BOB, "/submit", content("a"), lifetimeMs), firstId, count));
+  TEST_ASSERT_TRUE(cache.find(admissionKey("", ALICE, "/submit", content("a"), lifetimeMs), firstId, count));
+  TEST_ASSERT_EQUAL(8, firstId);
+  TEST_ASSERT_NOT_EQUAL(key, admissionKey("", ALICE, "/submit", content("order-17"), lifetimeMs));
+
+  // A key outlives the content window
+  delay(IDEMPOTENCY_CONTENT_MS);
+  TEST_ASSERT_TRUE(cache.find(key, firstId, count));
+  delay(IDEMPOTENCY_KEY_MS - IDEMPOTENCY_CONTENT_MS);
+  TEST_ASSERT_FALSE(cache.find(key, firstId, count));
+}
+
+void test_least_recently_seen_is_replaced() {
+  IdempotencyCache cache;
+  uint32_t firstId;
+  uint16_t count;
+  for (uint32_t i = 0; i < IDEMPOTENCY_SLOTS; i++) cache.remember(1000 + i, i, 1, IDEMPOTENCY_KEY_MS);
+  TEST_ASSERT_TRUE(cache.find(1000, firstId, count));                        // seen again, 1001 is now the oldest
+  cache.remember(2000, 99, 1, IDEMPOTENCY_KEY_MS);
+  TEST_ASSERT_TRUE(cache.find(1000, firstId, count));
+  TEST_ASSERT_FALSE(cache.find(1001, firstId, count));
+  TEST_ASSERT_TRUE(cache.find(2000, firstId, count));
+  TEST_ASSERT_EQUAL(99, firstId);
+}
+
+void test_burst_then_refill() {
+  ClientBuckets buckets;
+  for (int i = 0; i < CLIENT_BURST; i++) {
+    TEST_ASSERT_EQUAL(0, buckets.retryAfter(ALICE, 1));
+    buckets.charge(ALICE, 1);
+  }
+  TEST_ASSERT_EQUAL(CLIENT_REFILL_MS, buckets.retryAfter(ALICE, 1));
+  TEST_ASSERT_EQUAL(0, buckets.retryAfter(BOB, 1));                          // everyone has their own bucket
+  delay(CLIENT_REFILL_MS - 1000);
+  TEST_ASSERT_EQUAL(1000, buckets.retryAfter(ALICE, 1));
+  delay(1000);
+  TEST_ASSERT_EQUAL(0, buckets.retryAfter(ALICE, 1));
+
+  // A long pause fills the bucket, never past the burst
+  delay(100 * CLIENT_REFILL_MS);
+  TEST_ASSERT_EQUAL(0, buckets.retryAfter(ALICE, CLIENT_BURST));
+  buckets.charge(ALICE, CLIENT_BURST);
+  TEST_ASSERT_EQUAL(CLIENT_REFILL_MS, buckets.retryAfter(ALICE, 1));
+}
+
+void test_batch_leaves_debt() {
+  // A batch larger than the burst gets in on a full bucket, then its size is paid off
+  ClientBuckets buckets;
+  const uint16_t batch = 4 * CLIENT_BURST;
+  TEST_ASSERT_EQUAL(0, buckets.retryAfter(ALICE, batch));
+  buckets.charge(ALICE, batch);
+  uint32_t debtMs = (batch - CLIENT_BURST) * CLIENT_REFILL_MS;
+  TEST_ASSERT_EQUAL(debtMs + CLIENT_REFILL_MS, buckets.retryAfter(ALICE, 1));
+  TEST_ASSERT_EQUAL(debtMs + CLIENT_BURST * CLIENT_REFILL_MS, buckets.retryAfter(ALICE, batch)); // asks for a full bucket again
+  delay(debtMs);
+  TEST_ASSERT_EQUAL(CLIENT_REFILL_MS, buckets.retryAfter(ALICE, 1));
+  delay(CLIENT_REFILL_MS);
+  TEST_ASSERT_EQUAL(0, buckets.retryAfter(ALICE, 1));
+}
+
+void test_least_recently_seen_client_starts_over() {
+  ClientBuckets buckets;
+  for (uint32_t i = 0; i < CLIENT_SLOTS; i++) {
+    buckets.charge(ALICE + i, CLIENT_BURST);
+    delay(1);
+  }
+  TEST_ASSERT_EQUAL(CLIENT_SLOTS, buckets.tracked());
+  buckets.charge(ALICE, 0);                                                  // seen again, ALICE + 1 is now the oldest
+  buckets.charge(ALICE + CLIENT_SLOTS, 1);
+  TEST_ASSERT_EQUAL(CLIENT_SLOTS, buckets.tracked());
+  TEST_ASSERT_EQUAL(0, buckets.retryAfter(ALICE + 1, 1));                    // forgotten, a full bucket again
+  TEST_ASSERT_GREATER_THAN(0, buckets.retryAfter(ALICE, 1));
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_duplicate_within_the_window);
+  RUN_TEST(test_keys_scoped_per_client_and_route);
+  RUN_TEST(test_least_recently_seen_is_replaced);
+  RUN_TEST(test_burst_then_refill);
+  RUN_TEST(test_batch_leaves_debt);
+  RUN_TEST(test_least_recently_seen_client_starts_over);
+  return UNITY_END();
+}
@@ -0,0 +1,88 @@
+// Benchmarks: ns/op, heap allocations and printer bytes per call for the
+// driver's text paths and the receipt date formatting, across message sizes.
+// pio test -e native -f test_bench_format -v shows the table.
+#include <unity.h>
+#include <Bench.h>
+#include <ThermalPrinter.h>
+#include <TimeFormat.h>
+
+static const size_t SIZES[] = {16, 128, 512, 2048, 8192};
+
+static HardwareSerial serial;
+static ThermalPrinter printer(serial);
+static char text[8192 + 1];
+
+void setUp() {
+  serial.recording = false;                                                 // only count, the benchmarks send megabytes
+  printer.begin(9600);
+}
+
+void tearDown() {}
+
+static void fillText(size_t length) {
+  // Words of 1-9 letters with a newline now and then, like a to-do list
+  static const char words[] = "milk eggs bread call the plumber about sink water plants ";
+  for (size_t i = 0; i < length; i++) text[i] = words[i % (sizeof(words) - 1)];
+  for (size_t i = 97; i < length; i += 97) text[i] = '\n';
+  text[length] = '\0';
+}
+
+void test_bench_wrapped_upside_down() {
+  for (size_t size : SIZES) {
+    fillText(size);
+    BenchResult result = bench(size > 1024 ? 200 : 2000, &serial, [size]() {
+      printer.printWrappedUpsideDown(text, size);
+      printer.drain();
+    });
+    benchReport("printWrappedUpsideDown", size, result);
+    TEST_ASSERT_EQUAL(0, result.allocsPerOp);
+    TEST_ASSERT_GREATER_OR_EQUAL(size, result.bytesPerOp);                  // every character plus line ends
+  }
+}
+
+void test_bench_inverted() {
+  for (size_t size : {8, 16, 32}) {
+    fillText(size);
+    BenchResult result = bench(20000, &serial, []() {
+      printer.printInverted(text);
+      printer.drain();
+    });
+    benchReport("printInverted", size, result);
+    TEST_ASSERT_EQUAL(0, result.allocsPerOp);
+  }
+}
+
+void test_bench_date_header() {
+  // getFormattedDateTime() does this once per day, the time service caches it
+  char header[DATE_HEADER_SIZE];
+  unsigned long t = 1749300000UL;
+  BenchResult result = bench(200000, nullptr, [&]() {
+    formatDateHeader(header, t);
+    t += 86400;
+  });
+  benchReport("formatDateHeader", DATE_HEADER_SIZE, result);
+  TEST_ASSERT_EQUAL(0, result.allocsPerOp);
+}
+
+void test_bench_custom_date() {
+  // formatCustomDate(): parse the date field, then format it
+  char header[DATE_HEADER_SIZE];
+  const char *inputs[] = {"2025-06-07", "07/06/2025", "2025-13-40"};
+  for (const char *input : inputs) {
+    BenchResult result = bench(200000, nullptr, [&]() {
+      int year, month, day;
+      if (parseCustomDate(input, year, month, day)) formatDate(header, year, month, day);
+    });
+    benchReport("parseCustomDate + formatDate", strlen(input), result);
+    TEST_ASSERT_EQUAL(0, result.allocsPerOp);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_bench_wrapped_upside_down);
+  RUN_TEST(test_bench_inverted);
+  RUN_TEST(test_bench_date_header);
+  RUN_TEST(test_bench_custom_date);
+  return UNITY_END();
+}
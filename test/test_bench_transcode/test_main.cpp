@@ -0,0 +1,121 @@
+// Transcoder: spot checks against the codecs the tables were generated from,
+// then ns/op and allocations for transcode() and bestCodePage() across
+// scripts and message sizes. pio test -e native -f test_bench_transcode -v
+#include <unity.h>
+#include <Bench.h>
+#include <Transcoder.h>
+#include <string>
+
+static const size_t SIZES[] = {64, 512, 4096, 65536};
+
+struct Sample {
+  const char *name;
+  const char *text;                                 // one sentence, repeated to the size
+  uint8_t codePage;
+};
+
+static const Sample SAMPLES[] = {
+  {"ascii", "Buy milk, eggs and bread before six. ", 0},
+  {"german", "Grüße aus Köln, bitte Brötchen für Jörg kaufen! ", 0},
+  {"polish", "Zażółć gęślą jaźń, kup chleb i masło. ", 9},
+  {"greek", "Καλημέρα, αγόρασε γάλα και ψωμί. ", 7},
+  {"hebrew", "שלום, תקנה חלב ולחם. ", 8},
+  {"emoji", "Party at 8 🎉 bring snacks 🍕🍺 ", 0},
+};
+
+static char buffer[65536 + 64];
+
+void setUp() {}
+
+void tearDown() {}
+
+static std::string convert(const char *utf8, uint8_t codePage) {
+  strcpy(buffer, utf8);
+  size_t length = Transcoder::transcode(buffer, strlen(buffer), codePage);
+  return std::string(buffer, length);
+}
+
+void test_spot_checks() {
+  // Expected bytes from Python's codecs, which build_codepages.py reads
+  TEST_ASSERT_EQUAL_STRING("caf\x82", convert("café", 0).c_str());
+  TEST_ASSERT_EQUAL_STRING("\xe1", convert("ß", 0).c_str());
+  TEST_ASSERT_EQUAL_STRING("\x80", convert("€", 11).c_str());
+  TEST_ASSERT_EQUAL_STRING("EUR", convert("€", 0).c_str());               // not in PC437: transliterated
+  TEST_ASSERT_EQUAL_STRING("\x98", convert("α", 7).c_str());
+  TEST_ASSERT_EQUAL_STRING("\x88", convert("ł", 9).c_str());
+  TEST_ASSERT_EQUAL_STRING("\x80", convert("א", 8).c_str());
+  TEST_ASSERT_EQUAL_STRING("\x9b", convert("ø", 5).c_str());
+  TEST_ASSERT_EQUAL_STRING("\x87", convert("ç", 3).c_str());
+  TEST_ASSERT_EQUAL_STRING("plain ascii", convert("plain ascii", 9).c_str());
+  TEST_ASSERT_FALSE(Transcoder::isSupported(6));
+  TEST_ASSERT_TRUE(Transcoder::isSupported(0));
+}
+
+void test_never_longer_and_best_page() {
+  for (const Sample &sample : SAMPLES) {
+    size_t length = strlen(sample.text);
+    for (uint8_t page = 0; page < 16; page++) {
+      if (!Transcoder::isSupported(page)) continue;
+      strcpy(buffer, sample.text);
+      TEST_ASSERT_LESS_OR_EQUAL(length, Transcoder::transcode(buffer, length, page));
+    }
+    if (strcmp(sample.name, "emoji") != 0) {
+      TEST_ASSERT_EQUAL_MESSAGE(sample.codePage, Transcoder::bestCodePage(sample.text, length, 0), sample.name);
+    }
+  }
+  // Broken UTF-8 is no reason to crash or grow
+  const char broken[] = "a\xc3\xff\xe2\x82 \xf0\x9f";
+  strcpy(buffer, broken);
+  TEST_ASSERT_LESS_OR_EQUAL(sizeof(broken) - 1, Transcoder::transcode(buffer, sizeof(broken) - 1, 0));
+}
+
+static size_t fill(const char *sentence, size_t size) {
+  // Whole sentences only, a cut UTF-8 sequence would not be a fair sample
+  size_t n = strlen(sentence), length = 0;
+  while (length + n <= size) {
+    memcpy(buffer + length, sentence, n);
+    length += n;
+  }
+  buffer[length] = '\0';
+  return length;
+}
+
+void test_bench_transcode() {
+  static char source[sizeof(buffer)];
+  for (const Sample &sample : SAMPLES) {
+    for (size_t size : SIZES) {
+      size_t length = fill(sample.text, size);
+      memcpy(source, buffer, length + 1);
+      char name[40];
+      snprintf(name, sizeof(name), "transcode %s", sample.name);
+      BenchResult result = bench(size > 4096 ? 50 : 2000, nullptr, [&]() {
+        memcpy(buffer, source, length);                                     // in place, start from UTF-8 every time
+        Transcoder::transcode(buffer, length, sample.codePage);
+      });
+      benchReport(name, length, result);
+      TEST_ASSERT_EQUAL(0, result.allocsPerOp);
+    }
+  }
+}
+
+void test_bench_best_code_page() {
+  for (const Sample &sample : SAMPLES) {
+    size_t length = fill(sample.text, 512);
+    char name[40];
+    snprintf(name, sizeof(name), "bestCodePage %s", sample.name);
+    BenchResult result = bench(2000, nullptr, [&]() {
+      Transcoder::bestCodePage(buffer, length, 0);
+    });
+    benchReport(name, length, result);
+    TEST_ASSERT_EQUAL(0, result.allocsPerOp);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_spot_checks);
+  RUN_TEST(test_never_longer_and_best_page);
+  RUN_TEST(test_bench_transcode);
+  RUN_TEST(test_bench_best_code_page);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+// Word wrap: the WordWrap engine against the String based wrapper it replaced,
+// same lines out, and what each costs per call across message sizes. Lines in
+// reverse match the forward ones and cost about the same per byte at any length.
+// pio test -e native -f test_bench_wrap -v shows the table.
+#include <unity.h>
+#include <Bench.h>
+#include <ThermalPrinter.h>
+#include <WordWrap.h>
+#include <string>
+#include <vector>
+
+#define WRAP_WIDTH 32                                                       // maxCharsPerLine in ThermalPrinter.cpp
+
+static const size_t SIZES[] = {16, 128, 512, 2048, 8192};
+
+static HardwareSerial serial;
+static ThermalPrinter printer(serial);
+static char text[8192 + 1];
+
+void setUp() {
+  serial.recording = false;
+  printer.begin(9600);
+}
+
+void tearDown() {}
+
+// The wrapper before WordWrap, with std::string for Arduino's String: both
+// copy on substring(), keep short strings inline and trim() in place. The
+// original filled a String lines[100] on the stack and overran it past 100
+// lines, a vector keeps the larger sizes measurable.
+static void legacyWrappedUpsideDown(Print &out, std::string text) {
+  std::vector<std::string> lines;
+
+  while (text.length() > 0) {
+    if (text.length() <= WRAP_WIDTH) {
+      lines.push_back(text);
+      break;
+    }
+
+    size_t lastSpace = text.rfind(' ', WRAP_WIDTH);
+    if (lastSpace == std::string::npos) lastSpace = WRAP_WIDTH;
+
+    lines.push_back(text.substr(0, lastSpace));
+    text = text.substr(lastSpace);
+    size_t first = text.find_first_not_of(" \t\r\n");                     // String::trim()
+    size_t last = text.find_last_not_of(" \t\r\n");
+    text = first == std::string::npos ? std::string() : text.substr(first, last - first + 1);
+  }
+
+  for (size_t i = lines.size(); i > 0; i--) {
+    out.print(lines[i - 1].c_str());
+    out.println();
+  }
+}
+
+// Words of 1-14 letters, single spaces, no newlines: the input the old wrapper handled
+static size_t fillWords(uint32_t seed, size_t length) {
+  size_t n = 0;
+  while (n < length) {
+    seed = seed * 1103515245 + 12345;
+    size_t word = 1 + (seed >> 16) % 14;
+    if (n > 0) text[n++] = ' ';
+    for (size_t i = 0; i < word && n < length; i++) text[n++] = 'a' + (seed >> (i % 16)) % 26;
+  }
+  if (n > 0 && text[n - 1] == ' ') n--;
+  text[n] = '\0';
+  return n;
+}
+
+void test_same_lines_as_legacy() {
+  HardwareSerial legacy;
+  for (uint32_t seed = 1; seed <= 500; seed++) {
+    size_t length = fillWords(seed, seed % 700);
+    serial.recording = true;
+    serial.clear();
+    printer.printWrappedUpsideDown(text, length);
+    printer.drain();
+    legacy.clear();
+    legacyWrappedUpsideDown(legacy, std::string(text, length));
+    TEST_ASSERT_EQUAL(legacy.sent.size(), serial.sent.size());
+    TEST_ASSERT_EQUAL_MEMORY(legacy.sent.data(), serial.sent.data(), legacy.sent.size());
+  }
+}
+
+void test_long_words_hard_break() {
+  memset(text, 'x', 100);
+  WordWrap wrap(text, 100, WRAP_WIDTH);
+  WrapLine line;
+  size_t lengths[] = {32, 32, 32, 4};
+  for (size_t expected : lengths) {
+    TEST_ASSERT_TRUE(wrap.next(line));
+    TEST_ASSERT_EQUAL(expected, line.length);
+  }
+  TEST_ASSERT_FALSE(wrap.next(line));
+}
+
+void test_newlines_end_lines() {
+  const char *list = "milk\r\neggs\n\nbread and butter and jam and honey\n";
+  WordWrap wrap(list, strlen(list), WRAP_WIDTH);
+  const char *expected[] = {"milk", "eggs", "", "bread and butter and jam and", "honey"};
+  WrapLine line;
+  for (const char *want : expected) {
+    TEST_ASSERT_TRUE(wrap.next(line));
+    TEST_ASSERT_EQUAL(strlen(want), line.length);
+    TEST_ASSERT_EQUAL_MEMORY(want, list + line.start, line.length);
+  }
+  TEST_ASSERT_FALSE(wrap.next(line));
+}
+
+void test_bench_wrap_against_legacy() {
+  for (size_t size : SIZES) {
+    size_t length = fillWords(7, size);
+    uint32_t iterations = size > 1024 ? 200 : 2000;
+    BenchResult legacy = bench(iterations, &serial, [length]() {
+      legacyWrappedUpsideDown(serial, std::string(text, length));
+    });
+    BenchResult current = bench(iterations, &serial, [length]() {
+      printer.printWrappedUpsideDown(text, length);
+      printer.drain();
+    });
+    benchReport("legacy String wrap", size, legacy);
+    benchReport("WordWrap", size, current);
+    TEST_ASSERT_EQUAL(0, current.allocsPerOp);
+    TEST_ASSERT_EQUAL(legacy.bytesPerOp, current.bytesPerOp);              // same output
+    if (size >= 512) TEST_ASSERT_GREATER_THAN(10, legacy.allocsPerOp);     // a copy per line and per remainder
+  }
+}
+
+// Words with now and then a line break or a word longer than a line, into a buffer of any size
+static void fillMixed(std::vector<char> &out, uint32_t seed, size_t length) {
+  out.clear();
+  while (out.size() < length) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t kind = (seed >> 8) % 40;
+    size_t word = kind == 2 ? WRAP_WIDTH + (seed >> 16) % 80 : 1 + (seed >> 16) % 12;
+    if (kind == 0) out.push_back('\r');
+    if (kind <= 1) out.push_back('\n');
+    for (size_t i = 0; i < word; i++) out.push_back('a' + (seed >> (i % 16)) % 26);
+    out.push_back(' ');
+  }
+  out.resize(length);
+}
+
+void test_reversed_matches_forward() {
+  std::vector<char> mixed;
+  for (size_t length : {0, 10, 200, 1100, 5000, 40000, 300000}) {
+    for (uint8_t width : {1, 5, WRAP_WIDTH, 48}) {
+      fillMixed(mixed, length + width, length);
+      WordWrap wrap(mixed.data(), mixed.size(), width);
+      std::vector<WrapLine> forward;
+      WrapLine line;
+      while (wrap.next(line)) forward.push_back(line);
+      size_t n = forward.size();
+      wrap.forEachReversed([&](const char *start, size_t count) {
+        TEST_ASSERT_GREATER_THAN(0, n);
+        n--;
+        TEST_ASSERT_EQUAL_PTR(mixed.data() + forward[n].start, start);
+        TEST_ASSERT_EQUAL(forward[n].length, count);
+      });
+      TEST_ASSERT_EQUAL(0, n);
+      TEST_ASSERT_EQUAL(0, wrap.position());                                // rewound for the next caller
+    }
+  }
+}
+
+void test_bench_reversed_scales() {
+  // Cost per byte stays close to flat as the text grows, a rescan per block made it grow with the length
+  std::vector<char> mixed;
+  double first = 0;
+  for (size_t size : {8192, 65536, 524288}) {
+    fillMixed(mixed, 3, size);
+    size_t lines = 0;
+    BenchResult result = bench(size > 65536 ? 5 : 50, nullptr, [&]() {
+      WordWrap wrap(mixed.data(), mixed.size(), WRAP_WIDTH);
+      wrap.forEachReversed([&](const char *, size_t) { lines++; });
+    });
+    benchReport("forEachReversed", size, result);
+    TEST_ASSERT_EQUAL(0, result.allocsPerOp);
+    double perByte = result.nsPerOp / size;
+    if (first == 0) first = perByte;
+    TEST_ASSERT_LESS_THAN(first * 6, perByte);
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_same_lines_as_legacy);
+  RUN_TEST(test_long_words_hard_break);
+  RUN_TEST(test_newlines_end_lines);
+  RUN_TEST(test_bench_wrap_against_legacy);
+  RUN_TEST(test_reversed_matches_forward);
+  RUN_TEST(test_bench_reversed_scales);
+  return UNITY_END();
+}
@@ -0,0 +1,375 @@
+// HTTP front end over in-memory sockets: route table limits, early answers
+// that close without reading the body, multipart bodies split at every byte,
+// and many clients trickling requests in at once through the four connection slots.
+#include <unity.h>
+#include <HttpFront.h>
+#include <WebRoutes.h>
+#include <string>
+#include <vector>
+
+#define PORT 80
+
+static HttpFront *front;
+static uint32_t seed;
+
+static uint32_t random(uint32_t n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+// Per-slot state of the test routes, like the firmware's handlers keep it
+struct Echo {
+  std::string name;
+  std::string text;
+  std::string file;                                                         // data of parts with a filename
+  std::string fields;                                                       // names in the order they started, a file part with '*'
+  bool begun;
+};
+static Echo echoes[HTTP_MAX_CLIENTS];
+static Echo ended;                                                          // what the last request that ended got
+static uint32_t ends, aborts;
+
+static void beginEcho(HttpRequest &request) {
+  Echo &echo = echoes[request.slot()];
+  echo.name.clear();
+  echo.text.clear();
+  echo.file.clear();
+  echo.fields.clear();
+  echo.begun = true;
+}
+
+static void echoField(HttpRequest &request, const char *name, const uint8_t *data, size_t length, uint8_t flags) {
+  Echo &echo = echoes[request.slot()];
+  if (flags & HTTP_FIELD_START) echo.fields += std::string(name) + (flags & HTTP_FIELD_FILE ? "*" : "") + ",";
+  if (flags & HTTP_FIELD_FILE) echo.file.append((const char*)data, length);
+  else if (strcmp(name, "name") == 0) echo.name.append((const char*)data, length);
+  else if (strcmp(name, "text") == 0) echo.text.append((const char*)data, length);
+  if (echo.text.size() > 1000) request.send(413, "text/plain", "Text too long");
+}
+
+static void endEcho(HttpRequest &request) {
+  Echo &echo = echoes[request.slot()];
+  std::string body = echo.name + ":" + std::to_string(echo.text.size()) + ":" + echo.text.substr(0, 8);
+  echo.begun = false;
+  ended = echo;
+  ends++;
+  request.send(200, "text/plain", body.c_str());
+}
+
+static void abortEcho(HttpRequest &request) {
+  echoes[request.slot()].begun = false;
+  aborts++;
+}
+
+static void handleRoot(HttpRequest &request) {
+  request.send(200, "text/html", "<h1>Receipts</h1>");
+}
+
+void setUp() {
+  nativeResetClock();
+  front = new HttpFront(PORT);
+  front->begin();
+  front->on("/", HTTP_METHOD_GET, handleRoot);
+  TEST_ASSERT_TRUE(front->on({"/echo", HTTP_METHOD_POST, 1 << 20, beginEcho, echoField, endEcho, abortEcho, nullptr}));
+  for (auto &echo : echoes) echo = Echo();
+  ends = 0;
+  aborts = 0;
+}
+
+void tearDown() {
+  delete front;
+}
+
+static void serve(uint32_t rounds = 1) {
+  for (uint32_t i = 0; i < rounds; i++) {
+    front->handle(20);
+    delay(1);
+  }
+}
+
+static int status(const NativeNet::Socket &socket) {
+  if (socket.outgoing.compare(0, 9, "HTTP/1.1 ") != 0) return 0;
+  return atoi(socket.outgoing.c_str() + 9);
+}
+
+static std::string body(const NativeNet::Socket &socket) {
+  size_t start = socket.outgoing.find("\r\n\r\n");
+  return start == std::string::npos ? "" : socket.outgoing.substr(start + 4);
+}
+
+static std::string post(const char *path, const std::string &form, size_t contentLength = 0) {
+  char head[160];
+  snprintf(head, sizeof(head), "POST %s HTTP/1.1\r\nHost: printer\r\n"
+           "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %u\r\n\r\n",
+           path, (unsigned)(contentLength ? contentLength : form.size()));
+  return head + form;
+}
+
+void test_route_table_full() {
+  // "/" and "/echo" are in, the rest of the table fills up and one more is refused
+  for (uint8_t i = 2; i < HTTP_MAX_ROUTES; i++) TEST_ASSERT_TRUE(front->on("/filler", HTTP_METHOD_GET, handleRoot));
+  TEST_ASSERT_EQUAL(0, front->droppedRoutes());
+  TEST_ASSERT_FALSE(front->on("/metrics", HTTP_METHOD_GET, handleRoot));
+  TEST_ASSERT_EQUAL(1, front->droppedRoutes());
+
+  auto socket = WiFiServer::connect(PORT, 1);
+  socket->send("GET /metrics HTTP/1.1\r\n\r\n");
+  serve(2);
+  TEST_ASSERT_EQUAL(500, status(*socket));                                  // loud, not a 404 that looks like a typo
+  TEST_ASSERT_TRUE(socket->closed);
+
+  socket = WiFiServer::connect(PORT, 1);
+  socket->send("GET / HTTP/1.1\r\n\r\n");
+  serve(2);
+  TEST_ASSERT_EQUAL(200, status(*socket));
+}
+
+void test_firmware_routes_fit() {
+  // The list main.cpp registers, with the test's handler in place of the firmware's
+  HttpFront server(8080);
+  server.begin();
+  uint8_t count = 0;
+  #define TEST_ROUTE(path, methods, ...) TEST_ASSERT_TRUE(server.on(path, methods, handleRoot)); count++;
+  WEB_ROUTES(TEST_ROUTE, TEST_ROUTE)
+  #undef TEST_ROUTE
+  TEST_ASSERT_EQUAL(0, server.droppedRoutes());
+  TEST_ASSERT_LESS_OR_EQUAL(HTTP_MAX_ROUTES, count);
+  TEST_ASSERT_GREATER_THAN(1, count);
+
+  auto socket = WiFiServer::connect(8080, 1);
+  socket->send("GET /metrics.json HTTP/1.1\r\n\r\n");                  // the last one is found
+  for (int i = 0; i < 2; i++) {
+    server.handle(20);
+    delay(1);
+  }
+  TEST_ASSERT_EQUAL(200, status(*socket));
+}
+
+static void handleThrottled(HttpRequest &request) {
+  request.send(429, "text/plain", "Too many receipts");
+}
+
+static void handleNoFlash(HttpRequest &request) {
+  request.send(507, "text/plain", "Not enough flash");
+}
+
+void test_status_lines() {
+  // The answers of the admission and spool checks carry their own reason phrase
+  front->on("/throttled", HTTP_METHOD_GET, handleThrottled);
+  front->on("/no-flash", HTTP_METHOD_GET, handleNoFlash);
+  auto socket = WiFiServer::connect(PORT, 1);
+  socket->send("GET /throttled HTTP/1.1\r\n\r\n");
+  serve(2);
+  TEST_ASSERT_EQUAL(0, socket->outgoing.compare(0, 31, "HTTP/1.1 429 Too Many Requests\r"));
+  socket = WiFiServer::connect(PORT, 1);
+  socket->send("GET /no-flash HTTP/1.1\r\n\r\n");
+  serve(2);
+  TEST_ASSERT_EQUAL(0, socket->outgoing.compare(0, 34, "HTTP/1.1 507 Insufficient Storage\r"));
+}
+
+void test_early_413_closes_without_reading_the_body() {
+  const size_t announced = 512 * 1024;
+  auto socket = WiFiServer::connect(PORT, 1);
+  socket->send(post("/echo", "name=a&text=" + std::string(1200, 'x'), announced));
+  serve(10);
+  TEST_ASSERT_EQUAL(413, status(*socket));
+  TEST_ASSERT_TRUE(socket->closed);
+  TEST_ASSERT_EQUAL(1, aborts);
+  TEST_ASSERT_EQUAL(0, ends);
+  TEST_ASSERT_EQUAL(0, front->active());                                    // the slot is free again
+
+  // The client keeps sending the rest: nobody reads it
+  size_t read = socket->consumed;
+  socket->send(std::string(64 * 1024, 'x'));
+  serve(10);
+  TEST_ASSERT_EQUAL(read, socket->consumed);
+  TEST_ASSERT_LESS_THAN(4096, read);
+}
+
+void test_413_from_content_length() {
+  auto socket = WiFiServer::connect(PORT, 1);
+  socket->send("POST / HTTP/1.1\r\nContent-Length: 100000\r\n\r\n");
+  serve(2);
+  TEST_ASSERT_EQUAL(405, status(*socket));                                  // GET only, answered once the path is known
+  TEST_ASSERT_TRUE(socket->closed);
+
+  socket = WiFiServer::connect(PORT, 1);
+  socket->send(post("/echo", "name=a", 2 << 20));
+  serve(2);
+  TEST_ASSERT_EQUAL(413, status(*socket));
+  TEST_ASSERT_TRUE(socket->closed);
+  TEST_ASSERT_EQUAL(1, aborts);
+}
+
+void test_header_timeout() {
+  auto socket = WiFiServer::connect(PORT, 1);
+  socket->send("GET / HTTP/1.1\r\nHost: pri");
+  serve(2);
+  TEST_ASSERT_FALSE(socket->closed);
+  delay(HTTP_HEADER_TIMEOUT_MS);
+  serve(2);
+  TEST_ASSERT_EQUAL(408, status(*socket));
+  TEST_ASSERT_TRUE(socket->closed);
+  TEST_ASSERT_EQUAL(1, front->timeouts());
+}
+
+#define BOUNDARY "----form7MA4YWxkTrZu0gW"
+
+// Two fields, one with near misses of the delimiter and CRLFs in it, and a file with every byte value
+static std::string multipartBody(std::string &text, std::string &file) {
+  text = "one\r\ntwo\r\n\r\n--" "----form7MA4YWxkTrZu0g" "X\r\r\n-\r\n--" "----form7MA4 end\r";
+  file.clear();
+  for (int i = 0; i < 512; i++) file += (char)(i % 256);
+  file += "\r\n--" "----form7MA4YWxk\r\n";
+  return "preamble\r\n"
+         "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"name\"\r\n"
+         "\r\n"
+         "alice\r\n"
+         "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"text\"\r\n"
+         "\r\n" + text + "\r\n"
+         "--" BOUNDARY "\r\n"
+         "Content-Disposition: form-data; name=\"photo\"; filename=\"a.pgm\"\r\n"
+         "Content-Type: application/octet-stream\r\n"
+         "\r\n" + file + "\r\n"
+         "--" BOUNDARY "--\r\n"
+         "epilogue";
+}
+
+static std::string multipartHead(size_t length) {
+  char head[200];
+  snprintf(head, sizeof(head), "POST /echo HTTP/1.1\r\nHost: printer\r\n"
+           "Content-Type: multipart/form-data; boundary=" BOUNDARY "\r\nContent-Length: %u\r\n\r\n", (unsigned)length);
+  return head;
+}
+
+static void checkMultipart(const std::string &text, const std::string &file) {
+  TEST_ASSERT_EQUAL_STRING("name,text,photo*,", ended.fields.c_str());
+  TEST_ASSERT_EQUAL_STRING("alice", ended.name.c_str());
+  TEST_ASSERT_TRUE(text == ended.text);
+  TEST_ASSERT_EQUAL(file.size(), ended.file.size());
+  TEST_ASSERT_TRUE(file == ended.file);
+}
+
+void test_multipart_split_at_every_offset() {
+  // Two reads, the second starting at every byte of the body: inside each
+  // delimiter, between the CR and LF of every line, inside the part headers
+  std::string text, file;
+  std::string body = multipartBody(text, file);
+  for (size_t split = 0; split <= body.size(); split++) {
+    auto socket = WiFiServer::connect(PORT, 1);
+    socket->send(multipartHead(body.size()) + body.substr(0, split));
+    serve(2);
+    socket->send(body.substr(split));
+    serve(2);
+    TEST_ASSERT_EQUAL_MESSAGE(200, status(*socket), std::to_string(split).c_str());
+    checkMultipart(text, file);
+  }
+  TEST_ASSERT_EQUAL(body.size() + 1, ends);
+  TEST_ASSERT_EQUAL(0, aborts);
+}
+
+void test_multipart_byte_by_byte() {
+  // Every read ends on a byte, CRLFs included, and the chunks a field is handed in stay whole
+  std::string text, file;
+  std::string body = multipartBody(text, file);
+  auto socket = WiFiServer::connect(PORT, 1);
+  socket->send(multipartHead(body.size()));
+  for (char c : body) {
+    socket->send(std::string(1, c));
+    serve();
+  }
+  serve(2);
+  TEST_ASSERT_EQUAL(200, status(*socket));
+  checkMultipart(text, file);
+}
+
+struct Client {
+  std::shared_ptr<NativeNet::Socket> socket;
+  std::string request;
+  std::string expected;                                                     // response body
+  size_t sent;
+  uint32_t startAt;                                                         // millis() of the next attempt
+  bool done;
+};
+
+void test_concurrent_clients() {
+  // 120 clients, arriving within half a second, each sending its request in random
+  // slices over many passes. Every one ends with its own answer: a busy
+  // server only turns a client away with a 503 that it retries.
+  seed = 13;
+  std::vector<Client> clients(120);
+  for (size_t i = 0; i < clients.size(); i++) {
+    Client &client = clients[i];
+    if (random(4) == 0) {
+      client.request = "GET / HTTP/1.1\r\nHost: printer\r\n\r\n";
+      client.expected = "<h1>Receipts</h1>";
+    } else {
+      std::string name = "client" + std::to_string(i);
+      std::string text(1 + random(900), 'a' + i % 26);
+      text[0] = '0' + i % 10;
+      client.request = post("/echo", "name=" + name + "&text=" + text);
+      client.expected = name + ":" + std::to_string(text.size()) + ":" + text.substr(0, 8);
+    }
+    client.startAt = random(500);
+    client.sent = 0;
+    client.done = false;
+  }
+
+  uint32_t finished = 0, busy = 0;
+  while (finished < clients.size() && millis() < 60000) {
+    for (Client &client : clients) {
+      if (client.done || millis() < client.startAt) continue;
+      if (!client.socket) {
+        client.socket = WiFiServer::connect(PORT, 0x0A000000 + (uint32_t)(&client - &clients[0]));
+        client.sent = 0;
+      }
+      NativeNet::Socket &socket = *client.socket;
+      if (socket.closed) {
+        int code = status(socket);
+        if (code == 503) {
+          TEST_ASSERT_NOT_EQUAL(std::string::npos, socket.outgoing.find("Retry-After: 1"));
+          busy++;
+          client.socket.reset();
+          client.startAt = millis() + 50 + random(200);
+          continue;
+        }
+        TEST_ASSERT_EQUAL_MESSAGE(200, code, client.request.c_str());
+        TEST_ASSERT_EQUAL_STRING(client.expected.c_str(), body(socket).c_str()); // no bytes of another connection
+        TEST_ASSERT_FALSE(socket.reset);
+        client.done = true;
+        finished++;
+        continue;
+      }
+      if (client.sent < client.request.size() && random(3) == 0) {
+        size_t n = 1 + random(100);
+        if (n > client.request.size() - client.sent) n = client.request.size() - client.sent;
+        socket.send(client.request.substr(client.sent, n));
+        client.sent += n;
+      }
+    }
+    serve();
+  }
+
+  TEST_ASSERT_EQUAL(clients.size(), finished);
+  TEST_ASSERT_GREATER_THAN(0, busy);                                        // the slots did run full
+  TEST_ASSERT_EQUAL(busy, front->rejected());
+  TEST_ASSERT_EQUAL(0, front->timeouts());
+  TEST_ASSERT_EQUAL(0, aborts);
+  TEST_ASSERT_EQUAL(0, front->active());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_route_table_full);
+  RUN_TEST(test_firmware_routes_fit);
+  RUN_TEST(test_multipart_split_at_every_offset);
+  RUN_TEST(test_multipart_byte_by_byte);
+  RUN_TEST(test_status_lines);
+  RUN_TEST(test_early_413_closes_without_reading_the_body);
+  RUN_TEST(test_413_from_content_length);
+  RUN_TEST(test_header_timeout);
+  RUN_TEST(test_concurrent_clients);
+  return UNITY_END();
+}
@@ -0,0 +1,201 @@
+// RasterStream against a whole-image reference encoder: the same packed rows
+// for every dither mode, image size, scale factor and chunk split.
+#include <unity.h>
+#include <ImageRaster.h>
+#include <string>
+#include <vector>
+
+static RasterStream stream;
+static std::vector<uint8_t> packed;                                         // every band, in order
+static std::vector<uint16_t> bandRows;
+static uint16_t bandWidth;
+
+static void collect(const uint8_t *band, uint16_t width, uint16_t rows, void *context) {
+  packed.insert(packed.end(), band, band + (size_t)(width + 7) / 8 * rows);
+  bandRows.push_back(rows);
+  bandWidth = width;
+}
+
+void setUp() {
+  packed.clear();
+  bandRows.clear();
+  bandWidth = 0;
+}
+
+void tearDown() {}
+
+struct Image {
+  char type;                                        // '4' or '5'
+  uint16_t width, height;
+  uint8_t maxval;
+  std::vector<uint8_t> gray;                        // width * height, 0 = black
+};
+
+static uint32_t seed;
+
+static uint32_t random(uint32_t n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+static Image randomImage(char type, uint16_t width, uint16_t height) {
+  Image image = {type, width, height, (uint8_t)(type == '5' ? (random(2) ? 255 : 100 + random(155)) : 1), {}};
+  image.gray.resize((size_t)width * height);
+  for (uint16_t y = 0; y < height; y++) {
+    for (uint16_t x = 0; x < width; x++) {
+      uint32_t v = (x * 3 + y * 5 + random(64)) % (image.maxval + 1);     // gradients with noise
+      image.gray[(size_t)y * width + x] = v;
+    }
+  }
+  return image;
+}
+
+static std::string encodeFile(const Image &image, bool comment) {
+  std::string file = "P";
+  file += image.type;
+  file += comment ? "\n# made by the test\n" : "\n";
+  file += std::to_string(image.width) + " " + std::to_string(image.height) + "\n";
+  if (image.type == '5') {
+    file += std::to_string(image.maxval) + "\n";
+    file.append((const char*)image.gray.data(), image.gray.size());
+  } else {
+    for (uint16_t y = 0; y < image.height; y++) {
+      for (uint16_t x = 0; x < image.width; x += 8) {
+        uint8_t byte = 0;
+        for (uint16_t b = 0; b < 8 && x + b < image.width; b++) {
+          if (image.gray[(size_t)y * image.width + x + b] == 0) byte |= 0x80 >> b;
+        }
+        file += (char)byte;
+      }
+    }
+  }
+  return file;
+}
+
+// The whole image in memory: scale, dither, pack, as described in ImageRaster.h
+static std::vector<uint8_t> reference(const Image &image, DitherMode mode, uint16_t &outWidth, uint16_t &outHeight) {
+  static const uint8_t bayer[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+  outWidth = image.width > RASTER_MAX_WIDTH ? RASTER_MAX_WIDTH : image.width;
+  outHeight = (uint32_t)image.height * outWidth / image.width;
+  if (outHeight == 0) outHeight = 1;
+  uint16_t widthBytes = (outWidth + 7) / 8;
+
+  std::vector<int> gray((size_t)outWidth * outHeight);
+  for (uint16_t y = 0; y < outHeight; y++) {
+    uint32_t sy = (uint32_t)y * image.height / outHeight;
+    for (uint16_t x = 0; x < outWidth; x++) {
+      uint32_t sx = (uint32_t)x * image.width / outWidth;
+      uint8_t v = image.gray[sy * image.width + sx];
+      gray[(size_t)y * outWidth + x] = image.type == '4' ? (v ? 255 : 0) : image.maxval == 255 ? v : v * 255 / image.maxval;
+    }
+  }
+
+  std::vector<uint8_t> bits((size_t)widthBytes * outHeight, 0);
+  std::vector<int> error((size_t)(outWidth + 2) * (outHeight + 1), 0);     // in 1/16 steps, one column of margin each side
+  for (uint16_t y = 0; y < outHeight; y++) {
+    for (uint16_t x = 0; x < outWidth; x++) {
+      int v = gray[(size_t)y * outWidth + x];
+      bool black;
+      if (mode == DITHER_FLOYD_STEINBERG) {
+        v += error[(size_t)y * (outWidth + 2) + x + 1] / 16;
+        black = v < 128;
+        int e = v - (black ? 0 : 255);
+        error[(size_t)y * (outWidth + 2) + x + 2] += e * 7;
+        error[(size_t)(y + 1) * (outWidth + 2) + x] += e * 3;
+        error[(size_t)(y + 1) * (outWidth + 2) + x + 1] += e * 5;
+        error[(size_t)(y + 1) * (outWidth + 2) + x + 2] += e;
+      } else if (mode == DITHER_ORDERED) {
+        black = v < bayer[y & 3][x & 3] * 16 + 8;
+      } else {
+        black = v < 128;
+      }
+      if (black) bits[(size_t)y * widthBytes + x / 8] |= 0x80 >> (x % 8);
+    }
+  }
+  return bits;
+}
+
+static bool streamInChunks(const std::string &file, DitherMode mode) {
+  stream.begin(mode, collect, nullptr);
+  size_t at = 0;
+  while (at < file.size()) {
+    size_t chunk = 1 + random(random(4) == 0 ? 7 : 700);                    // some tiny chunks that split the header
+    if (chunk > file.size() - at) chunk = file.size() - at;
+    if (stream.write((const uint8_t*)file.data() + at, chunk) != chunk) return false;
+    at += chunk;
+  }
+  return stream.end();
+}
+
+static void checkAgainstReference(const Image &image, DitherMode mode, bool comment) {
+  uint16_t outWidth, outHeight;
+  std::vector<uint8_t> expected = reference(image, mode, outWidth, outHeight);
+  setUp();
+  TEST_ASSERT_TRUE_MESSAGE(streamInChunks(encodeFile(image, comment), mode), stream.error());
+  TEST_ASSERT_EQUAL(outWidth, stream.width());
+  TEST_ASSERT_EQUAL(outHeight, stream.rows());
+  TEST_ASSERT_EQUAL(outWidth, bandWidth);
+  for (size_t i = 0; i < bandRows.size(); i++) {
+    TEST_ASSERT_EQUAL(i + 1 < bandRows.size() ? RASTER_BAND_ROWS : (outHeight - 1) % RASTER_BAND_ROWS + 1, bandRows[i]);
+  }
+  TEST_ASSERT_EQUAL(expected.size(), packed.size());
+  TEST_ASSERT_EQUAL_MEMORY(expected.data(), packed.data(), expected.size());
+}
+
+void test_random_images_match_reference() {
+  seed = 1;
+  for (int n = 0; n < 120; n++) {
+    char type = random(3) == 0 ? '4' : '5';
+    uint16_t width = 1 + random(n % 4 == 0 ? 1000 : 400);                   // some wider than the paper
+    uint16_t height = 1 + random(90);
+    Image image = randomImage(type, width, height);
+    DitherMode mode = (DitherMode)random(3);
+    checkAgainstReference(image, mode, n % 5 == 0);
+  }
+}
+
+void test_exact_widths() {
+  seed = 7;
+  uint16_t widths[] = {1, 7, 8, 9, 383, 384, 385, 768};
+  for (uint16_t width : widths) {
+    for (int mode = 0; mode < 3; mode++) checkAgainstReference(randomImage('5', width, 49), (DitherMode)mode, false);
+    checkAgainstReference(randomImage('4', width, 25), DITHER_THRESHOLD, false);
+  }
+}
+
+void test_pbm_is_copied_exactly() {
+  // Black and white at full width needs no dithering: the bits are the file's
+  seed = 3;
+  Image image = randomImage('4', 384, 30);
+  std::string file = encodeFile(image, false);
+  TEST_ASSERT_TRUE(streamInChunks(file, DITHER_FLOYD_STEINBERG));
+  size_t header = file.size() - packed.size();
+  TEST_ASSERT_EQUAL_MEMORY(file.data() + header, packed.data(), packed.size());
+}
+
+void test_broken_files() {
+  struct { const char *file; size_t length; } broken[] = {
+    {"GIF89a", 6},
+    {"P6\n2 2\n255\n", 11},
+    {"P5\n2 x\n", 7},
+    {"P5\n0 5\n255\n", 11},
+    {"P5\n2 2\n65536\n", 13},
+    {"P5\n2 2\n1000\n", 12},
+    {"P5\n4 4\n255\n\x10\x20", 13},                                        // cut short
+  };
+  for (auto &b : broken) {
+    stream.begin(DITHER_THRESHOLD, collect, nullptr);
+    stream.write((const uint8_t*)b.file, b.length);
+    TEST_ASSERT_FALSE(stream.end());
+    TEST_ASSERT_NOT_NULL(stream.error());
+  }
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_random_images_match_reference);
+  RUN_TEST(test_exact_widths);
+  RUN_TEST(test_pbm_is_copied_exactly);
+  RUN_TEST(test_broken_files);
+  return UNITY_END();
+}
@@ -0,0 +1,144 @@
+// Long messages through the in-memory LittleFS: several MB written in uneven
+// slices and printed back page by page must give the lines of wrapping the
+// whole text at once, and the limit follows the flash that is free.
+#include <unity.h>
+#include <LittleFS.h>
+#include <LongMessage.h>
+#include <string>
+#include <vector>
+
+#define WIDTH 32
+
+static uint32_t seed;
+
+static uint32_t random(uint32_t n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+void setUp() {
+  nativeResetClock();
+  LittleFS.format();
+  TEST_ASSERT_TRUE(LittleFS.begin());
+}
+
+void tearDown() {
+}
+
+// Words of 1 to 12 letters, now and then a line break or a word longer than a line
+static std::string text(size_t bytes) {
+  std::string out;
+  out.reserve(bytes);
+  while (out.size() < bytes) {
+    uint32_t kind = random(40);
+    if (kind == 0) out += "\r\n";
+    else if (kind == 1) out += "\n";
+    else if (kind == 2) out += std::string(WIDTH + random(80), 'L');
+    else out += std::string(1 + random(12), 'a' + random(26));
+    out += ' ';
+  }
+  out.resize(bytes);
+  return out;
+}
+
+static bool store(const std::string &message, uint32_t id) {
+  LongMessageWriter writer;
+  if (!writer.begin(0)) return false;
+  for (size_t at = 0; at < message.size();) {
+    size_t n = 1 + random(3000);
+    if (n > message.size() - at) n = message.size() - at;
+    if (!writer.write((const uint8_t*)message.data() + at, n)) {
+      writer.discard();                                                     // as the firmware does when it answers 413
+      return false;
+    }
+    at += n;
+  }
+  return writer.finish(id);
+}
+
+static std::vector<std::string> printed(uint32_t id) {
+  std::vector<std::string> lines;
+  LongMessageReader reader;
+  TEST_ASSERT_TRUE(reader.open(id, WIDTH));
+  uint32_t steps = 0;
+  while (!reader.step([&](const char *line, size_t length) { lines.emplace_back(line, length); })) steps++;
+  reader.close();
+  TEST_ASSERT_GREATER_THAN(1, steps);                                       // in bounded pieces, not all at once
+  return lines;
+}
+
+static std::vector<std::string> wrapped(const std::string &message) {
+  std::vector<std::string> lines;
+  WordWrap wrap(message.data(), message.size(), WIDTH);
+  wrap.forEachReversed([&](const char *line, size_t length) { lines.emplace_back(line, length); });
+  return lines;
+}
+
+static void roundTrip(size_t bytes) {
+  std::string message = text(bytes);
+  TEST_ASSERT_TRUE(store(message, 7));
+  TEST_ASSERT_EQUAL(bytes, LittleFS.fileSize("/msg-7.txt"));
+  std::vector<std::string> expected = wrapped(message);
+  std::vector<std::string> lines = printed(7);
+  TEST_ASSERT_EQUAL(expected.size(), lines.size());
+  for (size_t i = 0; i < lines.size(); i++) TEST_ASSERT_EQUAL_STRING(expected[i].c_str(), lines[i].c_str());
+}
+
+void test_several_megabytes_round_trip() {
+  seed = 3;
+  LittleFS.setCapacity(32 << 20);
+  roundTrip(6 << 20);
+}
+
+void test_exactly_the_limit() {
+  seed = 5;
+  LittleFS.setCapacity(32 << 20);
+  roundTrip(LONG_MESSAGE_MAX);
+}
+
+void test_over_the_limit() {
+  seed = 7;
+  LittleFS.setCapacity(32 << 20);
+  std::string message = text(LONG_MESSAGE_MAX + 1);
+  TEST_ASSERT_FALSE(store(message, 7));
+  TEST_ASSERT_FALSE(LittleFS.exists("/msg-7.txt"));
+  TEST_ASSERT_FALSE(LittleFS.exists("/msg-new.txt"));                       // nothing left taking flash
+}
+
+void test_limit_follows_free_flash() {
+  // On the chip's 64 KB a message leaves room for the journal and its page index
+  FSInfo info;
+  LittleFS.info(info);
+  LongMessageWriter writer;
+  TEST_ASSERT_TRUE(writer.begin(0));
+  TEST_ASSERT_EQUAL(info.totalBytes - info.usedBytes - LONG_FLASH_RESERVE, writer.limit());
+  TEST_ASSERT_LESS_THAN(NATIVE_FS_BYTES, writer.limit());
+  writer.discard();
+
+  seed = 11;
+  TEST_ASSERT_FALSE(store(text(NATIVE_FS_BYTES), 3));
+  std::string message = text(writer.limit());
+  TEST_ASSERT_TRUE(store(message, 3));
+  std::vector<std::string> lines = printed(3);                              // the page index still fits
+  TEST_ASSERT_EQUAL(wrapped(message).size(), lines.size());
+}
+
+void test_no_room_no_message() {
+  LittleFS.setCapacity((NATIVE_FS_RESERVED + 1) * NATIVE_FS_BLOCK + LONG_FLASH_RESERVE);
+  File journal = LittleFS.open("/spool.log", "w");
+  journal.write((const uint8_t*)"x", 1);
+  journal.close();
+  LongMessageWriter writer;
+  TEST_ASSERT_FALSE(writer.begin(0));
+  TEST_ASSERT_FALSE(writer.active());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_several_megabytes_round_trip);
+  RUN_TEST(test_exactly_the_limit);
+  RUN_TEST(test_over_the_limit);
+  RUN_TEST(test_limit_follows_free_flash);
+  RUN_TEST(test_no_room_no_message);
+  return UNITY_END();
+}
@@ -0,0 +1,247 @@
+// Printer link calibration against a model of the EM5820 on the UART mock,
+// and the speed the throughput model picks for each baud rate.
+#include <unity.h>
+#include <EEPROM.h>
+#include <EscPos.h>
+#include <PrintJob.h>
+#include <PrinterProfile.h>
+
+using namespace EscPos;
+
+// The printer end of the UART. It only understands bytes sent at its own
+// rate, answers DLE EOT 1 there, switches with ESC ## SBDR n and burns every
+// line once its last byte is in, at the paper speed of its STSP setting,
+// one line after the other (the receive buffer holds the rest).
+class PrinterModel : public HardwareSerial {
+  public:
+    uint32_t rate = 9600;                           // what the printer listens at
+    uint32_t maxRate = 115200;                      // above this its answers arrive garbled
+    uint32_t sbdr[BAUD_RATE_COUNT] = {9600, 19200, 38400, 57600, 115200}; // its idea of the SBDR table
+    bool silent = false;                            // TX not wired
+    uint8_t speed = PRINT_SPEED_DEFAULT;
+    uint8_t heat = 0;
+    uint64_t burnDone = 0;                          // micros() the last line leaves the head
+    uint32_t starved = 0;                           // lines the head had to wait for
+
+    void reset() {
+      clear();
+      burnDone = 0;
+      starved = 0;
+      window.clear();
+      skip = 0;
+    }
+
+  protected:
+    void onByte(uint8_t c) override {
+      if (baud() != rate) return;                                           // noise at the printer's end
+      uint64_t arrived = micros() + (uint64_t)(128 - availableForWrite()) * 10000000 / baud();
+      if (skip > 0) {                                                       // raster data
+        if (--skip == 0) burn(arrived, rows);
+        return;
+      }
+      window.push_back(c);
+      if (window.size() > 8) window.erase(window.begin());
+      if (c == '\n') burn(arrived, PRINTJOB_LINE_DOTS);
+      if (ends(STATUS_PRINTER, sizeof(STATUS_PRINTER), 0) && !silent) received.push_back(rate > maxRate ? 0x00 : 0x12);
+      if (ends(SET_BAUD, sizeof(SET_BAUD), 1) && c < BAUD_RATE_COUNT) rate = sbdr[c];
+      if (ends(SET_SPEED, sizeof(SET_SPEED), 1)) speed = c;
+      if (ends(SET_HEAT, sizeof(SET_HEAT), 1)) heat = c;
+      if (window.size() == 8 && window[0] == GS && window[1] == 'v' && window[2] == '0') {
+        rows = window[6] | window[7] << 8;
+        skip = (window[4] | window[5] << 8) * rows;
+        window.clear();
+      }
+    }
+
+  private:
+    std::vector<uint8_t> window;                    // last bytes, for recognising commands
+    uint32_t skip = 0;
+    uint16_t rows = 0;
+
+    bool ends(const uint8_t *command, size_t length, size_t parameters) const {
+      if (window.size() < length + parameters) return false;
+      return memcmp(&window[window.size() - length - parameters], command, length) == 0;
+    }
+
+    void burn(uint64_t arrived, uint32_t dots) {
+      if (arrived > burnDone) {
+        if (burnDone > 0) starved++;
+        burnDone = arrived;
+      }
+      burnDone += (uint64_t)dots * 1000000 / paperDotsPerSecond(speed);
+    }
+};
+
+static PrinterModel model;
+static ThermalPrinter printer(model);
+static PrinterCalibration calibration(printer);
+static const PrinterProfile defaults = {9600, 10, 3};
+
+void setUp() {
+  nativeResetClock();
+  model = PrinterModel();
+  printer.begin(9600);
+  EEPROM.erase();
+}
+
+void tearDown() {}
+
+// Runs the calibration like the scheduler would, checking no step hides a long wait
+static void calibrate(uint32_t mixBytes, uint32_t mixDots) {
+  calibration.start(defaults, mixBytes, mixDots);
+  for (int steps = 0; calibration.running(); steps++) {
+    TEST_ASSERT_LESS_THAN(40, steps);
+    uint32_t before = millis();
+    uint32_t wait = calibration.step();
+    TEST_ASSERT_LESS_OR_EQUAL(CALIBRATION_PROBES * CALIBRATION_PROBE_MS + 5, millis() - before);
+    delay(wait);
+  }
+  TEST_ASSERT_TRUE(calibration.finished());
+}
+
+void test_speed_follows_the_link() {
+  // Text, about one byte per dot row: every rate feeds the fastest speed
+  for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++) TEST_ASSERT_EQUAL(9, profileForBaud(BAUD_RATES[i], 34, 30, 10, 3).speed);
+  // Full-width rasters: no rate keeps up, the configured speed stays
+  for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++) TEST_ASSERT_EQUAL(3, profileForBaud(BAUD_RATES[i], 48, 1, 10, 3).speed);
+  // The assumed mix before anything printed: faster from 38400 up
+  uint8_t expected[] = {3, 3, 9, 9, 9};
+  for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++) {
+    PrinterProfile p = profileForBaud(BAUD_RATES[i], 0, 0, 10, 3);
+    TEST_ASSERT_EQUAL(expected[i], p.speed);
+    uint32_t link = linkDotLinesPerSecond(BAUD_RATES[i], PROFILE_MIX_BYTES, PROFILE_MIX_DOTS);
+    if (p.speed > 3) TEST_ASSERT_LESS_OR_EQUAL(link, paperDotsPerSecond(p.speed));
+    if (p.speed < 9) TEST_ASSERT_GREATER_THAN(link, paperDotsPerSecond(p.speed + 1));
+  }
+  // Heat follows the speed, one step per two, at most 15
+  TEST_ASSERT_EQUAL(13, profileForBaud(115200, 0, 0, 10, 3).heat);
+  TEST_ASSERT_EQUAL(10, profileForBaud(9600, 0, 0, 10, 3).heat);
+  TEST_ASSERT_EQUAL(15, profileForBaud(115200, 0, 0, 15, 3).heat);
+}
+
+void test_paper_speed_table() {
+  TEST_ASSERT_EQUAL(320, paperDotsPerSecond(0));
+  TEST_ASSERT_EQUAL(480, paperDotsPerSecond(3));
+  TEST_ASSERT_EQUAL(800, paperDotsPerSecond(9));
+  TEST_ASSERT_EQUAL(800, paperDotsPerSecond(12));
+}
+
+void test_estimate_uses_printer_speed() {
+  PrintJob job(printer, 0);
+  printer.setSpeed(3);
+  job.begin();
+  for (int i = 0; i < 16; i++) job.line("0123456789012345678901234567890");
+  job.end();
+  uint32_t slow = job.cost().ms;
+  TEST_ASSERT_EQUAL(16 * PRINTJOB_LINE_DOTS * 1000 / 480, slow);            // text at 9600 is paper bound
+  printer.setSpeed(9);
+  job.begin();
+  for (int i = 0; i < 16; i++) job.line("0123456789012345678901234567890");
+  job.end();
+  TEST_ASSERT_LESS_THAN(slow, job.cost().ms);
+  TEST_ASSERT_EQUAL(2 * job.cost().bytes, job.sentBytes());
+  TEST_ASSERT_EQUAL(2 * 16 * PRINTJOB_LINE_DOTS, job.paperDots());
+}
+
+void test_calibration_finds_fastest_stable_rate() {
+  model.maxRate = 57600;
+  calibrate(0, 0);
+  TEST_ASSERT_TRUE(calibration.succeeded());
+  TEST_ASSERT_EQUAL(57600, printer.baud());
+  TEST_ASSERT_EQUAL(57600, model.rate);                                     // asked back after 115200 failed
+  TEST_ASSERT_TRUE(printer.isOnline());
+  TEST_ASSERT_EQUAL(57600, calibration.result().baud);
+  TEST_ASSERT_EQUAL(9, model.speed);                                        // applied
+  TEST_ASSERT_EQUAL(calibration.result().heat, model.heat);
+
+  // Stored for the next boot
+  PrinterProfile loaded = calibration.load(defaults);
+  TEST_ASSERT_EQUAL(57600, loaded.baud);
+  TEST_ASSERT_EQUAL(9, loaded.speed);
+}
+
+void test_calibration_sends_sbdr_indices() {
+  calibrate(0, 0);
+  TEST_ASSERT_EQUAL(115200, printer.baud());
+  // ESC ## SBDR 1, 2, 3, 4 in that order, nothing else
+  std::vector<uint8_t> parameters;
+  for (size_t i = 0; i + sizeof(SET_BAUD) < model.sent.size(); i++) {
+    if (memcmp(&model.sent[i], SET_BAUD, sizeof(SET_BAUD)) == 0) parameters.push_back(model.sent[i + sizeof(SET_BAUD)]);
+  }
+  TEST_ASSERT_EQUAL(4, parameters.size());
+  for (uint8_t n = 0; n < 4; n++) TEST_ASSERT_EQUAL(n + 1, parameters[n]);
+}
+
+void test_calibration_finds_printer_after_wrong_switch() {
+  // A printer whose table differs: SBDR 2 puts it at 57600, not 38400
+  model.sbdr[2] = 57600;
+  model.maxRate = 57600;
+  calibrate(0, 0);
+  TEST_ASSERT_TRUE(calibration.succeeded());
+  TEST_ASSERT_EQUAL(19200, printer.baud());                                 // found at 57600, asked back to the last good rate
+  TEST_ASSERT_EQUAL(19200, model.rate);
+  TEST_ASSERT_TRUE(printer.isOnline());
+}
+
+void test_silent_printer_keeps_profile() {
+  model.silent = true;
+  calibrate(0, 0);
+  TEST_ASSERT_FALSE(calibration.succeeded());
+  TEST_ASSERT_EQUAL(9600, printer.baud());
+  TEST_ASSERT_EQUAL(0, EEPROM.commits);
+  TEST_ASSERT_EQUAL(9600, calibration.load(defaults).baud);                // nothing stored, defaults
+  TEST_ASSERT_LESS_THAN(500, millis());                                     // gave up after one round of probes
+}
+
+// Prints the same receipt mix at a rate and speed on the modelled wire, returns when the paper stops
+static uint64_t printMix(uint32_t baud, uint8_t speed, uint32_t &starved) {
+  static uint8_t raster[48 * 24];
+  for (size_t i = 0; i < sizeof(raster); i++) raster[i] = i * 37;
+  printer.begin(baud);
+  model.rate = baud;
+  model.modelWire(true);
+  printer.setSpeed(speed);
+  model.reset();
+  uint64_t start = micros();
+  for (int receipt = 0; receipt < 4; receipt++) {
+    printer.printBitmap(384, 24, raster);
+    for (int i = 0; i < 20; i++) printer.println("milk eggs bread and a plumber");
+  }
+  printer.drain();
+  model.flush();
+  model.modelWire(false);
+  starved = model.starved;
+  return model.burnDone - start;
+}
+
+void test_adapted_speed_is_never_slower() {
+  printer.setRasterCompression(false);
+  uint32_t mixBytes = 0, mixDots = 0, starved;
+  printMix(9600, 3, starved);                                               // measure the mix as PrintJob would
+  mixBytes = model.written;
+  mixDots = 4 * (24 + 20 * PRINTJOB_LINE_DOTS);
+  for (uint8_t i = 0; i < BAUD_RATE_COUNT; i++) {
+    uint32_t baud = BAUD_RATES[i];
+    PrinterProfile adapted = profileForBaud(baud, mixBytes, mixDots, 10, 3);
+    uint32_t starvedBase, starvedAdapted;
+    uint64_t base = printMix(baud, 3, starvedBase);
+    uint64_t fast = printMix(baud, adapted.speed, starvedAdapted);
+    printf("%6lu baud: speed 3 %7.2f s, speed %u %7.2f s\n", (unsigned long)baud, base / 1e6, adapted.speed, fast / 1e6);
+    TEST_ASSERT_LESS_OR_EQUAL(base + base / 50, fast);                      // within the wire model's jitter
+    if (adapted.speed > 3) TEST_ASSERT_LESS_THAN(base, fast);
+  }
+  printer.setRasterCompression(true);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_speed_follows_the_link);
+  RUN_TEST(test_paper_speed_table);
+  RUN_TEST(test_estimate_uses_printer_speed);
+  RUN_TEST(test_calibration_finds_fastest_stable_rate);
+  RUN_TEST(test_calibration_sends_sbdr_indices);
+  RUN_TEST(test_calibration_finds_printer_after_wrong_switch);
+  RUN_TEST(test_silent_printer_keeps_profile);
+  RUN_TEST(test_adapted_speed_is_never_slower);
+  return UNITY_END();
+}
@@ -0,0 +1,155 @@
+// printBitmap() compression against a host decoder: the bytes sent, played
+// back the way the printer does (GS v 0 blocks, ESC J feeds, GS L margins),
+// must put exactly the original dots on the paper.
+#include <unity.h>
+#include <EscPos.h>
+#include <ThermalPrinter.h>
+#include <vector>
+
+using namespace EscPos;
+
+#define PAPER_BYTES 48                                                      // 384 dots
+
+static HardwareSerial serial;
+static ThermalPrinter printer(serial);
+
+void setUp() {
+  serial.clear();
+  serial.recording = true;
+  printer.setRasterCompression(true);
+}
+
+void tearDown() {}
+
+// The printer's side: paper as rows of 48 bytes. Returns false on anything it
+// would not understand or a block that leaves the paper.
+static bool decode(const std::vector<uint8_t> &bytes, std::vector<uint8_t> &paper, uint32_t &rows) {
+  paper.clear();
+  rows = 0;
+  uint16_t margin = 0;                                                      // dots
+  size_t i = 0;
+  while (i < bytes.size()) {
+    if (bytes.size() - i >= 4 && bytes[i] == GS && bytes[i + 1] == 'L') {
+      margin = bytes[i + 2] | bytes[i + 3] << 8;
+      if (margin % 8 != 0) return false;                                    // the driver only trims whole bytes
+      i += 4;
+    } else if (bytes.size() - i >= 3 && bytes[i] == ESC && bytes[i + 1] == 'J') {
+      rows += bytes[i + 2];
+      i += 3;
+    } else if (bytes.size() - i >= 8 && memcmp(&bytes[i], RASTER, sizeof(RASTER)) == 0) {
+      uint16_t widthBytes = bytes[i + 4] | bytes[i + 5] << 8;
+      uint16_t height = bytes[i + 6] | bytes[i + 7] << 8;
+      i += 8;
+      if (margin / 8 + widthBytes > PAPER_BYTES || bytes.size() - i < (size_t)widthBytes * height) return false;
+      paper.resize((size_t)(rows + height) * PAPER_BYTES, 0);
+      for (uint16_t y = 0; y < height; y++) {
+        memcpy(&paper[(size_t)(rows + y) * PAPER_BYTES + margin / 8], &bytes[i], widthBytes);
+        i += widthBytes;
+      }
+      rows += height;
+    } else {
+      return false;
+    }
+  }
+  paper.resize((size_t)rows * PAPER_BYTES, 0);
+  return margin == 0;                                                       // left as it was found
+}
+
+static uint32_t seed;
+
+static uint32_t random(uint32_t n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+// Blobs of ink on white: logos, QR codes and text lines look like this
+static std::vector<uint8_t> randomImage(uint16_t width, uint16_t height) {
+  uint16_t widthBytes = (width + 7) / 8;
+  std::vector<uint8_t> image((size_t)widthBytes * height, 0);
+  uint32_t blobs = random(12);
+  for (uint32_t b = 0; b < blobs; b++) {
+    uint16_t x0 = random(width), y0 = random(height);
+    uint16_t w = 1 + random(width - x0), h = 1 + random(height - y0 < 40 ? height - y0 : 40);
+    for (uint16_t y = y0; y < y0 + h; y++) {
+      for (uint16_t x = x0; x < x0 + w; x++) {
+        if (random(3) > 0) image[(size_t)y * widthBytes + x / 8] |= 0x80 >> (x % 8);
+      }
+    }
+  }
+  return image;
+}
+
+static void checkRoundTrip(uint16_t width, uint16_t height, const std::vector<uint8_t> &image) {
+  uint16_t widthBytes = (width + 7) / 8;
+  serial.clear();
+  uint32_t savedBefore = printer.totalStats().rasterSaved;
+  printer.printBitmap(width, height, image.data());
+  printer.drain();
+
+  std::vector<uint8_t> paper;
+  uint32_t rows;
+  TEST_ASSERT_TRUE(decode(serial.sent, paper, rows));
+  TEST_ASSERT_EQUAL(height, rows);                                          // white rows at the end are fed too
+  for (uint16_t y = 0; y < height; y++) {
+    TEST_ASSERT_EQUAL_MEMORY(&image[(size_t)y * widthBytes], &paper[(size_t)y * PAPER_BYTES], widthBytes);
+    for (uint16_t x = widthBytes; x < PAPER_BYTES; x++) TEST_ASSERT_EQUAL(0, paper[(size_t)y * PAPER_BYTES + x]);
+  }
+
+  // Never worse than the plain GS v 0 by more than one block, and the saving is counted
+  uint32_t plain = 8 + (uint32_t)widthBytes * height;
+  TEST_ASSERT_LESS_OR_EQUAL(plain + RASTER_BLOCK_COST, serial.sent.size());
+  uint32_t saved = printer.totalStats().rasterSaved - savedBefore;
+  TEST_ASSERT_EQUAL(plain > serial.sent.size() ? plain - serial.sent.size() : 0, saved);
+}
+
+void test_random_images_decode_to_the_original() {
+  seed = 11;
+  for (int n = 0; n < 400; n++) {
+    uint16_t width = 1 + random(384);
+    uint16_t height = 1 + random(n % 10 == 0 ? 600 : 120);                  // some past the 255 dot ESC J limit
+    checkRoundTrip(width, height, randomImage(width, height));
+  }
+}
+
+void test_edge_cases() {
+  std::vector<uint8_t> white(48 * 300, 0);
+  checkRoundTrip(384, 300, white);                                          // only feeds
+  std::vector<uint8_t> black(48 * 24, 0xFF);
+  checkRoundTrip(384, 24, black);                                           // one untrimmed block
+  std::vector<uint8_t> corner(48 * 24, 0);
+  corner[48 * 23 + 47] = 0x01;                                              // a single dot, last row, last column
+  checkRoundTrip(384, 24, corner);
+  std::vector<uint8_t> dots(1 * 9, 0);
+  dots[0] = dots[8] = 0x80;                                                 // narrow, white in between
+  checkRoundTrip(1, 9, dots);
+}
+
+void test_sparse_image_is_smaller() {
+  // A small logo in the middle of a wide white area
+  std::vector<uint8_t> image(48 * 200, 0);
+  for (int y = 80; y < 120; y++) for (int x = 20; x < 28; x++) image[y * 48 + x] = 0xAA;
+  checkRoundTrip(384, 200, image);
+  TEST_ASSERT_LESS_THAN(48 * 200 / 10, serial.sent.size());
+}
+
+void test_uncompressed_matches_plain_gs_v_0() {
+  seed = 5;
+  std::vector<uint8_t> image = randomImage(200, 50);
+  printer.setRasterCompression(false);
+  serial.clear();
+  printer.printBitmap(200, 50, image.data());
+  printer.drain();
+  TEST_ASSERT_EQUAL(8 + 25 * 50, serial.sent.size());
+  uint8_t header[] = {GS, 'v', '0', 0, 25, 0, 50, 0};
+  TEST_ASSERT_EQUAL_MEMORY(header, serial.sent.data(), sizeof(header));
+  TEST_ASSERT_EQUAL_MEMORY(image.data(), serial.sent.data() + 8, image.size());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_random_images_decode_to_the_original);
+  RUN_TEST(test_edge_cases);
+  RUN_TEST(test_sparse_image_is_smaller);
+  RUN_TEST(test_uncompressed_matches_plain_gs_v_0);
+  return UNITY_END();
+}
@@ -0,0 +1,163 @@
+// Print queue: nothing lost or duplicated under interleaved submits, fair order
+#include <unity.h>
+#include <ReceiptQueue.h>
+#include <vector>
+
+static ReceiptQueue *queue;
+
+void setUp() {
+  queue = new ReceiptQueue();
+}
+
+void tearDown() {
+  delete queue;
+}
+
+static Receipt receipt(uint32_t id, uint32_t client, uint8_t flags = 0) {
+  Receipt r;
+  memset(&r, 0, sizeof(r));
+  r.id = id;
+  r.client = client;
+  r.flags = flags;
+  snprintf(r.message, sizeof(r.message), "receipt %u", (unsigned)id);
+  return r;
+}
+
+static uint32_t printNext() {
+  Receipt *front = queue->front();
+  if (front == nullptr) return 0;
+  queue->advance();
+  uint32_t id = front->id;
+  queue->pop();
+  return id;
+}
+
+void test_front_changes_nothing() {
+  queue->push(receipt(1, 10));
+  queue->push(receipt(2, 10));
+  Receipt *first = queue->front();
+  TEST_ASSERT_EQUAL_PTR(first, queue->front());
+  TEST_ASSERT_EQUAL_PTR(first, queue->front());
+
+  // Without advance() the front has not started: another client's first receipt still gets its turn before 2
+  queue->push(receipt(3, 20));
+  TEST_ASSERT_EQUAL(1, printNext());
+  TEST_ASSERT_EQUAL(3, printNext());
+  TEST_ASSERT_EQUAL(2, printNext());
+}
+
+void test_advance_keeps_printing_receipt_in_front() {
+  queue->push(receipt(1, 10));
+  queue->push(receipt(2, 10));
+  queue->push(receipt(3, 10));
+  TEST_ASSERT_EQUAL(1, printNext());
+
+  // 2 starts printing (a long message spans several passes), 4 arrives meanwhile
+  queue->advance();
+  queue->push(receipt(4, 20));
+  TEST_ASSERT_EQUAL(2, queue->front()->id);
+  queue->pop();
+  TEST_ASSERT_EQUAL(4, printNext());
+  TEST_ASSERT_EQUAL(3, printNext());
+}
+
+void test_round_robin() {
+  for (uint32_t id = 1; id <= 4; id++) queue->push(receipt(id, 10));
+  queue->push(receipt(5, 20));
+  queue->push(receipt(6, 30));
+  uint32_t expected[] = {1, 5, 6, 2, 3, 4};
+  for (uint32_t id : expected) TEST_ASSERT_EQUAL(id, printNext());
+  TEST_ASSERT_NULL(queue->front());
+}
+
+void test_full_queue_rejects() {
+  for (uint32_t id = 1; id <= RECEIPT_QUEUE_SLOTS; id++) TEST_ASSERT_NOT_NULL(queue->push(receipt(id, id)));
+  TEST_ASSERT_TRUE(queue->isFull());
+  TEST_ASSERT_NULL(queue->push(receipt(99, 1)));
+  TEST_ASSERT_EQUAL(1, queue->rejected());
+  TEST_ASSERT_EQUAL(RECEIPT_QUEUE_SLOTS, queue->size());
+}
+
+void test_concurrent_submits_all_print() {
+  // N submits from several clients arrive interleaved with printing. A submit
+  // that finds the queue full gets a 503 and its client sends it again later,
+  // like the web page does. Every receipt must come out exactly once, each
+  // client's in the order it sent them, batches in one piece.
+  const uint32_t N = 2000;
+  const uint32_t CLIENTS = 7;
+  std::vector<std::vector<uint32_t>> waiting(CLIENTS);                      // ids each client still has to get accepted
+  for (uint32_t id = 1; id <= N; id++) waiting[(id * 2654435761UL >> 7) % CLIENTS].push_back(id);
+  std::vector<size_t> next(CLIENTS, 0);
+  std::vector<uint32_t> printed;
+  std::vector<int> times(N + 1, 0);
+  uint32_t refused = 0;
+  uint32_t seed = 12345;
+  uint8_t batchLeft = 0;
+  uint32_t batchClient = 0;
+
+  while (printed.size() < N) {
+    seed = seed * 1103515245 + 12345;
+    uint32_t action = (seed >> 16) % 10;
+    if (action < 6 || batchLeft > 0) {
+      uint32_t client = batchLeft > 0 ? batchClient : (seed >> 8) % CLIENTS;
+      if (next[client] == waiting[client].size()) continue;
+      uint32_t id = waiting[client][next[client]];
+      bool startBatch = batchLeft == 0 && (seed >> 4) % 8 == 0 && waiting[client].size() - next[client] >= 3;
+      if (startBatch) {
+        if (RECEIPT_QUEUE_SLOTS - queue->size() < 3) continue;              // a batch is checked for room as a whole first
+        batchLeft = 3;
+        batchClient = client;
+      }
+      uint8_t flags = batchLeft > 1 ? RECEIPT_BATCH_MORE : 0;
+      if (queue->push(receipt(id, client + 1, flags)) == nullptr) {
+        refused++;                                                          // 503 + Retry-After, sent again later
+        TEST_ASSERT_EQUAL(0, batchLeft);
+        continue;
+      }
+      next[client]++;
+      if (batchLeft > 0) batchLeft--;
+    } else {
+      uint32_t id = printNext();
+      if (id == 0) continue;
+      printed.push_back(id);
+      times[id]++;
+    }
+  }
+
+  TEST_ASSERT_EQUAL(N, printed.size());
+  for (uint32_t id = 1; id <= N; id++) TEST_ASSERT_EQUAL_MESSAGE(1, times[id], "printed once");
+  TEST_ASSERT_EQUAL(N, queue->enqueued());
+  TEST_ASSERT_EQUAL(N, queue->dequeued());
+  TEST_ASSERT_EQUAL(refused, queue->rejected());
+  TEST_ASSERT_GREATER_THAN(0, refused);                                     // the test did fill the queue
+
+  // Per client, receipts print in the order they were accepted
+  for (uint32_t client = 0; client < CLIENTS; client++) {
+    size_t at = 0;
+    for (uint32_t id : printed) {
+      if (at < waiting[client].size() && id == waiting[client][at]) at++;
+    }
+    TEST_ASSERT_EQUAL(waiting[client].size(), at);
+  }
+}
+
+void test_batch_stays_together() {
+  queue->push(receipt(1, 10));
+  queue->push(receipt(2, 20, RECEIPT_BATCH_MORE));
+  queue->push(receipt(3, 20, RECEIPT_BATCH_MORE));
+  queue->push(receipt(4, 20));
+  queue->push(receipt(5, 10));
+  uint32_t expected[] = {1, 2, 3, 4, 5};
+  for (uint32_t id : expected) TEST_ASSERT_EQUAL(id, printNext());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_front_changes_nothing);
+  RUN_TEST(test_advance_keeps_printing_receipt_in_front);
+  RUN_TEST(test_round_robin);
+  RUN_TEST(test_full_queue_rejects);
+  RUN_TEST(test_concurrent_submits_all_print);
+  RUN_TEST(test_batch_stays_together);
+  return UNITY_END();
+}
@@ -0,0 +1,152 @@
+// Soak: thousands of receipts through the whole path on the stubs, from the
+// form fields to printer bytes (admission, transcoding, journal, RAM queue,
+// print job), must leave the heap as they found it: not one allocation per
+// receipt, and a largest free block that never shrinks.
+#include <unity.h>
+#include <Bench.h>
+#include <LittleFS.h>
+#include <Spool.h>
+#include <PrintJob.h>
+#include <Transcoder.h>
+#include <TimeFormat.h>
+#include <Admission.h>
+#include <Metrics.h>
+
+#define ROUNDS 1500                   // rounds of 1 to 12 receipts, about 10000 in all
+#define WARM_UP 100                   // rounds before the heap is measured
+#define WIDTH 32
+#define SENDERS 6
+
+static HardwareSerial serial;
+static ThermalPrinter printer(serial);
+static PrintJob job(printer, 0);
+static ReceiptSpool spool;
+static ReceiptQueue queue;
+static IdempotencyCache recentSubmissions;
+static ClientBuckets clientBuckets;
+static Metrics metrics;
+static Receipt form;                                                        // the connection's receipt the fields stream into
+static uint32_t submitted, printed;
+static char *volatile kept;                                                 // a pointer the compiler cannot pair away
+
+void setUp() {
+  nativeResetClock();
+  LittleFS.format();
+  serial.recording = false;                                                 // only count, a soak sends megabytes
+  printer.begin(9600);
+}
+
+void tearDown() {
+}
+
+// What endSubmit() does once the fields are in
+static void submitOne() {
+  static const char *words[] = {"milk", "eggs", "Caf\xc3\xa9", "cr\xc3\xa8me", "call", "the", "plumber", "\n"};
+  uint32_t n = submitted;
+  size_t length = snprintf(form.message, sizeof(form.message), "Soak %lu:", (unsigned long)n);
+  for (uint32_t i = 0; i < n % 60; i++) {
+    length += snprintf(form.message + length, sizeof(form.message) - length, " %s", words[(n + i) % 8]);
+  }
+  form.client = 0x0A000000 + n % SENDERS;
+
+  uint32_t lifetimeMs, firstId;
+  uint16_t count;
+  uint32_t content = admissionHash(ADMISSION_HASH_SEED, form.message, length);
+  uint32_t key = admissionKey("", form.client, "/submit", content, lifetimeMs);
+  TEST_ASSERT_FALSE(recentSubmissions.find(key, firstId, count));
+  TEST_ASSERT_EQUAL(0, clientBuckets.retryAfter(form.client, 1));
+
+  form.codePage = Transcoder::bestCodePage(form.message, length, 0);
+  Transcoder::transcode(form.message, length, form.codePage);
+  formatDateHeader(form.timestamp, 1749300000UL + millis() / 1000);
+  form.flags = 0;
+  form.id = spool.nextId();
+  TEST_ASSERT_TRUE(spool.accept(form, queue));
+  clientBuckets.charge(form.client, 1);
+  recentSubmissions.remember(key, form.id, 1, lifetimeMs);
+  metrics.enqueued(form.id, spool.pending());
+  submitted++;
+}
+
+// What printTask() and printReceipt() do for a plain receipt
+static void printOne() {
+  spool.refill(queue);
+  Receipt *receipt = queue.front();
+  TEST_ASSERT_NOT_NULL(receipt);
+  queue.advance();
+  metrics.printing(receipt->id);
+
+  printer.beginJob();
+  job.begin();
+  job.style(STYLE_CODEPAGE, receipt->codePage);
+  job.wrappedUpsideDown(receipt->message, strlen(receipt->message), WIDTH);
+  job.style(STYLE_CODEPAGE, 0);
+  job.line(job.format("#%lu", (unsigned long)receipt->id));
+  job.inverted(receipt->timestamp);
+  job.feed(5);
+  job.end();
+  printer.endJob();
+  printer.drain();
+
+  spool.commit(receipt->id);
+  queue.pop();
+  printed++;
+}
+
+// A burst of 1 to 12 receipts (past the RAM queue, so some spill to flash), then the printer catches up
+static void round(uint32_t r) {
+  uint32_t burst = 1 + r * 7 % 12;
+  for (uint32_t i = 0; i < burst; i++) submitOne();
+  for (uint32_t i = 0; i < burst; i++) {
+    printOne();
+    delay(SPOOL_FLUSH_MS);
+    spool.tick();
+  }
+  delay(2 * CLIENT_REFILL_MS);                                              // each sender stays inside its rate
+}
+
+void test_heap_model_sees_a_leak() {
+  // The check below is only worth something if a leak shows
+  uint32_t free = ESP.getFreeHeap(), largest = ESP.getMaxFreeBlockSize();
+  kept = new char[1000];
+  TEST_ASSERT_LESS_OR_EQUAL(free - 1000, ESP.getFreeHeap());
+  TEST_ASSERT_LESS_THAN(largest, ESP.getMaxFreeBlockSize());
+  delete[] kept;
+  TEST_ASSERT_EQUAL(free, ESP.getFreeHeap());
+  TEST_ASSERT_EQUAL(largest, ESP.getMaxFreeBlockSize());
+}
+
+void test_soak_leaves_the_heap_alone() {
+  TEST_ASSERT_TRUE(spool.begin(queue));
+  for (uint32_t r = 0; r < WARM_UP; r++) round(r);                          // the journal grows to its first compaction
+  TEST_ASSERT_GREATER_THAN(0, spool.compactions());
+
+  uint64_t allocations = benchAllocations();
+  uint32_t compactions = spool.compactions();
+  uint32_t largest = ESP.getMaxFreeBlockSize();
+  uint32_t sent = serial.written;
+  uint32_t start = submitted;
+  for (uint32_t r = WARM_UP; r < ROUNDS; r++) {
+    round(r);
+    TEST_ASSERT_GREATER_OR_EQUAL(largest, ESP.getMaxFreeBlockSize());
+  }
+  printf("%lu receipts, %lu bytes to the printer, %lu compactions, %llu allocations, largest free block %lu B\n",
+         (unsigned long)(submitted - start), (unsigned long)(serial.written - sent),
+         (unsigned long)(spool.compactions() - compactions),
+         (unsigned long long)(benchAllocations() - allocations), (unsigned long)ESP.getMaxFreeBlockSize());
+
+  TEST_ASSERT_EQUAL(0, benchAllocations() - allocations);
+  TEST_ASSERT_EQUAL(largest, ESP.getMaxFreeBlockSize());
+  TEST_ASSERT_EQUAL(submitted, printed);
+  TEST_ASSERT_GREATER_THAN(5000, submitted - start);
+  TEST_ASSERT_GREATER_THAN(10, spool.compactions() - compactions);          // the journal was rewritten over and over
+  TEST_ASSERT_EQUAL(0, spool.pending());
+  TEST_ASSERT_EQUAL(0, queue.rejected());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_heap_model_sees_a_leak);
+  RUN_TEST(test_soak_leaves_the_heap_alone);
+  return UNITY_END();
+}
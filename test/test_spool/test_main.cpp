@@ -0,0 +1,422 @@
+// Receipt journal on the in-memory LittleFS: replay after power cuts at any
+// moment, sustained load far past one journal's id range, and a full flash.
+#include <unity.h>
+#include <LittleFS.h>
+#include <Spool.h>
+#include <algorithm>
+#include <set>
+#include <vector>
+
+static ReceiptSpool *spool;
+static ReceiptQueue *queue;
+static uint32_t seed;
+
+static uint32_t random(uint32_t n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+static void boot() {
+  delete spool;
+  delete queue;
+  spool = new ReceiptSpool();
+  queue = new ReceiptQueue();
+  TEST_ASSERT_TRUE(spool->begin(*queue));
+}
+
+static void powerCut() {
+  LittleFS.powerCut();
+  boot();
+}
+
+void setUp() {
+  nativeResetClock();
+  LittleFS.format();
+  spool = nullptr;
+  queue = nullptr;
+  boot();
+}
+
+void tearDown() {
+  delete spool;
+  delete queue;
+}
+
+static Receipt receipt(uint32_t id, uint8_t flags = 0, uint32_t client = 0) {
+  static Receipt r;
+  memset(&r, 0, sizeof(r));
+  r.id = id;
+  r.flags = flags;
+  r.client = client;
+  int length = snprintf(r.message, sizeof(r.message), "receipt %u ", (unsigned)id);
+  size_t padding = random(200);
+  for (size_t i = 0; i < padding; i++) r.message[length + i] = 'a' + (id + i) % 26;
+  strcpy(r.timestamp, "Sat, 06 Jun 2025");
+  return r;
+}
+
+static bool submit(uint32_t client = 0) {
+  uint32_t id = spool->nextId();
+  return spool->accept(receipt(id, 0, client), *queue);
+}
+
+static bool submitBatch(uint16_t count, std::vector<uint32_t> *ids = nullptr, uint32_t client = 0) {
+  if (!spool->reserve(count, count * 220, *queue)) return false;           // receipt() writes at most 220 bytes
+  for (uint16_t i = 0; i < count; i++) {
+    uint32_t id = spool->nextId();
+    TEST_ASSERT_TRUE(spool->accept(receipt(id, i + 1 < count ? RECEIPT_BATCH_MORE : 0, client), *queue));
+    if (ids) ids->push_back(id);
+  }
+  return true;
+}
+
+#define NOTHING 0xFFFFFFFFUL
+#define ALICE 0x0A000001
+#define BOB 0x0A000002
+#define CAROL 0x0A000003
+
+static uint32_t clientOf[4096];                                             // by id, the sender a receipt came back with
+
+// Prints the next receipt like printTask, NOTHING when nothing is waiting
+static uint32_t printOne() {
+  spool->refill(*queue);
+  Receipt *front = queue->front();
+  if (front == nullptr) return NOTHING;
+  queue->advance();
+  uint32_t id = front->id;
+  char expected[24];
+  snprintf(expected, sizeof(expected), "receipt %u ", (unsigned)id);
+  TEST_ASSERT_EQUAL(0, strncmp(front->message, expected, strlen(expected))); // the record came back intact
+  if (id < 4096) clientOf[id] = front->client;
+  spool->commit(id);
+  queue->pop();
+  return id;
+}
+
+static std::vector<uint32_t> printAll() {
+  std::vector<uint32_t> printed;
+  for (uint32_t id = printOne(); id != NOTHING; id = printOne()) printed.push_back(id);
+  return printed;
+}
+
+static void sync() {
+  delay(SPOOL_FLUSH_MS);
+  spool->tick();
+}
+
+void test_replay_after_power_cut() {
+  seed = 1;
+  for (int i = 0; i < 20; i++) TEST_ASSERT_TRUE(submit());                  // 8 in RAM, 12 spilled to flash
+  TEST_ASSERT_EQUAL(12, spool->spilled());
+  for (int i = 0; i < 5; i++) TEST_ASSERT_EQUAL(i, printOne());
+  sync();
+  powerCut();
+  TEST_ASSERT_EQUAL(15, spool->pending());
+  std::vector<uint32_t> printed = printAll();
+  TEST_ASSERT_EQUAL(15, printed.size());
+  for (uint32_t i = 0; i < printed.size(); i++) TEST_ASSERT_EQUAL(5 + i, printed[i]);
+  TEST_ASSERT_EQUAL(20, spool->nextId());                                   // ids go on where they were
+}
+
+void test_unsynced_records_are_lost_whole() {
+  seed = 2;
+  for (int i = 0; i < 5; i++) submit();
+  sync();
+  for (int i = 0; i < 3; i++) submit();                                     // still in the RAM buffer
+  printOne();
+  powerCut();
+  std::vector<uint32_t> printed = printAll();
+  TEST_ASSERT_EQUAL(5, printed.size());                                     // the 250 ms window, nothing half written
+  TEST_ASSERT_EQUAL(0, printed[0]);                                         // its commit was in the window too
+}
+
+void test_sustained_load_never_rejects() {
+  // Receipts keep arriving while the printer always has a backlog: the
+  // journal never empties, yet it must take many times SPOOL_MAX_JOBS ids
+  seed = 3;
+  const uint32_t TOTAL = 6 * SPOOL_MAX_JOBS;
+  uint32_t accepted = 0, next = 0, steps = 0;
+  size_t largest = 0;
+  while (accepted < TOTAL) {
+    if (random(4) == 0) {
+      TEST_ASSERT_TRUE_MESSAGE(submitBatch(3), "batch refused");
+      accepted += 3;
+    } else {
+      TEST_ASSERT_TRUE_MESSAGE(submit(), "receipt refused");
+      accepted++;
+    }
+    while (spool->pending() > 40) TEST_ASSERT_EQUAL(next++, printOne());  // the printer lags 40 receipts behind
+    if (++steps % 4 == 0) sync();
+    size_t size = LittleFS.fileSize(SPOOL_PATH);
+    if (size > largest) largest = size;
+    TEST_ASSERT_GREATER_THAN(0, spool->pending());
+  }
+  TEST_ASSERT_GREATER_THAN(5, spool->compactions());
+  TEST_ASSERT_LESS_THAN(SPOOL_COMPACT_BYTES + SPOOL_WRITE_BUFFER * 2, largest);
+
+  // And what is left survives a power cut in the middle of it
+  sync();
+  powerCut();
+  std::vector<uint32_t> rest = printAll();
+  for (uint32_t id : rest) TEST_ASSERT_EQUAL(next++, id);
+  TEST_ASSERT_EQUAL(accepted, next);
+}
+
+void test_random_power_cuts() {
+  seed = 4;
+  std::set<uint32_t> pending;                                               // accepted, not printed
+  std::set<uint32_t> durable;                                               // pending at the last sync
+  std::set<uint32_t> reprint;                                               // printed since, the commit may be lost
+  std::vector<std::vector<uint32_t>> batches;                               // accepted since
+  for (int round = 0; round < 150; round++) {
+    uint32_t steps = random(120);
+    for (uint32_t step = 0; step < steps; step++) {
+      uint32_t action = random(10);
+      if (action < 4) {
+        uint32_t id = spool->nextId();
+        if (spool->accept(receipt(id), *queue)) pending.insert(id);
+      } else if (action < 5) {
+        std::vector<uint32_t> ids;
+        if (submitBatch(2 + random(4), &ids)) {
+          pending.insert(ids.begin(), ids.end());
+          batches.push_back(ids);
+        }
+      } else if (action < 9) {
+        uint32_t id = printOne();
+        if (id != NOTHING) {
+          TEST_ASSERT_EQUAL(1, pending.erase(id));
+          reprint.insert(id);
+        }
+      } else {
+        sync();
+        durable = pending;
+        reprint.clear();
+        batches.clear();
+      }
+    }
+
+    powerCut();
+    std::set<uint32_t> replayed;
+    std::vector<uint32_t> order;
+    for (uint32_t id = printOne(); id != NOTHING; id = printOne()) {
+      TEST_ASSERT_TRUE_MESSAGE(replayed.insert(id).second, "printed twice");
+      order.push_back(id);
+    }
+    for (size_t i = 1; i < order.size(); i++) TEST_ASSERT_LESS_THAN(order[i], order[i - 1]); // journal order
+    for (uint32_t id : replayed) TEST_ASSERT_TRUE_MESSAGE(pending.count(id) || reprint.count(id), "replayed a receipt printed before the last sync");
+    for (uint32_t id : durable) {
+      if (pending.count(id)) TEST_ASSERT_TRUE_MESSAGE(replayed.count(id), "synced receipt lost");
+    }
+    for (auto &batch : batches) {
+      bool back = false, whole = true;
+      for (uint32_t id : batch) {
+        back |= replayed.count(id) > 0;
+        whole &= replayed.count(id) > 0 || !pending.count(id);
+      }
+      TEST_ASSERT_TRUE_MESSAGE(!back || whole, "batch came back in part");
+    }
+    pending.clear();                                                        // all printed now
+    durable.clear();
+    reprint.clear();
+    batches.clear();
+    sync();
+  }
+}
+
+void test_cut_during_compaction() {
+  seed = 5;
+  for (int i = 0; i < 30; i++) submit();
+  for (int i = 0; i < 10; i++) printOne();
+  sync();
+
+  // What a cut between writing the new journal and the rename leaves behind
+  File partial = LittleFS.open(SPOOL_PATH_NEW, "w");
+  partial.write((const uint8_t*)"garbage", 7);
+  partial.close();
+  powerCut();
+  TEST_ASSERT_FALSE(LittleFS.exists(SPOOL_PATH_NEW));
+  std::vector<uint32_t> printed = printAll();
+  TEST_ASSERT_EQUAL(20, printed.size());
+  TEST_ASSERT_EQUAL(10, printed[0]);
+}
+
+void test_compaction_without_room() {
+  // The copy of a large backlog does not fit next to the journal: it stays as it is
+  seed = 6;
+  powerCut();
+  LittleFS.setCapacity(12 * NATIVE_FS_BLOCK);
+  boot();
+  uint32_t next = 0;
+  while (LittleFS.fileSize(SPOOL_PATH) <= SPOOL_COMPACT_BYTES) {
+    TEST_ASSERT_TRUE(submit());
+    if (spool->pending() > 120) TEST_ASSERT_EQUAL(next++, printOne());
+    sync();
+  }
+  TEST_ASSERT_EQUAL(0, spool->compactions());
+  TEST_ASSERT_FALSE(LittleFS.exists(SPOOL_PATH_NEW));
+
+  powerCut();
+  std::vector<uint32_t> printed = printAll();
+  TEST_ASSERT_EQUAL(spool->nextId() - next, printed.size());
+  TEST_ASSERT_EQUAL(next, printed[0]);
+
+  // Once printed the journal shrinks again
+  sync();
+  TEST_ASSERT_TRUE(submit());
+  sync();
+  TEST_ASSERT_EQUAL(1, spool->compactions());
+  TEST_ASSERT_LESS_THAN(1024, LittleFS.fileSize(SPOOL_PATH));
+}
+
+void test_full_flash_turns_receipts_away() {
+  // Journal writes that do not fit stay in RAM: what was accepted still
+  // prints, new receipts are refused once the buffer is full as well
+  seed = 8;
+  powerCut();
+  LittleFS.setCapacity((NATIVE_FS_RESERVED + 3) * NATIVE_FS_BLOCK);         // an 8 KB journal
+  boot();
+  uint32_t accepted = 0;
+  while (submit()) {
+    accepted++;
+    sync();
+    TEST_ASSERT_LESS_THAN(200, accepted);
+  }
+  TEST_ASSERT_GREATER_THAN(RECEIPT_QUEUE_SLOTS, accepted);                  // some of them spilled
+  TEST_ASSERT_FALSE(submitBatch(2));
+  std::vector<uint32_t> printed = printAll();
+  TEST_ASSERT_EQUAL(accepted, printed.size());
+  for (uint32_t i = 0; i < printed.size(); i++) TEST_ASSERT_EQUAL(i, printed[i]);
+
+  // With nothing pending the journal starts over and takes receipts again
+  sync();
+  TEST_ASSERT_TRUE(submit());
+}
+
+void test_full_flash_keeps_the_buffer() {
+  // Records a flush could not write reach flash with the first one that can
+  seed = 9;
+  powerCut();
+  LittleFS.setCapacity((NATIVE_FS_RESERVED + 3) * NATIVE_FS_BLOCK);         // an 8 KB journal
+  boot();
+  uint32_t accepted = 0;
+  while (submit()) accepted++;
+  uint32_t writes = spool->flashWrites();
+  sync();
+  TEST_ASSERT_EQUAL(writes, spool->flashWrites());                          // still full
+  LittleFS.setCapacity(NATIVE_FS_BYTES);
+  sync();
+  TEST_ASSERT_EQUAL(writes + 1, spool->flashWrites());
+  powerCut();
+  std::vector<uint32_t> printed = printAll();
+  TEST_ASSERT_EQUAL(accepted, printed.size());
+  for (uint32_t i = 0; i < printed.size(); i++) TEST_ASSERT_EQUAL(i, printed[i]);
+}
+
+// Every receipt once, each sender's in the order they were sent
+static void checkSenderOrder(const std::vector<uint32_t> &printed, uint32_t total) {
+  TEST_ASSERT_EQUAL(total, printed.size());
+  std::set<uint32_t> seen;
+  uint32_t last[4] = {0, 0, 0, 0};
+  for (uint32_t id : printed) {
+    TEST_ASSERT_TRUE_MESSAGE(seen.insert(id).second, "printed twice");
+    uint32_t &previous = last[clientOf[id] & 3];
+    TEST_ASSERT_TRUE_MESSAGE(previous == 0 || id > previous, "a sender's receipts out of order");
+    previous = id;
+  }
+}
+
+static void senderTurns(bool reboot) {
+  // Alice fills RAM and flash, Bob and Carol send a few each after her
+  for (int i = 0; i < 40; i++) TEST_ASSERT_TRUE(submit(ALICE));
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_TRUE(submit(BOB));
+    TEST_ASSERT_TRUE(submit(CAROL));
+  }
+  TEST_ASSERT_EQUAL(46 - RECEIPT_QUEUE_SLOTS, spool->spilled());
+  if (reboot) {
+    sync();
+    powerCut();
+  }
+  std::vector<uint32_t> printed = printAll();
+  checkSenderOrder(printed, 46);
+
+  // Bob and Carol are through long before Alice's backlog is
+  uint32_t bob = 0, carol = 0;
+  for (size_t i = 0; i < printed.size(); i++) {
+    if (clientOf[printed[i]] == BOB && ++bob == 3) TEST_ASSERT_LESS_THAN(RECEIPT_QUEUE_SLOTS + 6, i);
+    if (clientOf[printed[i]] == CAROL && ++carol == 3) TEST_ASSERT_LESS_THAN(RECEIPT_QUEUE_SLOTS + 6, i);
+  }
+  TEST_ASSERT_EQUAL(3, bob);
+  TEST_ASSERT_EQUAL(3, carol);
+}
+
+void test_senders_take_turns_from_flash() {
+  seed = 10;
+  senderTurns(false);
+}
+
+void test_senders_are_journaled() {
+  // After a power cut the receipts come back with their senders, and the turns hold
+  seed = 11;
+  senderTurns(true);
+}
+
+void test_spilled_batch_stays_together() {
+  // A batch loaded in part goes on before anyone else's receipt is loaded
+  seed = 12;
+  for (int i = 0; i < RECEIPT_QUEUE_SLOTS - 2; i++) TEST_ASSERT_TRUE(submit(ALICE));
+  std::vector<uint32_t> batch;
+  TEST_ASSERT_TRUE(submitBatch(12, &batch, BOB));
+  for (int i = 0; i < 4; i++) TEST_ASSERT_TRUE(submit(CAROL));
+  std::vector<uint32_t> printed = printAll();
+  checkSenderOrder(printed, RECEIPT_QUEUE_SLOTS - 2 + 12 + 4);
+  size_t start = std::find(printed.begin(), printed.end(), batch[0]) - printed.begin();
+  for (size_t i = 0; i < batch.size(); i++) TEST_ASSERT_EQUAL(batch[i], printed[start + i]);
+}
+
+static void touch(const char *path) {
+  File file = LittleFS.open(path, "w");
+  file.write((const uint8_t*)"text", 4);
+  file.close();
+}
+
+void test_orphan_messages_are_swept() {
+  // Long message files of pending receipts stay, those the journal never got or already printed go
+  seed = 7;
+  for (int i = 0; i < 4; i++) submit();
+  printOne();
+  sync();
+  touch("/msg-0.txt");                                                      // printed, its remove() was cut off
+  touch("/msg-0.idx");
+  touch("/msg-2.txt");                                                      // pending
+  touch("/msg-2.idx");
+  touch("/msg-4.txt");                                                      // renamed, then the power went before accept()
+  touch("/msg-new.txt");
+  touch("/logo-1.bin");
+  powerCut();
+  TEST_ASSERT_FALSE(LittleFS.exists("/msg-0.txt"));
+  TEST_ASSERT_FALSE(LittleFS.exists("/msg-0.idx"));
+  TEST_ASSERT_TRUE(LittleFS.exists("/msg-2.txt"));
+  TEST_ASSERT_TRUE(LittleFS.exists("/msg-2.idx"));
+  TEST_ASSERT_FALSE(LittleFS.exists("/msg-4.txt"));
+  TEST_ASSERT_TRUE(LittleFS.exists("/msg-new.txt"));                        // the writer starts it over anyway
+  TEST_ASSERT_TRUE(LittleFS.exists("/logo-1.bin"));
+  TEST_ASSERT_EQUAL(3, spool->pending());
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_after_power_cut);
+  RUN_TEST(test_unsynced_records_are_lost_whole);
+  RUN_TEST(test_sustained_load_never_rejects);
+  RUN_TEST(test_random_power_cuts);
+  RUN_TEST(test_cut_during_compaction);
+  RUN_TEST(test_compaction_without_room);
+  RUN_TEST(test_full_flash_turns_receipts_away);
+  RUN_TEST(test_full_flash_keeps_the_buffer);
+  RUN_TEST(test_orphan_messages_are_swept);
+  RUN_TEST(test_senders_take_turns_from_flash);
+  RUN_TEST(test_senders_are_journaled);
+  RUN_TEST(test_spilled_batch_stays_together);
+  return UNITY_END();
+}
@@ -0,0 +1,62 @@
+// Receipt date formatting against the C library's calendar
+#include <unity.h>
+#include <TimeFormat.h>
+
+void setUp() {}
+void tearDown() {}
+
+void test_days_round_trip() {
+  // Every day from 1900 to 2100 survives daysFromCivil -> civilFromDays
+  int32_t first = daysFromCivil(1900, 1, 1);
+  int32_t last = daysFromCivil(2100, 12, 31);
+  for (int32_t days = first; days <= last; days++) {
+    int year, month, day;
+    civilFromDays(days, year, month, day);
+    TEST_ASSERT_EQUAL_INT32(days, daysFromCivil(year, month, day));
+    TEST_ASSERT_TRUE(day >= 1 && day <= daysInMonth(year, month));
+  }
+}
+
+void test_header_matches_strftime() {
+  // One timestamp a week over 40 years, compared with gmtime + strftime
+  for (time_t t = 0; t < 40L * 365 * 86400; t += 7 * 86400 + 3601) {
+    char expected[32];
+    strftime(expected, sizeof(expected), "%a, %d %b %Y", gmtime(&t));
+    char header[DATE_HEADER_SIZE];
+    formatDateHeader(header, (unsigned long)t);
+    TEST_ASSERT_EQUAL_STRING(expected, header);
+  }
+}
+
+void test_parse_custom_date() {
+  int year, month, day;
+  TEST_ASSERT_TRUE(parseCustomDate("2025-06-07", year, month, day));
+  TEST_ASSERT_EQUAL(2025, year); TEST_ASSERT_EQUAL(6, month); TEST_ASSERT_EQUAL(7, day);
+  TEST_ASSERT_TRUE(parseCustomDate("29/02/2024", year, month, day));
+  TEST_ASSERT_EQUAL(2024, year); TEST_ASSERT_EQUAL(2, month); TEST_ASSERT_EQUAL(29, day);
+
+  TEST_ASSERT_FALSE(parseCustomDate("29/02/2023", year, month, day));      // not a leap year
+  TEST_ASSERT_FALSE(parseCustomDate("2100-02-29", year, month, day));
+  TEST_ASSERT_FALSE(parseCustomDate("2025-13-01", year, month, day));
+  TEST_ASSERT_FALSE(parseCustomDate("2025/06-07", year, month, day));      // mixed separators
+  TEST_ASSERT_FALSE(parseCustomDate("1899-12-31", year, month, day));
+  TEST_ASSERT_FALSE(parseCustomDate("", year, month, day));
+  TEST_ASSERT_FALSE(parseCustomDate("99999999999-1-1", year, month, day));
+}
+
+void test_format_date() {
+  char out[DATE_HEADER_SIZE];
+  formatDate(out, 2025, 6, 7);
+  TEST_ASSERT_EQUAL_STRING("Sat, 07 Jun 2025", out);
+  formatDate(out, 2000, 2, 29);
+  TEST_ASSERT_EQUAL_STRING("Tue, 29 Feb 2000", out);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_days_round_trip);
+  RUN_TEST(test_header_matches_strftime);
+  RUN_TEST(test_parse_custom_date);
+  RUN_TEST(test_format_date);
+  return UNITY_END();
+}
@@ -0,0 +1,124 @@
+// Drain timing of the transmit ring: a receipt's clock stops when its last
+// byte reaches the UART FIFO, at the rate the modelled wire takes bytes.
+#include <unity.h>
+#include <ThermalPrinter.h>
+
+static HardwareSerial *wire;
+static ThermalPrinter *printer;
+
+void setUp() {
+  nativeResetClock();
+  wire = new HardwareSerial();
+  wire->recording = false;
+  printer = new ThermalPrinter(*wire);
+  printer->begin(9600);
+  wire->modelWire(true);
+}
+
+void tearDown() {
+  delete printer;
+  delete wire;
+}
+
+static void receipt(size_t bytes) {
+  static uint8_t data[8192];
+  memset(data, 'x', sizeof(data));
+  printer->write(data, bytes);
+  printer->flush();
+}
+
+// txTask every millisecond until nothing is left
+static void pumpUntilEmpty() {
+  while (printer->txPending() > 0) {
+    delay(1);
+    printer->pump();
+  }
+}
+
+static uint32_t expectedMicros(size_t bytes) {
+  return (uint64_t)(bytes - 128) * 10 * 1000000 / 9600;                    // the FIFO takes the first 128 right away
+}
+
+void test_one_receipt() {
+  receipt(1000);
+  printer->markDrain(0);
+  uint32_t took;
+  TEST_ASSERT_FALSE(printer->drained(took));
+  pumpUntilEmpty();
+  TEST_ASSERT_TRUE(printer->drained(took));
+  TEST_ASSERT_UINT32_WITHIN(2000, expectedMicros(1000), took);
+  TEST_ASSERT_FALSE(printer->drained(took));                                // handed out once
+}
+
+void test_receipts_finish_in_order() {
+  receipt(600);
+  printer->markDrain(0);
+  receipt(600);
+  printer->markDrain(0);
+  pumpUntilEmpty();
+  uint32_t first, second;
+  TEST_ASSERT_TRUE(printer->drained(first));
+  TEST_ASSERT_TRUE(printer->drained(second));
+  TEST_ASSERT_UINT32_WITHIN(2000, expectedMicros(600), first);
+  TEST_ASSERT_UINT32_WITHIN(2000, expectedMicros(1200), second);           // behind the first one's bytes
+}
+
+void test_buffered_job_bytes_count() {
+  // In a job the receipt's bytes can still sit in the write buffer
+  printer->beginJob();
+  uint8_t data[200];
+  memset(data, 'x', sizeof(data));
+  printer->write(data, sizeof(data));
+  printer->markDrain(0);
+  printer->endJob();
+  pumpUntilEmpty();
+  uint32_t took;
+  TEST_ASSERT_TRUE(printer->drained(took));
+  TEST_ASSERT_UINT32_WITHIN(2000, expectedMicros(200), took);
+}
+
+void test_stalls_add_up() {
+  // Larger than the ring: the write waits, the caller passes that time on
+  uint32_t before = printer->totalStats().serialMicros;
+  receipt(6000);
+  uint32_t stalled = printer->totalStats().serialMicros - before;
+  TEST_ASSERT_GREATER_THAN(0, stalled);
+  printer->markDrain(stalled);
+  pumpUntilEmpty();
+  uint32_t took;
+  TEST_ASSERT_TRUE(printer->drained(took));
+  TEST_ASSERT_UINT32_WITHIN(20000, expectedMicros(6000), took);             // the stall and the drain are the whole wire time
+}
+
+void test_across_the_micros_wrap() {
+  nativeAdvanceMicros(0xFFFFFFFFUL - 100000);                               // micros() wraps 0.1 s into the receipt
+  wire->modelWire(true);
+  receipt(1000);
+  printer->markDrain(0);
+  pumpUntilEmpty();
+  uint32_t took;
+  TEST_ASSERT_TRUE(printer->drained(took));
+  TEST_ASSERT_UINT32_WITHIN(2000, expectedMicros(1000), took);
+}
+
+void test_marks_are_bounded() {
+  for (uint8_t i = 0; i < TX_DRAIN_MARKS + 2; i++) {
+    receipt(100);
+    printer->markDrain(0);
+  }
+  pumpUntilEmpty();
+  uint32_t took, count = 0;
+  while (printer->drained(took)) count++;
+  TEST_ASSERT_EQUAL(TX_DRAIN_MARKS, count);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_one_receipt);
+  RUN_TEST(test_receipts_finish_in_order);
+  RUN_TEST(test_buffered_job_bytes_count);
+  RUN_TEST(test_stalls_add_up);
+  RUN_TEST(test_across_the_micros_wrap);
+  RUN_TEST(test_marks_are_bounded);
+  return UNITY_END();
+}